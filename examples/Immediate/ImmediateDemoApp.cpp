@@ -122,6 +122,9 @@ public:
     lab::OSCServer oscServer;
     lab::WebSocketsServer wsServer;
 
+    // kept between frames, so sprite atlases built by one render are drawn by the next
+    unique_ptr<lab::ImmRenderContext> imm;
+
     ImmediateSceneBuilder()
     : lab::LabRenderAppScene() 
     , oscServer("labrender")
@@ -207,7 +210,9 @@ public:
             //---------------------------------------
             // demo immediate 2d drawing
 
-            lab::ImmRenderContext irc;
+            if (!imm)
+                imm.reset(new lab::ImmRenderContext());
+            lab::ImmRenderContext& irc = *imm;
 
             irc.rectangle({ 20,20 }, { 200, 100 }, 0xff00ffff);
             irc.quad({ 100,100 }, { 150, 200 }, { 100, 175 }, { 50, 200 }, 0xff0080ff);
@@ -11,6 +11,7 @@
 #define HAVE_DEARIMGUI
 
 #include <LabRender/PassRenderer.h>
+#include <LabRender/Shader.h>
 #include <LabRender/Utils.h>
 #include <LabMath/LabMath.h>
 #include <LabCamera/LabCamera.h>
@@ -422,6 +423,17 @@ protected:
             lab::checkError(lab::ErrorPolicy::onErrorThrow,
                 lab::TestConditions::exhaustive, "main loop end");
 
+            // set LABRENDER_SHADER_STATS to report uniform traffic per frame
+            static const bool reportShaderStats = getenv("LABRENDER_SHADER_STATS") != nullptr;
+            static int statsFrames = 0;
+            if (reportShaderStats && ++statsFrames == 120)
+            {
+                lab::Render::Shader::Stats stats = lab::Render::Shader::resetStats();
+                printf("per frame: %.1f uniform location queries, %.1f uniform updates\n",
+                       stats.locationQueries / float(statsFrames), stats.uniformUpdates / float(statsFrames));
+                statsFrames = 0;
+            }
+
             static bool saving = false;
             if (saving)
             {
@@ -106,6 +106,9 @@ int main(void)
         app->frameEnd();
     }
 
+    // the scene's GL resources go while the context is still current
+    delete app->scene;
+    app->scene = nullptr;
     return EXIT_SUCCESS;
 }
 
@@ -84,6 +84,10 @@ int main(int argc, const char* argv[]) try
         lab_imgui_create_window("Hello LabImGui", 1024, 768,
                                 [](){ capturedApp->update(); },
                                 [](){ imgui_frame(); });
+
+        // the scene's GL resources go while the context is still current
+        delete app.scene;
+        app.scene = nullptr;
         lab_imgui_shutdown();
     }
     return EXIT_SUCCESS;
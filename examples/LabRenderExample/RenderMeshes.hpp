@@ -4,6 +4,7 @@
 #include <LabRenderModelLoader/modelLoader.h>
 
 #include <LabCamera/LabCamera.h>
+#include <LabRender/GeometryPool.h>
 #include <LabRender/PassRenderer.h>
 #include <LabRender/UtilityModel.h>
 #include <LabRender/Utils.h>
@@ -75,7 +76,12 @@ public:
     , wsServer("labrender")
     {}
 
-    virtual ~ExampleSceneBuilder() = default;
+    // the scene set the default geometry pool, so it releases it, and is
+    // destroyed before the GL context
+    virtual ~ExampleSceneBuilder()
+    {
+        lab::Render::GeometryPool::setDefault(nullptr);
+    }
 
     virtual void build() override {
         // pipeline
@@ -84,6 +90,9 @@ public:
         dr = make_shared<lab::Render::PassRenderer>();
         dr->configure(path.c_str());
 
+        // meshes share a few large buffers rather than owning one each
+        lab::Render::GeometryPool::setDefault(make_shared<lab::Render::GeometryPool>());
+
         // drawlist
         auto& meshes = drawList.deferredMeshes;
 
@@ -31,6 +31,11 @@ class OffScreenSceneBuilder : public lab::LabRenderAppScene {
         std::cout << "Loading pipeline configuration " << path << std::endl;
         dr = make_shared<lab::Render::PassRenderer>();
         dr->configure(path.c_str());
+
+        // offscreen frames should show the pipeline's textures from the
+        // first frame, rather than their placeholders
+        if (!dr->waitForTextures())
+            std::cerr << "Could not load every texture of " << path << std::endl;
         auto pass = dr->findPass<lab::Render::PassRenderer::Pass>("blit");
         if (pass)
             pass->active = true;
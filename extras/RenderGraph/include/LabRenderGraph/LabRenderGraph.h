@@ -46,6 +46,8 @@ struct texture
     std::string name;
     std::string path;
     lab::Render::TextureType format { lab::Render::TextureType::none };
+    lab::Render::TextureFilter filter { lab::Render::TextureFilter::bilinear };
+    lab::Render::ColorSpace colorSpace { lab::Render::ColorSpace::srgb };
     float scale {1.f};
 };
 
@@ -120,6 +122,57 @@ struct labfx
     std::vector<texture> textures;
 };
 
+// The compiled form of labfx::passes. Passes are vertices of a dependency
+// graph whose edges come from the textures each pass reads and writes,
+// including the depth attachment implied by depth test and depth write.
+// Passes that do not contribute to "visible" are culled, and the survivors
+// are ordered to minimize render target changes. If no active pass writes
+// "visible", the pipeline is offscreen, and the final contents of every
+// written texture are treated as its outputs. Plug passes run arbitrary
+// code, so they are never culled and are assumed to read their outputs.
+struct schedule
+{
+    std::vector<size_t> order;  // indices into labfx::passes, in execution order
+    std::vector<size_t> culled; // inactive passes, and passes with no effect on the outputs
+
+    // per pass, the indices of the passes that must run before it
+    std::vector<std::vector<size_t>> dependencies;
+
+    int framebuffer_binds {0};          // render target changes in the compiled order
+    int declared_framebuffer_binds {0}; // render target changes in declaration order
+};
+
+LRG_API schedule compile_schedule(const labfx&);
+
+// Buffer textures whose lifetimes within a schedule don't overlap may share
+// storage of the same format. A texture is transient if its first access in
+// the frame replaces its contents, by a clear or a quad or blit that writes
+// every pixel, and its last access is a read. Reads include those implied
+// by plugs. Any other texture may carry data between frames or out to the
+// application, so it keeps storage of its own. Depth attachments are not
+// aliased.
+struct attachment_lifetime
+{
+    std::string buffer;
+    std::string texture;
+    lab::Render::TextureType format { lab::Render::TextureType::none };
+    int first {-1};   // positions in schedule::order, -1 if never accessed
+    int last {-1};
+    bool transient {false};
+    int slot {-1};    // attachments with equal slots share storage
+};
+
+struct alias_plan
+{
+    std::vector<attachment_lifetime> attachments;
+    int slots {0};
+    size_t bytes_per_pixel {0};         // storage per pixel without aliasing
+    size_t aliased_bytes_per_pixel {0}; // storage per pixel with aliasing
+};
+
+LRG_API alias_plan plan_aliases(const labfx&, const schedule&);
+LRG_API size_t texture_bytes_per_pixel(lab::Render::TextureType);
+
 }} // lab::render
 
 #endif
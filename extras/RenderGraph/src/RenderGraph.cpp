@@ -27,13 +27,16 @@ StrView tok_yes{"yes", 3};
 StrView tok_no{"no", 2};
 StrView tok_true{"true", 4};
 StrView tok_false{"false", 5};
+StrView tok_nearest{"nearest", 7};
+StrView tok_trilinear{"trilinear", 9};
+StrView tok_linear{"linear", 6};
 
 enum class RenderToken
 {
     name,
     version,
     buffer, has_depth, textures,
-    texture, path,
+    texture, path, filter, color_space,
     pass,
     draw,
     active,
@@ -63,6 +66,8 @@ NamedRenderToken tokens[] =
     { RenderToken::pass,       {"pass", 4} },
     { RenderToken::active,     {"active", 6} },
     { RenderToken::path,       {"path", 4} },
+    { RenderToken::filter,     {"filter", 6} },
+    { RenderToken::color_space, {"color space", 11} },
     { RenderToken::shader,     {"shader", 6} },
     { RenderToken::use_shader, {"use shader", 10} },
     { RenderToken::draw,       {"draw", 4} },
@@ -711,6 +716,30 @@ LRG_API labfx_t* parse_labfx(char const*const input, size_t length)
                     str_token = str_token.Expect(StrView{":", 1}).Strip();
                     fx.textures.back().path = std::string(str_token.curr, str_token.sz);
                     break;
+
+                case RenderToken::filter:
+                    curr = curr.ScanForEndofLine(str_token);
+                    str_token = str_token.ScanForNonWhiteSpace();
+                    str_token = str_token.Expect(StrView{":", 1});
+                    str_token = str_token.ScanForNonWhiteSpace().Strip();
+                    if (str_token == tok_trilinear)
+                        fx.textures.back().filter = lab::Render::TextureFilter::trilinear;
+                    else if (str_token == tok_nearest)
+                        fx.textures.back().filter = lab::Render::TextureFilter::nearest;
+                    else
+                        fx.textures.back().filter = lab::Render::TextureFilter::bilinear;
+                    break;
+
+                case RenderToken::color_space:
+                    curr = curr.ScanForEndofLine(str_token);
+                    str_token = str_token.ScanForNonWhiteSpace();
+                    str_token = str_token.Expect(StrView{":", 1});
+                    str_token = str_token.ScanForNonWhiteSpace().Strip();
+                    if (str_token == tok_linear)
+                        fx.textures.back().colorSpace = lab::Render::ColorSpace::linear;
+                    else
+                        fx.textures.back().colorSpace = lab::Render::ColorSpace::srgb;
+                    break;
                     
                 default:
                     break;
@@ -0,0 +1,424 @@
+
+#include <LabRenderGraph/LabRenderGraph.h>
+
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+using namespace lab::fx;
+
+namespace {
+
+// a resource is a texture within a buffer; the depth attachment of a buffer
+// is named with a character that cannot appear in a labfx identifier.
+typedef std::pair<std::string, std::string> resource;
+const char* depth_attachment = "#depth";
+const char* visible_buffer = "visible";
+const char* unbound_target = "*";
+
+bool writes_visible(const pass& p)
+{
+    return p.output_buffer.empty() || p.output_buffer == visible_buffer;
+}
+
+// passes with equal targets can run back to back without rebinding
+std::string render_target(const pass& p)
+{
+    if (writes_visible(p))
+        return visible_buffer;
+
+    std::string t = p.output_buffer;
+    for (const auto& tx : p.output_textures)
+        t += "/" + tx;
+    return t;
+}
+
+bool reads_depth(const pass& p)
+{
+    return p.test != lab::Render::DepthTest::never && p.test != lab::Render::DepthTest::always;
+}
+
+bool writes_depth(const pass& p)
+{
+    return p.clear_depth || (p.write_depth && p.test != lab::Render::DepthTest::never);
+}
+
+struct access
+{
+    resource res;
+    bool cleared;
+};
+
+// a quad or blit without a depth test writes every pixel of its targets
+bool overwrites_targets(const pass& p)
+{
+    return (p.draw == pass_draw::quad || p.draw == pass_draw::blit) && !reads_depth(p);
+}
+
+void pass_reads(const pass& p, std::vector<resource>& reads)
+{
+    std::string buffer = writes_visible(p) ? visible_buffer : p.output_buffer;
+
+    for (const auto& tx : p.input_textures)
+        reads.push_back({tx.name, tx.texture});
+
+    if (reads_depth(p))
+        reads.push_back({buffer, depth_attachment});
+
+    if (p.draw == pass_draw::plug)
+    {
+        if (writes_visible(p))
+            reads.push_back({buffer, "color"});
+        for (const auto& tx : p.output_textures)
+            reads.push_back({buffer, tx});
+    }
+}
+
+void pass_writes(const pass& p, std::vector<access>& writes)
+{
+    if (writes_visible(p))
+    {
+        writes.push_back({{visible_buffer, "color"}, p.clear_outputs});
+    }
+    else
+    {
+        for (const auto& tx : p.output_textures)
+            writes.push_back({{p.output_buffer, tx}, p.clear_outputs});
+    }
+
+    if (writes_depth(p))
+        writes.push_back({{writes_visible(p) ? visible_buffer : p.output_buffer, depth_attachment}, p.clear_depth});
+}
+
+int count_binds(const std::vector<std::string>& targets, const std::vector<size_t>& order)
+{
+    int binds = 0;
+    std::string bound = unbound_target;
+    for (size_t i : order)
+    {
+        if (targets[i] != bound)
+        {
+            ++binds;
+            bound = targets[i];
+        }
+    }
+    return binds;
+}
+
+} // anon
+
+namespace lab { namespace fx {
+
+schedule compile_schedule(const labfx& fx)
+{
+    schedule result;
+
+    const size_t count = fx.passes.size();
+    std::vector<std::set<size_t>> order_edges(count);  // everything that must precede a pass
+    std::vector<std::set<size_t>> live_edges(count);   // passes whose results a pass consumes
+    std::vector<std::string> targets(count);
+
+    std::map<resource, size_t> last_writer;
+    std::map<resource, std::vector<size_t>> readers;
+    std::set<size_t> roots;
+    bool has_visible_output = false;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const pass& p = fx.passes[i];
+        targets[i] = render_target(p);
+        if (!p.active)
+            continue;
+
+        std::vector<resource> reads;
+        pass_reads(p, reads);
+        for (const auto& r : reads)
+        {
+            auto w = last_writer.find(r);
+            if (w != last_writer.end() && w->second != i)
+            {
+                order_edges[i].insert(w->second);
+                live_edges[i].insert(w->second);
+            }
+            readers[r].push_back(i);
+        }
+
+        std::vector<access> writes;
+        pass_writes(p, writes);
+        for (const auto& a : writes)
+        {
+            auto w = last_writer.find(a.res);
+            if (w != last_writer.end() && w->second != i)
+            {
+                // partial writes accumulate on the previous contents; clears do not
+                order_edges[i].insert(w->second);
+                if (!a.cleared)
+                    live_edges[i].insert(w->second);
+            }
+            for (size_t r : readers[a.res])
+                if (r != i)
+                    order_edges[i].insert(r);
+
+            readers[a.res].clear();
+            last_writer[a.res] = i;
+        }
+
+        if (writes_visible(p))
+        {
+            has_visible_output = true;
+            roots.insert(i);
+        }
+        if (p.draw == pass_draw::plug)
+            roots.insert(i);
+    }
+
+    if (!has_visible_output)
+    {
+        // offscreen pipeline; whatever is left in the buffers is the result
+        for (const auto& w : last_writer)
+            roots.insert(w.second);
+    }
+
+    std::vector<bool> live(count, false);
+    std::vector<size_t> stack(roots.begin(), roots.end());
+    while (!stack.empty())
+    {
+        size_t i = stack.back();
+        stack.pop_back();
+        if (live[i])
+            continue;
+        live[i] = true;
+        for (size_t j : live_edges[i])
+            stack.push_back(j);
+    }
+
+    result.dependencies.resize(count);
+    std::vector<size_t> declared;
+    std::vector<int> pending(count, 0);
+    std::map<std::string, int> unscheduled;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (fx.passes[i].active)
+            declared.push_back(i);
+
+        if (!live[i])
+        {
+            result.culled.push_back(i);
+            continue;
+        }
+
+        for (size_t j : order_edges[i])
+            if (live[j])
+                result.dependencies[i].push_back(j);
+
+        pending[i] = static_cast<int>(result.dependencies[i].size());
+        ++unscheduled[targets[i]];
+    }
+
+    std::vector<std::vector<size_t>> dependents(count);
+    for (size_t i = 0; i < count; ++i)
+        for (size_t j : result.dependencies[i])
+            dependents[j].push_back(i);
+
+    std::vector<bool> scheduled(count, false);
+    auto ready = [&](size_t i) { return live[i] && !scheduled[i] && pending[i] == 0; };
+
+    // the number of passes that could run on candidate's target without a rebind
+    auto run_length = [&](size_t candidate) {
+        std::vector<int> p = pending;
+        std::vector<bool> s = scheduled;
+        int length = 0;
+        size_t next = candidate;
+        while (next < count)
+        {
+            s[next] = true;
+            ++length;
+            for (size_t d : dependents[next])
+                --p[d];
+
+            size_t following = count;
+            for (size_t i = 0; i < count && following == count; ++i)
+                if (live[i] && !s[i] && p[i] == 0 && targets[i] == targets[candidate])
+                    following = i;
+            next = following;
+        }
+        return length;
+    };
+
+    std::string bound = unbound_target;
+    for (;;)
+    {
+        size_t pick = count;
+        for (size_t i = 0; i < count && pick == count; ++i)
+            if (ready(i) && targets[i] == bound)
+                pick = i;
+
+        if (pick == count)
+        {
+            // a rebind is unavoidable. Prefer the target that can run the
+            // longest, then the target with the fewest passes still to come,
+            // so that passes sharing a target later on are kept together.
+            int best_length = 0;
+            int best_remaining = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!ready(i))
+                    continue;
+
+                int length = run_length(i);
+                int remaining = unscheduled[targets[i]];
+                if (pick == count || length > best_length ||
+                    (length == best_length && remaining < best_remaining))
+                {
+                    pick = i;
+                    best_length = length;
+                    best_remaining = remaining;
+                }
+            }
+        }
+
+        if (pick == count)
+            break;
+
+        scheduled[pick] = true;
+        --unscheduled[targets[pick]];
+        for (size_t d : dependents[pick])
+            --pending[d];
+
+        result.order.push_back(pick);
+        bound = targets[pick];
+    }
+
+    result.framebuffer_binds = count_binds(targets, result.order);
+    result.declared_framebuffer_binds = count_binds(targets, declared);
+    return result;
+}
+
+size_t texture_bytes_per_pixel(lab::Render::TextureType t)
+{
+    using lab::Render::TextureType;
+    switch (t) {
+        case TextureType::f32x1: return 4;
+        case TextureType::f32x2: return 8;
+        case TextureType::f32x3: return 12;
+        case TextureType::f32x4: return 16;
+        case TextureType::f16x1: return 2;
+        case TextureType::f16x2: return 4;
+        case TextureType::f16x3: return 6;
+        case TextureType::f16x4: return 8;
+        case TextureType::u8x1: return 1;
+        case TextureType::u8x2: return 2;
+        case TextureType::u8x3: return 3;
+        case TextureType::u8x4: return 4;
+        case TextureType::s8x1: return 1;
+        case TextureType::s8x2: return 2;
+        case TextureType::s8x3: return 3;
+        case TextureType::s8x4: return 4;
+        default: return 0;
+    }
+}
+
+alias_plan plan_aliases(const labfx& fx, const schedule& s)
+{
+    alias_plan plan;
+
+    std::map<resource, size_t> index;
+    for (const auto& b : fx.buffers)
+        for (const auto& t : b.textures)
+        {
+            index[{b.name, t.name}] = plan.attachments.size();
+            plan.attachments.push_back({b.name, t.name, t.format});
+        }
+
+    // A lifetime begins where the contents are replaced, by a clear or a
+    // write of every pixel. Partial writes, such as geometry or a depth
+    // tested quad, keep what was there, as do plugs, so they are uses.
+    enum class use { read, partial_write, replace };
+    std::vector<bool> first_replaces(plan.attachments.size(), false);
+    std::vector<bool> last_is_read(plan.attachments.size(), false);
+    auto touch = [&](const resource& r, int position, use u) {
+        auto i = index.find(r);
+        if (i == index.end())
+            return;
+        attachment_lifetime& a = plan.attachments[i->second];
+        if (a.first < 0)
+        {
+            a.first = position;
+            first_replaces[i->second] = u == use::replace;
+        }
+        a.last = position;
+        last_is_read[i->second] = u == use::read;
+    };
+
+    for (int k = 0; k < static_cast<int>(s.order.size()); ++k)
+    {
+        const pass& p = fx.passes[s.order[k]];
+
+        std::vector<resource> reads;
+        pass_reads(p, reads);
+        for (const auto& r : reads)
+            touch(r, k, use::read);
+
+        std::vector<access> writes;
+        pass_writes(p, writes);
+        for (const auto& w : writes)
+            touch(w.res, k, w.cleared || overwrites_targets(p) ? use::replace : use::partial_write);
+    }
+
+    for (size_t i = 0; i < plan.attachments.size(); ++i)
+    {
+        attachment_lifetime& a = plan.attachments[i];
+        a.transient = a.first < 0 || (first_replaces[i] && last_is_read[i]);
+        plan.bytes_per_pixel += texture_bytes_per_pixel(a.format);
+    }
+
+    // assign slots greedily in order of first use; unused attachments go
+    // last, since they may share any slot of their format
+    std::vector<size_t> by_first;
+    for (size_t i = 0; i < plan.attachments.size(); ++i)
+        by_first.push_back(i);
+    std::stable_sort(by_first.begin(), by_first.end(), [&](size_t a, size_t b) {
+        int fa = plan.attachments[a].first, fb = plan.attachments[b].first;
+        return (fa < 0 ? INT_MAX : fa) < (fb < 0 ? INT_MAX : fb);
+    });
+
+    struct slot_use
+    {
+        lab::Render::TextureType format;
+        int last;
+        bool pinned;
+    };
+    std::vector<slot_use> slots;
+    for (size_t i : by_first)
+    {
+        attachment_lifetime& a = plan.attachments[i];
+        if (a.transient)
+        {
+            for (size_t j = 0; j < slots.size() && a.slot < 0; ++j)
+            {
+                if (slots[j].pinned || slots[j].format != a.format)
+                    continue;
+                if (a.first < 0 || slots[j].last < a.first)
+                {
+                    a.slot = static_cast<int>(j);
+                    if (a.last > slots[j].last)
+                        slots[j].last = a.last;
+                }
+            }
+        }
+        if (a.slot < 0)
+        {
+            a.slot = static_cast<int>(slots.size());
+            slots.push_back({a.format, a.last, !a.transient});
+            plan.aliased_bytes_per_pixel += texture_bytes_per_pixel(a.format);
+        }
+    }
+
+    plan.slots = static_cast<int>(slots.size());
+    return plan;
+}
+
+}} // lab::fx
@@ -1,27 +1,147 @@
 
 #include <LabRenderGraph/LabRenderGraph.h>
 #include <stdio.h>
+#include <string.h>
+#include <string>
 #include <vector>
 #include <sys/stat.h>
 
-int main(int argc, char** argv)
+static labfx_t* load(const std::string& filename)
 {
-    char* filename = "C:/Projects/meshula/src/LabRender/assets/pipelines/deferred-offscreen.labfx";
     struct stat st;
-    if (stat(filename, &st) != 0) 
-    {
-        return 0;
-    }
+    if (stat(filename.c_str(), &st) != 0)
+        return nullptr;
+
     size_t sz = st.st_size;
 
-    FILE* f = fopen(filename, "rb");
+    FILE* f = fopen(filename.c_str(), "rb");
     std::vector<char> buff(sz);
     fread(&buff[0], 1, sz, f);
     fclose(f);
-    
-    labfx_t* fx = parse_labfx(&buff[0], sz);
-    labfx_gen_t* sh = generate_shaders(fx);
+
+    return parse_labfx(&buff[0], sz);
+}
+
+static std::string names(const lab::fx::labfx& fx, const std::vector<size_t>& passes)
+{
+    std::string result;
+    for (size_t i : passes)
+        result += (result.length() ? ", " : "") + fx.passes[i].name;
+    return result;
+}
+
+static void print_plan(const lab::fx::alias_plan& plan)
+{
+    for (const auto& a : plan.attachments)
+        printf("  %s.%s: passes %d to %d%s, slot %d\n", a.buffer.c_str(), a.texture.c_str(),
+               a.first, a.last, a.transient ? " (transient)" : "", a.slot);
+    printf("  storage: %zu bytes per pixel, %zu aliased, %zu MB saved at 3840x2160\n",
+           plan.bytes_per_pixel, plan.aliased_bytes_per_pixel,
+           (plan.bytes_per_pixel - plan.aliased_bytes_per_pixel) * 3840 * 2160 / (1024 * 1024));
+}
+
+static bool check_plan(const lab::fx::alias_plan& plan, const std::vector<int>& expected_slots,
+                       size_t expected_bytes, size_t expected_aliased_bytes)
+{
+    bool ok = plan.attachments.size() == expected_slots.size() &&
+              plan.bytes_per_pixel == expected_bytes && plan.aliased_bytes_per_pixel == expected_aliased_bytes;
+    for (size_t i = 0; ok && i < expected_slots.size(); ++i)
+        ok = plan.attachments[i].slot == expected_slots[i];
+    if (!ok)
+        printf("  unexpected alias plan\n");
+    return ok;
+}
+
+static bool check_schedule(const std::string& filename, const char* expected_order, int expected_binds,
+                           const std::vector<int>& expected_slots, size_t expected_bytes, size_t expected_aliased_bytes)
+{
+    labfx_t* fx_ptr = load(filename);
+    if (!fx_ptr)
+    {
+        printf("could not load %s\n", filename.c_str());
+        return false;
+    }
+
+    auto fx = reinterpret_cast<lab::fx::labfx*>(fx_ptr);
+    lab::fx::schedule s = lab::fx::compile_schedule(*fx);
+    std::string order = names(*fx, s.order);
+    printf("%s\n  order: %s\n  culled: %s\n  binds: %d (declared %d)\n",
+           fx->name.c_str(), order.c_str(), names(*fx, s.culled).c_str(),
+           s.framebuffer_binds, s.declared_framebuffer_binds);
+
+    lab::fx::alias_plan plan = lab::fx::plan_aliases(*fx, s);
+    print_plan(plan);
+
+    bool ok = order == expected_order && s.framebuffer_binds == expected_binds;
+    ok &= check_plan(plan, expected_slots, expected_bytes, expected_aliased_bytes);
+
+    labfx_gen_t* sh = generate_shaders(fx_ptr);
     free_labfx_gen(sh);
-    free_labfx(fx);
-    return 1;
+    free_labfx(fx_ptr);
+    return ok;
+}
+
+static lab::fx::pass make_pass(const char* name, lab::fx::pass_draw draw, bool clear,
+                               std::vector<lab::fx::buffer_select> inputs, const char* output)
+{
+    lab::fx::pass p;
+    p.name = name;
+    p.draw = draw;
+    p.test = lab::Render::DepthTest::never;
+    p.clear_outputs = clear;
+    p.input_textures = inputs;
+    p.output_buffer = output;
+    if (strcmp(output, "visible"))
+        p.output_textures.push_back("color");
+    return p;
+}
+
+// a bloom chain, where the second blur reuses the bright pass' storage
+static bool check_bloom_aliasing()
+{
+    using lab::fx::pass_draw;
+    using lab::Render::TextureType;
+
+    lab::fx::labfx fx;
+    fx.name = "bloom";
+    for (const char* name : { "hdr", "bright", "blur h", "blur v", "overlay" })
+        fx.buffers.push_back({ name, { { "color", "", TextureType::f16x4 } }, false });
+
+    fx.passes.push_back(make_pass("clear hdr", pass_draw::none, true, {}, "hdr"));
+    fx.passes.push_back(make_pass("scene", pass_draw::opaque_geometry, false, {}, "hdr"));
+    fx.passes.push_back(make_pass("bright", pass_draw::quad, false, { { "hdr", "color" } }, "bright"));
+    fx.passes.push_back(make_pass("blur h", pass_draw::quad, false, { { "bright", "color" } }, "blur h"));
+    fx.passes.push_back(make_pass("blur v", pass_draw::quad, false, { { "blur h", "color" } }, "blur v"));
+
+    // the plug draws over whatever the overlay held, so it keeps its own storage
+    fx.passes.push_back(make_pass("overlay", pass_draw::plug, false, {}, "overlay"));
+    fx.passes.push_back(make_pass("composite", pass_draw::quad, false,
+                                  { { "hdr", "color" }, { "blur v", "color" }, { "overlay", "color" } }, "visible"));
+
+    lab::fx::schedule s = lab::fx::compile_schedule(fx);
+    printf("%s\n  order: %s\n", fx.name.c_str(), names(fx, s.order).c_str());
+    lab::fx::alias_plan plan = lab::fx::plan_aliases(fx, s);
+    print_plan(plan);
+    return check_plan(plan, { 0, 1, 2, 1, 3 }, 40, 32);
+}
+
+int main()
+{
+    std::string root = ASSET_ROOT;
+
+    // sky draws into gbuffer.color without clearing it first, so color
+    // carries over between frames and is not aliased
+    bool ok = check_schedule(root + "/pipelines/deferred-fxaa.labfx",
+                             "clear gbuffer, geometry, sky, illuminate, fxaa", 3,
+                             { 0, 1, 2, 3 }, 36, 36);
+
+    // the inactive blit leaves resolve as the output, and clearing resolve
+    // can be deferred until just before the post process writes it
+    ok &= check_schedule(root + "/pipelines/deferred-offscreen.labfx",
+                         "clear gbuffer, geometry, sky, clear framebuffer, post process", 3,
+                         { 0, 1, 2, 3 }, 36, 36);
+
+    ok &= check_bloom_aliasing();
+
+    return ok ? 0 : 1;
 }
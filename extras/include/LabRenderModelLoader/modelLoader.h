@@ -3,6 +3,7 @@
 
 #include <LabRender/LabRender.h>
 #include <LabRender/Model.h>
+#include <future>
 #include <memory>
 #include <string>
 
@@ -25,4 +26,29 @@
 namespace lab { namespace Render {
 	LRML_API std::shared_ptr<Model> loadMesh(const std::string& filename);
 	LRML_API std::shared_ptr<Model> load_ObjMesh(const std::string& srcFilename_);
+
+	struct MeshLoadState;
+
+	// A mesh loading on a worker thread. model is ready, with null on failure
+	// or cancellation, once the model can be drawn without stalling; it holds
+	// the exception if loading threw. Cancel a load that may be unfinished
+	// before its renderer is destroyed.
+	class MeshLoad
+	{
+	public:
+		std::shared_future<std::shared_ptr<Model>> model;
+
+		// stops the load from reaching the renderer, and resolves model to
+		// null unless it is already set. The worker finishes reading the file
+		// in the background.
+		LRML_API void cancel();
+
+	private:
+		friend LRML_API MeshLoad loadMeshAsync(Renderer& renderer, const std::string& filename);
+		std::shared_ptr<MeshLoadState> _state;
+	};
+
+	// Loads a mesh on a worker thread, then uploads its buffers in a command
+	// on the renderer.
+	LRML_API MeshLoad loadMeshAsync(Renderer& renderer, const std::string& filename);
 }}
@@ -0,0 +1,142 @@
+// Checks how batchDraws groups draws by vertex array, shader and material:
+// the batch counts, the order of the draws within and across batches, the
+// instance limit, and draws that can't be batched.
+
+#include "testCheck.h"
+
+#include <LabRender/DrawList.h>
+
+#include <vector>
+
+using namespace lab::Render;
+
+namespace {
+
+// stand ins for the objects a key points to; batchDraws only compares them
+int vaoA, vaoB, shaderA, shaderB, materialA, materialB;
+
+DrawBatchKey key(void const* vao, void const* shader, void const* material)
+{
+    DrawBatchKey k;
+    k.vao = vao;
+    k.shader = shader;
+    k.material = material;
+    return k;
+}
+
+bool sameBatches(const std::vector<DrawBatch>& batches, const std::vector<size_t>& counts)
+{
+    if (batches.size() != counts.size())
+        return false;
+    size_t first = 0;
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        if (batches[i].first != first || batches[i].count != counts[i])
+            return false;
+        first += counts[i];
+    }
+    return true;
+}
+
+bool testMixed()
+{
+    // vaos, shaders and materials interleaved; a key differing in any one
+    // of them is a group of its own
+    std::vector<DrawBatchKey> keys = {
+        key(&vaoA, &shaderA, &materialA),
+        key(&vaoB, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialB),
+        key(&vaoB, &shaderA, &materialA),
+        key(&vaoA, &shaderB, &materialA),
+        key(&vaoA, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialB),
+    };
+
+    std::vector<size_t> order;
+    std::vector<DrawBatch> batches;
+    DrawBatchReport report = batchDraws(keys, 64, order, batches);
+    bool ok = report.drawsIn == 8 && report.drawsOut == 4;
+    ok &= order == std::vector<size_t>({ 0, 2, 6, 1, 4, 3, 7, 5 });
+    ok &= sameBatches(batches, { 3, 2, 2, 1 });
+    return check("mixed keys group in first appearance order", ok);
+}
+
+bool testMaxInstances()
+{
+    std::vector<DrawBatchKey> keys(5, key(&vaoA, &shaderA, &materialA));
+    keys.insert(keys.begin() + 2, key(&vaoB, &shaderA, &materialA));
+
+    std::vector<size_t> order;
+    std::vector<DrawBatch> batches;
+    DrawBatchReport report = batchDraws(keys, 2, order, batches);
+    bool ok = report.drawsOut == 4;
+    ok &= order == std::vector<size_t>({ 0, 1, 3, 4, 5, 2 });
+    ok &= sameBatches(batches, { 2, 2, 1, 1 });
+
+    // a limit of zero is treated as one
+    report = batchDraws(keys, 0, order, batches);
+    ok &= report.drawsOut == keys.size() && sameBatches(batches, { 1, 1, 1, 1, 1, 1 });
+    return check("batches are split at maxInstances", ok);
+}
+
+bool testUnbatchable()
+{
+    // null vaos are never merged, even with equal keys, and keep their place
+    std::vector<DrawBatchKey> keys = {
+        key(nullptr, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialA),
+        key(nullptr, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialA),
+    };
+
+    std::vector<size_t> order;
+    std::vector<DrawBatch> batches;
+    DrawBatchReport report = batchDraws(keys, 64, order, batches);
+    bool ok = report.drawsOut == 3;
+    ok &= order == std::vector<size_t>({ 0, 1, 3, 2 });
+    ok &= sameBatches(batches, { 1, 2, 1 });
+    return check("draws without a vao are not batched", ok);
+}
+
+bool testPresorted()
+{
+    // only neighbours are grouped, so the order is kept
+    std::vector<DrawBatchKey> keys = {
+        key(&vaoA, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialA),
+        key(&vaoB, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialA),
+        key(&vaoA, &shaderA, &materialB),
+        key(&vaoA, &shaderA, &materialB),
+    };
+
+    std::vector<size_t> order;
+    std::vector<DrawBatch> batches;
+    DrawBatchReport report = batchDraws(keys, 64, order, batches, true);
+    bool ok = report.drawsIn == 6 && report.drawsOut == 4;
+    ok &= order == std::vector<size_t>({ 0, 1, 2, 3, 4, 5 });
+    ok &= sameBatches(batches, { 2, 1, 1, 2 });
+    return check("presorted draws batch only neighbours", ok);
+}
+
+bool testEmpty()
+{
+    std::vector<size_t> order(3);
+    std::vector<DrawBatch> batches(2);
+    DrawBatchReport report = batchDraws({}, 64, order, batches);
+    return check("no draws make no batches",
+                 report.drawsIn == 0 && report.drawsOut == 0 && order.empty() && batches.empty());
+}
+
+} // anon
+
+int main()
+{
+    bool ok = testMixed();
+    ok &= testMaxInstances();
+    ok &= testUnbatchable();
+    ok &= testPresorted();
+    ok &= testEmpty();
+    return ok ? 0 : 1;
+}
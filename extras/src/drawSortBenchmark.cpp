@@ -0,0 +1,127 @@
+
+// Sorts synthetic draw lists by drawSortKey and reports the sort time, serial
+// and parallel, and the shader, material, and vertex buffer changes needed to submit the
+// draws in submission order and in sorted order.
+
+#include <LabRender/DrawSort.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+using namespace lab::Render;
+
+namespace {
+
+struct SyntheticDraw
+{
+    uint32_t shader;
+    uint32_t material;
+    uint32_t vertices;
+    float depth;
+};
+
+struct StateChanges
+{
+    size_t shaders = 0;
+    size_t materials = 0;
+    size_t vertices = 0;
+};
+
+StateChanges countStateChanges(const std::vector<SyntheticDraw>& draws, const std::vector<DrawSortItem>& order)
+{
+    StateChanges changes;
+    const SyntheticDraw* prev = nullptr;
+    for (const DrawSortItem& item : order)
+    {
+        const SyntheticDraw& d = draws[item.index];
+        if (!prev || prev->shader != d.shader)
+            ++changes.shaders;
+        if (!prev || prev->material != d.material)
+            ++changes.materials;
+        if (!prev || prev->vertices != d.vertices)
+            ++changes.vertices;
+        prev = &d;
+    }
+    return changes;
+}
+
+double milliseconds(std::chrono::high_resolution_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+} // anon
+
+int main(int argc, char** argv)
+{
+    const uint32_t shaderCount = 32;
+    const uint32_t materialsPerShader = 64;
+    const uint32_t meshCount = 2048;
+    const int repeats = 5;
+
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint32_t> shaderDist(0, shaderCount - 1);
+    std::uniform_int_distribution<uint32_t> materialDist(0, materialsPerShader - 1);
+    std::uniform_int_distribution<uint32_t> meshDist(0, meshCount - 1);
+    std::uniform_real_distribution<float> depthDist(0.f, 1.f);
+
+    printf("%9s %10s %10s %10s %9s %9s %9s\n", "draws", "radix ms", "par ms", "std ms", "shaders", "materials", "vertices");
+
+    for (size_t count : { 100000, 250000, 500000, 1000000 })
+    {
+        std::vector<SyntheticDraw> draws(count);
+        std::vector<DrawSortItem> submitted(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            SyntheticDraw& d = draws[i];
+            d.shader = shaderDist(rng);
+            d.material = d.shader * materialsPerShader + materialDist(rng);
+            d.vertices = meshDist(rng);
+            d.depth = depthDist(rng);
+            submitted[i].key = drawSortKey(0, d.shader, d.material, d.vertices, d.depth);
+            submitted[i].index = static_cast<uint32_t>(i);
+        }
+
+        std::vector<DrawSortItem> sorted, parallelSorted, scratch;
+        double radixTime = 1e30;
+        double parallelTime = 1e30;
+        double stdTime = 1e30;
+        for (int r = 0; r < repeats; ++r)
+        {
+            sorted = submitted;
+            auto start = std::chrono::high_resolution_clock::now();
+            radixSortDraws(sorted, scratch);
+            radixTime = std::min(radixTime, milliseconds(std::chrono::high_resolution_clock::now() - start));
+
+            parallelSorted = submitted;
+            start = std::chrono::high_resolution_clock::now();
+            parallelRadixSortDraws(parallelSorted, scratch);
+            parallelTime = std::min(parallelTime, milliseconds(std::chrono::high_resolution_clock::now() - start));
+
+            std::vector<DrawSortItem> reference = submitted;
+            start = std::chrono::high_resolution_clock::now();
+            std::stable_sort(reference.begin(), reference.end(),
+                [](const DrawSortItem& a, const DrawSortItem& b) { return a.key < b.key; });
+            stdTime = std::min(stdTime, milliseconds(std::chrono::high_resolution_clock::now() - start));
+
+            for (size_t i = 0; i < count; ++i)
+                if (reference[i].index != sorted[i].index || reference[i].index != parallelSorted[i].index)
+                {
+                    printf("radix sort disagrees with std::stable_sort at %zu\n", i);
+                    return 1;
+                }
+        }
+
+        StateChanges before = countStateChanges(draws, submitted);
+        StateChanges after = countStateChanges(draws, sorted);
+        printf("%9zu %10.2f %10.2f %10.2f %9zu %9zu %9zu  submission order\n",
+               count, radixTime, parallelTime, stdTime, before.shaders, before.materials, before.vertices);
+        printf("%9s %10s %10s %10s %9zu %9zu %9zu  sorted\n",
+               "", "", "", "", after.shaders, after.materials, after.vertices);
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Records a million circles, lines, and rectangles into an ImmRenderContext,
+// one call per primitive and then as batches, and reports the tessellation
+// time of each. Nothing is rendered, so no GL context is needed.
+
+#include <LabRender/Immediate.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+namespace {
+
+double milliseconds(std::chrono::high_resolution_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// the best of several runs, each into a fresh context
+double best(int repeats, const std::function<void(lab::ImmRenderContext&)>& record)
+{
+    double t = 1e30;
+    for (int r = 0; r < repeats; ++r)
+    {
+        lab::ImmRenderContext context;
+        auto start = std::chrono::high_resolution_clock::now();
+        record(context);
+        t = std::min(t, milliseconds(std::chrono::high_resolution_clock::now() - start));
+    }
+    return t;
+}
+
+} // anon
+
+int main(int argc, char** argv)
+{
+    const int count = 1000000;
+    const int repeats = 3;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(0.f, 1920.f);
+    std::uniform_real_distribution<float> size(1.f, 8.f);
+
+    std::vector<float> x0(count), y0(count), x1(count), y1(count), radius(count);
+    std::vector<uint32_t> col(count);
+    for (int i = 0; i < count; ++i)
+    {
+        x0[i] = position(rng);
+        y0[i] = position(rng);
+        x1[i] = x0[i] + size(rng);
+        y1[i] = y0[i] + size(rng);
+        radius[i] = size(rng);
+        col[i] = 0xff000000 | rng();
+    }
+
+    printf("%10s %12s %12s %8s\n", "primitive", "single ms", "batch ms", "speedup");
+
+    double single = best(repeats, [&](lab::ImmRenderContext& c) {
+        for (int i = 0; i < count; ++i)
+            c.circle_filled(lab::v2f(x0[i], y0[i]), radius[i], col[i]);
+    });
+    double batch = best(repeats, [&](lab::ImmRenderContext& c) {
+        c.circles_filled(count, x0.data(), y0.data(), radius.data(), col.data());
+    });
+    printf("%10s %12.2f %12.2f %7.1fx\n", "circles", single, batch, single / batch);
+
+    single = best(repeats, [&](lab::ImmRenderContext& c) {
+        for (int i = 0; i < count; ++i)
+            c.line(lab::v2f(x0[i], y0[i]), lab::v2f(x1[i], y1[i]), col[i]);
+    });
+    batch = best(repeats, [&](lab::ImmRenderContext& c) {
+        c.lines(count, x0.data(), y0.data(), x1.data(), y1.data(), col.data());
+    });
+    printf("%10s %12.2f %12.2f %7.1fx\n", "lines", single, batch, single / batch);
+
+    single = best(repeats, [&](lab::ImmRenderContext& c) {
+        for (int i = 0; i < count; ++i)
+            c.rectangle_filled(lab::v2f(x0[i], y0[i]), lab::v2f(x1[i], y1[i]), col[i]);
+    });
+    batch = best(repeats, [&](lab::ImmRenderContext& c) {
+        c.rectangles_filled(count, x0.data(), y0.data(), x1.data(), y1.data(), col.data());
+    });
+    printf("%10s %12.2f %12.2f %7.1fx\n", "rects", single, batch, single / batch);
+
+    return 0;
+}
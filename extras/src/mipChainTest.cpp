@@ -0,0 +1,235 @@
+
+// Checks generated mip chains against a reference that averages each level
+// directly from level 0, and checks the filters' behaviour on non power of two
+// images.
+
+#include "testCheck.h"
+
+#include <LabRender/MipChain.h>
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <string.h>
+#include <vector>
+
+using namespace lab::Render;
+
+namespace {
+
+float srgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float l)
+{
+    return l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.f / 2.4f) - 0.055f;
+}
+
+// the average of each 2^level square block of level 0
+std::vector<float> reference(const std::vector<float>& image, int w, int h, int channels, int level)
+{
+    int block = 1 << level;
+    int lw = w / block, lh = h / block;
+    std::vector<float> result(size_t(lw) * lh * channels);
+    for (int y = 0; y < lh; ++y)
+        for (int x = 0; x < lw; ++x)
+            for (int c = 0; c < channels; ++c)
+            {
+                double sum = 0;
+                for (int by = 0; by < block; ++by)
+                    for (int bx = 0; bx < block; ++bx)
+                        sum += image[(size_t(y * block + by) * w + x * block + bx) * channels + c];
+                result[(size_t(y) * lw + x) * channels + c] = float(sum / (block * block));
+            }
+    return result;
+}
+
+bool testSrgb()
+{
+    const int w = 64, h = 32;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> pixels(w * h * 4);
+    for (auto& p : pixels)
+        p = uint8_t(rng());
+
+    // colour is averaged premultiplied by alpha
+    std::vector<float> linear(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i)
+        linear[i] = (i & 3) == 3 ? pixels[i] / 255.f : srgbToLinear(pixels[i] / 255.f) * (pixels[i | 3] / 255.f);
+
+    MipChain chain = generateMipChain(TextureType::u8x4, w, h, pixels.data());
+    bool ok = chain.levels.size() == 7 && chain.levels.back().width == 1 && chain.levels.back().height == 1;
+    ok &= memcmp(chain.pixels(0), pixels.data(), pixels.size()) == 0;
+
+    int worst = 0;
+    for (size_t level = 1; ok && level < chain.levels.size(); ++level)
+    {
+        const MipChain::Level& l = chain.levels[level];
+        std::vector<float> expected = reference(linear, w, h, 4, int(level));
+        const uint8_t* got = chain.pixels(level);
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            float e = (i & 3) == 3 ? expected[i] : linearToSrgb(expected[i] / expected[i | 3]);
+            worst = std::max(worst, abs(int(got[i]) - int(lrintf(e * 255.f))));
+        }
+        ok &= l.size == size_t(l.width) * l.height * 4;
+    }
+    return check("u8x4 sRGB box matches reference", ok && worst <= 1);
+}
+
+// a transparent red texel beside opaque green ones mustn't tint the mip, and
+// the linear colour space averages the stored values directly
+bool testAlphaAndLinear()
+{
+    const uint8_t pixels[16] = { 255, 0, 0, 0,    0, 255, 0, 255,
+                                 0, 255, 0, 255,  0, 255, 0, 255 };
+    MipChain srgb = generateMipChain(TextureType::u8x4, 2, 2, pixels);
+    const uint8_t* p = srgb.pixels(1);
+    bool ok = p[0] == 0 && p[1] == 255 && p[2] == 0 && abs(int(p[3]) - 191) <= 1;
+
+    const uint8_t grey[16] = { 0, 0, 0, 255,  255, 255, 255, 255,
+                               0, 0, 0, 255,  255, 255, 255, 255 };
+    MipChain linear = generateMipChain(TextureType::u8x4, 2, 2, grey, MipFilter::box, ColorSpace::linear);
+    p = linear.pixels(1);
+    ok &= abs(int(p[0]) - 128) <= 1 && p[3] == 255;
+    p = generateMipChain(TextureType::u8x4, 2, 2, grey).pixels(1);
+    ok &= abs(int(p[0]) - 188) <= 1;
+    return check("premultiplied alpha and linear u8x4", ok);
+}
+
+bool testFloat(TextureType type)
+{
+    const int w = 32, h = 16;
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> value(-4.f, 4.f);
+    std::vector<float> image(w * h * 2);
+    for (auto& v : image)
+        v = type == TextureType::f16x2 ? halfToFloat(floatToHalf(value(rng))) : value(rng);
+
+    std::vector<uint8_t> pixels;
+    if (type == TextureType::f16x2)
+    {
+        pixels.resize(image.size() * 2);
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            uint16_t half = floatToHalf(image[i]);
+            memcpy(&pixels[i * 2], &half, 2);
+        }
+    }
+    else
+    {
+        pixels.resize(image.size() * 4);
+        memcpy(pixels.data(), image.data(), pixels.size());
+    }
+
+    MipChain chain = generateMipChain(type, w, h, pixels.data());
+    float worst = 0;
+    for (size_t level = 1; level < chain.levels.size(); ++level)
+    {
+        std::vector<float> expected = reference(image, w, h, 2, int(level));
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            float got;
+            if (type == TextureType::f16x2)
+            {
+                uint16_t half;
+                memcpy(&half, chain.pixels(level) + i * 2, 2);
+                got = halfToFloat(half);
+            }
+            else
+                memcpy(&got, chain.pixels(level) + i * 4, 4);
+            worst = std::max(worst, fabsf(got - expected[i]));
+        }
+    }
+
+    float tolerance = type == TextureType::f16x2 ? 4.f / 1024.f : 1e-5f;
+    return check(type == TextureType::f16x2 ? "f16x2 box matches reference" : "f32x2 box matches reference",
+                 chain.levels.size() == 6 && worst <= tolerance);
+}
+
+bool testHalf()
+{
+    int mismatches = 0;
+    for (uint32_t h = 0; h < 0x10000; ++h)
+    {
+        bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x3ff);
+        if (!nan && floatToHalf(halfToFloat(uint16_t(h))) != h)
+            ++mismatches;
+    }
+
+    // halfway between 1 and the next half rounds to even
+    bool ok = floatToHalf(1.f + 1.f / 2048.f) == 0x3c00 && floatToHalf(65520.f) == 0x7c00;
+    return check("half conversion round trips", !mismatches && ok);
+}
+
+bool testOddSizes(MipFilter filter, const char* name)
+{
+    const int w = 5, h = 3;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> value(0.f, 1.f);
+    std::vector<float> image(w * h);
+    double mean = 0;
+    for (auto& v : image)
+        mean += v = value(rng);
+    mean /= image.size();
+
+    MipChain chain = generateMipChain(TextureType::f32x1, w, h, image.data(), filter);
+    bool ok = chain.levels.size() == 3 && chain.levels[1].width == 2 && chain.levels[1].height == 1;
+
+    const float* level1 = reinterpret_cast<const float*>(chain.pixels(1));
+    double mean1 = (level1[0] + level1[1]) * 0.5;
+
+    // a constant image is unchanged by any filter
+    std::vector<float> constant(w * h, 0.25f);
+    MipChain flat = generateMipChain(TextureType::f32x1, w, h, constant.data(), filter);
+    for (size_t level = 1; level < flat.levels.size(); ++level)
+        for (int i = 0; i < flat.levels[level].width * flat.levels[level].height; ++i)
+            ok &= fabsf(reinterpret_cast<const float*>(flat.pixels(level))[i] - 0.25f) < 1e-5f;
+
+    // the box filter covers every source texel exactly once
+    if (filter == MipFilter::box)
+        ok &= fabs(mean1 - mean) < 1e-5;
+
+    return check(name, ok);
+}
+
+bool testCheckerboard()
+{
+    // a one texel checkerboard is above the first level's Nyquist limit, so
+    // both filters should remove it, away from the edges where the kaiser
+    // filter's clamped taps lose their symmetry
+    const int w = 64, h = 64;
+    std::vector<float> image(w * h);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            image[y * w + x] = float((x + y) & 1);
+
+    bool ok = true;
+    for (MipFilter filter : { MipFilter::box, MipFilter::kaiser })
+    {
+        MipChain chain = generateMipChain(TextureType::f32x1, w, h, image.data(), filter);
+        const float* level1 = reinterpret_cast<const float*>(chain.pixels(1));
+        int lw = chain.levels[1].width, lh = chain.levels[1].height;
+        for (int y = 3; y < lh - 3; ++y)
+            for (int x = 3; x < lw - 3; ++x)
+                ok &= fabsf(level1[y * lw + x] - 0.5f) < 1e-4f;
+    }
+    return check("checkerboard filters to grey", ok);
+}
+
+} // anon
+
+int main()
+{
+    bool ok = testHalf();
+    ok &= testSrgb();
+    ok &= testAlphaAndLinear();
+    ok &= testFloat(TextureType::f32x2);
+    ok &= testFloat(TextureType::f16x2);
+    ok &= testOddSizes(MipFilter::box, "5x3 box preserves the mean");
+    ok &= testOddSizes(MipFilter::kaiser, "5x3 kaiser preserves a constant");
+    ok &= testCheckerboard();
+    return ok ? 0 : 1;
+}
@@ -1,7 +1,10 @@
 
 #include <LabRender/LabRender.h>
+#include <LabRender/MappedFile.h>
+#include <LabRender/MeshCache.h>
+#include <LabRender/MeshOptimizer.h>
 #include <LabRender/Model.h>
-#include <LabRender/utils.h>
+#include <LabRender/Utils.h>
 
 #define BUILDING_LABRENDER_MODELLOADER
 #include "LabRenderModelLoader/modelLoader.h"
@@ -21,7 +24,15 @@
 
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <string.h>
+#include <thread>
 
 
 namespace lab {
@@ -620,7 +631,7 @@ namespace lab {
 
     namespace Render {
 
-    std::shared_ptr<Model> loadMesh(const std::string& srcFilename)
+    static std::shared_ptr<Model> loadMeshSource(const std::string& srcFilename)
     {
         std::string filename = lab::expandPath(srcFilename.c_str());
         std::string extension = filename.substr(filename.rfind('.') + 1);
@@ -680,6 +691,96 @@ namespace lab {
         return {};
     }
 
+    std::shared_ptr<Model> loadMesh(const std::string& srcFilename)
+    {
+        if (auto cached = loadMeshCache(srcFilename))
+            return cached;
+
+        std::shared_ptr<Model> model = loadMeshSource(srcFilename);
+        if (model && !meshCacheDirectory().empty() && !writeMeshCache(srcFilename, *model))
+            std::cerr << "Could not write mesh cache " << meshCachePath(srcFilename) << std::endl;
+        return model;
+    }
+
+    // shared by a MeshLoad, its worker, and its upload command
+    struct MeshLoadState
+    {
+        std::mutex lock;
+        Renderer* renderer = nullptr;   // null once cancelled
+        bool settled = false;           // the promise has been set
+        std::promise<std::shared_ptr<Model>> promise;
+
+        // settles the promise unless it already is, under the lock
+        void fail(std::exception_ptr error)
+        {
+            if (settled)
+                return;
+            settled = true;
+            if (error)
+                promise.set_exception(error);
+            else
+                promise.set_value(nullptr);
+        }
+    };
+
+    void MeshLoad::cancel()
+    {
+        if (!_state)
+            return;
+        std::lock_guard<std::mutex> guard(_state->lock);
+        _state->renderer = nullptr;
+        _state->fail(nullptr);
+    }
+
+    MeshLoad loadMeshAsync(Renderer& renderer, const std::string& filename)
+    {
+        MeshLoad result;
+        result._state = std::make_shared<MeshLoadState>();
+        result._state->renderer = &renderer;
+        result.model = result._state->promise.get_future().share();
+
+        std::shared_ptr<MeshLoadState> state = result._state;
+        std::thread([state, filename]() {
+            std::shared_ptr<Model> model;
+            try {
+                model = loadMesh(filename);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(state->lock);
+                state->fail(std::current_exception());
+                return;
+            }
+
+            // the renderer is alive until the load is cancelled, and cancel
+            // waits on the lock, so it can't go while the command is enqueued
+            std::lock_guard<std::mutex> guard(state->lock);
+            if (!model || !state->renderer) {
+                state->fail(nullptr);
+                return;
+            }
+
+            state->renderer->enqueCommand([state, model]() {
+                std::lock_guard<std::mutex> guard(state->lock);
+                if (state->settled)
+                    return;
+                try {
+                    for (auto& part : model->parts())
+                        if (auto mesh = dynamic_cast<ModelPart*>(part.get()))
+                            if (mesh->verts())
+                                mesh->verts()->uploadVerts();
+                }
+                catch (...) {
+                    state->fail(std::current_exception());
+                    return;
+                }
+                state->settled = true;
+                state->promise.set_value(model);
+            });
+        }).detach();
+
+        return result;
+    }
+
     namespace  // Local utility functions
     {
         void CalcNormal(float N[3], float v0[3], float v1[3], float v2[3]) {
@@ -796,6 +897,685 @@ namespace lab {
 
     }  // computeSmoothingNormals
 
+    namespace  // Parallel OBJ parsing
+    {
+        // Large OBJ files are split into chunks at line boundaries, and the
+        // chunks are parsed on all cores. A first pass counts each chunk's
+        // v, vn and vt lines, so that the second can resolve relative indices
+        // and write attributes straight into place. Quads are split along
+        // their shorter diagonal once all positions are known, as tinyobj
+        // does. Files using statements the fast path doesn't handle are
+        // loaded by tinyobj::LoadObj instead.
+
+        const size_t objChunkSize = 1 << 20;
+
+        struct ObjStatement
+        {
+            enum Kind { shape, material, smoothing };
+            Kind kind;
+            size_t face;                // the first of the chunk's faces it applies to
+            std::string name;
+            unsigned int id = 0;
+        };
+
+        struct ObjChunk
+        {
+            const char* begin = nullptr;
+            const char* end = nullptr;
+            size_t vertexBase = 0, normalBase = 0, texcoordBase = 0;
+            size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+            std::vector<tinyobj::index_t> corners;
+            std::vector<uint8_t> faceSizes;         // 3 or 4
+            std::vector<ObjStatement> statements;
+            std::vector<std::string> mtllibs;
+            std::vector<tinyobj::index_t> triangles;
+            std::vector<size_t> faceTriangles;      // the first triangle of each face, then the total
+            bool unsupported = false;
+        };
+
+        bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+        bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+        const char* skipSpace(const char* p, const char* end)
+        {
+            while (p < end && isSpace(*p))
+                ++p;
+            return p;
+        }
+
+        const char* lineEnd(const char* p, const char* end)
+        {
+            const char* e = static_cast<const char*>(memchr(p, '\n', end - p));
+            return e ? e : end;
+        }
+
+        // the rest of the line, without surrounding white space
+        std::string lineText(const char* p, const char* end)
+        {
+            p = skipSpace(p, end);
+            while (end > p && isSpace(end[-1]))
+                --end;
+            return std::string(p, end);
+        }
+
+        bool keyword(const char* p, const char* end, const char* word, const char*& rest)
+        {
+            size_t n = strlen(word);
+            if (size_t(end - p) < n || memcmp(p, word, n) || (p + n < end && !isSpace(p[n])))
+                return false;
+            rest = p + n;
+            return true;
+        }
+
+        bool parseInt(const char*& p, const char* end, int& result)
+        {
+            const char* s = p;
+            bool negative = s < end && *s == '-';
+            if (s < end && (*s == '-' || *s == '+'))
+                ++s;
+            if (s == end || !isDigit(*s))
+                return false;
+
+            int value = 0;
+            for (; s < end && isDigit(*s); ++s)
+                value = value * 10 + (*s - '0');
+            result = negative ? -value : value;
+            p = s;
+            return true;
+        }
+
+        bool parseFloat(const char*& p, const char* end, float& result)
+        {
+            static const double powers[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+            const char* s = skipSpace(p, end);
+            bool negative = s < end && *s == '-';
+            if (s < end && (*s == '-' || *s == '+'))
+                ++s;
+
+            uint64_t mantissa = 0;
+            int exponent = 0, digits = 0;
+            for (; s < end && isDigit(*s); ++s, ++digits)
+            {
+                if (mantissa < 100000000000000000ull)
+                    mantissa = mantissa * 10 + uint64_t(*s - '0');
+                else
+                    ++exponent;
+            }
+            if (s < end && *s == '.')
+                for (++s; s < end && isDigit(*s); ++s, ++digits)
+                    if (mantissa < 100000000000000000ull)
+                    {
+                        mantissa = mantissa * 10 + uint64_t(*s - '0');
+                        --exponent;
+                    }
+            if (!digits)
+                return false;
+
+            if (s < end && (*s == 'e' || *s == 'E'))
+            {
+                const char* e = s + 1;
+                int power;
+                if (parseInt(e, end, power))
+                {
+                    exponent += power;
+                    s = e;
+                }
+            }
+
+            double value = double(mantissa);
+            if (exponent < 0)
+                value = exponent >= -22 ? value / powers[-exponent] : value * pow(10.0, exponent);
+            else if (exponent > 0)
+                value = exponent <= 22 ? value * powers[exponent] : value * pow(10.0, exponent);
+
+            result = float(negative ? -value : value);
+            p = s;
+            return true;
+        }
+
+        // OBJ indices count from 1, or back from the last attribute when negative
+        int resolveIndex(int index, size_t count)
+        {
+            return index > 0 ? index - 1 : index < 0 ? int(count) + index : -1;
+        }
+
+        void countAttributes(ObjChunk& chunk)
+        {
+            for (const char* p = chunk.begin; p < chunk.end; )
+            {
+                const char* end = lineEnd(p, chunk.end);
+                const char* s = skipSpace(p, end);
+                const char* rest;
+                if (keyword(s, end, "v", rest))
+                    ++chunk.vertexCount;
+                else if (keyword(s, end, "vn", rest))
+                    ++chunk.normalCount;
+                else if (keyword(s, end, "vt", rest))
+                    ++chunk.texcoordCount;
+                p = end + 1;
+            }
+        }
+
+        void parseChunk(ObjChunk& chunk, tinyobj::attrib_t& attrib)
+        {
+            float* vertices = attrib.vertices.data() + 3 * chunk.vertexBase;
+            float* normals = attrib.normals.data() + 3 * chunk.normalBase;
+            float* texcoords = attrib.texcoords.data() + 2 * chunk.texcoordBase;
+            size_t vertexCount = chunk.vertexBase, normalCount = chunk.normalBase, texcoordCount = chunk.texcoordBase;
+
+            for (const char* p = chunk.begin; p < chunk.end && !chunk.unsupported; )
+            {
+                const char* end = lineEnd(p, chunk.end);
+                const char* s = skipSpace(p, end);
+                p = end + 1;
+
+                const char* rest;
+                if (s == end || *s == '#')
+                    continue;
+
+                const char* last = end;
+                while (last > s && isSpace(last[-1]))
+                    --last;
+                if (last[-1] == '\\')
+                {
+                    // continued lines
+                    chunk.unsupported = true;
+                }
+                else if (keyword(s, end, "v", rest))
+                {
+                    // colors following the position are ignored
+                    chunk.unsupported = !parseFloat(rest, end, vertices[0]) || !parseFloat(rest, end, vertices[1]) ||
+                                        !parseFloat(rest, end, vertices[2]);
+                    vertices += 3;
+                    ++vertexCount;
+                }
+                else if (keyword(s, end, "vn", rest))
+                {
+                    chunk.unsupported = !parseFloat(rest, end, normals[0]) || !parseFloat(rest, end, normals[1]) ||
+                                        !parseFloat(rest, end, normals[2]);
+                    normals += 3;
+                    ++normalCount;
+                }
+                else if (keyword(s, end, "vt", rest))
+                {
+                    chunk.unsupported = !parseFloat(rest, end, texcoords[0]);
+                    if (!parseFloat(rest, end, texcoords[1]))
+                        texcoords[1] = 0.f;
+                    texcoords += 2;
+                    ++texcoordCount;
+                }
+                else if (keyword(s, end, "f", rest))
+                {
+                    int corners = 0;
+                    for (rest = skipSpace(rest, end); rest < end && !chunk.unsupported; rest = skipSpace(rest, end))
+                    {
+                        int v = 0, t = 0, n = 0;
+                        if (!parseInt(rest, end, v))
+                        {
+                            chunk.unsupported = true;
+                            break;
+                        }
+                        if (rest < end && *rest == '/')
+                        {
+                            ++rest;
+                            parseInt(rest, end, t);
+                            if (rest < end && *rest == '/')
+                            {
+                                ++rest;
+                                parseInt(rest, end, n);
+                            }
+                        }
+                        if (rest < end && !isSpace(*rest))
+                            chunk.unsupported = true;
+
+                        tinyobj::index_t index;
+                        index.vertex_index = resolveIndex(v, vertexCount);
+                        index.texcoord_index = resolveIndex(t, texcoordCount);
+                        index.normal_index = resolveIndex(n, normalCount);
+                        chunk.corners.push_back(index);
+                        ++corners;
+                    }
+
+                    // polygons would need tinyobj's triangulation
+                    if (corners < 3 || corners > 4)
+                        chunk.unsupported = true;
+                    chunk.faceSizes.push_back(uint8_t(corners));
+                }
+                else if (keyword(s, end, "o", rest) || keyword(s, end, "g", rest))
+                {
+                    ObjStatement st = { ObjStatement::shape, chunk.faceSizes.size(), lineText(rest, end) };
+                    chunk.statements.push_back(st);
+                }
+                else if (keyword(s, end, "usemtl", rest))
+                {
+                    ObjStatement st = { ObjStatement::material, chunk.faceSizes.size(), lineText(rest, end) };
+                    chunk.statements.push_back(st);
+                }
+                else if (keyword(s, end, "s", rest))
+                {
+                    ObjStatement st = { ObjStatement::smoothing, chunk.faceSizes.size() };
+                    int id;
+                    rest = skipSpace(rest, end);
+                    if (parseInt(rest, end, id) && id > 0)
+                        st.id = unsigned(id);
+                    chunk.statements.push_back(st);
+                }
+                else if (keyword(s, end, "mtllib", rest))
+                {
+                    std::istringstream names(lineText(rest, end));
+                    std::string name;
+                    while (names >> name)
+                        chunk.mtllibs.push_back(name);
+                }
+                // lines, points, and free form geometry aren't drawn
+            }
+        }
+
+        bool triangulateChunk(ObjChunk& chunk, const tinyobj::attrib_t& attrib)
+        {
+            int vertices = int(attrib.vertices.size() / 3);
+            int normals = int(attrib.normals.size() / 3);
+            int texcoords = int(attrib.texcoords.size() / 2);
+            for (auto& c : chunk.corners)
+                if (c.vertex_index < 0 || c.vertex_index >= vertices ||
+                    c.normal_index < -1 || c.normal_index >= normals ||
+                    c.texcoord_index < -1 || c.texcoord_index >= texcoords)
+                    return false;
+
+            auto distance2 = [&](const tinyobj::index_t& a, const tinyobj::index_t& b)
+            {
+                const float* pa = &attrib.vertices[3 * a.vertex_index];
+                const float* pb = &attrib.vertices[3 * b.vertex_index];
+                return (pa[0] - pb[0]) * (pa[0] - pb[0]) + (pa[1] - pb[1]) * (pa[1] - pb[1]) + (pa[2] - pb[2]) * (pa[2] - pb[2]);
+            };
+
+            chunk.faceTriangles.reserve(chunk.faceSizes.size() + 1);
+            const tinyobj::index_t* c = chunk.corners.data();
+            for (uint8_t size : chunk.faceSizes)
+            {
+                chunk.faceTriangles.push_back(chunk.triangles.size() / 3);
+                if (size == 3)
+                    chunk.triangles.insert(chunk.triangles.end(), c, c + 3);
+                else if (distance2(c[0], c[2]) <= distance2(c[1], c[3]))
+                    chunk.triangles.insert(chunk.triangles.end(), { c[0], c[1], c[2], c[0], c[2], c[3] });
+                else
+                    chunk.triangles.insert(chunk.triangles.end(), { c[0], c[1], c[3], c[1], c[2], c[3] });
+                c += size;
+            }
+            chunk.faceTriangles.push_back(chunk.triangles.size() / 3);
+
+            std::vector<tinyobj::index_t>().swap(chunk.corners);
+            return true;
+        }
+
+        // Parses an OBJ file into the same form as tinyobj::LoadObj with
+        // triangulation. Returns false if the file needs tinyobj.
+        bool parseObjParallel(const std::string& path, const std::string& baseDir,
+            tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+            std::vector<tinyobj::material_t>& materials, std::string& warn)
+        {
+            MappedFile file;
+            if (!file.open(path))
+                return false;
+
+            const char* text = reinterpret_cast<const char*>(file.data());
+            const char* textEnd = text + file.size();
+
+            std::vector<ObjChunk> chunks(std::max<size_t>(1, file.size() / objChunkSize));
+            const char* p = text;
+            for (size_t i = 0; i < chunks.size(); ++i)
+            {
+                chunks[i].begin = p;
+                if (i + 1 < chunks.size())
+                {
+                    p = std::max(p, text + file.size() * (i + 1) / chunks.size());
+                    p = std::min(textEnd, lineEnd(p, textEnd) + 1);
+                }
+                else
+                    p = textEnd;
+                chunks[i].end = p;
+            }
+
+            lab::parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    countAttributes(chunks[i]);
+            });
+
+            size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+            for (auto& c : chunks)
+            {
+                c.vertexBase = vertexCount;
+                c.normalBase = normalCount;
+                c.texcoordBase = texcoordCount;
+                vertexCount += c.vertexCount;
+                normalCount += c.normalCount;
+                texcoordCount += c.texcoordCount;
+            }
+            attrib.vertices.resize(3 * vertexCount);
+            attrib.normals.resize(3 * normalCount);
+            attrib.texcoords.resize(2 * texcoordCount);
+
+            std::atomic<bool> supported(true);
+            lab::parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end && supported; ++i)
+                {
+                    parseChunk(chunks[i], attrib);
+                    if (chunks[i].unsupported)
+                        supported = false;
+                }
+            });
+            if (!supported)
+                return false;
+
+            lab::parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    if (!triangulateChunk(chunks[i], attrib))
+                        supported = false;
+            });
+            if (!supported)
+                return false;
+
+            // the first material library that opens supplies the materials
+            std::map<std::string, int> materialMap;
+            bool mtllibLoaded = false;
+            for (auto& c : chunks)
+                for (auto& name : c.mtllibs)
+                {
+                    std::ifstream mtl(baseDir + "/" + name);
+                    if (mtllibLoaded || !mtl)
+                        continue;
+                    std::string mtlWarn, mtlErr;
+                    tinyobj::LoadMtl(&materialMap, &materials, &mtl, &mtlWarn, &mtlErr);
+                    warn += mtlWarn + mtlErr;
+                    mtllibLoaded = true;
+                }
+
+            // statements apply from their face onwards, across chunks
+            tinyobj::shape_t shape;
+            int material = -1;
+            unsigned int smoothing = 0;
+            for (auto& c : chunks)
+            {
+                size_t face = 0;
+                auto flush = [&](size_t until)
+                {
+                    size_t first = c.faceTriangles[face], last = c.faceTriangles[until];
+                    shape.mesh.indices.insert(shape.mesh.indices.end(),
+                        c.triangles.begin() + 3 * first, c.triangles.begin() + 3 * last);
+                    shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), last - first, 3);
+                    shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), last - first, material);
+                    shape.mesh.smoothing_group_ids.insert(shape.mesh.smoothing_group_ids.end(), last - first, smoothing);
+                    face = until;
+                };
+
+                for (auto& st : c.statements)
+                {
+                    flush(st.face);
+                    if (st.kind == ObjStatement::shape)
+                    {
+                        if (!shape.mesh.indices.empty())
+                            shapes.push_back(std::move(shape));
+                        shape = tinyobj::shape_t();
+                        shape.name = st.name;
+                    }
+                    else if (st.kind == ObjStatement::material)
+                    {
+                        auto m = materialMap.find(st.name);
+                        material = m != materialMap.end() ? m->second : -1;
+                        if (m == materialMap.end())
+                            warn += "material [ '" + st.name + "' ] not found in .mtl\n";
+                    }
+                    else
+                        smoothing = st.id;
+                }
+                flush(c.faceSizes.size());
+                std::vector<tinyobj::index_t>().swap(c.triangles);
+            }
+            if (!shape.mesh.indices.empty())
+                shapes.push_back(std::move(shape));
+            return true;
+        }
+
+        bool loadObj(const std::string& path, const std::string& baseDir,
+            tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+            std::vector<tinyobj::material_t>& materials, std::string& warn, std::string& err)
+        {
+            if (parseObjParallel(path, baseDir, attrib, shapes, materials, warn))
+                return true;
+
+            attrib = tinyobj::attrib_t();
+            shapes.clear();
+            materials.clear();
+            warn.clear();
+            return tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str(), baseDir.c_str());
+        }
+    }
+
+    // writes the three vertices of a shape's face
+    static void emitFace(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape,
+        const std::vector<tinyobj::material_t>& materials, const std::map<int, vec3>& smoothVertexNormals,
+        size_t f, VertPTNC* out)
+    {
+        tinyobj::index_t idx0 = shape.mesh.indices[3 * f + 0];
+        tinyobj::index_t idx1 = shape.mesh.indices[3 * f + 1];
+        tinyobj::index_t idx2 = shape.mesh.indices[3 * f + 2];
+
+        int current_material_id = shape.mesh.material_ids[f];
+
+        if ((current_material_id < 0) ||
+            (current_material_id >= static_cast<int>(materials.size()))) {
+            // Invaid material ID. Use default material.
+            current_material_id =
+                materials.size() -
+                1;  // Default material is added to the last item in `materials`.
+        }
+
+        float diffuse[3];
+        for (size_t i = 0; i < 3; i++) {
+            diffuse[i] = materials[current_material_id].diffuse[i];
+        }
+        float tc[3][2];
+        if (attrib.texcoords.size() > 0) {
+            if ((idx0.texcoord_index < 0) || (idx1.texcoord_index < 0) ||
+                (idx2.texcoord_index < 0)) {
+                // face does not contain valid uv index.
+                tc[0][0] = 0.0f;
+                tc[0][1] = 0.0f;
+                tc[1][0] = 0.0f;
+                tc[1][1] = 0.0f;
+                tc[2][0] = 0.0f;
+                tc[2][1] = 0.0f;
+            }
+            else {
+                assert(attrib.texcoords.size() >
+                    size_t(2 * idx0.texcoord_index + 1));
+                assert(attrib.texcoords.size() >
+                    size_t(2 * idx1.texcoord_index + 1));
+                assert(attrib.texcoords.size() >
+                    size_t(2 * idx2.texcoord_index + 1));
+
+                // Flip Y coord.
+                tc[0][0] = attrib.texcoords[2 * idx0.texcoord_index];
+                tc[0][1] = 1.0f - attrib.texcoords[2 * idx0.texcoord_index + 1];
+                tc[1][0] = attrib.texcoords[2 * idx1.texcoord_index];
+                tc[1][1] = 1.0f - attrib.texcoords[2 * idx1.texcoord_index + 1];
+                tc[2][0] = attrib.texcoords[2 * idx2.texcoord_index];
+                tc[2][1] = 1.0f - attrib.texcoords[2 * idx2.texcoord_index + 1];
+            }
+        }
+        else {
+            tc[0][0] = 0.0f;
+            tc[0][1] = 0.0f;
+            tc[1][0] = 0.0f;
+            tc[1][1] = 0.0f;
+            tc[2][0] = 0.0f;
+            tc[2][1] = 0.0f;
+        }
+
+        float v[3][3];
+        for (int k = 0; k < 3; k++) {
+            int f0 = idx0.vertex_index;
+            int f1 = idx1.vertex_index;
+            int f2 = idx2.vertex_index;
+            assert(f0 >= 0);
+            assert(f1 >= 0);
+            assert(f2 >= 0);
+
+            v[0][k] = attrib.vertices[3 * f0 + k];
+            v[1][k] = attrib.vertices[3 * f1 + k];
+            v[2][k] = attrib.vertices[3 * f2 + k];
+        }
+
+        float n[3][3];
+        {
+            bool invalid_normal_index = false;
+            if (attrib.normals.size() > 0) {
+                int nf0 = idx0.normal_index;
+                int nf1 = idx1.normal_index;
+                int nf2 = idx2.normal_index;
+
+                if ((nf0 < 0) || (nf1 < 0) || (nf2 < 0)) {
+                    // normal index is missing from this face.
+                    invalid_normal_index = true;
+                }
+                else {
+                    for (int k = 0; k < 3; k++) {
+                        assert(size_t(3 * nf0 + k) < attrib.normals.size());
+                        assert(size_t(3 * nf1 + k) < attrib.normals.size());
+                        assert(size_t(3 * nf2 + k) < attrib.normals.size());
+                        n[0][k] = attrib.normals[3 * nf0 + k];
+                        n[1][k] = attrib.normals[3 * nf1 + k];
+                        n[2][k] = attrib.normals[3 * nf2 + k];
+                    }
+                }
+            }
+            else {
+                invalid_normal_index = true;
+            }
+
+            if (invalid_normal_index && !smoothVertexNormals.empty()) {
+                // Use smoothing normals
+                auto s0 = smoothVertexNormals.find(idx0.vertex_index);
+                auto s1 = smoothVertexNormals.find(idx1.vertex_index);
+                auto s2 = smoothVertexNormals.find(idx2.vertex_index);
+
+                if (s0 != smoothVertexNormals.end() && s1 != smoothVertexNormals.end() &&
+                    s2 != smoothVertexNormals.end()) {
+                    for (int k = 0; k < 3; k++) {
+                        n[0][k] = s0->second.v[k];
+                        n[1][k] = s1->second.v[k];
+                        n[2][k] = s2->second.v[k];
+                    }
+
+                    invalid_normal_index = false;
+                }
+            }
+
+            if (invalid_normal_index) {
+                // compute geometric normal
+                CalcNormal(n[0], v[0], v[1], v[2]);
+                n[1][0] = n[0][0];
+                n[1][1] = n[0][1];
+                n[1][2] = n[0][2];
+                n[2][0] = n[0][0];
+                n[2][1] = n[0][1];
+                n[2][2] = n[0][2];
+            }
+
+            for (int k = 0; k < 3; k++) {
+
+                // Combine normal and diffuse to get color.
+                float normal_factor = 0.f;
+                float diffuse_factor = 1 - normal_factor;
+                float c[3] = { n[k][0] * normal_factor + diffuse[0] * diffuse_factor,
+                               n[k][1] * normal_factor + diffuse[1] * diffuse_factor,
+                               n[k][2] * normal_factor + diffuse[2] * diffuse_factor };
+                float len2 = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+                if (len2 > 0.0f) {
+                    float len = sqrtf(len2);
+
+                    c[0] /= len;
+                    c[1] /= len;
+                    c[2] /= len;
+                }
+
+                out[k] = VertPTNC(
+                    v3f(v[k][0], v[k][1], v[k][2]),
+                    V2F(tc[k][0], tc[k][1]),
+                    V3F(n[k][0], n[k][1], n[k][2]),
+                    V4F(c[0] * 0.5f + 0.5f, c[1] * 0.5f + 0.5f, c[2] * 0.5f + 0.5f, 1.f));
+            }
+        }
+    }
+
+    struct ObjPartStats
+    {
+        size_t vertices = 0;
+        size_t triangles = 0;
+        float acmrBefore = 0;
+        float acmrAfter = 0;
+        bool packed = false;
+    };
+
+    // indexes and orders a shape's vertices, and wraps them as a part
+    static std::shared_ptr<ModelPart> buildObjPart(std::vector<VertPTNC>& corners, ObjPartStats& stats)
+    {
+        std::vector<uint32_t> triIndices(corners.size());
+        size_t vertexCount = indexVertices(corners.data(), corners.size(), sizeof(VertPTNC), triIndices.data());
+        stats.acmrBefore = averageCacheMissRatio(triIndices.data(), triIndices.size(), vertexCount);
+        optimizeVertexCache(triIndices.data(), triIndices.size(), vertexCount);
+        vertexCount = optimizeVertexFetch(corners.data(), vertexCount, sizeof(VertPTNC), triIndices.data(), triIndices.size());
+        stats.acmrAfter = averageCacheMissRatio(triIndices.data(), triIndices.size(), vertexCount);
+        stats.vertices = vertexCount;
+        stats.triangles = triIndices.size() / 3;
+
+        Bounds bounds;
+        bounds.first = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        bounds.second = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+        for (size_t i = 0; i < vertexCount; ++i) {
+            const float* p = corners[i].pos;
+            bounds.first = { std::min(bounds.first.x, p[0]), std::min(bounds.first.y, p[1]), std::min(bounds.first.z, p[2]) };
+            bounds.second = { std::max(bounds.second.x, p[0]), std::max(bounds.second.y, p[1]), std::max(bounds.second.z, p[2]) };
+        }
+
+        // pack the vertices unless the uvs repeat, which unorm16 can't hold;
+        // parts given their own vertex shaders unpack when first drawn
+        bool packable = true;
+        for (size_t i = 0; i < vertexCount && packable; ++i) {
+            const float* uv = corners[i].uv;
+            packable = uv[0] >= 0.f && uv[0] <= 1.f && uv[1] >= 0.f && uv[1] <= 1.f;
+        }
+
+        std::shared_ptr<BufferBase> vertices;
+        if (packable) {
+            const float boundsMin[3] = { bounds.first.x, bounds.first.y, bounds.first.z };
+            const float boundsMax[3] = { bounds.second.x, bounds.second.y, bounds.second.z };
+            auto packed = std::make_shared<Buffer<VertPackedPTNC>>(BufferBase::BufferType::VertexBuffer);
+            std::vector<VertPackedPTNC> packedVertices(vertexCount);
+            for (size_t i = 0; i < vertexCount; ++i)
+                packedVertices[i] = VertPackedPTNC(corners[i], boundsMin, boundsMax);
+            packed->assign(packedVertices.begin(), packedVertices.end());
+            vertices = packed;
+        }
+        else {
+            auto full = std::make_shared<Buffer<VertPTNC>>(BufferBase::BufferType::VertexBuffer);
+            full->assign(corners.begin(), corners.begin() + vertexCount);
+            vertices = full;
+        }
+        stats.packed = packable;
+        std::vector<VertPTNC>().swap(corners);
+
+        auto mesh = std::make_shared<ModelPart>();
+        mesh->setVAO(std::unique_ptr<VAO>(new VAO(vertices)), bounds);
+        std::shared_ptr<IndexBuffer> indices = std::make_shared<IndexBuffer>();
+        indices->assign(triIndices.begin(), triIndices.end());
+        mesh->verts()->setIndices(indices);
+        return mesh;
+    }
+
     std::shared_ptr<Model> load_ObjMesh(const std::string& srcFilename_)
     {
         tinyobj::attrib_t attrib;
@@ -815,8 +1595,7 @@ namespace lab {
         }
         std::string base_dir = srcFilename.substr(0, srcFilename.find_last_of("/\\"));
 
-        bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, srcFilename.c_str(),
-            base_dir.c_str());
+        bool ret = loadObj(srcFilename, base_dir, attrib, shapes, materials, warn, err);
         if (!warn.empty()) {
             std::cout << "WARN: " << warn << std::endl;
         }
@@ -825,7 +1604,7 @@ namespace lab {
         }
 
         if (!ret) {
-            std::cerr << "Failed to load " << filename << std::endl;
+            std::cerr << "Failed to load " << srcFilename << std::endl;
             return {};
         }
 
@@ -904,213 +1683,71 @@ namespace lab {
         bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
         bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
 
-        {
-            for (size_t s = 0; s < shapes.size(); s++) {
-                std::vector<float> buffer;  // pos(3float), normal(3float), color(3float)
-
-                // Check for smoothing group and compute smoothing normals
-                std::map<int, vec3> smoothVertexNormals;
-                if (hasSmoothingGroup(shapes[s])) {
-                    std::cout << "Compute smoothingNormal for shape [" << s << "]" << std::endl;
-                    computeSmoothingNormals(attrib, shapes[s], smoothVertexNormals);
-                }
-
-                auto mesh = std::make_shared<ModelPart>();
-                VAO* vertdata = new VAO(std::make_shared<Buffer<VertPTNC>>(BufferBase::BufferType::VertexBuffer));
-
-                for (size_t f = 0; f < shapes[s].mesh.indices.size() / 3; f++) {
-                    tinyobj::index_t idx0 = shapes[s].mesh.indices[3 * f + 0];
-                    tinyobj::index_t idx1 = shapes[s].mesh.indices[3 * f + 1];
-                    tinyobj::index_t idx2 = shapes[s].mesh.indices[3 * f + 2];
-
-                    int current_material_id = shapes[s].mesh.material_ids[f];
-
-                    if ((current_material_id < 0) ||
-                        (current_material_id >= static_cast<int>(materials.size()))) {
-                        // Invaid material ID. Use default material.
-                        current_material_id =
-                            materials.size() -
-                            1;  // Default material is added to the last item in `materials`.
-                    }
-                    // if (current_material_id >= materials.size()) {
-                    //    std::cerr << "Invalid material index: " << current_material_id <<
-                    //    std::endl;
-                    //}
-                    //
-                    float diffuse[3];
-                    for (size_t i = 0; i < 3; i++) {
-                        diffuse[i] = materials[current_material_id].diffuse[i];
-                    }
-                    float tc[3][2];
-                    if (attrib.texcoords.size() > 0) {
-                        if ((idx0.texcoord_index < 0) || (idx1.texcoord_index < 0) ||
-                            (idx2.texcoord_index < 0)) {
-                            // face does not contain valid uv index.
-                            tc[0][0] = 0.0f;
-                            tc[0][1] = 0.0f;
-                            tc[1][0] = 0.0f;
-                            tc[1][1] = 0.0f;
-                            tc[2][0] = 0.0f;
-                            tc[2][1] = 0.0f;
-                        }
-                        else {
-                            assert(attrib.texcoords.size() >
-                                size_t(2 * idx0.texcoord_index + 1));
-                            assert(attrib.texcoords.size() >
-                                size_t(2 * idx1.texcoord_index + 1));
-                            assert(attrib.texcoords.size() >
-                                size_t(2 * idx2.texcoord_index + 1));
-
-                            // Flip Y coord.
-                            tc[0][0] = attrib.texcoords[2 * idx0.texcoord_index];
-                            tc[0][1] = 1.0f - attrib.texcoords[2 * idx0.texcoord_index + 1];
-                            tc[1][0] = attrib.texcoords[2 * idx1.texcoord_index];
-                            tc[1][1] = 1.0f - attrib.texcoords[2 * idx1.texcoord_index + 1];
-                            tc[2][0] = attrib.texcoords[2 * idx2.texcoord_index];
-                            tc[2][1] = 1.0f - attrib.texcoords[2 * idx2.texcoord_index + 1];
-                        }
-                    }
-                    else {
-                        tc[0][0] = 0.0f;
-                        tc[0][1] = 0.0f;
-                        tc[1][0] = 0.0f;
-                        tc[1][1] = 0.0f;
-                        tc[2][0] = 0.0f;
-                        tc[2][1] = 0.0f;
-                    }
-
-                    float v[3][3];
-                    for (int k = 0; k < 3; k++) {
-                        int f0 = idx0.vertex_index;
-                        int f1 = idx1.vertex_index;
-                        int f2 = idx2.vertex_index;
-                        assert(f0 >= 0);
-                        assert(f1 >= 0);
-                        assert(f2 >= 0);
-
-                        v[0][k] = attrib.vertices[3 * f0 + k];
-                        v[1][k] = attrib.vertices[3 * f1 + k];
-                        v[2][k] = attrib.vertices[3 * f2 + k];
-                        bmin[k] = std::min(v[0][k], bmin[k]);
-                        bmin[k] = std::min(v[1][k], bmin[k]);
-                        bmin[k] = std::min(v[2][k], bmin[k]);
-                        bmax[k] = std::max(v[0][k], bmax[k]);
-                        bmax[k] = std::max(v[1][k], bmax[k]);
-                        bmax[k] = std::max(v[2][k], bmax[k]);
-                    }
-
-                    float n[3][3];
-                    {
-                        bool invalid_normal_index = false;
-                        if (attrib.normals.size() > 0) {
-                            int nf0 = idx0.normal_index;
-                            int nf1 = idx1.normal_index;
-                            int nf2 = idx2.normal_index;
-
-                            if ((nf0 < 0) || (nf1 < 0) || (nf2 < 0)) {
-                                // normal index is missing from this face.
-                                invalid_normal_index = true;
-                            }
-                            else {
-                                for (int k = 0; k < 3; k++) {
-                                    assert(size_t(3 * nf0 + k) < attrib.normals.size());
-                                    assert(size_t(3 * nf1 + k) < attrib.normals.size());
-                                    assert(size_t(3 * nf2 + k) < attrib.normals.size());
-                                    n[0][k] = attrib.normals[3 * nf0 + k];
-                                    n[1][k] = attrib.normals[3 * nf1 + k];
-                                    n[2][k] = attrib.normals[3 * nf2 + k];
-                                }
-                            }
-                        }
-                        else {
-                            invalid_normal_index = true;
-                        }
-
-                        if (invalid_normal_index && !smoothVertexNormals.empty()) {
-                            // Use smoothing normals
-                            int f0 = idx0.vertex_index;
-                            int f1 = idx1.vertex_index;
-                            int f2 = idx2.vertex_index;
-
-                            if (f0 >= 0 && f1 >= 0 && f2 >= 0) {
-                                n[0][0] = smoothVertexNormals[f0].v[0];
-                                n[0][1] = smoothVertexNormals[f0].v[1];
-                                n[0][2] = smoothVertexNormals[f0].v[2];
-
-                                n[1][0] = smoothVertexNormals[f1].v[0];
-                                n[1][1] = smoothVertexNormals[f1].v[1];
-                                n[1][2] = smoothVertexNormals[f1].v[2];
-
-                                n[2][0] = smoothVertexNormals[f2].v[0];
-                                n[2][1] = smoothVertexNormals[f2].v[1];
-                                n[2][2] = smoothVertexNormals[f2].v[2];
-
-                                invalid_normal_index = false;
-                            }
-                        }
-
-                        if (invalid_normal_index) {
-                            // compute geometric normal
-                            CalcNormal(n[0], v[0], v[1], v[2]);
-                            n[1][0] = n[0][0];
-                            n[1][1] = n[0][1];
-                            n[1][2] = n[0][2];
-                            n[2][0] = n[0][0];
-                            n[2][1] = n[0][1];
-                            n[2][2] = n[0][2];
-                        }
-
-                        for (int k = 0; k < 3; k++) {
-
-                            // Combine normal and diffuse to get color.
-                            float normal_factor = 0.f;
-                            float diffuse_factor = 1 - normal_factor;
-                            float c[3] = { n[k][0] * normal_factor + diffuse[0] * diffuse_factor,
-                                           n[k][1] * normal_factor + diffuse[1] * diffuse_factor,
-                                           n[k][2] * normal_factor + diffuse[2] * diffuse_factor };
-                            float len2 = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
-                            if (len2 > 0.0f) {
-                                float len = sqrtf(len2);
-
-                                c[0] /= len;
-                                c[1] /= len;
-                                c[2] /= len;
-                            }
-
-                            vertdata->vertexData<VertPTNC>(true)->push_back(VertPTNC(
-                                v3f(v[k][0], v[k][1], v[k][2]),
-                                V2F(tc[k][0], tc[k][1]),
-                                V3F(n[k][0], n[k][1], n[k][2]),
-                                V4F(c[0] * 0.5f + 0.5f, c[1] * 0.5f + 0.5f, c[2] * 0.5f + 0.5f, 1.f)));
-                        }
-                    }
-                }
-
-                Bounds bounds;
-                bounds.first = { bmin[0], bmin[1], bmin[2] };
-                bounds.second = { bmax[0], bmax[1], bmax[2] };
-                mesh->setVAO(std::unique_ptr<VAO>(vertdata), bounds);
-                std::shared_ptr<IndexBuffer> indices = std::make_shared<IndexBuffer>();
-                VAO* verts = mesh->verts();
-                for (int tri_idx = 0; tri_idx < shapes[s].mesh.indices.size(); ++tri_idx)
-                    indices->push_back(tri_idx);
-                verts->setIndices(indices);
-
-#if 0
-                // OpenGL viewer does not support texturing with per-face material.
-                if (shapes[s].mesh.material_ids.size() > 0 &&
-                    shapes[s].mesh.material_ids.size() > s) {
-                    o.material_id = shapes[s].mesh.material_ids[0];  // use the material ID
-                                                                        // of the first face.
-                }
-                else {
-                    o.material_id = materials.size() - 1;  // = ID for default material.
-                }
-                printf("shape[%d] material_id %d\n", int(s), int(o.material_id));
-#endif
-
-                model->addPart(mesh);
+        // Each step below is spread over all cores: smoothing normals per
+        // shape, then the corners of every face, then indexing per shape.
+        // Nothing here touches GL; buffers upload on first draw, or in a
+        // render command for loadMeshAsync.
+        std::vector<std::map<int, vec3>> smoothVertexNormals(shapes.size());
+        for (size_t s = 0; s < shapes.size(); s++) {
+            if (hasSmoothingGroup(shapes[s]))
+                std::cout << "Compute smoothingNormal for shape [" << s << "]" << std::endl;
+        }
+        lab::parallelFor(shapes.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++) {
+                if (hasSmoothingGroup(shapes[s]))
+                    computeSmoothingNormals(attrib, shapes[s], smoothVertexNormals[s]);
+            }
+        });
+
+        // three vertices per face; shared ones are merged by buildObjPart
+        std::vector<size_t> faceStart(shapes.size() + 1, 0);
+        std::vector<std::vector<VertPTNC>> corners(shapes.size());
+        for (size_t s = 0; s < shapes.size(); s++) {
+            faceStart[s + 1] = faceStart[s] + shapes[s].mesh.indices.size() / 3;
+            corners[s].resize(shapes[s].mesh.indices.size() / 3 * 3);
+        }
+        lab::parallelFor(faceStart.back(), 4096, [&](size_t begin, size_t end) {
+            size_t s = std::upper_bound(faceStart.begin(), faceStart.end(), begin) - faceStart.begin() - 1;
+            for (size_t face = begin; face < end; ++face) {
+                while (face >= faceStart[s + 1])
+                    ++s;
+                size_t f = face - faceStart[s];
+                emitFace(attrib, shapes[s], materials, smoothVertexNormals[s], f, &corners[s][3 * f]);
+            }
+        });
+
+        std::vector<std::shared_ptr<ModelPart>> parts(shapes.size());
+        std::vector<ObjPartStats> stats(shapes.size());
+        lab::parallelFor(shapes.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++) {
+                if (!corners[s].empty())
+                    parts[s] = buildObjPart(corners[s], stats[s]);
             }
+        });
+
+        for (size_t s = 0; s < shapes.size(); s++) {
+            auto mesh = parts[s];
+            if (!mesh)
+                continue;
+
+            printf("shape[%d] %d %s vertices for %d triangles, ACMR %.3f -> %.3f\n", int(s), int(stats[s].vertices),
+                stats[s].packed ? "packed" : "float", int(stats[s].triangles), stats[s].acmrBefore, stats[s].acmrAfter);
+
+            Bounds bounds = mesh->localBounds();
+            bmin[0] = std::min(bmin[0], bounds.first.x);
+            bmin[1] = std::min(bmin[1], bounds.first.y);
+            bmin[2] = std::min(bmin[2], bounds.first.z);
+            bmax[0] = std::max(bmax[0], bounds.second.x);
+            bmax[1] = std::max(bmax[1], bounds.second.y);
+            bmax[2] = std::max(bmax[2], bounds.second.z);
+
+            // the viewer doesn't texture per face, so a part is bound to
+            // the material of its first face
+            int material_id = shapes[s].mesh.material_ids.empty() ? -1 : shapes[s].mesh.material_ids[0];
+            if (material_id >= 0 && material_id < int(materials.size()))
+                mesh->materialName = materials[material_id].name;
+
+            model->addPart(mesh);
         }
 
         printf("bmin = %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
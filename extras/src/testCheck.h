@@ -0,0 +1,13 @@
+// Reporting shared by the tests in extras, which exercise CPU side code and
+// run without a GL context.
+
+#pragma once
+
+#include <stdio.h>
+
+// prints a line for the check, and returns whether it passed
+inline bool check(const char* name, bool ok)
+{
+    printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
@@ -0,0 +1,58 @@
+
+// Builds texture cache entries ahead of time, so that the first run of an
+// application maps its textures instead of decoding them.
+//
+//     TextureCacheTool [-cache dir] [-kaiser] [-linear] image...
+
+#include <LabRender/TextureCache.h>
+#include <LabRender/Utils.h>
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace lab::Render;
+
+int main(int argc, char** argv)
+{
+    MipFilter filter = MipFilter::box;
+    ColorSpace colorSpace = ColorSpace::srgb;
+    std::vector<std::string> images;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-cache") && i + 1 < argc)
+            setTextureCacheDirectory(argv[++i]);
+        else if (!strcmp(argv[i], "-kaiser"))
+            filter = MipFilter::kaiser;
+        else if (!strcmp(argv[i], "-linear"))
+            colorSpace = ColorSpace::linear;
+        else
+            images.push_back(argv[i]);
+    }
+
+    if (images.empty() || textureCacheDirectory().empty())
+    {
+        printf("usage: TextureCacheTool [-cache dir] [-kaiser] [-linear] image...\n");
+        return 1;
+    }
+
+    std::atomic<int> failures(0);
+    lab::parallelFor(images.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            std::unique_ptr<TextureLevels> levels = loadTextureLevels(images[i], filter, colorSpace);
+            if (!levels || !levels->mapped())
+            {
+                printf("could not cache %s\n", images[i].c_str());
+                ++failures;
+                continue;
+            }
+            printf("%s -> %s\n", images[i].c_str(), textureCachePath(images[i]).c_str());
+        }
+    });
+
+    return failures ? 1 : 0;
+}
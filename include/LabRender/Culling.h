@@ -0,0 +1,48 @@
+//
+//  Culling.h
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+#include <LabMath/LabMath.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace lab { namespace Render {
+
+    // Planes as (a, b, c, d), facing inward, so that a point is inside when
+    // a x + b y + c z + d >= 0 for every plane.
+    struct Frustum
+    {
+        float planes[6][4];
+    };
+
+    // the clip volume of a GL projection * view matrix
+    LR_API Frustum extractFrustum(const m44f & viewProjection);
+
+    // Axis aligned boxes as centers and half extents, in structure of arrays
+    // form so that several boxes are tested at once.
+    struct BoxSoA
+    {
+        std::vector<float> cx, cy, cz;
+        std::vector<float> ex, ey, ez;
+
+        LR_API void resize(size_t count);
+        size_t size() const { return cx.size(); }
+
+        // stores the world space box enclosing local bounds under transform
+        LR_API void set(size_t i, const Bounds & local, const m44f & transform);
+    };
+
+    // Sets visible[i] to 1 for each box in [begin, end) that intersects the
+    // frustum, and 0 for each box wholly outside one of its planes. Uses SSE
+    // or AVX where available.
+    LR_API void cullBoxes(const Frustum &, const BoxSoA &, size_t begin, size_t end, uint8_t * visible);
+
+}} // lab::Render
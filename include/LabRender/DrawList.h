@@ -8,10 +8,13 @@
 
 #pragma once
 
+#include "LabRender/Culling.h"
+#include "LabRender/DrawSort.h"
 #include "LabRender/Light.h"
 #include "LabRender/ModelBase.h"
 #include <LabMath/LabMath.h>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 namespace lab { namespace Render {
@@ -32,6 +35,72 @@ namespace lab { namespace Render {
         m44f modl;
         m44f view;
         m44f proj;
+
+        // If set, the renderer draws deferredMeshes in the order found by
+        // sortMeshes, rather than in submission order.
+        bool sortDeferredMeshes = false;
+
+        // Orders the indices of deferredMeshes by drawSortKey into
+        // drawOrder, leaving deferredMeshes as submitted. Sky parts are drawn
+        // after everything else, so that the depth test rejects covered
+        // pixels, and depth is the distance to the center of each mesh's
+        // bounds. Storage is kept between calls.
+        LR_API void sortMeshes();
+        const std::vector<uint32_t> & drawOrder() const { return _drawOrder; }
+
+        // If set, the renderer draws only the deferredMeshes found visible
+        // by cullMeshes.
+        bool cullDeferredMeshes = false;
+
+        // Fills visible with the indices of the deferredMeshes whose world
+        // bounds intersect the frustum of proj * view, following order if
+        // given and submission order otherwise, and returns the number
+        // culled. Sky parts, and meshes with empty bounds, are never culled.
+        // Large lists are culled on several threads.
+        LR_API size_t cullMeshes(std::vector<uint32_t> & visible, const std::vector<uint32_t> * order = nullptr);
+
+    private:
+        std::vector<uint32_t> _drawOrder;
+        std::vector<DrawSortItem> _sortItems;
+        std::vector<DrawSortItem> _sortScratch;
+        std::vector<float> _sortDepths;
+        std::unordered_map<void const*, uint32_t> _shaderIds;
+        std::unordered_map<void const*, uint32_t> _materialIds;
+        std::unordered_map<void const*, uint32_t> _vertexIds;
+        BoxSoA _cullBoxes;
+        std::vector<uint8_t> _cullVisible;
+    };
+
+    // Draws with equal keys share vertices, shader, and material, and may be
+    // submitted as a single instanced draw. A null vao marks a draw that
+    // can't be batched.
+    struct DrawBatchKey
+    {
+        void const* vao = nullptr;
+        void const* shader = nullptr;
+        void const* material = nullptr;
+    };
+
+    // a run of batchDraws' order that is drawn with one call
+    struct DrawBatch
+    {
+        size_t first = 0;
+        size_t count = 0;
     };
 
+    struct DrawBatchReport
+    {
+        size_t drawsIn = 0;
+        size_t drawsOut = 0;
+    };
+
+    // Groups draws by key, keeping the submission order within a group,
+    // and ordering groups by their first draw.
+    // order receives the indices of keys in batched order, and batches the
+    // runs of order to draw together, each at most maxInstances long. If
+    // presorted, the order of keys is kept, and only neighbours are grouped.
+    LR_API DrawBatchReport batchDraws(const std::vector<DrawBatchKey> & keys, size_t maxInstances,
+                                      std::vector<size_t> & order, std::vector<DrawBatch> & batches,
+                                      bool presorted = false);
+
 }}
@@ -0,0 +1,51 @@
+//
+//  DrawSort.h
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace lab { namespace Render {
+
+    // A draw's state packed so that sorting keys groups draws sharing a
+    // pass, then shader, then material, then vertices, and orders each
+    // group front to back. Fields, most significant first:
+    //
+    //   pass 4 | shader 12 | material 12 | vertices 12 | depth 24
+    //
+    // Ids are expected to be small and dense; wider ids are truncated,
+    // which costs state changes but not correctness. depth is 0 at the
+    // nearest draw and 1 at the farthest.
+    const int drawSortPassBits = 4;
+    const int drawSortShaderBits = 12;
+    const int drawSortMaterialBits = 12;
+    const int drawSortVerticesBits = 12;
+    const int drawSortDepthBits = 24;
+
+    LR_API uint64_t drawSortKey(uint32_t pass, uint32_t shader, uint32_t material, uint32_t vertices, float depth);
+
+    struct DrawSortItem
+    {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    // Stable least significant digit radix sort on key, one byte per pass.
+    // Bytes that are equal in every key are skipped. scratch is resized as
+    // needed, and may be kept between calls to avoid allocation.
+    LR_API void radixSortDraws(std::vector<DrawSortItem> & items, std::vector<DrawSortItem> & scratch);
+
+    // The same sort, with each pass histogrammed and scattered by several
+    // threads over contiguous chunks of items. Chunks scatter to disjoint
+    // ranges of each bucket in chunk order, so the result is identical.
+    // Small inputs are sorted on the calling thread.
+    LR_API void parallelRadixSortDraws(std::vector<DrawSortItem> & items, std::vector<DrawSortItem> & scratch);
+
+}} // lab::Render
@@ -90,6 +90,11 @@ namespace lab { namespace Render {
         };
         void createAttachments(const FrameBufferSpec &, int width, int height);
 
+        // as above, but color attachment i uses storage[i] instead of a new
+        // texture if storage[i] is not null.
+        void createAttachments(const FrameBufferSpec &, int width, int height,
+                               const std::vector<std::shared_ptr<Render::Texture>> & storage);
+
         // Draw to texture 2D in the indicated attachment location (or a 2D layer of
         // a 3D texture).
         // Uniform name is the name the attachment is to take during post processing
@@ -114,9 +119,19 @@ namespace lab { namespace Render {
 
         bool setSize(int width, int height);
 
+        // Attachments given the same slot share one texture. The caller is
+        // responsible for ensuring that they have the same format and that
+        // their contents are never needed at the same time.
+        void alias(const std::string & fbo, const std::string & attachment, int slot);
+        void clearAliases();
+
+        // bytes of texture storage in use, after aliasing
+        size_t allocatedBytes() const;
+
     private:
         int _width, _height;
         std::map<std::string, std::pair<FrameBuffer::FrameBufferSpec, std::shared_ptr<FrameBuffer>>> _fbos;
+        std::map<std::pair<std::string, std::string>, int> _aliases;
     };
 
 }} // lab::Render
@@ -0,0 +1,80 @@
+//
+//  GeometryPool.h
+//  LabRender
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+
+#include <memory>
+#include <stddef.h>
+
+namespace lab { namespace Render {
+
+    struct BufferBase;
+
+    // where a VAO's vertices and indices live in a GeometryPool
+    struct GeometryRange
+    {
+        void const* arena = nullptr;    // null until uploaded
+        size_t firstVertex = 0;
+        size_t vertexCount = 0;
+        size_t firstIndex = 0;
+        size_t indexCount = 0;
+    };
+
+    // A GeometryPool sub-allocates the vertices and indices of many VAOs
+    // from a few large buffers. Each arena holds vertices of one layout, and
+    // has a single vertex array, vertex buffer and index buffer. Ranges are
+    // drawn with a base vertex, and the last arena drawn is left bound, so
+    // parts sharing a layout draw one after another without rebinding.
+    class GeometryPool
+    {
+    public:
+        // arenas are made with room for at least this many bytes of
+        // vertices and of indices, and larger for meshes that don't fit
+        LR_API GeometryPool(size_t arenaVertexBytes = 32 << 20, size_t arenaIndexBytes = 16 << 20);
+
+        // deletes the arenas, so the pool must be released on the GL thread
+        LR_API ~GeometryPool();
+
+        GeometryPool(const GeometryPool &) = delete;
+        GeometryPool & operator=(const GeometryPool &) = delete;
+
+        // Copies vertices, and 32 bit indices if given, into an arena for
+        // the vertices' layout. An uploaded range is rewritten in place if
+        // its layout and counts are unchanged, and moved otherwise. Fails
+        // for vertices that are empty or have no layout. Call on the GL
+        // thread.
+        LR_API bool upload(const BufferBase & vertices, const BufferBase * indices, GeometryRange &);
+
+        // returns a range's space to its arena; any thread may release
+        LR_API void release(GeometryRange &);
+
+        // binds the range's arena, unless it's the one left bound
+        LR_API void bind(const GeometryRange &);
+
+        LR_API void draw(const GeometryRange &);
+        LR_API void drawInstanced(const GeometryRange &, int instances);
+
+        // Binds no vertex array if a pooled draw left an arena bound. Call
+        // before binding element buffers or vertex arrays directly; VAO
+        // and the PassRenderer do.
+        LR_API static void unbind();
+
+        LR_API size_t arenaCount() const;
+
+        // VAOs made while a default pool is set allocate from it. The default
+        // is held until replaced, so set it to nullptr before destroying the
+        // GL context; otherwise the pool is released at static destruction,
+        // and deletes its buffers without a context.
+        LR_API static void setDefault(std::shared_ptr<GeometryPool>);
+        LR_API static std::shared_ptr<GeometryPool> defaultPool();
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+}} // lab::Render
@@ -29,13 +29,24 @@ enum ImmDrawCornerFlags_
 
 /*
 
-    Current use pattern is when immediate drawing is to begin, create an ImmRenderContext,
-    draw stuff, call render, then let ImmRenderContext fall out of scope.
+    Create an ImmRenderContext once and keep it for as long as drawing continues. Each
+    frame, draw stuff, then call render, which draws everything recorded since the last
+    render and empties the draw lists for the next frame.
 
-    Profiling may dictate another pattern is preferable.
+    The context must persist because sprite atlases are built on its worker thread
+    between one render and the next, and uploaded over the following frames; a context
+    made for a single frame waits on its worker and discards its atlases.
 
  */
 
+// Counts over all of a context's draw lists, since it was created
+struct ImmRenderStats
+{
+    size_t emitted_vertices = 0;    // vertices in the draw lists, a shape or sprite counting as four
+    size_t culled_primitives = 0;   // primitives entirely outside their clip rect
+    size_t culled_vertices = 0;     // vertices culled and trimmed primitives would have emitted
+};
+
 class ImmRenderContext
 {
     struct Detail;
@@ -45,7 +56,26 @@ public:
     LR_API ImmRenderContext();
     LR_API ~ImmRenderContext();
 
-    // Render-level scissoring, not used for culling
+    // Worker threads may record concurrently, each into a draw list of its
+    // own with its own clip rect and texture stacks. Between begin and end,
+    // every call the thread makes on this context records into the list for
+    // slot, which must not be shared by threads recording at the same time.
+    // Lists are drawn after the context's own list, in order of slot, and
+    // recording must have ended before render is called. Sprites share one
+    // batch per context, so sprite is only to be called by the owning thread.
+    LR_API void begin_thread_recording(int slot);
+    LR_API void end_thread_recording();
+
+    // When enabled, circles, rounded rectangles and lines are each drawn as a
+    // single quad whose coverage is computed from the shape's signed distance
+    // in the fragment shader, instead of as tessellated triangles with an
+    // anti-aliased fringe. Other primitives are unaffected. Off by default.
+    LR_API void analytic_shapes(bool enable);
+
+    LR_API ImmRenderStats stats() const;
+
+    // Render-level scissoring. Primitives entirely outside the clip rect are
+    // culled before tessellation, and long polylines are trimmed to it.
     LR_API void push_clip_rect(v2f clip_rect_min, v2f clip_rect_max, bool intersect_with_current_clip_rect = false);
     LR_API void push_clip_rect_fullscreen();
     LR_API void pop_clip_rect();
@@ -96,6 +126,18 @@ public:
     LR_API void poly_line(         const v2f* points, const int num_points, uint32_t col, bool closed, float thickness);
     LR_API void poly_convex_filled(const v2f* points, const int num_points, uint32_t col);
 
+    // Batches of primitives given as arrays, one element per primitive. These
+    // draw as circle_filled, line, and rectangle_filled would for each
+    // element, except that circles are regular polygons and that fully
+    // transparent primitives still produce triangles, but are tessellated
+    // several primitives at a time with SIMD.
+    LR_API void circles_filled(   int count, const float* x, const float* y, const float* radius,
+                                  const uint32_t* col, int num_segments = 12);
+    LR_API void lines(            int count, const float* x0, const float* y0, const float* x1, const float* y1,
+                                  const uint32_t* col, float thickness = 1.0f);
+    LR_API void rectangles_filled(int count, const float* x0, const float* y0, const float* x1, const float* y1,
+                                  const uint32_t* col);
+
     LR_API void bezier(const v2f& pos0, const v2f& cp0, const v2f& cp1, const v2f& pos1, 
                        uint32_t col, float thickness, int num_segments = 0);
 
@@ -111,9 +153,19 @@ public:
     LR_API void path_fill_convex(uint32_t col);
     LR_API void path_stroke(     uint32_t col, bool closed, float thickness = 1.0f);
 
-    LR_API void sprite(lab::ImmSpriteId id, int depth, float scale, float theta_radians, float x, float y);
+    // Sprites are gathered into atlases and drawn as instanced quads, one
+    // 40 byte record per sprite, when render is called. They draw in order of
+    // layer, then depth, lowest first, and are grouped by texture within each.
+    // layer is clamped to [-128, 127] and depth to 24 bits.
+    LR_API void sprite(lab::ImmSpriteId id, int depth, float scale, float theta_radians, float x, float y, int layer = 0);
+
+    // Sprite atlases are built on a worker thread and uploaded by render, at
+    // most this many bytes of pixels per frame. Sprites whose atlas is still
+    // uploading draw from textures of their own images. 1MB by default.
+    LR_API void sprite_upload_budget(size_t bytes);
 
-    // call render after everything is done to emit draw calls.
+    // call render after everything is done to emit draw calls. The draw
+    // lists are emptied for the next frame.
     LR_API void render(int w, int h);
 };
 
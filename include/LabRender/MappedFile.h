@@ -0,0 +1,62 @@
+//
+//  MappedFile.h
+//  LabRender
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+namespace lab {
+
+    // A whole file mapped read only into memory
+    class MappedFile
+    {
+    public:
+        LR_API MappedFile();
+        LR_API ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator=(const MappedFile &) = delete;
+
+        // fails for missing and empty files
+        LR_API bool open(const std::string & path);
+
+        LR_API const uint8_t* data() const;
+        LR_API size_t size() const;
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+    // The size and modification time of a file. Caches record the stamp of
+    // their source so that they can be rebuilt when it changes.
+    struct FileStamp
+    {
+        uint64_t size = 0;
+        int64_t modified = 0;       // nanoseconds since 1970
+    };
+
+    LR_API bool stampFile(const std::string & path, FileStamp &);
+
+    // creates dir and any missing parents, returning whether dir exists
+    LR_API bool makeDirectories(const std::string & dir);
+
+    // $envVar if it is set, otherwise LabRender/name in the temp directory
+    LR_API std::string cacheDirectory(char const*const envVar, char const*const name);
+
+    // the file in dir caching sourcePath, named for a hash of the path
+    LR_API std::string cacheFilePath(const std::string & dir, const std::string & sourcePath, char const*const extension);
+
+    // Calls write with a temporary file beside path and renames it over path,
+    // so that a reader never sees a partial file, and racing writers each
+    // leave a whole one.
+    LR_API bool writeFileAtomically(const std::string & path, const std::function<bool(FILE*)> & write);
+
+} // lab
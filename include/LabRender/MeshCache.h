@@ -0,0 +1,39 @@
+//
+//  MeshCache.h
+//  LabRender
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+#include <LabRender/Model.h>
+
+#include <memory>
+#include <string>
+
+namespace lab { namespace Render {
+
+    // A mesh cache file is a header, a table of parts, and then each part's
+    // vertex layout, material name, vertices and 32 bit indices, aligned to
+    // 16 bytes. Cached models draw their vertices straight from the mapped
+    // file. The header records the source file's size and modification time,
+    // so entries rebuild when the mesh changes; changes to files it refers
+    // to, such as OBJ material libraries, aren't noticed.
+
+    // The cache lives in $LABRENDER_MESH_CACHE, or LabRender/meshes in the
+    // temp directory. An empty directory turns caching off.
+    LR_API void setMeshCacheDirectory(const std::string & dir);
+    LR_API std::string meshCacheDirectory();
+
+    // the cache file for a mesh, named for a hash of its path
+    LR_API std::string meshCachePath(const std::string & meshPath);
+
+    // Returns the model cached for a mesh file, or null if the entry is
+    // missing or stale.
+    LR_API std::shared_ptr<Model> loadMeshCache(const std::string & meshPath);
+
+    // Writes a model as the cache entry for a mesh file. Every part must be
+    // a ModelPart with indexed vertices.
+    LR_API bool writeMeshCache(const std::string & meshPath, const Model &);
+
+}} // lab::Render
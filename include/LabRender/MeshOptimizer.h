@@ -0,0 +1,38 @@
+//
+//  MeshOptimizer.h
+//  LabRender
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lab { namespace Render {
+
+    // Builds an index buffer for a triangle list of unindexed vertices,
+    // merging vertices whose bytes are identical. The unique vertices are
+    // compacted to the front of the array in order of first appearance, and
+    // indices receives one index per input vertex. Returns the unique count.
+    LR_API size_t indexVertices(void* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indices);
+
+    // Reorders the triangles of an index buffer in place so that consecutive
+    // triangles share vertices, after Forsyth's "Linear-Speed Vertex Cache
+    // Optimisation", which keeps the post-transform cache warm whatever its size.
+    LR_API void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+    // Reorders vertices into the order the indices first use them, so that
+    // vertex fetch walks memory forwards, and remaps the indices to match.
+    // Unreferenced vertices are dropped. Returns the new vertex count.
+    LR_API size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize,
+                                      uint32_t* indices, size_t indexCount);
+
+    // The average number of vertices transformed per triangle by a FIFO
+    // post-transform cache of the given size; 0.5 is ideal for large regular
+    // meshes, 3 is a cache that never hits.
+    LR_API float averageCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                       int cacheSize = 16);
+
+}} // lab::Render
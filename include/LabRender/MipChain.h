@@ -0,0 +1,57 @@
+//
+//  MipChain.h
+//  LabRender
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+#include <LabRenderTypes/Texture.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace lab { namespace Render {
+
+    enum class MipFilter { box, kaiser };
+
+    // Every level of a mip chain, level 0 first, each tightly packed in the
+    // chain's texel format.
+    struct MipChain
+    {
+        struct Level
+        {
+            int width = 0;
+            int height = 0;
+            size_t offset = 0;
+            size_t size = 0;
+        };
+
+        TextureType type = TextureType::none;
+        std::vector<Level> levels;
+        std::vector<uint8_t> data;
+
+        const uint8_t* pixels(size_t level) const { return data.data() + levels[level].offset; }
+    };
+
+    // bytes in one texel of the type, or zero for none and unknown values
+    LR_API size_t textureTexelBytes(TextureType);
+
+    // levels from w x h down to 1 x 1, each dimension halving and rounding down
+    LR_API int mipLevelCount(int w, int h);
+
+    // Builds the chain below level 0, each level filtered from the one above
+    // at float precision, with row bands filtered in parallel. In the sRGB
+    // colour space the first three channels of u8x3 and u8x4 are filtered in
+    // linear space; every other channel is filtered as stored. Colour of the
+    // four channel types other than s8x4 is filtered premultiplied by alpha.
+    // Returns an empty chain for TextureType::none.
+    LR_API MipChain generateMipChain(TextureType, int w, int h, const void* pixels,
+                                     MipFilter filter = MipFilter::box,
+                                     ColorSpace colorSpace = ColorSpace::srgb);
+
+    LR_API uint16_t floatToHalf(float);
+    LR_API float halfToFloat(uint16_t);
+
+}} // lab::Render
@@ -33,6 +33,7 @@ namespace lab { namespace Render {
 		LR_API void setVAO(std::unique_ptr<VAO>, Bounds localBounds);
 
 		LR_API void setShaderType(ShaderType st) { _shaderType = st; }
+		LR_API ShaderType shaderType() const { return _shaderType; }
 
 		LR_API virtual void update(double time) override {}
 
@@ -46,11 +47,21 @@ namespace lab { namespace Render {
             const FrameBuffer& fbo, const std::vector<std::string>& output_attachments,
             Renderer::RenderLock &) override;
 
+        // draws instances copies, transformed by consecutive ObjectUniforms
+        // already streamed at the context's objectUniformOffset
+		LR_API void drawInstances(
+            const FrameBuffer& fbo, const std::vector<std::string>& output_attachments,
+            Renderer::RenderLock &, int instances);
+
 		LR_API VAO * verts() const { return _verts.get(); }
 
 		LR_API void setShader(std::shared_ptr<Shader> shader) { _shader = shader; }
 		LR_API std::shared_ptr<Shader> shader() const { return _shader; }
 
+        // false if the part's shader reads transforms as loose uniforms, as
+        // fragment stages do, since instances can't vary those
+        LR_API bool instanceable() const;
+
 		LR_API static char const*const defaultShaderSourceId() { return "default"; }
 
         // passing in nullptr for vshSrc or fshSrc will cause the corresponding shader to be auto generated
@@ -63,11 +74,18 @@ namespace lab { namespace Render {
             return _localBounds;
         }
 
+        LR_API virtual void objectUniforms(const ViewMatrices &, ObjectUniforms &) const override;
+
     protected:
+        // replaces VertPackedPTNC vertices with VertPTNC, for shaders that
+        // read them as floats; false if the vertices aren't packed
+        LR_API bool unpackVertices();
+
         ShaderType              _shaderType;
         std::shared_ptr<Shader> _shader;
         std::unique_ptr<VAO>    _verts;
         Bounds                  _localBounds;
+        bool                    _quantizedPositions = false;   // snorm positions within _localBounds
     };
 
     class Model 
@@ -9,6 +9,8 @@
 #pragma once
 
 #include "LabRender/Renderer.h"
+#include "LabRender/UniformBlocks.h"
+#include "LabRender/ViewMatrices.h"
 #include <memory>
 
 namespace lab { namespace Render {
@@ -25,8 +27,12 @@ namespace lab { namespace Render {
             const FrameBuffer& fbo, const std::vector<std::string>& output_attachments, 
             Renderer::RenderLock &) = 0;
         virtual Bounds localBounds() const = 0;
+
+        // the per object uniform block for a draw with the given matrices
+        LR_API virtual void objectUniforms(const ViewMatrices &, ObjectUniforms &) const;
         
         std::shared_ptr<Material> material;
+        std::string materialName;   // the material the source file bound to this object
     };
 
 }}
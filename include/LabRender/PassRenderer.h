@@ -33,6 +33,12 @@ namespace lab { namespace Render {
 			int _passNumber;
 			std::shared_ptr<Shader> _shader;
             std::shared_ptr<ModelPart> _fullScreenQuadMesh;
+            std::vector<ViewMatrices> _objectMatrices;
+            std::vector<ObjectUniforms> _objectBlocks;
+            std::vector<DrawBatchKey> _batchKeys;
+            std::vector<size_t> _batchOrder;
+            std::vector<DrawBatch> _batches;
+            std::vector<int> _batchUniformOffsets;
 
 		public:
 
@@ -56,6 +62,9 @@ namespace lab { namespace Render {
             std::vector<std::pair<std::string, std::string>> readAttachments;
 
             DepthTest depthTest = DepthTest::less;
+
+            // may be changed after configure; the schedule is recompiled
+            // on the next render
             bool active = true;
             bool writeDepth = true;
             bool clearDepthBuffer = false;
@@ -65,14 +74,27 @@ namespace lab { namespace Render {
 
             std::function<void()> renderPlug;
 
+            // deferred meshes submitted by the last run, before and after batching
+            DrawBatchReport batchReport;
+
             void prepareFullScreenQuadAndShader(const FramebufferSet&);
         };
 
         LR_API PassRenderer();
         LR_API virtual ~PassRenderer();
 
+        // Reads a pipeline and compiles its schedule. The GLSL of every
+        // labfx shader is generated here, culled passes' included; a quad
+        // pass's program is compiled when the pass first runs, so passes
+        // the schedule culls never compile one.
         LR_API void configure(char const*const path);
 
+        // configure loads its textures in the background, bound as placeholders
+        // until they arrive. Blocks until they have all loaded, and returns false
+        // if any failed. Call on the render thread, for instance before
+        // capturing frames that must not show placeholders.
+        LR_API bool waitForTextures();
+
         LR_API std::shared_ptr<Render::Texture> texture(const std::string & name) override;
 
         LR_API std::shared_ptr<FrameBuffer> framebuffer(const std::string & name);
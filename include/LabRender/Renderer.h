@@ -22,6 +22,7 @@
 namespace lab { namespace Render {
 
 class DrawList;
+class UniformStream;
 
 /**
     To render a frame, create a RenderLock.
@@ -42,7 +43,8 @@ public:
     class RenderContext;
 
     Renderer() = default;
-    virtual ~Renderer() = default;
+    // texture streams mustn't enqueue commands on a destroyed renderer
+    virtual ~Renderer() { cancelTextureStreams(*this); }
 
     virtual std::shared_ptr<Render::Texture> texture(const std::string & name) = 0;
     virtual void render(RenderLock & rl, v2i fbSize, DrawList &) = 0;
@@ -73,6 +75,17 @@ public:
 			int32_t rootFramebuffer = 0;
 			double renderTime = 0;
 			std::unordered_map<std::string, std::shared_ptr<Render::Texture>> boundTextures;
+
+			// per object uniform blocks, and the offset of the current draw's
+			// block within the stream, or -1 if it has not been streamed yet.
+			// A renderer sets the stream only while it renders.
+			UniformStream* objectUniforms = nullptr;
+			int objectUniformOffset = -1;
+
+			// indices of the drawList's deferredMeshes to draw, in draw
+			// order, after sorting and culling, or nullptr to draw them all
+			// as submitted
+			std::vector<uint32_t> const* visibleMeshes = nullptr;
 		};
 
 		RenderContext context;
@@ -86,17 +99,21 @@ public:
                 context.mousePosition = mousePosition;
                 context.renderTime = renderTime;
 
-                // run any queued commands
-                std::function<void(void)> run;
+                // run the commands queued before this frame; commands they
+                // enqueue run next frame, so a command can spread work over frames
+                std::vector<std::function<void(void)>> jobs;
                 do
                 {
                     auto run = dr->_jobs.pop_front();
                     if (!run.first)
                         break;
 
-                    run.second();
+                    jobs.emplace_back(std::move(run.second));
                 }
                 while (true);
+
+                for (auto & job : jobs)
+                    job();
             }
         }
 
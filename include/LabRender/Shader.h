@@ -23,9 +23,25 @@ namespace lab { namespace Render {
         std::vector<Uniform> automatics;
         std::vector<Uniform> sampledTextures;
 
+        // a program is pending from linkAsync until poll sees the driver finish
+        enum class Status { pending, ready, failed };
+
         uint32_t id = 0;
+        Status status = Status::pending;
         ErrorPolicy errorPolicy;
         std::vector<unsigned int> stages;
+        std::vector<std::string> stageSources; // for error reports, until the link completes
+        std::vector<int> locations; // indexed by UniformHandle, -1 if not an active uniform
+
+        // GL uniform traffic, for profiling; counted from any thread.
+        // resetStats returns the counts since the last reset.
+        struct Stats
+        {
+            size_t locationQueries = 0;
+            size_t uniformUpdates = 0;
+        };
+        static Stats stats();
+        static Stats resetStats();
 
         Shader(ErrorPolicy ep = ErrorPolicy::onErrorThrow) : id(), errorPolicy(ep) {}
         ~Shader();
@@ -34,12 +50,39 @@ namespace lab { namespace Render {
 
         Shader & shader(const std::string & name, ProgramType type, bool autoPreamble, char const*const source);
 
+        // links the stages, and resolves the locations of all active uniforms
         void link();
+
+        // Starts linking without waiting for the driver. With
+        // GL_KHR_parallel_shader_compile the driver compiles in the
+        // background, and poll completes the link once it is done; otherwise
+        // poll waits for the driver.
+        void linkAsync();
+
+        // completes a pending link if the driver has finished, or if wait is
+        // set; returns true if the shader is ready. Errors are reported under
+        // the error policy unless report is unset, in which case they are
+        // kept for the next poll or reportLinkErrors, so that a link finished
+        // in the background doesn't throw out of the frame that polled it.
+        bool poll(bool wait = false, bool report = true);
+
+        // reports errors kept from a link completed without reporting
+        void reportLinkErrors();
+
+        // programs as returned by glGetProgramBinary; loading returns false
+        // if the driver rejects the binary, in which case the caller compiles
+        bool loadBinary(uint32_t format, const void* data, size_t size);
+        bool binary(uint32_t & format, std::vector<uint8_t> & data) const;
+
+        static bool parallelCompileSupported();
         void bind(Renderer::RenderLock & rl) const;
         void unbind() const;
 
         unsigned int attribute(const char *name) const;
         unsigned int uniform(const char *name) const;
+        int uniformLocation(UniformHandle h) const {
+            return h < locations.size() ? locations[h] : -1;
+        }
 
         void uniformInt(const char *name, int i) const;
         void uniformFloat(const char *name, float f) const;
@@ -48,6 +91,26 @@ namespace lab { namespace Render {
         void uniform(const char *name, const v4f &v) const;
 
         void uniform(const char *name, const m44f &m, bool transpose = false) const;
+
+        void uniformInt(UniformHandle, int i) const;
+        void uniformFloat(UniformHandle, float f) const;
+        void uniform(UniformHandle, const v2f &v) const;
+        void uniform(UniformHandle, const v3f &v) const;
+        void uniform(UniformHandle, const v4f &v) const;
+
+        void uniform(UniformHandle, const m44f &m, bool transpose = false) const;
+
+    private:
+        struct LinkError
+        {
+            int glErr;
+            std::string message;
+            std::string source;
+        };
+        std::vector<LinkError> _linkErrors;
+
+        void finishLink();
+        void resolveUniforms();
     };
 
 }}
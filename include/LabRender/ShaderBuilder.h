@@ -33,6 +33,29 @@ namespace lab { namespace Render {
             std::vector<std::pair<std::string, SemanticType>> varyings;
         };
 
+        // identifies a generated shader variant; see variantKey
+        typedef uint64_t ShaderKey;
+
+        // The source a variant was made from, if it wasn't generated. The
+        // text is referenced, not copied, so it must outlive the lookup.
+        struct VariantSource
+        {
+            VariantSource() : hash(0), vsh(nullptr), fsh(nullptr) {}
+            uint64_t hash;
+            char const* vsh;
+            char const* fsh;
+        };
+        static VariantSource variantSource(char const*const vsh, char const*const fsh);
+
+        // Packs the attributes, shader type, deferred and texture flags of
+        // a variant, and part of its source hash, into a key. Since keys of
+        // different sources may collide, variant lookups also take the
+        // source, and the cache compares it in full.
+        static ShaderKey variantKey(uint32_t attributeMask, uint32_t shaderType,
+                                    bool deferred, bool textured, const VariantSource& source);
+
+        // Shaders by name, or by variant key. Lookups take no locks and
+        // don't allocate, so any thread may look up or add shaders.
         class Cache
 		{
         public:
@@ -42,7 +65,26 @@ namespace lab { namespace Render {
             void add(const std::string&, std::shared_ptr<Shader>);
             std::shared_ptr<Shader> shader(const std::string&) const;
 
+            bool hasShader(ShaderKey, const VariantSource& = VariantSource()) const;
+            void add(ShaderKey, std::shared_ptr<Shader>, const VariantSource& = VariantSource());
+            std::shared_ptr<Shader> shader(ShaderKey, const VariantSource& = VariantSource()) const;
+
+            // the state of a cached shader; failed if there is none
+            Shader::Status status(const std::string&) const;
+            Shader::Status status(ShaderKey, const VariantSource& = VariantSource()) const;
+
+            // completes the links of compiled programs without waiting on
+            // the driver, and stores the new programs' binaries; call once
+            // per frame
+            void update();
+
+            // Linked programs are stored in directory, keyed by a hash of
+            // their source and the driver, and later runs load them instead
+            // of compiling. An empty directory, the default, disables this.
+            void setProgramBinaryDirectory(const std::string & directory);
+
         private:
+            friend class ShaderBuilder;
             class Detail;
             std::unique_ptr<Detail> _detail;
         };
@@ -79,6 +121,15 @@ namespace lab { namespace Render {
         std::map<std::string, Semantic*> attributes;
         std::set<Semantic*> varyings;
         std::set<Semantic*> outputs;
+
+        // if set, makeShader returns shaders that are still compiling; they
+        // become ready in Shader::poll or Cache::update
+        bool compileAsync = false;
+
+        // if set, vertex shaders declare vec3 octahedralDecode(vec2), which
+        // unpacks a normal stored as an octahedral pair. setAttributes sets
+        // it for meshes whose a_normal is a vec2.
+        bool octahedralNormals = false;
     };
 
 }} // lab::Render
@@ -13,11 +13,15 @@
 #include <LabRender/SemanticType.h>
 #include <LabRender/TextureType.h>
 
+#include <future>
 #include <map>
 #include <vector>
 
 namespace lab { namespace Render {
 
+    class Renderer;
+    class TextureLevels;
+
     struct Texture
     {
         static size_t pixelByteSize(TextureType);
@@ -51,6 +55,10 @@ namespace lab { namespace Render {
         Texture & create(int w, int h, int depth, Render::TextureType resultType, int filter, int wrap,
                          Render::TextureType srcDataType, void *data);
 
+        // every level of the chain, with minFilter chosen from the mipmap filters.
+        // Levels are allocated but left unfilled if uploadPixels is false.
+        Texture & create(const TextureLevels &, int minFilter, int magFilter, int wrap, bool uploadPixels = true);
+
         // create a depth texture
         Texture & createDepth(int w, int h);
 
@@ -69,6 +77,8 @@ namespace lab { namespace Render {
         // type is the data type of the supplied pixel data, see ibid
         // todo should be Type srcDataType, not glType
         Texture & update(int xoffset, int yoffset, int width, int height, int format, int glType, void* data);
+        Texture & updateLevel(int level, int xoffset, int yoffset, int width, int height, int format, int glType, void* data);
+        Texture & updateCompressedLevel(int level, int width, int height, size_t size, void* data);
 
         // copy the texture data
         std::vector<uint8_t> get();
@@ -100,9 +110,13 @@ namespace lab { namespace Render {
 
     /// @TUDO should also have a cube texture provider
 
+    // File textures are loaded with a full mip chain, through the texture cache.
+    // 8 bit images are filtered in the given colour space.
+
     class FileTextureProvider : public TextureProvider {
     public:
-        FileTextureProvider(const std::string & path);
+        FileTextureProvider(const std::string & path, TextureFilter filter = TextureFilter::bilinear,
+                            ColorSpace colorSpace = ColorSpace::srgb);
         virtual ~FileTextureProvider() {}
         virtual std::shared_ptr<Texture> texture() const override { return _texture; }
 
@@ -110,6 +124,42 @@ namespace lab { namespace Render {
         std::shared_ptr<Texture> _texture;
     };
 
+    /// Loads an image file without blocking. texture() is a placeholder until
+    /// the image has been decoded and its mips built on a worker thread, and
+    /// streamed into the texture a band of rows per frame by commands enqueued
+    /// on the renderer.
+    /// Construct it on the render thread.
+
+    struct TextureStream;
+
+    class AsyncFileTextureProvider : public TextureProvider {
+    public:
+        LR_API AsyncFileTextureProvider(Renderer &, const std::string & path,
+                                        TextureFilter filter = TextureFilter::bilinear,
+                                        ColorSpace colorSpace = ColorSpace::srgb);
+        virtual ~AsyncFileTextureProvider() {}
+        virtual std::shared_ptr<Texture> texture() const override { return _texture; }
+
+        // true once the image is in the texture, false if it could not be loaded.
+        // The upload completes on the render thread, so don't block on it there.
+        LR_API std::shared_future<bool> ready() const;
+
+        // waits for the decode, then uploads whatever remains immediately,
+        // regardless of the upload budget. Call on the render thread.
+        LR_API bool finish();
+
+    private:
+        std::shared_ptr<Texture> _texture;
+        std::shared_ptr<TextureStream> _stream;
+    };
+
+    // bytes of streamed texture data uploaded per frame, 4MB by default
+    LR_API void setTextureUploadBudget(size_t bytes);
+
+    // abandons the renderer's streams not yet uploaded, whose ready() then
+    // reports false; Renderer's destructor calls it
+    LR_API void cancelTextureStreams(Renderer &);
+
     int glFormat(TextureType);
     int glInternalFormat(TextureType);
     int glType(TextureType);
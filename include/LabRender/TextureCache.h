@@ -0,0 +1,73 @@
+//
+//  TextureCache.h
+//  LabRender
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+#include <LabRender/MappedFile.h>
+#include <LabRender/MipChain.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lab { namespace Render {
+
+    // The mip levels of a texture in their final layout, either mapped from a
+    // texture cache file or held in memory.
+
+    class TextureLevels
+    {
+    public:
+        LR_API TextureLevels();
+        LR_API explicit TextureLevels(MipChain && chain);
+        LR_API ~TextureLevels();
+
+        TextureLevels(const TextureLevels &) = delete;
+        TextureLevels & operator=(const TextureLevels &) = delete;
+
+        TextureType type = TextureType::none;
+        unsigned int compressedFormat = 0; // a GL compressed internal format when the levels hold blocks
+        std::vector<MipChain::Level> levels;
+
+        const uint8_t* pixels(size_t level) const { return _data + levels[level].offset; }
+        bool mapped() const { return !!_mapping; }
+
+    private:
+        friend struct TextureCacheFile;
+
+        std::unique_ptr<MappedFile> _mapping;
+        std::vector<uint8_t> _owned;
+        const uint8_t* _data = nullptr;
+    };
+
+    // A cache file is a header, a table of levels, and then each level in the
+    // texture's final layout, aligned to 16 bytes, so it can be mapped and
+    // handed to GL as is. The header records the source image's size and
+    // modification time, so entries rebuild when the image changes.
+
+    // The cache lives in $LABRENDER_TEXTURE_CACHE, or LabRender/textures in
+    // the temp directory. An empty directory turns caching off.
+    LR_API void setTextureCacheDirectory(const std::string & dir);
+    LR_API std::string textureCacheDirectory();
+
+    // the cache file for an image, named for a hash of its path
+    LR_API std::string textureCachePath(const std::string & imagePath);
+
+    // Maps the cache entry for an image, first building it from the image if
+    // it is missing or stale. HDR images are cached as linear f16x4, others
+    // as u8x4 in the given colour space; pass linear for data such as normal
+    // maps. Without a cache directory the levels are built in memory.
+    // Returns null if the image can't be loaded.
+    LR_API std::unique_ptr<TextureLevels> loadTextureLevels(const std::string & imagePath,
+                                                            MipFilter filter = MipFilter::box,
+                                                            ColorSpace colorSpace = ColorSpace::srgb);
+
+    // Writes levels as the cache entry for an image, for example block
+    // compressed levels produced by an offline tool.
+    LR_API bool writeTextureCache(const std::string & imagePath, const TextureLevels &,
+                                  MipFilter filter, ColorSpace colorSpace = ColorSpace::srgb);
+
+}} // lab::Render
@@ -2,6 +2,7 @@
 
 #include <LabRender/LabRender.h>
 #include <LabRender/SemanticType.h>
+#include <stdint.h>
 #include <string>
 
 namespace lab { namespace Render {
@@ -15,24 +16,31 @@ namespace lab { namespace Render {
     };
 
     LR_API AutomaticUniform stringToAutomaticUniform(const std::string & s);
-    
+
+    // Uniform names are interned to small integers, so that a shader can find
+    // a uniform's location without hashing a string or querying GL.
+    typedef uint32_t UniformHandle;
+    LR_API UniformHandle uniformHandle(const char * name);
+    inline UniformHandle uniformHandle(const std::string & name) { return uniformHandle(name.c_str()); }
+
     class Uniform {
     public:
         Uniform(std::string name,
             Render::SemanticType type,
             AutomaticUniform automatic,
             std::string texture)
-            : name(name), type(type), automatic(automatic), texture(texture) {}
+            : name(name), handle(uniformHandle(name)), type(type), automatic(automatic), texture(texture) {}
 
         Uniform(const Uniform & rhs)
-            : name(rhs.name), type(rhs.type), automatic(rhs.automatic), texture(rhs.texture) {}
+            : name(rhs.name), handle(rhs.handle), type(rhs.type), automatic(rhs.automatic), texture(rhs.texture) {}
 
         Uniform & operator=(const Uniform & rhs) {
-            name = rhs.name; type = rhs.type; automatic = rhs.automatic; texture = rhs.texture;
+            name = rhs.name; handle = rhs.handle; type = rhs.type; automatic = rhs.automatic; texture = rhs.texture;
             return *this;
         }
 
         std::string name;
+        UniformHandle handle;
         std::string texture;
         Render::SemanticType type = Render::SemanticType::unknown_st;
         AutomaticUniform automatic = AutomaticUniform::none;
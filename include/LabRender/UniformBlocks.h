@@ -0,0 +1,90 @@
+//
+//  UniformBlocks.h
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#pragma once
+
+#include <LabRender/LabRender.h>
+#include <LabRender/Uniform.h>
+#include <LabMath/LabMath.h>
+
+#include <string>
+
+namespace lab { namespace Render {
+
+    // std140 uniform blocks shared by every shader made by ShaderBuilder.
+    // The layouts of these structs must match the declarations returned by
+    // uniformBlockDeclarations().
+
+    const unsigned int frameUniformBinding = 0;
+    const unsigned int objectUniformBinding = 1;
+
+    // the object block holds an array of ObjectUniforms indexed by
+    // gl_InstanceID, so that a batch of objects can be drawn instanced.
+    // 64 objects fill the smallest GL_MAX_UNIFORM_BLOCK_SIZE allowed.
+    const size_t maxObjectsPerDraw = 64;
+
+    // uploaded once per frame; block LabFrame, instance lab_frame
+    struct FrameUniforms
+    {
+        m44f view;
+        m44f projection;
+        m44f skyMatrix;
+        v2f resolution;
+        v2f mousePosition;
+        float renderTime;
+        float pad[3];
+    };
+
+    // streamed per draw; block LabObject, vertex stage only, and
+    // lab_object refers to the current instance's ObjectUniforms
+    struct ObjectUniforms
+    {
+        m44f model;
+        m44f modelView;
+        m44f modelViewProj;
+        m44f rotationTransform;
+    };
+
+    static_assert(sizeof(FrameUniforms) == 224, "FrameUniforms must match the std140 layout of LabFrame");
+    static_assert(sizeof(ObjectUniforms) == 256, "ObjectUniforms must match the std140 layout of LabObject");
+
+    LR_API char const* uniformBlockDeclarations(bool vertexStage);
+
+    // If a uniform is served by one of the blocks, returns the block member
+    // that provides it, otherwise nullptr. Automatic uniforms are matched by
+    // their AutomaticUniform, and the standard transforms by name. The object
+    // block serves only the vertex stage, so other stages declare the
+    // transforms as loose uniforms.
+    LR_API char const* uniformBlockMember(const std::string & name, AutomaticUniform, bool vertexStage = true);
+
+    // Per-frame streaming storage for uniform blocks. Blocks are appended on
+    // the CPU, uploaded in as few calls as possible, and bound by range. The
+    // buffer is orphaned at the start of each frame so that writing never
+    // waits on draws still reading the previous frame's blocks.
+    class UniformStream
+    {
+    public:
+        // range is the number of bytes bound at each offset
+        LR_API UniformStream(unsigned int binding, size_t range);
+        LR_API ~UniformStream();
+
+        LR_API void beginFrame();
+
+        // returns the offset of the copy of data within the stream
+        LR_API int push(void const* data, size_t size);
+
+        // sends everything pushed since the previous upload to the GPU
+        LR_API void upload();
+
+        LR_API void bind(int offset) const;
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+}} // lab::Render
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <LabRender/LabRender.h>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -22,5 +23,14 @@ namespace lab {
     LR_API std::vector<std::uint8_t> loadFile(char const*const path, bool errorIfNotFound = true);
     LR_API std::string expandPath(char const*const path);
 
+    // Calls fn(begin, end) over disjoint ranges covering [0, count), on as
+    // many threads as there are cores, but with at least minPerThread items
+    // per call. The ranges run on a pool of threads kept for the process,
+    // and on the calling thread. Small counts, calls nested in another
+    // parallelFor, and calls made while the pool is busy with another
+    // thread's loop run on the calling thread. The first exception thrown by
+    // fn is rethrown to the caller once every range has finished.
+    LR_API void parallelFor(size_t count, size_t minPerThread, const std::function<void(size_t, size_t)> & fn);
+
 
 } // lab
@@ -9,10 +9,13 @@
 
 #include <LabRender/LabRender.h>
 #include <LabRender/ErrorPolicy.h>
+#include <LabRender/GeometryPool.h>
 #include <LabRender/Semantic.h>
 #include <LabRender/SemanticType.h>
 #include <LabMath/LabMath.h>
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <ostream>
 #include <iostream>
@@ -37,13 +40,37 @@ namespace lab { namespace Render {
         unsigned int id = 0;
         BufferType bufferType = BufferType::VertexBuffer;
 
+        // How an attribute's components are stored. native stores them as
+        // the semantic type's own; the others are converted on fetch, and
+        // if normalized, integers map to [0, 1], or [-1, 1] when signed.
+        // i2_10_10_10 packs four components into 32 bits.
+        enum class ElementType : unsigned int {
+            native = 0, f16, i8, u8, i16, u16, i2_10_10_10
+        };
+
         struct Layout {
-            Layout(const std::string & name, SemanticType semanticType) : name(name), semanticType(semanticType) {}
-            Layout(const Layout & rhs) : name(rhs.name), semanticType(rhs.semanticType) {}
-            Layout & operator=(const Layout & rhs) { name = rhs.name; semanticType = rhs.semanticType; return * this; }
+            Layout(const std::string & name, SemanticType semanticType,
+                   ElementType elementType = ElementType::native, bool normalized = false)
+            : name(name), semanticType(semanticType), elementType(elementType), normalized(normalized) {}
+            Layout(const Layout & rhs)
+            : name(rhs.name), semanticType(rhs.semanticType), elementType(rhs.elementType), normalized(rhs.normalized) {}
+            Layout & operator=(const Layout & rhs) {
+                name = rhs.name; semanticType = rhs.semanticType;
+                elementType = rhs.elementType; normalized = rhs.normalized; return * this; }
+
+            // bytes the attribute occupies in a vertex
+            LR_API int size() const;
+
+            // the GL type of the stored components
+            LR_API int openGLElementType() const;
+
+            // true for integers mapped to [-1, 1] or [0, 1]
+            bool quantized() const { return normalized && elementType != ElementType::native && elementType != ElementType::f16; }
 
             std::string name;
             SemanticType semanticType;
+            ElementType elementType;
+            bool normalized;
         };
 
         std::vector<Layout> layout;
@@ -74,6 +101,9 @@ namespace lab { namespace Render {
 
         void push_back(T d) { _data.push_back(d); }
 
+        template <typename Iter>
+        void assign(Iter first, Iter last) { _data.assign(first, last); }
+
         T & elementAt(size_t i) {
             if (_data.size() > i)
                 return _data[i];
@@ -126,6 +156,9 @@ namespace lab { namespace Render {
         std::shared_ptr<BufferBase> _vertices;   // vbo
         std::shared_ptr<IndexBuffer> _indices;   // ibo
 
+        std::shared_ptr<GeometryPool> _pool;     // if set, the vbo and ibo are copied into the pool
+        GeometryRange _range;
+
     public:
 
         /// @TODO provide accessors for these two
@@ -143,6 +176,14 @@ namespace lab { namespace Render {
 
 		LR_API bool hasAttribute(char const*const name) const;
 
+        std::shared_ptr<BufferBase> vertexBuffer() const { return _vertices; }
+        std::shared_ptr<IndexBuffer> indexBuffer() const { return _indices; }
+
+        // VAOs made while GeometryPool has a default pool upload to it, and
+        // VAOs with the same key draw one after another without rebinding
+        std::shared_ptr<GeometryPool> geometryPool() const { return _pool; }
+		LR_API void const* vertexArrayKey() const;
+
         // Create a vertex array object referencing a shader and a vertex buffer.
         // The vertex buffer is used to determine the number of elements to
         // draw in draw() and drawInstanced().
@@ -164,6 +205,9 @@ namespace lab { namespace Render {
 
 		LR_API VAO & attribute(const char *name, SemanticType t, int location, bool normalized = false);
 
+        // Define an attribute stored as the layout describes
+		LR_API VAO & attribute(const BufferBase::Layout &, int location);
+
         // Validate VBO modes and attribute byte sizes
 		LR_API void check() const;
 
@@ -307,6 +351,7 @@ namespace lab { namespace Render {
         float uv[2];
     };
     struct VertPTNC {
+        VertPTNC() = default;
         VertPTNC(v3f pos_, v2f uv_, v3f normal_, v4f color_) {
             pos[0] = pos_.x; pos[1] = pos_.y; pos[2] = pos_.z;
             uv[0] = uv_.x; uv[1] = uv_.y;
@@ -328,4 +373,87 @@ namespace lab { namespace Render {
         float color[4];
     };
 
+    // VertPackedPTNC holds a VertPTNC in 20 bytes instead of 48. Positions
+    // are snorm16 within the part's bounds, which ModelPart folds into the
+    // object's transforms. Normals are octahedral snorm16 pairs decoded by
+    // the generated vertex shader. uvs must lie in [0, 1]. Parts drawn with
+    // a material's own vertex shader are unpacked to VertPTNC first, since
+    // such shaders read a_position and a_normal as vec3.
+
+    struct VertPackedPTNC {
+        VertPackedPTNC() = default;
+        VertPackedPTNC(const VertPTNC & v, const float boundsMin[3], const float boundsMax[3]) {
+            for (int i = 0; i < 3; ++i) {
+                float half = 0.5f * (boundsMax[i] - boundsMin[i]);
+                float center = 0.5f * (boundsMax[i] + boundsMin[i]);
+                pos[i] = snorm16(half > 0 ? (v.pos[i] - center) / half : 0.f);
+            }
+            pos[3] = 0;
+            uv[0] = unorm16(v.uv[0]);
+            uv[1] = unorm16(v.uv[1]);
+
+            // project onto the octahedron, folding the lower half over
+            float n[3] = { v.normal[0], v.normal[1], v.normal[2] };
+            float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+            float ox = l1 > 0 ? n[0] / l1 : 0.f;
+            float oy = l1 > 0 ? n[1] / l1 : 0.f;
+            if (n[2] < 0) {
+                float fx = (1.f - fabsf(oy)) * (ox >= 0 ? 1.f : -1.f);
+                float fy = (1.f - fabsf(ox)) * (oy >= 0 ? 1.f : -1.f);
+                ox = fx; oy = fy;
+            }
+            normal[0] = snorm16(ox);
+            normal[1] = snorm16(oy);
+
+            for (int i = 0; i < 4; ++i)
+                color[i] = uint8_t(std::min(std::max(v.color[i], 0.f), 1.f) * 255.f + 0.5f);
+        }
+        // the VertPTNC this was packed from, to within the packing's precision
+        VertPTNC unpack(const float boundsMin[3], const float boundsMax[3]) const {
+            VertPTNC v;
+            for (int i = 0; i < 3; ++i) {
+                float half = 0.5f * (boundsMax[i] - boundsMin[i]);
+                float center = 0.5f * (boundsMax[i] + boundsMin[i]);
+                v.pos[i] = center + half * std::max(pos[i] / 32767.f, -1.f);
+            }
+            v.uv[0] = uv[0] / 65535.f;
+            v.uv[1] = uv[1] / 65535.f;
+
+            // unfold the lower half of the octahedron
+            float ox = std::max(normal[0] / 32767.f, -1.f);
+            float oy = std::max(normal[1] / 32767.f, -1.f);
+            float oz = 1.f - fabsf(ox) - fabsf(oy);
+            if (oz < 0) {
+                float fx = (1.f - fabsf(oy)) * (ox >= 0 ? 1.f : -1.f);
+                float fy = (1.f - fabsf(ox)) * (oy >= 0 ? 1.f : -1.f);
+                ox = fx; oy = fy;
+            }
+            float len = sqrtf(ox * ox + oy * oy + oz * oz);
+            v.normal[0] = len > 0 ? ox / len : 0.f;
+            v.normal[1] = len > 0 ? oy / len : 0.f;
+            v.normal[2] = len > 0 ? oz / len : 1.f;
+
+            for (int i = 0; i < 4; ++i)
+                v.color[i] = color[i] / 255.f;
+            return v;
+        }
+        static void describeLayout(std::vector<BufferBase::Layout> & layout) {
+            typedef BufferBase::ElementType ET;
+            layout.push_back(BufferBase::Layout("a_position", SemanticType::vec4_st, ET::i16, true));
+            layout.push_back(BufferBase::Layout("a_uv", SemanticType::vec2_st, ET::u16, true));
+            layout.push_back(BufferBase::Layout("a_normal", SemanticType::vec2_st, ET::i16, true));
+            layout.push_back(BufferBase::Layout("a_color", SemanticType::vec4_st, ET::u8, true));
+        }
+        static int16_t snorm16(float f) {
+            return int16_t(floorf(std::min(std::max(f, -1.f), 1.f) * 32767.f + 0.5f));
+        }
+        static uint16_t unorm16(float f) {
+            return uint16_t(std::min(std::max(f, 0.f), 1.f) * 65535.f + 0.5f);
+        }
+        int16_t pos[4];         // w is padding
+        uint16_t uv[2];
+        int16_t normal[2];
+        uint8_t color[4];
+    };
+
 }} // Lab::Render
@@ -11,6 +11,16 @@ namespace lab { namespace Render {
         u8x1,  u8x2,  u8x3,  u8x4,
         s8x1,  s8x2,  s8x3,  s8x4
     };
+
+    // how a mipmapped texture is sampled when minified
+    enum class TextureFilter {
+        nearest, bilinear, trilinear
+    };
+
+    // how the colour channels of an 8 bit texture are encoded
+    enum class ColorSpace {
+        srgb, linear
+    };
 }}
 
 #endif
@@ -0,0 +1,151 @@
+//
+//  Culling.cpp
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#include "LabRender/Culling.h"
+
+#include <math.h>
+
+#if defined(__AVX__)
+# include <immintrin.h>
+# define LR_CULL_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# include <xmmintrin.h>
+# define LR_CULL_SSE
+#endif
+
+namespace lab { namespace Render {
+
+namespace {
+
+    float element(const m44f & m, int column, int row)
+    {
+        const v4f & c = m[column];
+        switch (row)
+        {
+            case 0: return c.x;
+            case 1: return c.y;
+            case 2: return c.z;
+            default: return c.w;
+        }
+    }
+
+    bool boxVisible(const Frustum & f, const BoxSoA & b, size_t i)
+    {
+        for (int p = 0; p < 6; ++p)
+        {
+            const float* n = f.planes[p];
+            float d = n[0] * b.cx[i] + n[1] * b.cy[i] + n[2] * b.cz[i] + n[3];
+            float r = fabsf(n[0]) * b.ex[i] + fabsf(n[1]) * b.ey[i] + fabsf(n[2]) * b.ez[i];
+            if (d + r < 0.f)
+                return false;
+        }
+        return true;
+    }
+
+} // anon
+
+Frustum extractFrustum(const m44f & m)
+{
+    // Gribb & Hartmann; each plane is row 3 plus or minus row 0, 1, or 2
+    Frustum f;
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            f.planes[i * 2 + 0][c] = element(m, c, 3) + element(m, c, i);
+            f.planes[i * 2 + 1][c] = element(m, c, 3) - element(m, c, i);
+        }
+    }
+    return f;
+}
+
+void BoxSoA::resize(size_t count)
+{
+    cx.resize(count); cy.resize(count); cz.resize(count);
+    ex.resize(count); ey.resize(count); ez.resize(count);
+}
+
+void BoxSoA::set(size_t i, const Bounds & local, const m44f & m)
+{
+    float c[3] = { (local.first.x + local.second.x) * 0.5f,
+                   (local.first.y + local.second.y) * 0.5f,
+                   (local.first.z + local.second.z) * 0.5f };
+    float e[3] = { (local.second.x - local.first.x) * 0.5f,
+                   (local.second.y - local.first.y) * 0.5f,
+                   (local.second.z - local.first.z) * 0.5f };
+
+    // the center transforms as a point, and the extent by the absolute
+    // value of the upper 3x3
+    float wc[3], we[3];
+    for (int r = 0; r < 3; ++r)
+    {
+        wc[r] = element(m, 3, r);
+        we[r] = 0.f;
+        for (int k = 0; k < 3; ++k)
+        {
+            wc[r] += element(m, k, r) * c[k];
+            we[r] += fabsf(element(m, k, r)) * e[k];
+        }
+    }
+
+    cx[i] = wc[0]; cy[i] = wc[1]; cz[i] = wc[2];
+    ex[i] = we[0]; ey[i] = we[1]; ez[i] = we[2];
+}
+
+void cullBoxes(const Frustum & f, const BoxSoA & b, size_t begin, size_t end, uint8_t * visible)
+{
+    size_t i = begin;
+
+#if defined(LR_CULL_AVX)
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&b.cx[i]), cy = _mm256_loadu_ps(&b.cy[i]), cz = _mm256_loadu_ps(&b.cz[i]);
+        __m256 ex = _mm256_loadu_ps(&b.ex[i]), ey = _mm256_loadu_ps(&b.ey[i]), ez = _mm256_loadu_ps(&b.ez[i]);
+        __m256 outside = _mm256_setzero_ps();
+        for (int p = 0; p < 6; ++p)
+        {
+            const float* n = f.planes[p];
+            __m256 d = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(n[0]), cx), _mm256_mul_ps(_mm256_set1_ps(n[1]), cy)),
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(n[2]), cz), _mm256_set1_ps(n[3])));
+            __m256 r = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(fabsf(n[0])), ex), _mm256_mul_ps(_mm256_set1_ps(fabsf(n[1])), ey)),
+                _mm256_mul_ps(_mm256_set1_ps(fabsf(n[2])), ez));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        int mask = _mm256_movemask_ps(outside);
+        for (int k = 0; k < 8; ++k)
+            visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+    }
+#elif defined(LR_CULL_SSE)
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&b.cx[i]), cy = _mm_loadu_ps(&b.cy[i]), cz = _mm_loadu_ps(&b.cz[i]);
+        __m128 ex = _mm_loadu_ps(&b.ex[i]), ey = _mm_loadu_ps(&b.ey[i]), ez = _mm_loadu_ps(&b.ez[i]);
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; ++p)
+        {
+            const float* n = f.planes[p];
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(n[0]), cx), _mm_mul_ps(_mm_set1_ps(n[1]), cy)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(n[2]), cz), _mm_set1_ps(n[3])));
+            __m128 r = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(n[0])), ex), _mm_mul_ps(_mm_set1_ps(fabsf(n[1])), ey)),
+                _mm_mul_ps(_mm_set1_ps(fabsf(n[2])), ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(outside);
+        for (int k = 0; k < 4; ++k)
+            visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+    }
+#endif
+
+    for (; i < end; ++i)
+        visible[i] = boxVisible(f, b, i) ? 1 : 0;
+}
+
+}} // lab::Render
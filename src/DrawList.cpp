@@ -0,0 +1,234 @@
+//
+//  DrawList.cpp
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#include "LabRender/DrawList.h"
+#include "LabRender/Model.h"
+#include "LabRender/Utils.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <unordered_map>
+
+namespace lab { namespace Render {
+
+namespace {
+
+    bool keyEqual(const DrawBatchKey & a, const DrawBatchKey & b)
+    {
+        return a.vao == b.vao && a.shader == b.shader && a.material == b.material;
+    }
+
+    struct KeyHash
+    {
+        size_t operator()(const DrawBatchKey & k) const
+        {
+            std::hash<void const*> h;
+            size_t r = h(k.vao);
+            r ^= h(k.shader) + 0x9e3779b97f4a7c15ull + (r << 6) + (r >> 2);
+            r ^= h(k.material) + 0x9e3779b97f4a7c15ull + (r << 6) + (r >> 2);
+            return r;
+        }
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const DrawBatchKey & a, const DrawBatchKey & b) const { return keyEqual(a, b); }
+    };
+
+    // dense ids in order of first appearance, in a map kept between frames
+    class IdMap
+    {
+    public:
+        explicit IdMap(std::unordered_map<void const*, uint32_t> & ids) : _ids(ids) { _ids.clear(); }
+
+        uint32_t id(void const* p)
+        {
+            if (!p)
+                return 0;
+            auto i = _ids.find(p);
+            if (i != _ids.end())
+                return i->second;
+            uint32_t id = static_cast<uint32_t>(_ids.size()) + 1;
+            _ids[p] = id;
+            return id;
+        }
+
+    private:
+        std::unordered_map<void const*, uint32_t> & _ids;
+    };
+
+}
+
+void DrawList::sortMeshes()
+{
+    const size_t count = deferredMeshes.size();
+    _drawOrder.resize(count);
+    if (count < 2)
+    {
+        if (count)
+            _drawOrder[0] = 0;
+        return;
+    }
+
+    IdMap shaders(_shaderIds), materials(_materialIds), vertices(_vertexIds);
+    _sortDepths.resize(count);
+    float nearest = FLT_MAX;
+    float farthest = -FLT_MAX;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Bounds bounds = deferredMeshes[i].second->localBounds();
+        v3f c = { (bounds.first.x + bounds.second.x) * 0.5f,
+                  (bounds.first.y + bounds.second.y) * 0.5f,
+                  (bounds.first.z + bounds.second.z) * 0.5f };
+
+        // view space z of the center; the camera looks down -z
+        m44f mv = matrix_multiply(view, deferredMeshes[i].first);
+        float z = mv[0].z * c.x + mv[1].z * c.y + mv[2].z * c.z + mv[3].z;
+        _sortDepths[i] = -z;
+        nearest = std::min(nearest, -z);
+        farthest = std::max(farthest, -z);
+    }
+    float range = farthest > nearest ? farthest - nearest : 1.f;
+
+    _sortItems.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        ModelBase* mesh = deferredMeshes[i].second.get();
+        uint32_t pass = 0, shader = 0, verts = 0;
+        if (ModelPart* part = dynamic_cast<ModelPart*>(mesh))
+        {
+            pass = part->shaderType() == ModelPart::ShaderType::skyShader ? 1 : 0;
+            shader = shaders.id(part->shader().get());
+            verts = part->verts() ? vertices.id(part->verts()->vertexArrayKey()) : 0;
+        }
+        uint32_t material = materials.id(mesh->material.get());
+        _sortItems[i].key = drawSortKey(pass, shader, material, verts, (_sortDepths[i] - nearest) / range);
+        _sortItems[i].index = static_cast<uint32_t>(i);
+    }
+
+    radixSortDraws(_sortItems, _sortScratch);
+
+    for (size_t i = 0; i < count; ++i)
+        _drawOrder[i] = _sortItems[i].index;
+}
+
+size_t DrawList::cullMeshes(std::vector<uint32_t> & visible, const std::vector<uint32_t> * order)
+{
+    const size_t count = deferredMeshes.size();
+    Frustum frustum = extractFrustum(matrix_multiply(proj, view));
+
+    _cullBoxes.resize(count);
+    _cullVisible.resize(count);
+    parallelFor(count, 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            _cullBoxes.set(i, deferredMeshes[i].second->localBounds(), deferredMeshes[i].first);
+
+        cullBoxes(frustum, _cullBoxes, begin, end, _cullVisible.data());
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (_cullVisible[i])
+                continue;
+
+            ModelBase* mesh = deferredMeshes[i].second.get();
+            Bounds bounds = mesh->localBounds();
+            ModelPart* part = dynamic_cast<ModelPart*>(mesh);
+            if ((part && part->shaderType() == ModelPart::ShaderType::skyShader) ||
+                bounds.first.x > bounds.second.x)
+            {
+                _cullVisible[i] = 1;
+            }
+        }
+    });
+
+    visible.clear();
+    if (order)
+    {
+        for (uint32_t i : *order)
+            if (_cullVisible[i])
+                visible.push_back(i);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+            if (_cullVisible[i])
+                visible.push_back(static_cast<uint32_t>(i));
+    }
+
+    return count - visible.size();
+}
+
+DrawBatchReport batchDraws(const std::vector<DrawBatchKey> & keys, size_t maxInstances,
+                           std::vector<size_t> & order, std::vector<DrawBatch> & batches,
+                           bool presorted)
+{
+    DrawBatchReport report;
+    report.drawsIn = keys.size();
+
+    order.resize(keys.size());
+    if (presorted)
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+            order[i] = i;
+    }
+    else
+    {
+        // groups are numbered by first appearance, rather than ordered by
+        // address, so the order is the same from run to run; a counting
+        // sort on the group keeps submission order within each
+        thread_local std::unordered_map<DrawBatchKey, uint32_t, KeyHash, KeyEqual> groupIds;
+        thread_local std::vector<uint32_t> groups;
+        thread_local std::vector<size_t> starts;
+        groupIds.clear();
+        groups.resize(keys.size());
+        starts.clear();
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            uint32_t group = static_cast<uint32_t>(starts.size());
+            if (keys[i].vao)
+                group = groupIds.emplace(keys[i], group).first->second;
+            if (group == starts.size())
+                starts.push_back(0);
+            groups[i] = group;
+            ++starts[group];
+        }
+        size_t offset = 0;
+        for (auto & start : starts)
+        {
+            size_t count = start;
+            start = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < keys.size(); ++i)
+            order[starts[groups[i]]++] = i;
+    }
+
+    if (maxInstances < 1)
+        maxInstances = 1;
+
+    batches.clear();
+    for (size_t i = 0; i < order.size(); )
+    {
+        const DrawBatchKey & key = keys[order[i]];
+        size_t end = i + 1;
+        if (key.vao)
+            while (end < order.size() && end - i < maxInstances && keyEqual(key, keys[order[end]]))
+                ++end;
+
+        DrawBatch batch;
+        batch.first = i;
+        batch.count = end - i;
+        batches.push_back(batch);
+        i = end;
+    }
+
+    report.drawsOut = batches.size();
+    return report;
+}
+
+}} // lab::Render
@@ -0,0 +1,157 @@
+//
+//  DrawSort.cpp
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#include "LabRender/DrawSort.h"
+#include "LabRender/Utils.h"
+
+#include <algorithm>
+#include <string.h>
+#include <thread>
+
+namespace lab { namespace Render {
+
+namespace {
+
+    uint64_t field(uint32_t value, int bits)
+    {
+        return uint64_t(value) & ((uint64_t(1) << bits) - 1);
+    }
+
+}
+
+uint64_t drawSortKey(uint32_t pass, uint32_t shader, uint32_t material, uint32_t vertices, float depth)
+{
+    if (!(depth > 0.f))
+        depth = 0.f;
+    else if (depth > 1.f)
+        depth = 1.f;
+
+    const uint32_t depthMax = (uint32_t(1) << drawSortDepthBits) - 1;
+    uint64_t key = field(pass, drawSortPassBits);
+    key = (key << drawSortShaderBits) | field(shader, drawSortShaderBits);
+    key = (key << drawSortMaterialBits) | field(material, drawSortMaterialBits);
+    key = (key << drawSortVerticesBits) | field(vertices, drawSortVerticesBits);
+    key = (key << drawSortDepthBits) | uint64_t(depth * depthMax);
+    return key;
+}
+
+void radixSortDraws(std::vector<DrawSortItem> & items, std::vector<DrawSortItem> & scratch)
+{
+    const size_t count = items.size();
+    if (count < 2)
+        return;
+
+    // histogram every digit in a single read of the keys
+    size_t histogram[8][256];
+    memset(histogram, 0, sizeof(histogram));
+    for (const DrawSortItem & item : items)
+    {
+        uint64_t key = item.key;
+        for (int d = 0; d < 8; ++d)
+            ++histogram[d][(key >> (d * 8)) & 0xff];
+    }
+
+    scratch.resize(count);
+    DrawSortItem* src = items.data();
+    DrawSortItem* dst = scratch.data();
+    for (int d = 0; d < 8; ++d)
+    {
+        size_t* h = histogram[d];
+        const int shift = d * 8;
+        if (h[(src[0].key >> shift) & 0xff] == count)
+            continue;
+
+        size_t offset = 0;
+        for (int b = 0; b < 256; ++b)
+        {
+            size_t n = h[b];
+            h[b] = offset;
+            offset += n;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            dst[h[(src[i].key >> shift) & 0xff]++] = src[i];
+
+        DrawSortItem* t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != items.data())
+        items.swap(scratch);
+}
+
+void parallelRadixSortDraws(std::vector<DrawSortItem> & items, std::vector<DrawSortItem> & scratch)
+{
+    // below this many items per thread, starting the threads costs more than the sort
+    const size_t minPerChunk = 1 << 15;
+    const size_t count = items.size();
+    const size_t chunks = std::min<size_t>(std::max<size_t>(1, std::thread::hardware_concurrency()), count / minPerChunk);
+    if (chunks < 2)
+    {
+        radixSortDraws(items, scratch);
+        return;
+    }
+
+    const size_t chunkSize = (count + chunks - 1) / chunks;
+    std::vector<size_t> histograms(chunks * 256);
+
+    scratch.resize(count);
+    DrawSortItem* src = items.data();
+    DrawSortItem* dst = scratch.data();
+    for (int d = 0; d < 8; ++d)
+    {
+        const int shift = d * 8;
+
+        // items move between chunks every pass, so each pass histograms afresh
+        parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c)
+            {
+                size_t* h = &histograms[c * 256];
+                memset(h, 0, 256 * sizeof(size_t));
+                const size_t last = std::min(count, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < last; ++i)
+                    ++h[(src[i].key >> shift) & 0xff];
+            }
+        });
+
+        size_t first = 0;
+        for (size_t c = 0; c < chunks; ++c)
+            first += histograms[c * 256 + ((src[0].key >> shift) & 0xff)];
+        if (first == count)
+            continue;
+
+        // bucket major, chunk minor, so that equal digits keep their order
+        size_t offset = 0;
+        for (int b = 0; b < 256; ++b)
+            for (size_t c = 0; c < chunks; ++c)
+            {
+                size_t n = histograms[c * 256 + b];
+                histograms[c * 256 + b] = offset;
+                offset += n;
+            }
+
+        parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c)
+            {
+                size_t* h = &histograms[c * 256];
+                const size_t last = std::min(count, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < last; ++i)
+                    dst[h[(src[i].key >> shift) & 0xff]++] = src[i];
+            }
+        });
+
+        DrawSortItem* t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != items.data())
+        items.swap(scratch);
+}
+
+}} // lab::Render
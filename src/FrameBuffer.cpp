@@ -9,6 +9,7 @@
 #include "gl4.h"
 #include "LabRender/Texture.h"
 #include <iostream>
+#include <set>
 
 using namespace std;
 
@@ -38,6 +39,12 @@ namespace lab {
     }
 
     void FrameBuffer::createAttachments(const FrameBufferSpec& spec, int width, int height)
+    {
+        createAttachments(spec, width, height, {});
+    }
+
+    void FrameBuffer::createAttachments(const FrameBufferSpec& spec, int width, int height,
+                                        const std::vector<std::shared_ptr<Texture>>& storage)
     {
         textures.clear();
         if (!spec.attachments.size()) {
@@ -50,8 +57,13 @@ namespace lab {
         try {
             for (int i = 0; i < spec.attachments.size(); ++i)
             {
-                textures.emplace_back(std::make_shared<Texture>());
-                textures[i]->create(width, height, spec.attachments[i].type, GL_NEAREST, GL_CLAMP_TO_EDGE);
+                if (i < storage.size() && storage[i])
+                    textures.push_back(storage[i]);
+                else
+                {
+                    textures.emplace_back(std::make_shared<Texture>());
+                    textures[i]->create(width, height, spec.attachments[i].type, GL_NEAREST, GL_CLAMP_TO_EDGE);
+                }
                 attachColor(spec.attachments[i].base_name.c_str(),
                             spec.attachments[i].output_name.c_str(),
                             spec.attachments[i].uniform_name.c_str(),
@@ -236,6 +248,39 @@ namespace lab {
         _fbos[name] = std::make_pair(spec, std::make_shared<FrameBuffer>());
     }
 
+    void FramebufferSet::alias(const std::string& fbo, const std::string& attachment, int slot)
+    {
+        _aliases[{fbo, attachment}] = slot;
+        _width = _height = 0; // force reallocation
+    }
+
+    void FramebufferSet::clearAliases()
+    {
+        _aliases.clear();
+        _width = _height = 0;
+    }
+
+    size_t FramebufferSet::allocatedBytes() const
+    {
+        std::set<unsigned int> counted;
+        size_t bytes = 0;
+        for (auto& i : _fbos)
+        {
+            const FrameBuffer::FrameBufferSpec& spec = i.second.first;
+            const auto& textures = i.second.second->textures;
+            for (size_t j = 0; j < textures.size(); ++j)
+            {
+                const auto& t = textures[j];
+                if (!t || !counted.insert(t->id).second)
+                    continue;
+
+                size_t texel = t->depthTexture ? sizeof(float) : Texture::pixelByteSize(spec.attachments[j].type);
+                bytes += texel * t->width * t->height;
+            }
+        }
+        return bytes;
+    }
+
     bool FramebufferSet::setSize(int width, int height)
 	{
         if (_width == width && _height == height)
@@ -247,8 +292,29 @@ namespace lab {
         _width = width;
         _height = height;
 
+        std::map<int, std::shared_ptr<Texture>> slots;
         for (auto& i : _fbos)
-            i.second.second->createAttachments(i.second.first, width, height);
+        {
+            const FrameBuffer::FrameBufferSpec& spec = i.second.first;
+            std::vector<std::shared_ptr<Texture>> storage(spec.attachments.size());
+            std::vector<int> slot(spec.attachments.size(), -1);
+            for (size_t j = 0; j < spec.attachments.size(); ++j)
+            {
+                auto a = _aliases.find({i.first, spec.attachments[j].base_name});
+                if (a != _aliases.end())
+                {
+                    slot[j] = a->second;
+                    storage[j] = slots[a->second];
+                }
+            }
+
+            i.second.second->createAttachments(spec, width, height, storage);
+
+            // the first attachment on a slot creates the texture the rest will share
+            for (size_t j = 0; j < slot.size(); ++j)
+                if (slot[j] >= 0 && !slots[slot[j]] && j < i.second.second->textures.size())
+                    slots[slot[j]] = i.second.second->textures[j];
+        }
 
         return true;
     }
@@ -0,0 +1,320 @@
+//
+//  GeometryPool.cpp
+//  LabRender
+//
+
+#include "LabRender/GeometryPool.h"
+#include "LabRender/SemanticType.h"
+#include "LabRender/Vertex.h"
+#include "gl4.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace lab { namespace Render {
+
+namespace {
+
+    // the vertex array of the arena a pooled draw left bound, or zero
+    unsigned int boundArena = 0;
+
+    mutex defaultPoolMutex;
+    shared_ptr<GeometryPool> defaultGeometryPool;
+
+    // First fit allocation of ranges in [0, capacity). Freed ranges merge
+    // with free neighbours.
+    class RangeAllocator
+    {
+        map<size_t, size_t> _free;      // offset to length
+
+    public:
+        explicit RangeAllocator(size_t capacity)
+        {
+            if (capacity)
+                _free[0] = capacity;
+        }
+
+        bool allocate(size_t count, size_t & offset)
+        {
+            for (auto i = _free.begin(); i != _free.end(); ++i)
+            {
+                if (i->second < count)
+                    continue;
+                offset = i->first;
+                size_t rest = i->second - count;
+                _free.erase(i);
+                if (rest)
+                    _free[offset + count] = rest;
+                return true;
+            }
+            return false;
+        }
+
+        void free(size_t offset, size_t count)
+        {
+            if (!count)
+                return;
+
+            auto next = _free.lower_bound(offset);
+            if (next != _free.end() && offset + count == next->first)
+            {
+                count += next->second;
+                next = _free.erase(next);
+            }
+            if (next != _free.begin())
+            {
+                auto prev = std::prev(next);
+                if (prev->first + prev->second == offset)
+                {
+                    prev->second += count;
+                    return;
+                }
+            }
+            _free[offset] = count;
+        }
+    };
+
+    struct Arena
+    {
+        Arena(const string & key, int stride, size_t vertexCapacity, size_t indexCapacity)
+        : key(key), stride(stride), vertices(vertexCapacity), indices(indexCapacity) {}
+
+        string key;
+        int stride;
+        unsigned int vao = 0;
+        unsigned int vbo = 0;
+        unsigned int ibo = 0;
+        RangeAllocator vertices;    // in vertices
+        RangeAllocator indices;     // in indices
+
+        bool allocate(GeometryRange & range)
+        {
+            if (!vertices.allocate(range.vertexCount, range.firstVertex))
+                return false;
+            if (range.indexCount && !indices.allocate(range.indexCount, range.firstIndex))
+            {
+                vertices.free(range.firstVertex, range.vertexCount);
+                return false;
+            }
+            range.arena = this;
+            return true;
+        }
+    };
+
+    // arenas hold vertices of the same stride and attributes
+    string layoutKey(const BufferBase & vertices)
+    {
+        string key = to_string(vertices.stride());
+        for (auto & l : vertices.layout)
+        {
+            key += ';' + l.name + '/' + to_string(unsigned(l.semanticType)) + '/' +
+                   to_string(unsigned(l.elementType)) + (l.normalized ? "/n" : "");
+        }
+        return key;
+    }
+
+} // anon
+
+class GeometryPool::Detail
+{
+public:
+    size_t arenaVertexBytes;
+    size_t arenaIndexBytes;
+
+    mutable mutex lock;
+    vector<unique_ptr<Arena>> arenas;
+
+    void release(GeometryRange & range)
+    {
+        Arena* arena = const_cast<Arena*>(static_cast<Arena const*>(range.arena));
+        if (arena)
+        {
+            arena->vertices.free(range.firstVertex, range.vertexCount);
+            if (range.indexCount)
+                arena->indices.free(range.firstIndex, range.indexCount);
+        }
+        range = GeometryRange();
+    }
+
+    Arena* makeArena(const BufferBase & vertices, const string & key, const GeometryRange & range)
+    {
+        int stride = vertices.stride();
+        size_t vertexCapacity = max(arenaVertexBytes / stride, range.vertexCount);
+        size_t indexCapacity = max(arenaIndexBytes / sizeof(uint32_t), range.indexCount);
+        unique_ptr<Arena> arena(new Arena(key, stride, vertexCapacity, indexCapacity));
+
+        GeometryPool::unbind();
+        glGenVertexArrays(1, &arena->vao);
+        glGenBuffers(1, &arena->vbo);
+        glGenBuffers(1, &arena->ibo);
+
+        glBindVertexArray(arena->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertexCapacity * stride, nullptr, GL_STATIC_DRAW);
+
+        // attribute locations follow the layout, as for VAO
+        size_t offset = 0;
+        GLuint location = 0;
+        for (auto & l : vertices.layout)
+        {
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, semanticTypeElementCount(l.semanticType), l.openGLElementType(),
+                                  l.normalized, stride, (char *)NULL + offset);
+            offset += l.size();
+            ++location;
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->ibo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * sizeof(uint32_t), nullptr, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        arenas.push_back(std::move(arena));
+        return arenas.back().get();
+    }
+};
+
+GeometryPool::GeometryPool(size_t arenaVertexBytes, size_t arenaIndexBytes)
+: _detail(new Detail())
+{
+    _detail->arenaVertexBytes = arenaVertexBytes;
+    _detail->arenaIndexBytes = arenaIndexBytes;
+}
+
+GeometryPool::~GeometryPool()
+{
+    for (auto & arena : _detail->arenas)
+    {
+        if (boundArena == arena->vao)
+            unbind();
+        glDeleteVertexArrays(1, &arena->vao);
+        glDeleteBuffers(1, &arena->vbo);
+        glDeleteBuffers(1, &arena->ibo);
+    }
+    delete _detail;
+}
+
+bool GeometryPool::upload(const BufferBase & vertices, const BufferBase * indices, GeometryRange & range)
+{
+    size_t vertexCount = vertices.count();
+    size_t indexCount = indices ? indices->count() : 0;
+    if (!vertexCount || vertices.layout.empty() || vertices.stride() <= 0 ||
+        (indices && indices->stride() != sizeof(uint32_t)))
+        return false;
+
+    string key = layoutKey(vertices);
+    Arena* arena = nullptr;
+    {
+        lock_guard<mutex> lock(_detail->lock);
+        Arena const* current = static_cast<Arena const*>(range.arena);
+        if (current && current->key == key && range.vertexCount == vertexCount && range.indexCount == indexCount)
+            arena = const_cast<Arena*>(current);
+        else
+        {
+            _detail->release(range);
+            range.vertexCount = vertexCount;
+            range.indexCount = indexCount;
+            for (auto & a : _detail->arenas)
+            {
+                if (a->key == key && a->allocate(range))
+                {
+                    arena = a.get();
+                    break;
+                }
+            }
+            if (!arena)
+            {
+                arena = _detail->makeArena(vertices, key, range);
+                arena->allocate(range);
+            }
+        }
+    }
+
+    // the copy target leaves the bound vertex array's state alone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstVertex * arena->stride, vertexCount * arena->stride, vertices.buffer());
+    if (indexCount)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, arena->ibo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * sizeof(uint32_t), indexCount * sizeof(uint32_t), indices->buffer());
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return true;
+}
+
+void GeometryPool::release(GeometryRange & range)
+{
+    lock_guard<mutex> lock(_detail->lock);
+    _detail->release(range);
+}
+
+void GeometryPool::bind(const GeometryRange & range)
+{
+    Arena const* arena = static_cast<Arena const*>(range.arena);
+    if (arena && boundArena != arena->vao)
+    {
+        glBindVertexArray(arena->vao);
+        boundArena = arena->vao;
+    }
+}
+
+void GeometryPool::draw(const GeometryRange & range)
+{
+    if (!range.arena)
+        return;
+
+    bind(range);
+    if (range.indexCount)
+        glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei) range.indexCount, GL_UNSIGNED_INT,
+                                 (char *)NULL + range.firstIndex * sizeof(uint32_t), (GLint) range.firstVertex);
+    else
+        glDrawArrays(GL_TRIANGLES, (GLint) range.firstVertex, (GLsizei) range.vertexCount);
+}
+
+void GeometryPool::drawInstanced(const GeometryRange & range, int instances)
+{
+    if (!range.arena)
+        return;
+
+    bind(range);
+    if (range.indexCount)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei) range.indexCount, GL_UNSIGNED_INT,
+                                          (char *)NULL + range.firstIndex * sizeof(uint32_t), instances, (GLint) range.firstVertex);
+    else
+        glDrawArraysInstanced(GL_TRIANGLES, (GLint) range.firstVertex, (GLsizei) range.vertexCount, instances);
+}
+
+void GeometryPool::unbind()
+{
+    if (boundArena)
+    {
+        glBindVertexArray(0);
+        boundArena = 0;
+    }
+}
+
+size_t GeometryPool::arenaCount() const
+{
+    lock_guard<mutex> lock(_detail->lock);
+    return _detail->arenas.size();
+}
+
+void GeometryPool::setDefault(std::shared_ptr<GeometryPool> pool)
+{
+    lock_guard<mutex> lock(defaultPoolMutex);
+    defaultGeometryPool = pool;
+}
+
+std::shared_ptr<GeometryPool> GeometryPool::defaultPool()
+{
+    lock_guard<mutex> lock(defaultPoolMutex);
+    return defaultGeometryPool;
+}
+
+}} // lab::Render
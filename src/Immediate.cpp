@@ -1,5 +1,6 @@
 
 #include "LabRender/Immediate.h"
+#include "LabRender/DrawSort.h"
 #include "gl4.h"
 
 #define STBRP_ASSERT(x)    IMM_ASSERT(x)
@@ -14,10 +15,22 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# include <xmmintrin.h>
+# define IMM_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define IMM_SIMD_NEON
+#endif
+
 
 
 /*
@@ -66,6 +79,75 @@ inline v2f    ImmClamp(const v2f& f, const v2f& mn, v2f mx) { return v2f(ImmClam
 
 static inline int       ImmUpperPowerOfTwo(int v) { v--; v |= v >> 1; v |= v >> 2; v |= v >> 4; v |= v >> 8; v |= v >> 16; v++; return v; }
 
+// Four wide float math for the batch tessellators
+#if defined(IMM_SIMD_SSE)
+typedef __m128 ImmF4;
+inline ImmF4 ImmF4Load(const float* p) { return _mm_loadu_ps(p); }
+inline ImmF4 ImmF4Set(float v) { return _mm_set1_ps(v); }
+inline void  ImmF4Store(float* p, ImmF4 v) { _mm_storeu_ps(p, v); }
+inline ImmF4 ImmF4Add(ImmF4 a, ImmF4 b) { return _mm_add_ps(a, b); }
+inline ImmF4 ImmF4Sub(ImmF4 a, ImmF4 b) { return _mm_sub_ps(a, b); }
+inline ImmF4 ImmF4Mul(ImmF4 a, ImmF4 b) { return _mm_mul_ps(a, b); }
+inline ImmF4 ImmF4InvLength(ImmF4 x, ImmF4 y)
+{
+    // as ImmInvLength, with a fail value of 1
+    const ImmF4 one = _mm_set1_ps(1.0f);
+    ImmF4 d = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+    ImmF4 valid = _mm_cmpgt_ps(d, _mm_setzero_ps());
+    ImmF4 inv = _mm_div_ps(one, _mm_sqrt_ps(d));
+    return _mm_or_ps(_mm_and_ps(valid, inv), _mm_andnot_ps(valid, one));
+}
+#elif defined(IMM_SIMD_NEON)
+typedef float32x4_t ImmF4;
+inline ImmF4 ImmF4Load(const float* p) { return vld1q_f32(p); }
+inline ImmF4 ImmF4Set(float v) { return vdupq_n_f32(v); }
+inline void  ImmF4Store(float* p, ImmF4 v) { vst1q_f32(p, v); }
+inline ImmF4 ImmF4Add(ImmF4 a, ImmF4 b) { return vaddq_f32(a, b); }
+inline ImmF4 ImmF4Sub(ImmF4 a, ImmF4 b) { return vsubq_f32(a, b); }
+inline ImmF4 ImmF4Mul(ImmF4 a, ImmF4 b) { return vmulq_f32(a, b); }
+inline ImmF4 ImmF4InvLength(ImmF4 x, ImmF4 y)
+{
+    // as ImmInvLength, with a fail value of 1; the estimate is refined twice
+    ImmF4 d = vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y));
+    ImmF4 e = vrsqrteq_f32(d);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(d, e), e));
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(d, e), e));
+    return vbslq_f32(vcgtq_f32(d, vdupq_n_f32(0.0f)), e, vdupq_n_f32(1.0f));
+}
+#else
+struct ImmF4 { float v[4]; };
+inline ImmF4 ImmF4Load(const float* p) { ImmF4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+inline ImmF4 ImmF4Set(float v) { ImmF4 r; for (int i = 0; i < 4; ++i) r.v[i] = v; return r; }
+inline void  ImmF4Store(float* p, ImmF4 v) { for (int i = 0; i < 4; ++i) p[i] = v.v[i]; }
+inline ImmF4 ImmF4Add(ImmF4 a, ImmF4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+inline ImmF4 ImmF4Sub(ImmF4 a, ImmF4 b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+inline ImmF4 ImmF4Mul(ImmF4 a, ImmF4 b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+inline ImmF4 ImmF4InvLength(ImmF4 x, ImmF4 y)
+{
+    ImmF4 r;
+    for (int i = 0; i < 4; ++i) r.v[i] = ImmInvLength(v2f(x.v[i], y.v[i]), 1.0f);
+    return r;
+}
+#endif
+
+// Loads four lanes of each array starting at i, padding past count with zero
+struct ImmF4Lanes
+{
+    float pad[4][4];
+    int lanes;
+
+    ImmF4Lanes(int i, int count) : lanes(std::min(4, count - i)) {}
+
+    ImmF4 load(const float* p, int i, int slot)
+    {
+        if (lanes == 4)
+            return ImmF4Load(p + i);
+        for (int l = 0; l < 4; ++l)
+            pad[slot][l] = l < lanes ? p[i + l] : 0.0f;
+        return ImmF4Load(pad[slot]);
+    }
+};
+
 
 
 
@@ -73,6 +155,7 @@ struct GLBitsAndBobs
 {
     unsigned int vboHandle{ 0 };
     unsigned int elementsHandle{ 0 };
+    unsigned int vaoHandle{ 0 };
     int vertHandle{ 0 };
     int fragHandle{ 0 };
     int shaderHandle{ 0 };
@@ -83,9 +166,40 @@ struct GLBitsAndBobs
     int attribLocationColor{ 0 };
     unsigned int defaultTexture{ 0 };
 
+    // analytic shapes, one instanced quad each
+    unsigned int shapeHandle{ 0 };
+    unsigned int shapeVaoHandle{ 0 };
+    int shapeVertHandle{ 0 };
+    int shapeFragHandle{ 0 };
+    int shapeShaderHandle{ 0 };
+    int shapeLocationProjMtx{ 0 };
+
+    // sprites, one instanced quad each
+    unsigned int spriteHandle{ 0 };
+    unsigned int spriteVaoHandle{ 0 };
+    int spriteVertHandle{ 0 };
+    int spriteFragHandle{ 0 };
+    int spriteShaderHandle{ 0 };
+    int spriteLocationProjMtx{ 0 };
+    int spriteLocationTex{ 0 };
+
+    // Vertices and indices stream through rings of three segments. A frame
+    // writes one segment, unsynchronized, while the GPU may still be reading
+    // the other two; a fence per segment guards against lapping the GPU.
+    static constexpr int ringSegments = 3;
+    size_t vtxSegmentCapacity{ 0 };     // vertices per segment
+    size_t idxSegmentCapacity{ 0 };     // indices per segment
+    size_t shapeSegmentCapacity{ 0 };   // shapes per segment
+    size_t spriteSegmentCapacity{ 0 };  // sprites per segment
+    int ringSegment{ 0 };
+    GLsync ringFences[ringSegments]{};
+
     GLBitsAndBobs() {}
     ~GLBitsAndBobs()
     {
+        for (GLsync& fence : ringFences)
+            if (fence) glDeleteSync(fence);
+        if (vaoHandle) glDeleteVertexArrays(1, &vaoHandle);
         if (vboHandle) glDeleteBuffers(1, &vboHandle);
         if (elementsHandle) glDeleteBuffers(1, &elementsHandle);
         if (shaderHandle && vertHandle) glDetachShader(shaderHandle, vertHandle);
@@ -94,6 +208,20 @@ struct GLBitsAndBobs
         if (fragHandle) glDeleteShader(fragHandle);
         if (shaderHandle) glDeleteProgram(shaderHandle);
         if (defaultTexture) glDeleteTextures(1, &defaultTexture);
+        if (shapeVaoHandle) glDeleteVertexArrays(1, &shapeVaoHandle);
+        if (shapeHandle) glDeleteBuffers(1, &shapeHandle);
+        if (shapeShaderHandle && shapeVertHandle) glDetachShader(shapeShaderHandle, shapeVertHandle);
+        if (shapeVertHandle) glDeleteShader(shapeVertHandle);
+        if (shapeShaderHandle && shapeFragHandle) glDetachShader(shapeShaderHandle, shapeFragHandle);
+        if (shapeFragHandle) glDeleteShader(shapeFragHandle);
+        if (shapeShaderHandle) glDeleteProgram(shapeShaderHandle);
+        if (spriteVaoHandle) glDeleteVertexArrays(1, &spriteVaoHandle);
+        if (spriteHandle) glDeleteBuffers(1, &spriteHandle);
+        if (spriteShaderHandle && spriteVertHandle) glDetachShader(spriteShaderHandle, spriteVertHandle);
+        if (spriteVertHandle) glDeleteShader(spriteVertHandle);
+        if (spriteShaderHandle && spriteFragHandle) glDetachShader(spriteShaderHandle, spriteFragHandle);
+        if (spriteFragHandle) glDeleteShader(spriteFragHandle);
+        if (spriteShaderHandle) glDeleteProgram(spriteShaderHandle);
     }
 
     void init()
@@ -147,6 +275,9 @@ struct GLBitsAndBobs
 
         glGenBuffers(1, &vboHandle);
         glGenBuffers(1, &elementsHandle);
+        initVAO();
+        initShapes();
+        initSprites();
 
         // font texture
         // Build texture atlas
@@ -169,6 +300,22 @@ struct GLBitsAndBobs
         // Restore state
         glBindTexture(GL_TEXTURE_2D, last_texture);
     }
+
+    void initVAO();
+    void initShapes();
+    void initSprites();
+
+    // points the shape attributes at the shape_offset'th shape of the buffer
+    void bindShapes(size_t shape_offset);
+    void bindSprites(size_t sprite_offset);
+
+    // makes room for a frame's geometry in every segment, returning false if
+    // the rings had to be reallocated
+    bool reserveRing(size_t vtx_count, size_t idx_count, size_t shape_count, size_t sprite_count);
+
+    // waits, if necessary, until the GPU has finished with the next segment
+    int beginRingSegment();
+    void endRingSegment(int segment);
 };
 static GLBitsAndBobs gl;
 
@@ -194,7 +341,8 @@ typedef uint8_t ImmDrawListFlags;
 enum ImDmrawListFlags_
 {
     ImmDrawListFlags_AntiAliasedLines = 1 << 0,
-    ImmDrawListFlags_AntiAliasedFill = 1 << 1
+    ImmDrawListFlags_AntiAliasedFill = 1 << 1,
+    ImmDrawListFlags_AnalyticShapes = 1 << 2    // circles, rounded rects and lines become ImmDrawShapes
 };
 
 
@@ -228,10 +376,14 @@ typedef void(*ImmDrawCallback)(const ImmDrawList* parent_list, const ImmDrawCmd*
 struct ImmDrawCmd
 {
     unsigned int    ElemCount = 0;              // Number of indices (multiple of 3) to be rendered as triangles. Vertices are stored in the callee ImmDrawList's vtx_buffer[] array, indices in idx_buffer[].
+    unsigned int    ShapeCount = 0;             // Number of ImmDrawShapes to be rendered as instanced quads.
+    unsigned int    SpriteCount = 0;            // Number of ImmDrawSprites to be rendered as instanced quads. A command holds only one of triangles, shapes or sprites.
     v4f          ClipRect{ 0,0,0,0 };               // Clipping rectangle (x1, y1, x2, y2)
     ImmTextureId     TextureId{ 0 };              // User-provided texture ID.
     ImmDrawCallback  UserCallback{ nullptr };           // If != NULL, call the function instead of rendering the vertices. clip_rect and texture_id will be set normally.
     void*           UserCallbackData{ nullptr };       // The draw callback code can access this.
+
+    bool IsEmpty() const { return ElemCount == 0 && ShapeCount == 0 && SpriteCount == 0; }
 };
 
 // Vertex layout
@@ -242,6 +394,36 @@ struct ImmDrawVert
     uint32_t   col;
 };
 
+// A shape drawn as a single quad, with coverage computed in the fragment
+// shader from its signed distance. Boxes cover circles and rounded rects;
+// segments are boxes oriented along a line.
+enum ImmDrawShapeKind_
+{
+    ImmDrawShapeKind_Box = 0,
+    ImmDrawShapeKind_Segment = 1
+};
+
+struct ImmDrawShape
+{
+    v2f      a;         // box: centre; segment: first end
+    v2f      b;         // box: half size; segment: second end
+    v4f      radii;     // box: corner radii, clockwise from top left; segment: x is half the thickness
+    float    stroke;    // outline width centred on the edge, or zero if filled
+    float    kind;      // ImmDrawShapeKind_
+    uint32_t col;
+};
+
+// A sprite drawn as a single quad, expanded from this record in the vertex
+// shader. The quad is size, rotated by the angle whose sine and cosine are
+// given, and centred on pos; uv holds the atlas rect as min x, min y, max x, max y.
+struct ImmDrawSprite
+{
+    v2f      pos;
+    v2f      size;
+    float    sin, cos;
+    v4f      uv;
+};
+
 // Draw channels are used by the Columns API to "split" the render list into different channels while building, so items of each column can be batched together.
 // You can also use them to simulate drawing layers and submit primitives in a different order than how they will be rendered.
 struct ImmDrawChannel
@@ -263,6 +445,8 @@ struct ImmDrawList
     PodVector<ImmDrawCmd>     CmdBuffer;          // Draw commands. Typically 1 command = 1 GPU draw call, unless the command is a callback.
     PodVector<ImmDrawIdx>     IdxBuffer;          // Index buffer. Each command consume ImmDrawCmd::ElemCount of those
     PodVector<ImmDrawVert>    VtxBuffer;          // Vertex buffer.
+    PodVector<ImmDrawShape>   ShapeBuffer;        // Analytic shapes. Each command with a ShapeCount consumes that many of those; not supported with channels.
+    PodVector<ImmDrawSprite>  SpriteBuffer;       // Sprites. Each command with a SpriteCount consumes that many of those; not supported with channels.
 
                                                   // [Internal, used while building lists]
     ImmDrawListFlags         Flags;              // Flags, you may poke into these to adjust anti-aliasing settings per-primitive.
@@ -278,12 +462,20 @@ struct ImmDrawList
     int                     _ChannelsCount;     // [Internal] number of active channels (1+)
     PodVector<ImmDrawChannel> _Channels;          // [Internal] draw channels for columns API (not resized down so _ChannelsCount may be smaller than _Channels.Size)
 
+    // Primitives entirely outside the current clip rect are rejected before tessellation, and
+    // open polylines are trimmed to their visible runs. Counted since the last Clear().
+    unsigned int            CulledPrimitives;   // primitives rejected entirely
+    unsigned int            CulledVertices;     // vertices rejected primitives and trimmed runs would have emitted
+    PodVector<uint8_t>      _CullKeep;          // [Internal] visible batch elements
+    PodVector<float>        _CullScratch;       // [Internal] compacted batch arrays
+    PodVector<uint32_t>     _CullScratchCol;
+
 
 
                                                   // If you want to create ImmDrawList instances, pass them ImGui::GetDrawListSharedData() or create and use your own ImmDrawListSharedData (so you can use ImmDrawList without ImGui)
     ImmDrawList(const ImmDrawListSharedData* shared_data) { _Data = shared_data; _OwnerName = NULL; Clear(); }
     ~ImmDrawList() { ClearFreeMemory(); }
-    LR_API void  PushClipRect(v2f clip_rect_min, v2f clip_rect_max, bool intersect_with_current_clip_rect = false);  // Render-level scissoring. This is passed down to your render function but not used for CPU-side coarse clipping.
+    LR_API void  PushClipRect(v2f clip_rect_min, v2f clip_rect_max, bool intersect_with_current_clip_rect = false);  // Render-level scissoring. Primitives entirely outside the clip rect are also culled on the CPU.
     LR_API void  PushClipRectFullScreen();
     LR_API void  PopClipRect();
     LR_API void  PushTextureID(ImmTextureId texture_id);
@@ -308,9 +500,15 @@ struct ImmDrawList
     LR_API void  AddImageQuad(ImmTextureId user_texture_id, const v2f& a, const v2f& b, const v2f& c, const v2f& d, const v2f& uv_a = v2f(0, 0), const v2f& uv_b = v2f(1, 0), const v2f& uv_c = v2f(1, 1), const v2f& uv_d = v2f(0, 1), uint32_t col = 0xFFFFFFFF);
     LR_API void  AddImageRounded(ImmTextureId user_texture_id, const v2f& a, const v2f& b, const v2f& uv_a, const v2f& uv_b, uint32_t col, float rounding, int rounding_corners = ImmDrawCornerFlags_All);
     LR_API void  AddPolyline(const v2f* points, const int num_points, uint32_t col, bool closed, float thickness);
+    LR_API void  PolylineTessellate(const v2f* points, const int num_points, uint32_t col, bool closed, float thickness);    // AddPolyline without culling
     LR_API void  AddConvexPolyFilled(const v2f* points, const int num_points, uint32_t col);
     LR_API void  AddBezierCurve(const v2f& pos0, const v2f& cp0, const v2f& cp1, const v2f& pos1, uint32_t col, float thickness, int num_segments = 0);
 
+    // Batches, from arrays of attributes; tessellated four at a time into a single reservation
+    LR_API void  AddCirclesFilled(int count, const float* x, const float* y, const float* radius, const uint32_t* col, int num_segments = 12);
+    LR_API void  AddLines(int count, const float* x0, const float* y0, const float* x1, const float* y1, const uint32_t* col, float thickness = 1.0f);
+    LR_API void  AddRectsFilled(int count, const float* x0, const float* y0, const float* x1, const float* y1, const uint32_t* col);
+
     // Stateful path API, add points then finish with PathFill() or PathStroke()
     inline    void  PathClear() { _Path.resize(0); }
     inline    void  PathLineTo(const v2f& pos) { _Path.push_back(pos); }
@@ -337,7 +535,19 @@ struct ImmDrawList
                                                                              // NB: all primitives needs to be reserved via PrimReserve() beforehand!
     LR_API void  Clear();
     LR_API void  ClearFreeMemory();
+    LR_API bool  ClipOverlaps(const v2f& bmin, const v2f& bmax, float pad) const;
+    LR_API bool  CullRect(const v2f& bmin, const v2f& bmax, float pad, int vtx_count);   // true, and counted, if the bounds grown by pad miss the clip rect
+    LR_API bool  CullPoints(const v2f* points, int points_count, float pad, int vtx_count);
+    LR_API int   StrokeVtxCount(int points_count, bool closed, float thickness) const;
+    LR_API int   FillVtxCount(int points_count) const;
+    LR_API int   CompactBatch(int count, int vtx_per, const float** arrays, int array_count, const uint32_t*& col);
     LR_API void  PrimReserve(int idx_count, int vtx_count);
+    LR_API ImmDrawShape* ShapeReserve(int shape_count);
+    LR_API ImmDrawSprite* SpriteReserve(int sprite_count);
+    LR_API void  SpriteUnreserve(int sprite_count);   // gives back the unused end of the last reservation
+    LR_API void  ShapeBox(const v2f& centre, const v2f& half_size, const v4f& radii, float stroke, uint32_t col);
+    LR_API void  ShapeSegment(const v2f& a, const v2f& b, float thickness, uint32_t col);
+    LR_API v4f   ShapeRadii(const v2f& a, const v2f& b, float rounding, int rounding_corners);
     LR_API void  PrimRect(const v2f& a, const v2f& b, uint32_t col);      // Axis aligned rectangle (composed of two triangles)
     LR_API void  PrimRectUV(const v2f& a, const v2f& b, const v2f& uv_a, const v2f& uv_b, uint32_t col);
     LR_API void  PrimQuadUV(const v2f& a, const v2f& b, const v2f& c, const v2f& d, const v2f& uv_a, const v2f& uv_b, const v2f& uv_c, const v2f& uv_d, uint32_t col);
@@ -453,6 +663,8 @@ void ImmDrawList::Clear()
     CmdBuffer.resize(0);
     IdxBuffer.resize(0);
     VtxBuffer.resize(0);
+    ShapeBuffer.resize(0);
+    SpriteBuffer.resize(0);
     Flags = ImmDrawListFlags_AntiAliasedLines | ImmDrawListFlags_AntiAliasedFill;
     _VtxCurrentIdx = 0;
     _VtxWritePtr = NULL;
@@ -462,6 +674,8 @@ void ImmDrawList::Clear()
     _Path.resize(0);
     _ChannelsCurrent = 0;
     _ChannelsCount = 1;
+    CulledPrimitives = 0;
+    CulledVertices = 0;
     // NB: Do not clear channels so our allocations are re-used after the first frame.
 }
 
@@ -470,6 +684,8 @@ void ImmDrawList::ClearFreeMemory()
     CmdBuffer.clear();
     IdxBuffer.clear();
     VtxBuffer.clear();
+    ShapeBuffer.clear();
+    SpriteBuffer.clear();
     _VtxCurrentIdx = 0;
     _VtxWritePtr = NULL;
     _IdxWritePtr = NULL;
@@ -478,6 +694,11 @@ void ImmDrawList::ClearFreeMemory()
     _Path.clear();
     _ChannelsCurrent = 0;
     _ChannelsCount = 1;
+    CulledPrimitives = 0;
+    CulledVertices = 0;
+    _CullKeep.clear();
+    _CullScratch.clear();
+    _CullScratchCol.clear();
     for (int i = 0; i < _Channels.Size; i++)
     {
         if (i == 0) memset(&_Channels[0], 0, sizeof(_Channels[0]));  // channel 0 is a copy of CmdBuffer/IdxBuffer, don't destruct again
@@ -504,7 +725,7 @@ void ImmDrawList::AddDrawCmd()
 void ImmDrawList::AddCallback(ImmDrawCallback callback, void* callback_data)
 {
     ImmDrawCmd* current_cmd = CmdBuffer.Size ? &CmdBuffer.back() : NULL;
-    if (!current_cmd || current_cmd->ElemCount != 0 || current_cmd->UserCallback != NULL)
+    if (!current_cmd || !current_cmd->IsEmpty() || current_cmd->UserCallback != NULL)
     {
         AddDrawCmd();
         current_cmd = &CmdBuffer.back();
@@ -522,7 +743,7 @@ void ImmDrawList::UpdateClipRect()
     // If current command is used with different settings we need to add a new command
     const v4f curr_clip_rect = GetCurrentClipRect();
     ImmDrawCmd* curr_cmd = CmdBuffer.Size > 0 ? &CmdBuffer.Data[CmdBuffer.Size-1] : NULL;
-    if (!curr_cmd || (curr_cmd->ElemCount != 0 && memcmp(&curr_cmd->ClipRect, &curr_clip_rect, sizeof(v4f)) != 0) || curr_cmd->UserCallback != NULL)
+    if (!curr_cmd || (!curr_cmd->IsEmpty() && memcmp(&curr_cmd->ClipRect, &curr_clip_rect, sizeof(v4f)) != 0) || curr_cmd->UserCallback != NULL)
     {
         AddDrawCmd();
         return;
@@ -530,7 +751,7 @@ void ImmDrawList::UpdateClipRect()
 
     // Try to merge with previous command if it matches, else use current command
     ImmDrawCmd* prev_cmd = CmdBuffer.Size > 1 ? curr_cmd - 1 : NULL;
-    if (curr_cmd->ElemCount == 0 && prev_cmd && memcmp(&prev_cmd->ClipRect, &curr_clip_rect, sizeof(v4f)) == 0 && prev_cmd->TextureId == GetCurrentTextureId() && prev_cmd->UserCallback == NULL)
+    if (curr_cmd->IsEmpty() && prev_cmd && memcmp(&prev_cmd->ClipRect, &curr_clip_rect, sizeof(v4f)) == 0 && prev_cmd->TextureId == GetCurrentTextureId() && prev_cmd->UserCallback == NULL)
         CmdBuffer.pop_back();
     else
         curr_cmd->ClipRect = curr_clip_rect;
@@ -541,7 +762,7 @@ void ImmDrawList::UpdateTextureID()
     // If current command is used with different settings we need to add a new command
     const ImmTextureId curr_texture_id = GetCurrentTextureId();
     ImmDrawCmd* curr_cmd = CmdBuffer.Size ? &CmdBuffer.back() : NULL;
-    if (!curr_cmd || (curr_cmd->ElemCount != 0 && curr_cmd->TextureId != curr_texture_id) || curr_cmd->UserCallback != NULL)
+    if (!curr_cmd || (!curr_cmd->IsEmpty() && curr_cmd->TextureId != curr_texture_id) || curr_cmd->UserCallback != NULL)
     {
         AddDrawCmd();
         return;
@@ -549,16 +770,95 @@ void ImmDrawList::UpdateTextureID()
 
     // Try to merge with previous command if it matches, else use current command
     ImmDrawCmd* prev_cmd = CmdBuffer.Size > 1 ? curr_cmd - 1 : NULL;
-    if (curr_cmd->ElemCount == 0 && prev_cmd && prev_cmd->TextureId == curr_texture_id && memcmp(&prev_cmd->ClipRect, &GetCurrentClipRect(), sizeof(v4f)) == 0 && prev_cmd->UserCallback == NULL)
+    if (curr_cmd->IsEmpty() && prev_cmd && prev_cmd->TextureId == curr_texture_id && memcmp(&prev_cmd->ClipRect, &GetCurrentClipRect(), sizeof(v4f)) == 0 && prev_cmd->UserCallback == NULL)
         CmdBuffer.pop_back();
     else
         curr_cmd->TextureId = curr_texture_id;
 }
 
+bool ImmDrawList::ClipOverlaps(const v2f& bmin, const v2f& bmax, float pad) const
+{
+    const v4f clip = GetCurrentClipRect();
+    return bmax.x + pad >= clip.x && bmin.x - pad <= clip.z && bmax.y + pad >= clip.y && bmin.y - pad <= clip.w;
+}
+
+bool ImmDrawList::CullRect(const v2f& bmin, const v2f& bmax, float pad, int vtx_count)
+{
+    if (ClipOverlaps(bmin, bmax, pad))
+        return false;
+
+    CulledPrimitives++;
+    CulledVertices += vtx_count;
+    return true;
+}
+
 #undef GetCurrentClipRect
 #undef GetCurrentTextureId
 
-// Render-level scissoring. This is passed down to your render function but not used for CPU-side coarse clipping. Prefer using higher-level ImGui::PushClipRect() to affect logic (hit-testing and widget culling)
+bool ImmDrawList::CullPoints(const v2f* points, int points_count, float pad, int vtx_count)
+{
+    if (points_count <= 0)
+        return false;
+
+    v2f bmin = points[0], bmax = points[0];
+    for (int i = 1; i < points_count; i++)
+    {
+        bmin.x = std::min(bmin.x, points[i].x); bmin.y = std::min(bmin.y, points[i].y);
+        bmax.x = std::max(bmax.x, points[i].x); bmax.y = std::max(bmax.y, points[i].y);
+    }
+    return CullRect(bmin, bmax, pad, vtx_count);
+}
+
+// The vertices AddPolyline and AddConvexPolyFilled emit, for culling counters
+int ImmDrawList::StrokeVtxCount(int points_count, bool closed, float thickness) const
+{
+    if (points_count < 2)
+        return 0;
+    if (Flags & ImmDrawListFlags_AntiAliasedLines)
+        return points_count * (thickness > 1.0f ? 4 : 3);
+    return (closed ? points_count : points_count - 1) * 4;
+}
+
+int ImmDrawList::FillVtxCount(int points_count) const
+{
+    return (Flags & ImmDrawListFlags_AntiAliasedFill) ? points_count * 2 : points_count;
+}
+
+// Given the batch elements flagged visible in _CullKeep, counts the rest as
+// culled and, if there are any, compacts the visible ones into scratch storage
+// and repoints the arrays there. Returns the number of visible elements.
+int ImmDrawList::CompactBatch(int count, int vtx_per, const float** arrays, int array_count, const uint32_t*& col)
+{
+    int kept = 0;
+    for (int p = 0; p < count; p++)
+        kept += _CullKeep[p];
+    if (kept == count)
+        return count;
+
+    CulledPrimitives += count - kept;
+    CulledVertices += (count - kept) * vtx_per;
+    if (kept == 0)
+        return 0;
+
+    _CullScratch.resize(kept * array_count);
+    _CullScratchCol.resize(kept);
+    for (int a = 0; a < array_count; a++)
+    {
+        float* dst = _CullScratch.Data + a * kept;
+        for (int p = 0; p < count; p++)
+            if (_CullKeep[p])
+                *dst++ = arrays[a][p];
+        arrays[a] = _CullScratch.Data + a * kept;
+    }
+    uint32_t* dst = _CullScratchCol.Data;
+    for (int p = 0; p < count; p++)
+        if (_CullKeep[p])
+            *dst++ = col[p];
+    col = _CullScratchCol.Data;
+    return kept;
+}
+
+// Render-level scissoring. Primitives entirely outside the clip rect are also culled on the CPU. Prefer using higher-level ImGui::PushClipRect() to affect logic (hit-testing and widget culling)
 void ImmDrawList::PushClipRect(v2f cr_min, v2f cr_max, bool intersect_with_current_clip_rect)
 {
     v4f cr(cr_min.x, cr_min.y, cr_max.x, cr_max.y);
@@ -684,6 +984,10 @@ void ImmDrawList::ChannelsSetCurrent(int idx)
 // NB: this can be called with negative count for removing primitives (as long as the result does not underflow)
 void ImmDrawList::PrimReserve(int idx_count, int vtx_count)
 {
+    const ImmDrawCmd& curr_cmd = CmdBuffer.Data[CmdBuffer.Size-1];
+    if (curr_cmd.ShapeCount != 0 || curr_cmd.SpriteCount != 0)
+        AddDrawCmd();
+
     ImmDrawCmd& draw_cmd = CmdBuffer.Data[CmdBuffer.Size-1];
     draw_cmd.ElemCount += idx_count;
 
@@ -695,6 +999,51 @@ void ImmDrawList::PrimReserve(int idx_count, int vtx_count)
     IdxBuffer.resize(idx_buffer_old_size + idx_count);
     _IdxWritePtr = IdxBuffer.Data + idx_buffer_old_size;
 }
+// Triangles, shapes and sprites are drawn by different programs, so each starts a command of its own
+ImmDrawShape* ImmDrawList::ShapeReserve(int shape_count)
+{
+    const ImmDrawCmd& curr_cmd = CmdBuffer.Data[CmdBuffer.Size-1];
+    if (curr_cmd.ElemCount != 0 || curr_cmd.SpriteCount != 0)
+        AddDrawCmd();
+
+    CmdBuffer.Data[CmdBuffer.Size-1].ShapeCount += shape_count;
+    int shape_buffer_old_size = ShapeBuffer.Size;
+    ShapeBuffer.resize(shape_buffer_old_size + shape_count);
+    return ShapeBuffer.Data + shape_buffer_old_size;
+}
+
+ImmDrawSprite* ImmDrawList::SpriteReserve(int sprite_count)
+{
+    const ImmDrawCmd& curr_cmd = CmdBuffer.Data[CmdBuffer.Size-1];
+    if (curr_cmd.ElemCount != 0 || curr_cmd.ShapeCount != 0)
+        AddDrawCmd();
+
+    CmdBuffer.Data[CmdBuffer.Size-1].SpriteCount += sprite_count;
+    int sprite_buffer_old_size = SpriteBuffer.Size;
+    SpriteBuffer.resize(sprite_buffer_old_size + sprite_count);
+    return SpriteBuffer.Data + sprite_buffer_old_size;
+}
+
+void ImmDrawList::SpriteUnreserve(int sprite_count)
+{
+    CmdBuffer.Data[CmdBuffer.Size-1].SpriteCount -= sprite_count;
+    SpriteBuffer.resize(SpriteBuffer.Size - sprite_count);
+}
+
+void ImmDrawList::ShapeBox(const v2f& centre, const v2f& half_size, const v4f& radii, float stroke, uint32_t col)
+{
+    ImmDrawShape* shape = ShapeReserve(1);
+    shape->a = centre; shape->b = half_size; shape->radii = radii;
+    shape->stroke = stroke; shape->kind = (float)ImmDrawShapeKind_Box; shape->col = col;
+}
+
+void ImmDrawList::ShapeSegment(const v2f& a, const v2f& b, float thickness, uint32_t col)
+{
+    ImmDrawShape* shape = ShapeReserve(1);
+    shape->a = a; shape->b = b; shape->radii = v4f(thickness * 0.5f, 0, 0, 0);
+    shape->stroke = 0.0f; shape->kind = (float)ImmDrawShapeKind_Segment; shape->col = col;
+}
+
 // Fully unrolled with inline call to keep our debug builds decently fast.
 void ImmDrawList::PrimRect(const v2f& a, const v2f& c, uint32_t col)
 {
@@ -741,11 +1090,63 @@ void ImmDrawList::PrimQuadUV(const v2f& a, const v2f& b, const v2f& c, const v2f
 }
 
 // TODO: Thickness anti-aliased lines cap are missing their AA fringe.
+// Open polylines longer than this are trimmed to their visible runs
+static const int ImmPolylineTrimPoints = 64;
+
 void ImmDrawList::AddPolyline(const v2f* points, const int points_count, uint32_t col, bool closed, float thickness)
 {
     if (points_count < 2)
         return;
 
+    // the stroke, its fringe, and the half pixel offset some callers apply
+    const float pad = thickness * 0.5f + 2.0f;
+    if (closed || points_count <= ImmPolylineTrimPoints)
+    {
+        if (CullPoints(points, points_count, pad, StrokeVtxCount(points_count, closed, thickness)))
+            return;
+        PolylineTessellate(points, points_count, col, closed, thickness);
+        return;
+    }
+
+    // Trim long open polylines to the runs of segments that touch the clip
+    // rect, each extended by a segment at either end so that the joins
+    // bordering the clip rect are tessellated as they would be untrimmed.
+    const int segments = points_count - 1;
+    auto visible = [&](int i)
+    {
+        const v2f& p0 = points[i];
+        const v2f& p1 = points[i+1];
+        return ClipOverlaps(v2f(std::min(p0.x, p1.x), std::min(p0.y, p1.y)), v2f(std::max(p0.x, p1.x), std::max(p0.y, p1.y)), pad);
+    };
+
+    const int total_vtx_count = StrokeVtxCount(points_count, false, thickness);
+    int emitted_vtx_count = 0;
+    int run_start = -1;
+    bool visible_prev = false, visible_curr = visible(0);
+    for (int i = 0; i <= segments; i++)
+    {
+        const bool visible_next = i + 1 < segments && visible(i + 1);
+        const bool keep = i < segments && (visible_prev || visible_curr || visible_next);
+        if (keep && run_start < 0)
+            run_start = i;
+        if (!keep && run_start >= 0)
+        {
+            // segments run_start to i-1, so points run_start to i
+            PolylineTessellate(points + run_start, i - run_start + 1, col, false, thickness);
+            emitted_vtx_count += StrokeVtxCount(i - run_start + 1, false, thickness);
+            run_start = -1;
+        }
+        visible_prev = visible_curr;
+        visible_curr = visible_next;
+    }
+
+    if (emitted_vtx_count == 0)
+        CulledPrimitives++;
+    CulledVertices += total_vtx_count - emitted_vtx_count;
+}
+
+void ImmDrawList::PolylineTessellate(const v2f* points, const int points_count, uint32_t col, bool closed, float thickness)
+{
     const v2f uv = _Data->TexUvWhitePixel;
 
     int count = points_count;
@@ -922,6 +1323,9 @@ void ImmDrawList::AddPolyline(const v2f* points, const int points_count, uint32_
 
 void ImmDrawList::AddConvexPolyFilled(const v2f* points, const int points_count, uint32_t col)
 {
+    if (CullPoints(points, points_count, 1.0f, FillVtxCount(points_count)))
+        return;
+
     const v2f uv = _Data->TexUvWhitePixel;
 
     if (Flags & ImmDrawListFlags_AntiAliasedFill)
@@ -1106,10 +1510,31 @@ void ImmDrawList::PathRect(const v2f& a, const v2f& b, float rounding, int round
     }
 }
 
+// The corner radii PathRect would use
+v4f ImmDrawList::ShapeRadii(const v2f& a, const v2f& b, float rounding, int rounding_corners)
+{
+    rounding = std::min(rounding, fabsf(b.x - a.x) * ( ((rounding_corners & ImmDrawCornerFlags_Top)  == ImmDrawCornerFlags_Top)  || ((rounding_corners & ImmDrawCornerFlags_Bot)   == ImmDrawCornerFlags_Bot)   ? 0.5f : 1.0f ) - 1.0f);
+    rounding = std::min(rounding, fabsf(b.y - a.y) * ( ((rounding_corners & ImmDrawCornerFlags_Left) == ImmDrawCornerFlags_Left) || ((rounding_corners & ImmDrawCornerFlags_Right) == ImmDrawCornerFlags_Right) ? 0.5f : 1.0f ) - 1.0f);
+    rounding = std::max(rounding, 0.0f);
+    return v4f((rounding_corners & ImmDrawCornerFlags_TopLeft) ? rounding : 0.0f,
+               (rounding_corners & ImmDrawCornerFlags_TopRight) ? rounding : 0.0f,
+               (rounding_corners & ImmDrawCornerFlags_BotRight) ? rounding : 0.0f,
+               (rounding_corners & ImmDrawCornerFlags_BotLeft) ? rounding : 0.0f);
+}
+
 void ImmDrawList::AddLine(const v2f& a, const v2f& b, uint32_t col, float thickness)
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
+    const bool shapes = (Flags & ImmDrawListFlags_AnalyticShapes) != 0;
+    if (CullRect(v2f(std::min(a.x, b.x), std::min(a.y, b.y)), v2f(std::max(a.x, b.x), std::max(a.y, b.y)),
+                 thickness * 0.5f + 2.0f, shapes ? 4 : StrokeVtxCount(2, false, thickness)))
+        return;
+    if (shapes)
+    {
+        ShapeSegment(a + v2f(0.5f,0.5f), b + v2f(0.5f,0.5f), thickness, col);
+        return;
+    }
     PathLineTo(a + v2f(0.5f,0.5f));
     PathLineTo(b + v2f(0.5f,0.5f));
     PathStroke(col, false, thickness);
@@ -1120,6 +1545,16 @@ void ImmDrawList::AddRect(const v2f& a, const v2f& b, uint32_t col, float roundi
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
+    const bool shapes = (Flags & ImmDrawListFlags_AnalyticShapes) != 0;
+    if (CullRect(v2f(std::min(a.x, b.x), std::min(a.y, b.y)), v2f(std::max(a.x, b.x), std::max(a.y, b.y)),
+                 thickness * 0.5f + 1.0f, shapes ? 4 : StrokeVtxCount(rounding > 0.0f ? 16 : 4, true, thickness)))
+        return;
+    if (shapes)
+    {
+        const v2f a_in = a + v2f(0.5f,0.5f), b_in = b - v2f(0.5f,0.5f);
+        ShapeBox((a_in + b_in) * 0.5f, (b_in - a_in) * 0.5f, ShapeRadii(a_in, b_in, rounding, rounding_corners_flags), thickness, col);
+        return;
+    }
     PathRect(a + v2f(0.5f,0.5f), b - v2f(0.5f,0.5f), rounding, rounding_corners_flags);
     PathStroke(col, true, thickness);
 }
@@ -1128,7 +1563,15 @@ void ImmDrawList::AddRectFilled(const v2f& a, const v2f& b, uint32_t col, float
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
-    if (rounding > 0.0f)
+    const bool shapes = rounding > 0.0f && (Flags & ImmDrawListFlags_AnalyticShapes);
+    if (CullRect(v2f(std::min(a.x, b.x), std::min(a.y, b.y)), v2f(std::max(a.x, b.x), std::max(a.y, b.y)),
+                 1.0f, shapes ? 4 : rounding > 0.0f ? FillVtxCount(16) : 4))
+        return;
+    if (shapes)
+    {
+        ShapeBox((a + b) * 0.5f, (b - a) * 0.5f, ShapeRadii(a, b, rounding, rounding_corners_flags), 0.0f, col);
+    }
+    else if (rounding > 0.0f)
     {
         PathRect(a, b, rounding, rounding_corners_flags);
         PathFillConvex(col);
@@ -1144,6 +1587,8 @@ void ImmDrawList::AddRectFilledMultiColor(const v2f& a, const v2f& c, uint32_t c
 {
     if (((col_upr_left | col_upr_right | col_bot_right | col_bot_left) & IMM_COL32_A_MASK) == 0)
         return;
+    if (CullRect(v2f(std::min(a.x, c.x), std::min(a.y, c.y)), v2f(std::max(a.x, c.x), std::max(a.y, c.y)), 0.0f, 4))
+        return;
 
     const v2f uv = _Data->TexUvWhitePixel;
     PrimReserve(6, 4);
@@ -1205,6 +1650,16 @@ void ImmDrawList::AddCircle(const v2f& centre, float radius, uint32_t col, int n
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
+    const bool shapes = (Flags & ImmDrawListFlags_AnalyticShapes) != 0;
+    if (CullRect(centre - v2f(radius, radius), centre + v2f(radius, radius), thickness * 0.5f + 1.0f,
+                 shapes ? 4 : StrokeVtxCount(num_segments + 1, true, thickness)))
+        return;
+    if (shapes)
+    {
+        const float r = radius - 0.5f;
+        ShapeBox(centre, v2f(r, r), v4f(r, r, r, r), thickness, col);
+        return;
+    }
 
     const float a_max = (float)M_PI*2.0f * ((float)num_segments - 1.0f) / (float)num_segments;
     PathArcTo(centre, radius-0.5f, 0.0f, a_max, num_segments);
@@ -1215,6 +1670,14 @@ void ImmDrawList::AddCircleFilled(const v2f& centre, float radius, uint32_t col,
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
+    const bool shapes = (Flags & ImmDrawListFlags_AnalyticShapes) != 0;
+    if (CullRect(centre - v2f(radius, radius), centre + v2f(radius, radius), 1.0f, shapes ? 4 : FillVtxCount(num_segments + 1)))
+        return;
+    if (shapes)
+    {
+        ShapeBox(centre, v2f(radius, radius), v4f(radius, radius, radius, radius), 0.0f, col);
+        return;
+    }
 
     const float a_max = (float)M_PI*2.0f * ((float)num_segments - 1.0f) / (float)num_segments;
     PathArcTo(centre, radius, 0.0f, a_max, num_segments);
@@ -1226,15 +1689,262 @@ void ImmDrawList::AddBezierCurve(const v2f& pos0, const v2f& cp0, const v2f& cp1
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
 
+    // a bezier lies within the bounds of its control points; adaptive
+    // subdivision is counted as if it were a single segment
+    const v2f hull[4] = { pos0, cp0, cp1, pos1 };
+    if (CullPoints(hull, 4, thickness * 0.5f + 1.0f, StrokeVtxCount(num_segments > 0 ? num_segments + 1 : 2, false, thickness)))
+        return;
+
     PathLineTo(pos0);
     PathBezierCurveTo(cp0, cp1, pos1, num_segments);
     PathStroke(col, false, thickness);
 }
 
+// The batches write the same triangles as their single primitive versions,
+// except that circles are regular polygons, and that fully transparent
+// primitives are not skipped. Every primitive of a batch has the same
+// topology, so the indices of one are offset for the rest.
+
+void ImmDrawList::AddCirclesFilled(int count, const float* x, const float* y, const float* radius, const uint32_t* col, int num_segments)
+{
+    if (count <= 0 || num_segments < 3)
+        return;
+
+    _CullKeep.resize(count);
+    for (int p = 0; p < count; p++)
+        _CullKeep[p] = ClipOverlaps(v2f(x[p] - radius[p], y[p] - radius[p]), v2f(x[p] + radius[p], y[p] + radius[p]), 1.0f);
+    const float* arrays[3] = { x, y, radius };
+    count = CompactBatch(count, (Flags & ImmDrawListFlags_AnalyticShapes) ? 4 : FillVtxCount(num_segments), arrays, 3, col);
+    if (count == 0)
+        return;
+    x = arrays[0]; y = arrays[1]; radius = arrays[2];
+
+    if (Flags & ImmDrawListFlags_AnalyticShapes)
+    {
+        ImmDrawShape* shape = ShapeReserve(count);
+        for (int p = 0; p < count; p++, shape++)
+        {
+            shape->a = v2f(x[p], y[p]); shape->b = v2f(radius[p], radius[p]);
+            shape->radii = v4f(radius[p], radius[p], radius[p], radius[p]);
+            shape->stroke = 0.0f; shape->kind = (float)ImmDrawShapeKind_Box; shape->col = col[p];
+        }
+        return;
+    }
+
+    const v2f uv = _Data->TexUvWhitePixel;
+    const bool aa = (Flags & ImmDrawListFlags_AntiAliasedFill) != 0;
+    const int rings = aa ? 2 : 1;   // inner, and outer fringe
+    const int vtx_per = num_segments * rings;
+    const int idx_per = (num_segments - 2) * 3 + (aa ? num_segments * 6 : 0);
+
+    float* unit = (float*)alloca(num_segments * 2 * sizeof(float));
+    ImmDrawIdx* topology = (ImmDrawIdx*)alloca(idx_per * sizeof(ImmDrawIdx));
+    for (int i = 0; i < num_segments; i++)
+    {
+        const float a = ((float)i * 2 * (float)M_PI) / (float)num_segments;
+        unit[i*2+0] = cosf(a);
+        unit[i*2+1] = sinf(a);
+    }
+    ImmDrawIdx* t = topology;
+    for (int i = 2; i < num_segments; i++)
+    {
+        t[0] = 0; t[1] = (ImmDrawIdx)((i-1)*rings); t[2] = (ImmDrawIdx)(i*rings);
+        t += 3;
+    }
+    if (aa)
+    {
+        for (int i0 = num_segments-1, i1 = 0; i1 < num_segments; i0 = i1++)
+        {
+            t[0] = (ImmDrawIdx)(i1*2); t[1] = (ImmDrawIdx)(i0*2);   t[2] = (ImmDrawIdx)(i0*2+1);
+            t[3] = (ImmDrawIdx)(i0*2+1); t[4] = (ImmDrawIdx)(i1*2+1); t[5] = (ImmDrawIdx)(i1*2);
+            t += 6;
+        }
+    }
+
+    PrimReserve(count * idx_per, count * vtx_per);
+    for (int p = 0; p < count; p++)
+    {
+        const unsigned int base = _VtxCurrentIdx + p * vtx_per;
+        for (int j = 0; j < idx_per; j++)
+            _IdxWritePtr[j] = (ImmDrawIdx)(base + topology[j]);
+        _IdxWritePtr += idx_per;
+    }
+
+    // the averaged edge normals of a regular polygon are 1/cos(pi/n) long
+    const ImmF4 fringe = ImmF4Set(aa ? 0.5f / cosf((float)M_PI / (float)num_segments) : 0.0f);
+    float inner_x[4], inner_y[4], outer_x[4], outer_y[4];
+    for (int p = 0; p < count; p += 4)
+    {
+        ImmF4Lanes in(p, count);
+        const ImmF4 cx = in.load(x, p, 0);
+        const ImmF4 cy = in.load(y, p, 1);
+        const ImmF4 r = in.load(radius, p, 2);
+        const ImmF4 r_inner = ImmF4Sub(r, fringe);
+        const ImmF4 r_outer = ImmF4Add(r, fringe);
+
+        for (int k = 0; k < num_segments; k++)
+        {
+            const ImmF4 c = ImmF4Set(unit[k*2+0]);
+            const ImmF4 s = ImmF4Set(unit[k*2+1]);
+            ImmF4Store(inner_x, ImmF4Add(cx, ImmF4Mul(r_inner, c)));
+            ImmF4Store(inner_y, ImmF4Add(cy, ImmF4Mul(r_inner, s)));
+            ImmF4Store(outer_x, ImmF4Add(cx, ImmF4Mul(r_outer, c)));
+            ImmF4Store(outer_y, ImmF4Add(cy, ImmF4Mul(r_outer, s)));
+
+            for (int l = 0; l < in.lanes; l++)
+            {
+                ImmDrawVert* v = _VtxWritePtr + (p + l) * vtx_per + k * rings;
+                v[0].pos = v2f(inner_x[l], inner_y[l]); v[0].uv = uv; v[0].col = col[p+l];
+                if (aa)
+                {
+                    v[1].pos = v2f(outer_x[l], outer_y[l]); v[1].uv = uv; v[1].col = col[p+l] & ~IMM_COL32_A_MASK;
+                }
+            }
+        }
+    }
+    _VtxWritePtr += count * vtx_per;
+    _VtxCurrentIdx += count * vtx_per;
+}
+
+void ImmDrawList::AddLines(int count, const float* x0, const float* y0, const float* x1, const float* y1, const uint32_t* col, float thickness)
+{
+    if (count <= 0)
+        return;
+
+    const float pad = thickness * 0.5f + 2.0f;
+    _CullKeep.resize(count);
+    for (int p = 0; p < count; p++)
+        _CullKeep[p] = ClipOverlaps(v2f(std::min(x0[p], x1[p]), std::min(y0[p], y1[p])), v2f(std::max(x0[p], x1[p]), std::max(y0[p], y1[p])), pad);
+    const float* arrays[4] = { x0, y0, x1, y1 };
+    count = CompactBatch(count, (Flags & ImmDrawListFlags_AnalyticShapes) ? 4 : StrokeVtxCount(2, false, thickness), arrays, 4, col);
+    if (count == 0)
+        return;
+    x0 = arrays[0]; y0 = arrays[1]; x1 = arrays[2]; y1 = arrays[3];
+
+    if (Flags & ImmDrawListFlags_AnalyticShapes)
+    {
+        ImmDrawShape* shape = ShapeReserve(count);
+        for (int p = 0; p < count; p++, shape++)
+        {
+            shape->a = v2f(x0[p] + 0.5f, y0[p] + 0.5f); shape->b = v2f(x1[p] + 0.5f, y1[p] + 0.5f);
+            shape->radii = v4f(thickness * 0.5f, 0, 0, 0);
+            shape->stroke = 0.0f; shape->kind = (float)ImmDrawShapeKind_Segment; shape->col = col[p];
+        }
+        return;
+    }
+
+    // Each end has a vertex per offset along the normal, matching AddPolyline
+    // for two points. Transparent vertices form the anti-aliased fringe.
+    const float AA_SIZE = 1.0f;
+    const bool aa = (Flags & ImmDrawListFlags_AntiAliasedLines) != 0;
+    const bool thick_line = thickness > 1.0f;
+    const float half_inner_thickness = (thickness - AA_SIZE) * 0.5f;
+
+    static const ImmDrawIdx thin_topology[] = { 3,0,2, 2,5,3, 4,1,0, 0,3,4 };
+    static const ImmDrawIdx thick_topology[] = { 5,1,2, 2,6,5, 5,1,0, 0,4,5, 6,2,3, 3,7,6 };
+    static const ImmDrawIdx solid_topology[] = { 0,2,3, 0,3,1 };
+
+    float offsets[4];
+    bool fringe[4];
+    const ImmDrawIdx* topology;
+    int per_end, idx_per;
+    if (aa && !thick_line)
+    {
+        per_end = 3; idx_per = 12; topology = thin_topology;
+        offsets[0] = 0.0f;     fringe[0] = false;
+        offsets[1] = AA_SIZE;  fringe[1] = true;
+        offsets[2] = -AA_SIZE; fringe[2] = true;
+    }
+    else if (aa)
+    {
+        per_end = 4; idx_per = 18; topology = thick_topology;
+        offsets[0] = half_inner_thickness + AA_SIZE;    fringe[0] = true;
+        offsets[1] = half_inner_thickness;              fringe[1] = false;
+        offsets[2] = -half_inner_thickness;             fringe[2] = false;
+        offsets[3] = -(half_inner_thickness + AA_SIZE); fringe[3] = true;
+    }
+    else
+    {
+        per_end = 2; idx_per = 6; topology = solid_topology;
+        offsets[0] = thickness * 0.5f;  fringe[0] = false;
+        offsets[1] = -thickness * 0.5f; fringe[1] = false;
+    }
+
+    const int vtx_per = per_end * 2;
+    PrimReserve(count * idx_per, count * vtx_per);
+    for (int p = 0; p < count; p++)
+    {
+        const unsigned int base = _VtxCurrentIdx + p * vtx_per;
+        for (int j = 0; j < idx_per; j++)
+            _IdxWritePtr[j] = (ImmDrawIdx)(base + topology[j]);
+        _IdxWritePtr += idx_per;
+    }
+
+    const v2f uv = _Data->TexUvWhitePixel;
+    const ImmF4 half = ImmF4Set(0.5f);
+    float ends[2][2][4];    // end, axis, lane
+    float normal[2][4];     // axis, lane
+    for (int p = 0; p < count; p += 4)
+    {
+        ImmF4Lanes in(p, count);
+        const ImmF4 ax = ImmF4Add(in.load(x0, p, 0), half);
+        const ImmF4 ay = ImmF4Add(in.load(y0, p, 1), half);
+        const ImmF4 bx = ImmF4Add(in.load(x1, p, 2), half);
+        const ImmF4 by = ImmF4Add(in.load(y1, p, 3), half);
+        const ImmF4 dx = ImmF4Sub(bx, ax);
+        const ImmF4 dy = ImmF4Sub(by, ay);
+        const ImmF4 inv = ImmF4InvLength(dx, dy);
+        ImmF4Store(normal[0], ImmF4Mul(dy, inv));
+        ImmF4Store(normal[1], ImmF4Mul(ImmF4Sub(ImmF4Set(0.0f), dx), inv));
+        ImmF4Store(ends[0][0], ax); ImmF4Store(ends[0][1], ay);
+        ImmF4Store(ends[1][0], bx); ImmF4Store(ends[1][1], by);
+
+        for (int l = 0; l < in.lanes; l++)
+        {
+            const uint32_t c = col[p+l];
+            const uint32_t c_trans = c & ~IMM_COL32_A_MASK;
+            ImmDrawVert* v = _VtxWritePtr + (p + l) * vtx_per;
+            for (int e = 0; e < 2; e++)
+            {
+                for (int o = 0; o < per_end; o++, v++)
+                {
+                    v->pos = v2f(ends[e][0][l] + normal[0][l] * offsets[o], ends[e][1][l] + normal[1][l] * offsets[o]);
+                    v->uv = uv;
+                    v->col = fringe[o] ? c_trans : c;
+                }
+            }
+        }
+    }
+    _VtxWritePtr += count * vtx_per;
+    _VtxCurrentIdx += count * vtx_per;
+}
+
+void ImmDrawList::AddRectsFilled(int count, const float* x0, const float* y0, const float* x1, const float* y1, const uint32_t* col)
+{
+    // nothing to compute, only to copy, so the win over AddRectFilled is the single reservation
+    if (count <= 0)
+        return;
+
+    _CullKeep.resize(count);
+    for (int p = 0; p < count; p++)
+        _CullKeep[p] = ClipOverlaps(v2f(std::min(x0[p], x1[p]), std::min(y0[p], y1[p])), v2f(std::max(x0[p], x1[p]), std::max(y0[p], y1[p])), 0.0f);
+    const float* arrays[4] = { x0, y0, x1, y1 };
+    count = CompactBatch(count, 4, arrays, 4, col);
+    if (count == 0)
+        return;
+    x0 = arrays[0]; y0 = arrays[1]; x1 = arrays[2]; y1 = arrays[3];
+
+    PrimReserve(count * 6, count * 4);
+    for (int p = 0; p < count; p++)
+        PrimRect(v2f(x0[p], y0[p]), v2f(x1[p], y1[p]), col[p]);
+}
+
 void ImmDrawList::AddImage(ImmTextureId user_texture_id, const v2f& a, const v2f& b, const v2f& uv_a, const v2f& uv_b, uint32_t col)
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
+    if (CullRect(v2f(std::min(a.x, b.x), std::min(a.y, b.y)), v2f(std::max(a.x, b.x), std::max(a.y, b.y)), 0.0f, 4))
+        return;
 
     const bool push_texture_id = _TextureIdStack.empty() || user_texture_id != _TextureIdStack.back();
     if (push_texture_id)
@@ -1251,6 +1961,9 @@ void ImmDrawList::AddImageQuad(ImmTextureId user_texture_id, const v2f& a, const
 {
     if ((col & IMM_COL32_A_MASK) == 0)
         return;
+    const v2f quad[4] = { a, b, c, d };
+    if (CullPoints(quad, 4, 0.0f, 4))
+        return;
 
     const bool push_texture_id = _TextureIdStack.empty() || user_texture_id != _TextureIdStack.back();
     if (push_texture_id)
@@ -1288,10 +2001,25 @@ void ImmDrawList::AddImageRounded(ImmTextureId user_texture_id, const v2f& a, co
         PopTextureID();
 }
 
-typedef std::tuple<std::shared_ptr<uint8_t>, int, int> SpriteDesc;
-std::unordered_map<lab::ImmSpriteId, SpriteDesc> cached_sprites;
+struct SpriteDesc
+{
+    std::shared_ptr<uint8_t> pixels;
+    int w, h;
+};
+
+// Sprite ids index the table directly; id 0 is never handed out. The defrag
+// thread reads pixels under the mutex while new sprites may be registered;
+// sprite() reads without it, so ids are registered on the thread calling sprite.
+std::vector<SpriteDesc> cached_sprites(1);
 std::unordered_map<uint8_t*, lab::ImmSpriteId> cached_sprites_reverse;
+static std::mutex cached_sprites_mutex;
 
+static const SpriteDesc* find_sprite(lab::ImmSpriteId id)
+{
+    if (id == 0 || id >= cached_sprites.size())
+        return nullptr;
+    return &cached_sprites[(size_t)id];
+}
 
 lab::ImmSpriteId SpriteId(std::shared_ptr<uint8_t> rgb, int w, int h)
 {
@@ -1301,14 +2029,159 @@ lab::ImmSpriteId SpriteId(std::shared_ptr<uint8_t> rgb, int w, int h)
         return it->second;
     }
 
-    static std::atomic<int> id(0);
-    int new_id = ++id;
-
+    std::lock_guard<std::mutex> lock(cached_sprites_mutex);
+    lab::ImmSpriteId new_id = cached_sprites.size();
     cached_sprites_reverse[rgb.get()] = new_id;
-    cached_sprites[new_id] = { rgb, w, h };
+    cached_sprites.push_back({ rgb, w, h });
     return new_id;
 }
 
+// Textures made by the sprite batcher are named by handles into this table,
+// because atlases built on the defrag thread have no GL texture until the GL
+// thread uploads them. Deletes requested by the defrag thread wait likewise.
+// Staged atlases may take several frames to upload; meanwhile their sprites
+// draw from fallback textures of their own images.
+struct SpriteTextures
+{
+    struct Staged
+    {
+        uint64_t handle;
+        int w, h;
+        std::vector<uint8_t> pixels;
+        GLuint name;                    // 0 until the first rows are uploaded
+        int rows;                       // rows uploaded so far
+    };
+
+    std::mutex mutex;
+    std::vector<GLuint> names;          // by handle - 1, 0 while staged
+    std::vector<uint64_t> free_handles;
+    std::vector<Staged> staged;
+    std::vector<uint64_t> deleted;
+    std::unordered_map<uint64_t, GLuint> fallbacks;    // by image id
+
+    uint64_t allocate()
+    {
+        if (free_handles.size())
+        {
+            uint64_t handle = free_handles.back();
+            free_handles.pop_back();
+            return handle;
+        }
+        names.push_back(0);
+        return names.size();
+    }
+
+    void release(uint64_t handle)
+    {
+        GLuint& name = names[handle - 1];
+        if (name)
+            glDeleteTextures(1, &name);
+        name = 0;
+        free_handles.push_back(handle);
+    }
+
+    static GLuint upload(const void* pixels, int w, int h)
+    {
+        GLuint name;
+        glGenTextures(1, &name);
+        glBindTexture(GL_TEXTURE_2D, name);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return name;
+    }
+
+    // On the GL thread, while no defrag is running. Staged atlases upload
+    // in order, a band of rows at a time, until budget bytes have been sent,
+    // and are named once complete. Returns the bytes uploaded.
+    size_t upload_staged(size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = 0;
+        size_t complete = 0;
+        for (Staged& t : staged)
+        {
+            if (bytes >= budget)
+                break;
+
+            if (!t.name)
+                t.name = upload(nullptr, t.w, t.h);
+
+            const size_t row = size_t(t.w) * 4;
+            int rows = (int) std::min(size_t(t.h - t.rows), std::max(size_t(1), (budget - bytes) / row));
+            glBindTexture(GL_TEXTURE_2D, t.name);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, t.rows, t.w, rows, GL_RGBA, GL_UNSIGNED_BYTE, t.pixels.data() + t.rows * row);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            t.rows += rows;
+            bytes += rows * row;
+            if (t.rows < t.h)
+                break;
+
+            names[t.handle - 1] = t.name;
+            ++complete;
+        }
+        staged.erase(staged.begin(), staged.begin() + complete);
+
+        for (uint64_t handle : deleted)
+            release(handle);
+        deleted.clear();
+
+        if (staged.empty())
+        {
+            for (auto& f : fallbacks)
+                glDeleteTextures(1, &f.second);
+            fallbacks.clear();
+        }
+        return bytes;
+    }
+
+    bool uploading()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !staged.empty();
+    }
+
+    // On the GL thread, once no defrag will run again. Staged atlases are
+    // dropped rather than uploaded; their handles stay unnamed until the
+    // batcher destroys them.
+    void discard_staged()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Staged& t : staged)
+            if (t.name)
+                glDeleteTextures(1, &t.name);
+        staged.clear();
+
+        for (uint64_t handle : deleted)
+            release(handle);
+        deleted.clear();
+
+        for (auto& f : fallbacks)
+            glDeleteTextures(1, &f.second);
+        fallbacks.clear();
+    }
+
+    // a texture of just the image, on the GL thread with the mutex held
+    GLuint fallback(uint64_t image_id)
+    {
+        auto i = fallbacks.find(image_id);
+        if (i != fallbacks.end())
+            return i->second;
+
+        GLuint name = 0;
+        {
+            std::lock_guard<std::mutex> lock(cached_sprites_mutex);
+            if (const SpriteDesc* desc = find_sprite(image_id))
+                name = upload(desc->pixels.get(), desc->w, desc->h);
+        }
+        fallbacks[image_id] = name;
+        return name;
+    }
+};
+static SpriteTextures sprite_textures;
+static thread_local bool on_defrag_thread = false;
+
 
 
 //-----------------------------------------------------------------------------
@@ -1331,6 +2204,269 @@ void ImmDrawData::ScaleClipRects(const v2f& scale)
 }
 
 
+// The VAO is made once, since the immediate mode renderer shares its
+// buffers across every ImmRenderContext, and so assumes a single GL context.
+void GLBitsAndBobs::initVAO()
+{
+    glGenVertexArrays(1, &vaoHandle);
+    glBindVertexArray(vaoHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, vboHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsHandle);
+
+    glEnableVertexAttribArray(attribLocationPosition);
+    glVertexAttribPointer(attribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawVert), (GLvoid*)IMM_OFFSETOF(ImmDrawVert, pos));
+
+    if (attribLocationUV >= 0)
+    {
+        glEnableVertexAttribArray(attribLocationUV);
+        glVertexAttribPointer(attribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawVert), (GLvoid*)IMM_OFFSETOF(ImmDrawVert, uv));
+    }
+    if (attribLocationColor >= 0)
+    {
+        glEnableVertexAttribArray(attribLocationColor);
+        glVertexAttribPointer(attribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImmDrawVert), (GLvoid*)IMM_OFFSETOF(ImmDrawVert, col));
+    }
+    glBindVertexArray(0);
+}
+
+void GLBitsAndBobs::initShapes()
+{
+    // A quad per shape, with a pixel of margin for the anti-aliased edge.
+    // Segments are boxes rotated onto the line, without rounding.
+    const GLchar* vertex_shader =
+        "#version 150\n"
+        "uniform mat4 ProjMtx;\n"
+        "in vec2 ShapeA;\n"
+        "in vec2 ShapeB;\n"
+        "in vec4 Radii;\n"
+        "in vec2 StrokeKind;\n"
+        "in vec4 Color;\n"
+        "out vec2 Frag_Local;\n"
+        "flat out vec2 Frag_Half;\n"
+        "flat out vec4 Frag_Radii;\n"
+        "flat out float Frag_Stroke;\n"
+        "flat out vec4 Frag_Color;\n"
+        "void main()\n"
+        "{\n"
+        "	vec2 corner = vec2((gl_VertexID & 1) != 0 ? 1.0 : -1.0, (gl_VertexID & 2) != 0 ? 1.0 : -1.0);\n"
+        "	vec2 centre = ShapeA;\n"
+        "	vec2 half_size = ShapeB;\n"
+        "	vec2 axis = vec2(1.0, 0.0);\n"
+        "	vec4 radii = Radii;\n"
+        "	if (StrokeKind.y > 0.5)\n"
+        "	{\n"
+        "		vec2 d = ShapeB - ShapeA;\n"
+        "		float len = length(d);\n"
+        "		axis = len > 0.0 ? d / len : vec2(1.0, 0.0);\n"
+        "		centre = (ShapeA + ShapeB) * 0.5;\n"
+        "		half_size = vec2(len * 0.5, Radii.x);\n"
+        "		radii = vec4(0.0);\n"
+        "	}\n"
+        "	vec2 local = corner * (half_size + vec2(StrokeKind.x * 0.5 + 1.0));\n"
+        "	vec2 pos = centre + axis * local.x + vec2(-axis.y, axis.x) * local.y;\n"
+        "	Frag_Local = local;\n"
+        "	Frag_Half = half_size;\n"
+        "	Frag_Radii = radii;\n"
+        "	Frag_Stroke = StrokeKind.x;\n"
+        "	Frag_Color = Color;\n"
+        "	gl_Position = ProjMtx * vec4(pos, 0, 1);\n"
+        "}\n";
+
+    // coverage from the signed distance to a box with a radius per corner
+    const GLchar* fragment_shader =
+        "#version 150\n"
+        "in vec2 Frag_Local;\n"
+        "flat in vec2 Frag_Half;\n"
+        "flat in vec4 Frag_Radii;\n"
+        "flat in float Frag_Stroke;\n"
+        "flat in vec4 Frag_Color;\n"
+        "out vec4 Out_Color;\n"
+        "void main()\n"
+        "{\n"
+        "	vec2 p = Frag_Local;\n"
+        "	float r = p.x > 0.0 ? (p.y > 0.0 ? Frag_Radii.z : Frag_Radii.y) : (p.y > 0.0 ? Frag_Radii.w : Frag_Radii.x);\n"
+        "	vec2 q = abs(p) - Frag_Half + r;\n"
+        "	float d = min(max(q.x, q.y), 0.0) + length(max(q, 0.0)) - r;\n"
+        "	if (Frag_Stroke > 0.0)\n"
+        "		d = abs(d) - Frag_Stroke * 0.5;\n"
+        "	Out_Color = vec4(Frag_Color.rgb, Frag_Color.a * clamp(0.5 - d, 0.0, 1.0));\n"
+        "}\n";
+
+    shapeShaderHandle = glCreateProgram();
+    shapeVertHandle = glCreateShader(GL_VERTEX_SHADER);
+    shapeFragHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(shapeVertHandle, 1, &vertex_shader, 0);
+    glShaderSource(shapeFragHandle, 1, &fragment_shader, 0);
+    glCompileShader(shapeVertHandle);
+    glCompileShader(shapeFragHandle);
+    glAttachShader(shapeShaderHandle, shapeVertHandle);
+    glAttachShader(shapeShaderHandle, shapeFragHandle);
+    glBindAttribLocation(shapeShaderHandle, 0, "ShapeA");
+    glBindAttribLocation(shapeShaderHandle, 1, "ShapeB");
+    glBindAttribLocation(shapeShaderHandle, 2, "Radii");
+    glBindAttribLocation(shapeShaderHandle, 3, "StrokeKind");
+    glBindAttribLocation(shapeShaderHandle, 4, "Color");
+    glLinkProgram(shapeShaderHandle);
+
+    GLint linked = 0;
+    glGetProgramiv(shapeShaderHandle, GL_LINK_STATUS, &linked);
+    if (!linked)
+        printf("Immediate mode shape shader failed to link\n");
+
+    shapeLocationProjMtx = glGetUniformLocation(shapeShaderHandle, "ProjMtx");
+
+    glGenBuffers(1, &shapeHandle);
+    glGenVertexArrays(1, &shapeVaoHandle);
+    glBindVertexArray(shapeVaoHandle);
+    for (GLuint i = 0; i < 5; ++i)
+    {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1);
+    }
+    glBindVertexArray(0);
+}
+
+// There is no base instance in GL 4.1, so each command's shapes are reached
+// by offsetting the attribute pointers instead
+void GLBitsAndBobs::bindShapes(size_t shape_offset)
+{
+    const size_t base = shape_offset * sizeof(ImmDrawShape);
+    glBindBuffer(GL_ARRAY_BUFFER, shapeHandle);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawShape), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawShape, a)));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawShape), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawShape, b)));
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ImmDrawShape), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawShape, radii)));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawShape), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawShape, stroke)));
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImmDrawShape), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawShape, col)));
+}
+
+void GLBitsAndBobs::initSprites()
+{
+    // corners in the same order as shapes; uv y follows the quad's y
+    const GLchar* vertex_shader =
+        "#version 150\n"
+        "uniform mat4 ProjMtx;\n"
+        "in vec2 SpritePos;\n"
+        "in vec2 SpriteSize;\n"
+        "in vec2 SpriteSinCos;\n"
+        "in vec4 SpriteUV;\n"
+        "out vec2 Frag_UV;\n"
+        "void main()\n"
+        "{\n"
+        "	vec2 corner = vec2((gl_VertexID & 1) != 0 ? 0.5 : -0.5, (gl_VertexID & 2) != 0 ? 0.5 : -0.5);\n"
+        "	vec2 local = corner * SpriteSize;\n"
+        "	vec2 pos = SpritePos + vec2(SpriteSinCos.y * local.x - SpriteSinCos.x * local.y,\n"
+        "	                            SpriteSinCos.x * local.x + SpriteSinCos.y * local.y);\n"
+        "	Frag_UV = mix(SpriteUV.xy, SpriteUV.zw, corner + 0.5);\n"
+        "	gl_Position = ProjMtx * vec4(pos, 0, 1);\n"
+        "}\n";
+
+    const GLchar* fragment_shader =
+        "#version 150\n"
+        "uniform sampler2D Texture;\n"
+        "in vec2 Frag_UV;\n"
+        "out vec4 Out_Color;\n"
+        "void main()\n"
+        "{\n"
+        "	Out_Color = texture(Texture, Frag_UV);\n"
+        "}\n";
+
+    spriteShaderHandle = glCreateProgram();
+    spriteVertHandle = glCreateShader(GL_VERTEX_SHADER);
+    spriteFragHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(spriteVertHandle, 1, &vertex_shader, 0);
+    glShaderSource(spriteFragHandle, 1, &fragment_shader, 0);
+    glCompileShader(spriteVertHandle);
+    glCompileShader(spriteFragHandle);
+    glAttachShader(spriteShaderHandle, spriteVertHandle);
+    glAttachShader(spriteShaderHandle, spriteFragHandle);
+    glBindAttribLocation(spriteShaderHandle, 0, "SpritePos");
+    glBindAttribLocation(spriteShaderHandle, 1, "SpriteSize");
+    glBindAttribLocation(spriteShaderHandle, 2, "SpriteSinCos");
+    glBindAttribLocation(spriteShaderHandle, 3, "SpriteUV");
+    glLinkProgram(spriteShaderHandle);
+
+    GLint linked = 0;
+    glGetProgramiv(spriteShaderHandle, GL_LINK_STATUS, &linked);
+    if (!linked)
+        printf("Immediate mode sprite shader failed to link\n");
+
+    spriteLocationProjMtx = glGetUniformLocation(spriteShaderHandle, "ProjMtx");
+    spriteLocationTex = glGetUniformLocation(spriteShaderHandle, "Texture");
+
+    glGenBuffers(1, &spriteHandle);
+    glGenVertexArrays(1, &spriteVaoHandle);
+    glBindVertexArray(spriteVaoHandle);
+    for (GLuint i = 0; i < 4; ++i)
+    {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1);
+    }
+    glBindVertexArray(0);
+}
+
+void GLBitsAndBobs::bindSprites(size_t sprite_offset)
+{
+    const size_t base = sprite_offset * sizeof(ImmDrawSprite);
+    glBindBuffer(GL_ARRAY_BUFFER, spriteHandle);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawSprite), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawSprite, pos)));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawSprite), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawSprite, size)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawSprite), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawSprite, sin)));
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ImmDrawSprite), (GLvoid*)(base + IMM_OFFSETOF(ImmDrawSprite, uv)));
+}
+
+bool GLBitsAndBobs::reserveRing(size_t vtx_count, size_t idx_count, size_t shape_count, size_t sprite_count)
+{
+    if (vtx_count <= vtxSegmentCapacity && idx_count <= idxSegmentCapacity && shape_count <= shapeSegmentCapacity &&
+        sprite_count <= spriteSegmentCapacity)
+        return true;
+
+    // grow by half again, to settle quickly on the working set
+    vtxSegmentCapacity = std::max(vtxSegmentCapacity, vtx_count + vtx_count / 2);
+    idxSegmentCapacity = std::max(idxSegmentCapacity, idx_count + idx_count / 2);
+    shapeSegmentCapacity = std::max(shapeSegmentCapacity, shape_count + shape_count / 2);
+    spriteSegmentCapacity = std::max(spriteSegmentCapacity, sprite_count + sprite_count / 2);
+
+    // orphaning leaves the old storage to draws in flight, so the fences
+    // guarding it no longer matter
+    for (GLsync& fence : ringFences)
+    {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vboHandle);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(ringSegments * vtxSegmentCapacity * sizeof(ImmDrawVert)), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsHandle);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(ringSegments * idxSegmentCapacity * sizeof(ImmDrawIdx)), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, shapeHandle);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(ringSegments * shapeSegmentCapacity * sizeof(ImmDrawShape)), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, spriteHandle);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(ringSegments * spriteSegmentCapacity * sizeof(ImmDrawSprite)), nullptr, GL_STREAM_DRAW);
+    return false;
+}
+
+int GLBitsAndBobs::beginRingSegment()
+{
+    int segment = ringSegment;
+    ringSegment = (ringSegment + 1) % ringSegments;
+
+    GLsync& fence = ringFences[segment];
+    if (fence)
+    {
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return segment;
+}
+
+void GLBitsAndBobs::endRingSegment(int segment)
+{
+    ringFences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
 // OpenGL3 Render function.
 // (this used to be set in io.RenderDrawListsFn and called by ImGui::Render(), but you can now call this directly from your main loop)
 // Note that this implementation is little overcomplicated because we are saving/setting up/restoring every OpenGL state explicitly, in order to be able to run within any OpenGL engine that doesn't do so.
@@ -1395,39 +2531,94 @@ void ImmDrawData::Render(int fb_width, int fb_height)
     glUniformMatrix4fv(gl.attribLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
     glBindSampler(0, 0); // Rely on combined texture/sampler state.
 
-    // Recreate the VAO every time
-    // (This is to easily allow multiple GL contexts. VAO are not shared among GL contexts,
-    // and we don't track creation/deletion of windows so we don't have an obvious key to use to cache them.)
-    GLuint vao_handle = 0;
-    glGenVertexArrays(1, &vao_handle);
-    glBindVertexArray(vao_handle);
-    glBindBuffer(GL_ARRAY_BUFFER, gl.vboHandle);
+    // Upload every command list into this frame's ring segment with a
+    // single unsynchronized map per buffer
+    TotalVtxCount = TotalIdxCount = 0;
+    size_t total_shape_count = 0;
+    size_t total_sprite_count = 0;
+    for (int n = 0; n < this->CmdLists.size(); n++)
+    {
+        TotalVtxCount += this->CmdLists[n]->VtxBuffer.Size;
+        TotalIdxCount += this->CmdLists[n]->IdxBuffer.Size;
+        total_shape_count += this->CmdLists[n]->ShapeBuffer.Size;
+        total_sprite_count += this->CmdLists[n]->SpriteBuffer.Size;
+    }
 
-    glEnableVertexAttribArray(gl.attribLocationPosition);
-    glVertexAttribPointer(gl.attribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawVert), (GLvoid*)IMM_OFFSETOF(ImmDrawVert, pos));
+    glBindVertexArray(gl.vaoHandle);
+    gl.reserveRing(TotalVtxCount, TotalIdxCount, total_shape_count, total_sprite_count);
+    int segment = gl.beginRingSegment();
+    size_t vtx_segment_start = segment * gl.vtxSegmentCapacity;
+    size_t idx_segment_start = segment * gl.idxSegmentCapacity;
+    size_t shape_segment_start = segment * gl.shapeSegmentCapacity;
+    size_t sprite_segment_start = segment * gl.spriteSegmentCapacity;
 
-    if (gl.attribLocationUV >= 0)
+    if (TotalVtxCount > 0 && TotalIdxCount > 0)
+    {
+        const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        glBindBuffer(GL_ARRAY_BUFFER, gl.vboHandle);
+        ImmDrawVert* vtx_dst = (ImmDrawVert*) glMapBufferRange(GL_ARRAY_BUFFER,
+            vtx_segment_start * sizeof(ImmDrawVert), TotalVtxCount * sizeof(ImmDrawVert), access);
+        ImmDrawIdx* idx_dst = (ImmDrawIdx*) glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER,
+            idx_segment_start * sizeof(ImmDrawIdx), TotalIdxCount * sizeof(ImmDrawIdx), access);
+        if (vtx_dst && idx_dst)
+        {
+            for (int n = 0; n < this->CmdLists.size(); n++)
+            {
+                const ImmDrawList* cmd_list = this->CmdLists[n];
+                memcpy(vtx_dst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImmDrawVert));
+                memcpy(idx_dst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImmDrawIdx));
+                vtx_dst += cmd_list->VtxBuffer.Size;
+                idx_dst += cmd_list->IdxBuffer.Size;
+            }
+        }
+        if (vtx_dst) glUnmapBuffer(GL_ARRAY_BUFFER);
+        if (idx_dst) glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    }
+    if (total_shape_count > 0)
     {
-        glEnableVertexAttribArray(gl.attribLocationUV);
-        glVertexAttribPointer(gl.attribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImmDrawVert), (GLvoid*)IMM_OFFSETOF(ImmDrawVert, uv));
+        const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        glBindBuffer(GL_ARRAY_BUFFER, gl.shapeHandle);
+        ImmDrawShape* shape_dst = (ImmDrawShape*) glMapBufferRange(GL_ARRAY_BUFFER,
+            shape_segment_start * sizeof(ImmDrawShape), total_shape_count * sizeof(ImmDrawShape), access);
+        if (shape_dst)
+        {
+            for (int n = 0; n < this->CmdLists.size(); n++)
+            {
+                const ImmDrawList* cmd_list = this->CmdLists[n];
+                memcpy(shape_dst, cmd_list->ShapeBuffer.Data, cmd_list->ShapeBuffer.Size * sizeof(ImmDrawShape));
+                shape_dst += cmd_list->ShapeBuffer.Size;
+            }
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
     }
-    if (gl.attribLocationColor >= 0)
+    if (total_sprite_count > 0)
     {
-        glEnableVertexAttribArray(gl.attribLocationColor);
-        glVertexAttribPointer(gl.attribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImmDrawVert), (GLvoid*)IMM_OFFSETOF(ImmDrawVert, col));
+        const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        glBindBuffer(GL_ARRAY_BUFFER, gl.spriteHandle);
+        ImmDrawSprite* sprite_dst = (ImmDrawSprite*) glMapBufferRange(GL_ARRAY_BUFFER,
+            sprite_segment_start * sizeof(ImmDrawSprite), total_sprite_count * sizeof(ImmDrawSprite), access);
+        if (sprite_dst)
+        {
+            for (int n = 0; n < this->CmdLists.size(); n++)
+            {
+                const ImmDrawList* cmd_list = this->CmdLists[n];
+                memcpy(sprite_dst, cmd_list->SpriteBuffer.Data, cmd_list->SpriteBuffer.Size * sizeof(ImmDrawSprite));
+                sprite_dst += cmd_list->SpriteBuffer.Size;
+            }
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
     }
 
     // Draw
+    size_t vtx_offset = vtx_segment_start;
+    size_t idx_offset = idx_segment_start;
+    size_t shape_offset = shape_segment_start;
+    size_t sprite_offset = sprite_segment_start;
+    enum { Triangles, Shapes, Sprites } drawing = Triangles;
     for (int n = 0; n < this->CmdLists.size(); n++)
     {
         const ImmDrawList* cmd_list = this->CmdLists[n];
-        const ImmDrawIdx* idx_buffer_offset = 0;
-
-        glBindBuffer(GL_ARRAY_BUFFER, gl.vboHandle);
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImmDrawVert), (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl.elementsHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImmDrawIdx), (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+        size_t idx_buffer_offset = idx_offset * sizeof(ImmDrawIdx);
 
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
         {
@@ -1436,17 +2627,57 @@ void ImmDrawData::Render(int fb_width, int fb_height)
             {
                 pcmd->UserCallback(cmd_list, pcmd);
             }
+            else if (pcmd->ShapeCount)
+            {
+                if (drawing != Shapes)
+                {
+                    glUseProgram(gl.shapeShaderHandle);
+                    glUniformMatrix4fv(gl.shapeLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
+                    glBindVertexArray(gl.shapeVaoHandle);
+                    drawing = Shapes;
+                }
+                glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
+                gl.bindShapes(shape_offset);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)pcmd->ShapeCount);
+            }
+            else if (pcmd->SpriteCount)
+            {
+                if (drawing != Sprites)
+                {
+                    glUseProgram(gl.spriteShaderHandle);
+                    glUniform1i(gl.spriteLocationTex, 0);
+                    glUniformMatrix4fv(gl.spriteLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
+                    glBindVertexArray(gl.spriteVaoHandle);
+                    drawing = Sprites;
+                }
+                GLuint tx_id = pcmd->TextureId  ? (GLuint)(intptr_t)pcmd->TextureId : gl.defaultTexture;
+                glBindTexture(GL_TEXTURE_2D, tx_id);
+                glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
+                gl.bindSprites(sprite_offset);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)pcmd->SpriteCount);
+            }
             else
             {
+                if (drawing != Triangles)
+                {
+                    glUseProgram(gl.shaderHandle);
+                    glBindVertexArray(gl.vaoHandle);
+                    drawing = Triangles;
+                }
                 GLuint tx_id = pcmd->TextureId  ? (GLuint)(intptr_t)pcmd->TextureId : gl.defaultTexture;
                 glBindTexture(GL_TEXTURE_2D, tx_id);
                 glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
-                glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImmDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, idx_buffer_offset);
+                glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImmDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                                         (GLvoid*)(intptr_t)idx_buffer_offset, (GLint)vtx_offset);
             }
-            idx_buffer_offset += pcmd->ElemCount;
+            idx_buffer_offset += pcmd->ElemCount * sizeof(ImmDrawIdx);
+            shape_offset += pcmd->ShapeCount;
+            sprite_offset += pcmd->SpriteCount;
         }
+        vtx_offset += cmd_list->VtxBuffer.Size;
+        idx_offset += cmd_list->IdxBuffer.Size;
     }
-    glDeleteVertexArrays(1, &vao_handle);
+    gl.endRingSegment(segment);
 
     // Restore modified GL state
     glUseProgram(last_program);
@@ -1470,9 +2701,23 @@ void ImmDrawData::Render(int fb_width, int fb_height)
 
 
 
-// need one of these global.
-static lab::ImmDrawListSharedData dlsd;
-static lab::ImmDrawList* drawlist_ptr{ nullptr };    // tiny sprite lacks a user context pointer?
+// read only after construction, so every draw list on every thread may share it
+static const lab::ImmDrawListSharedData dlsd;
+
+// tiny sprite lacks a user context pointer, so the list being flushed to is
+// set for the duration of spritebatch_flush
+static lab::ImmDrawList* sprite_drawlist{ nullptr };
+
+// scratch for sorting the sprites being flushed, kept to avoid allocation
+static std::vector<lab::Render::DrawSortItem> sprite_sort_items, sprite_sort_scratch;
+static std::vector<spritebatch_sprite_t> sprite_sort_sprites;
+
+struct ImmThreadRecording
+{
+    const void* context{ nullptr };
+    lab::ImmDrawList* list{ nullptr };
+};
+static thread_local ImmThreadRecording thread_recording;
 
 
 struct ImmRenderContext::Detail
@@ -1480,8 +2725,72 @@ struct ImmRenderContext::Detail
     spritebatch_config_t config;
     spritebatch_t* batch{ nullptr };
 
+    // The batch belongs to the defrag thread while it runs, so sprites are
+    // queued and pushed at render.
+    struct PendingSprite
+    {
+        lab::ImmSpriteId id;
+        int w, h;
+        float x, y, sx, sy, c, s;
+        int sort_bits;
+    };
+    std::vector<PendingSprite> pending_sprites;
+    std::vector<spritebatch_sprite_t> unbatched_sprites;
+    size_t upload_budget{ 1 << 20 };
+
+    // one worker defrags for the life of the context, when asked at the end
+    // of a render
+    std::thread defrag_thread;
+    std::mutex defrag_mutex;
+    std::condition_variable defrag_cv;
+    bool defrag_requested{ false };
+    bool defrag_quit{ false };
+
     lab::ImmDrawData dd;
     lab::ImmDrawList dl;
+    bool analytic_shapes{ false };
+
+    // lists recorded by worker threads, indexed by slot
+    std::mutex thread_lists_mutex;
+    std::vector<std::unique_ptr<lab::ImmDrawList>> thread_lists;
+
+    // the list the calling thread records into
+    lab::ImmDrawList& list()
+    {
+        if (thread_recording.context == this)
+            return *thread_recording.list;
+        return dl;
+    }
+
+    lab::ImmDrawList* thread_list(int slot)
+    {
+        std::lock_guard<std::mutex> lock(thread_lists_mutex);
+        if (slot >= (int) thread_lists.size())
+            thread_lists.resize(slot + 1);
+        if (!thread_lists[slot])
+        {
+            thread_lists[slot].reset(new lab::ImmDrawList(&dlsd));
+            thread_lists[slot]->AddDrawCmd();
+            set_flag(*thread_lists[slot], lab::ImmDrawListFlags_AnalyticShapes, analytic_shapes);
+        }
+        return thread_lists[slot].get();
+    }
+
+    static void set_flag(lab::ImmDrawList& list, lab::ImmDrawListFlags flag, bool enable)
+    {
+        list.Flags = (lab::ImmDrawListFlags)(enable ? (list.Flags | flag) : (list.Flags & ~flag));
+    }
+
+    // the context's own list draws first, then the thread lists in order of
+    // slot, so the result doesn't depend on how the threads were scheduled
+    void gather_lists()
+    {
+        dd.CmdLists.clear();
+        dd.CmdLists.push_back(&dl);
+        for (auto& l : thread_lists)
+            if (l && (l->VtxBuffer.Size > 0 || l->ShapeBuffer.Size > 0 || l->SpriteBuffer.Size > 0))
+                dd.CmdLists.push_back(l.get());
+    }
 
 
     static void submit_batch(spritebatch_sprite_t* sprites, int count) 
@@ -1497,107 +2806,274 @@ struct ImmRenderContext::Detail
         // NOTE:
         // perform any additional sorting here
 
-        for (int i = 0; i < count; ++i)
+        // A batch shares one texture. Each sprite becomes an instance record
+        // that the vertex shader expands to a quad.
+        lab::ImmTextureId texture;
+        {
+            std::lock_guard<std::mutex> lock(sprite_textures.mutex);
+            texture = sprite_textures.names[sprites[0].texture_id - 1];
+        }
+        if (texture)
         {
-            spritebatch_sprite_t* s = sprites + i;
-            lab::ImmTextureId texture = (uint32_t)s->texture_id;
+            submit_sprites(sprites, count, texture, false);
+            return;
+        }
 
-            v2f quad[] = {
-                { -0.5f,  0.5f },
-                {  0.5f,  0.5f },
-                {  0.5f, -0.5f },
-                { -0.5f, -0.5f },
-            };
+        // the batch's atlas is still uploading
+        submit_whole_images(sprites, count);
+    }
 
-            for (int j = 0; j < 4; ++j)
+    // runs of one image draw together, from a texture of the image
+    static void submit_whole_images(const spritebatch_sprite_t* sprites, int count)
+    {
+        for (int i = 0; i < count; )
+        {
+            int end = i + 1;
+            while (end < count && sprites[end].image_id == sprites[i].image_id)
+                ++end;
+            lab::ImmTextureId texture;
             {
-                float x = quad[j].x;
-                float y = quad[j].y;
-
-                // scale sprite about origin
-                x *= s->sx;
-                y *= s->sy;
-
-                // rotate sprite about origin
-                float x0 = s->c * x - s->s * y;
-                float y0 = s->s * x + s->c * y;
-                x = x0;
-                y = y0;
-
-                // translate sprite into the world
-                x += s->x;
-                y += s->y;
-
-                quad[j].x = x;
-                quad[j].y = y;
+                std::lock_guard<std::mutex> lock(sprite_textures.mutex);
+                texture = sprite_textures.fallback(sprites[i].image_id);
             }
+            submit_sprites(sprites + i, end - i, texture, true);
+            i = end;
+        }
+    }
 
-            drawlist_ptr->AddImageQuad(texture, quad[0],            quad[1],            quad[2],            quad[3],
-                                      {s->minx, s->maxy}, {s->maxx, s->maxy}, {s->maxx, s->miny}, {s->minx, s->miny}, 
-                                      0xffffffff);
+    // whole_image draws from a texture of each sprite's image alone, rather
+    // than from its place in an atlas
+    static void submit_sprites(const spritebatch_sprite_t* sprites, int count, lab::ImmTextureId texture, bool whole_image)
+    {
+        sprite_drawlist->PushTextureID(texture);
+        lab::ImmDrawSprite* dst = sprite_drawlist->SpriteReserve(count);
+        int kept = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const spritebatch_sprite_t* s = sprites + i;
+
+            // bounds of the rotated quad
+            const float hx = 0.5f * (fabsf(s->c * s->sx) + fabsf(s->s * s->sy));
+            const float hy = 0.5f * (fabsf(s->s * s->sx) + fabsf(s->c * s->sy));
+            if (sprite_drawlist->CullRect(v2f(s->x - hx, s->y - hy), v2f(s->x + hx, s->y + hy), 0.0f, 4))
+                continue;
+
+            lab::ImmDrawSprite& d = dst[kept++];
+            d.pos = v2f(s->x, s->y);
+            d.size = v2f(s->sx, s->sy);
+            d.sin = s->s;
+            d.cos = s->c;
+            if (whole_image)
+                d.uv = v4f(0, 1, 1, 0);     // flipped, as the batcher's lonely textures are
+            else
+                d.uv = v4f(s->minx, s->miny, s->maxx, s->maxy);
+        }
+        sprite_drawlist->SpriteUnreserve(count - kept);
+        sprite_drawlist->PopTextureID();
+    }
+
+    // Sprites order by the layer and depth packed in the top half of their
+    // sort bits, and then by texture, so that each layer and depth draws in as
+    // few batches as possible. The sort is stable, so sprites sharing all
+    // three keep their submission order.
+    static void sort_sprites(spritebatch_sprite_t* sprites, int count)
+    {
+        sprite_sort_items.resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            sprite_sort_items[i].key = (sprites[i].sort_bits & 0xffffffff00000000ull) | (sprites[i].texture_id & 0xffffffffull);
+            sprite_sort_items[i].index = (uint32_t) i;
         }
+        lab::Render::parallelRadixSortDraws(sprite_sort_items, sprite_sort_scratch);
+
+        sprite_sort_sprites.assign(sprites, sprites + count);
+        for (int i = 0; i < count; ++i)
+            sprites[i] = sprite_sort_sprites[sprite_sort_items[i].index];
     }
 
     // given the user supplied image_id, return the raw pixels for that image
     static void* get_pixels(SPRITEBATCH_U64 image_id)
     {
-        auto it = cached_sprites.find(image_id);
-        if (it == cached_sprites.end())
-            return nullptr;
-        return std::get<0>(it->second).get();
+        std::lock_guard<std::mutex> lock(cached_sprites_mutex);
+        const SpriteDesc* desc = find_sprite(image_id);
+        return desc ? desc->pixels.get() : nullptr;
     }
 
+    // the defrag thread stages its atlases; flush makes single textures on the GL thread
     static SPRITEBATCH_U64 generate_texture_handle(void* pixels, int w, int h)
     {
-        GLuint location;
-        glGenTextures(1, &location);
-        glBindTexture(GL_TEXTURE_2D, location);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        return (SPRITEBATCH_U64)location;
+        std::lock_guard<std::mutex> lock(sprite_textures.mutex);
+        uint64_t handle = sprite_textures.allocate();
+        if (on_defrag_thread)
+        {
+            const uint8_t* p = (const uint8_t*) pixels;
+            sprite_textures.staged.push_back({ handle, w, h, std::vector<uint8_t>(p, p + size_t(w) * h * 4), 0, 0 });
+        }
+        else
+            sprite_textures.names[handle - 1] = SpriteTextures::upload(pixels, w, h);
+        return handle;
     }
 
     static void destroy_texture_handle(SPRITEBATCH_U64 texture_id)
     {
-        GLuint id = (GLuint)texture_id;
-        glDeleteTextures(1, &id);
+        std::lock_guard<std::mutex> lock(sprite_textures.mutex);
+        if (on_defrag_thread)
+            sprite_textures.deleted.push_back(texture_id);
+        else
+            sprite_textures.release(texture_id);
+    }
+
+    void defrag_worker()
+    {
+        on_defrag_thread = true;
+        std::unique_lock<std::mutex> lock(defrag_mutex);
+        for (;;)
+        {
+            defrag_cv.wait(lock, [this]() { return defrag_requested || defrag_quit; });
+            if (defrag_quit)
+                return;
+
+            lock.unlock();
+            spritebatch_defrag(batch);
+            lock.lock();
+            defrag_requested = false;
+            defrag_cv.notify_all();
+        }
+    }
+
+    void wait_for_defrag()
+    {
+        std::unique_lock<std::mutex> lock(defrag_mutex);
+        defrag_cv.wait(lock, [this]() { return !defrag_requested; });
+    }
+
+    bool defrag_running()
+    {
+        std::lock_guard<std::mutex> lock(defrag_mutex);
+        return defrag_requested;
+    }
+
+    void start_defrag()
+    {
+        if (!defrag_thread.joinable())
+            defrag_thread = std::thread([this]() { defrag_worker(); });
+
+        std::lock_guard<std::mutex> lock(defrag_mutex);
+        defrag_requested = true;
+        defrag_cv.notify_all();
+    }
+
+    // While a defrag has the batch, the frame's sprites bypass it, and draw
+    // from textures of their own images in submission order within each
+    // layer and depth.
+    void submit_unbatched_sprites()
+    {
+        unbatched_sprites.resize(pending_sprites.size());
+        for (size_t i = 0; i < pending_sprites.size(); ++i)
+        {
+            const PendingSprite& p = pending_sprites[i];
+            spritebatch_sprite_t& s = unbatched_sprites[i];
+            s = spritebatch_sprite_t();
+            s.image_id = p.id;
+            s.sort_bits = ((SPRITEBATCH_U64) (uint32_t) p.sort_bits << 32) | (SPRITEBATCH_U64) i;
+            s.x = p.x; s.y = p.y;
+            s.sx = p.sx; s.sy = p.sy;
+            s.c = p.c; s.s = p.s;
+        }
+        pending_sprites.clear();
+
+        const int count = (int) unbatched_sprites.size();
+        sort_sprites(unbatched_sprites.data(), count);
+        sprite_drawlist = &dl;
+        submit_whole_images(unbatched_sprites.data(), count);
+        sprite_drawlist = nullptr;
     }
 
     void update_sprites()
     {
-        // Run tinyspritebatch to find sprite batches.
-        // This is the most basic usage of tinypsritebatch, one defrag, tick and flush per game loop.
-        // It is also possible to only use defrag once every N frames.
-        // tick can also be called at different time intervals (for example, once per game update
-        // but not necessarily once per screen render).
-        spritebatch_defrag(batch);
+        // Defrag packs atlases on the worker, from one flush until the first
+        // frame that finds it done. Frames that find it running don't wait,
+        // and the old atlases stay until it is done. Its atlases upload over
+        // as many frames as the budget needs, and the textures they replace
+        // are deleted at the first.
+        if (defrag_running())
+        {
+            submit_unbatched_sprites();
+            return;
+        }
+        sprite_textures.upload_staged(upload_budget);
+
+        for (const PendingSprite& s : pending_sprites)
+            spritebatch_push(batch, s.id, s.w, s.h, s.x, s.y, s.sx, s.sy, s.c, s.s, s.sort_bits);
+        pending_sprites.clear();
+
         spritebatch_tick(batch);
+        sprite_drawlist = &dl;
         spritebatch_flush(batch);
+        sprite_drawlist = nullptr;
+
+        // the next defrag waits until this one's atlases are all uploaded
+        if (!sprite_textures.uploading())
+            start_defrag();
+    }
+
+    // counts of the lists cleared by earlier renders
+    ImmRenderStats recorded;
+
+    static void add_stats(ImmRenderStats& stats, const lab::ImmDrawList& l)
+    {
+        stats.emitted_vertices += l.VtxBuffer.Size + 4 * (l.ShapeBuffer.Size + l.SpriteBuffer.Size);
+        stats.culled_primitives += l.CulledPrimitives;
+        stats.culled_vertices += l.CulledVertices;
+    }
+
+    // empties the lists for the next frame, keeping their allocations
+    void clear_lists()
+    {
+        auto clear = [this](lab::ImmDrawList& l)
+        {
+            add_stats(recorded, l);
+            l.Clear();
+            l.AddDrawCmd();
+            set_flag(l, lab::ImmDrawListFlags_AnalyticShapes, analytic_shapes);
+        };
+        clear(dl);
+        std::lock_guard<std::mutex> lock(thread_lists_mutex);
+        for (auto& l : thread_lists)
+            if (l)
+                clear(*l);
     }
 
 
     Detail()
     : dl(&dlsd)
     {
-        drawlist_ptr = &dl;
-
         spritebatch_set_default_config(&config);
         config.batch_callback = submit_batch;                       // report batches of sprites from `spritebatch_flush`
         config.get_pixels_callback = get_pixels;                    // used to retrieve image pixels from `spritebatch_flush` and `spritebatch_defrag`
         config.generate_texture_callback = generate_texture_handle; // used to generate a texture handle from `spritebatch_flush` and `spritebatch_defrag`
         config.delete_texture_callback = destroy_texture_handle;    // used to destroy a texture handle from `spritebatch_defrag`
+        config.sort_callback = sort_sprites;                        // orders sprites by layer, depth and texture before batching
 
         batch = spritebatch_create();
         spritebatch_init(batch, &config);
 
         dl.AddDrawCmd();               // initial command to coalesce verts/indices into
-        dd.CmdLists.push_back(&dl);    // just one command list for now.
     }
 
     ~Detail()
     {
+        if (defrag_thread.joinable())
+        {
+            wait_for_defrag();
+            {
+                std::lock_guard<std::mutex> lock(defrag_mutex);
+                defrag_quit = true;
+                defrag_cv.notify_all();
+            }
+            defrag_thread.join();
+        }
+        sprite_textures.discard_staged();
         spritebatch_term(batch);
         spritebatch_destroy(batch);
     }
@@ -1612,96 +3088,139 @@ ImmRenderContext::ImmRenderContext()
 
 ImmRenderContext::~ImmRenderContext() = default;
 
-void ImmRenderContext::sprite(lab::ImmSpriteId id, int depth, float s, float theta_radians, float x, float y) 
-{ 
-    constexpr uint64_t sortbits = 0;
-    constexpr float scale = 1.f;
+void ImmRenderContext::begin_thread_recording(int slot)
+{
+    IMM_ASSERT(slot >= 0);
+    thread_recording.context = _detail.get();
+    thread_recording.list = _detail->thread_list(slot);
+}
+
+void ImmRenderContext::end_thread_recording()
+{
+    thread_recording = ImmThreadRecording();
+}
 
-    auto it = cached_sprites.find(id);
-    if (it == cached_sprites.end())
+void ImmRenderContext::analytic_shapes(bool enable)
+{
+    std::lock_guard<std::mutex> lock(_detail->thread_lists_mutex);
+    _detail->analytic_shapes = enable;
+    Detail::set_flag(_detail->dl, lab::ImmDrawListFlags_AnalyticShapes, enable);
+    for (auto& l : _detail->thread_lists)
+        if (l)
+            Detail::set_flag(*l, lab::ImmDrawListFlags_AnalyticShapes, enable);
+}
+
+ImmRenderStats ImmRenderContext::stats() const
+{
+    ImmRenderStats stats = _detail->recorded;
+    Detail::add_stats(stats, _detail->dl);
+    std::lock_guard<std::mutex> lock(_detail->thread_lists_mutex);
+    for (auto& l : _detail->thread_lists)
+        if (l)
+            Detail::add_stats(stats, *l);
+    return stats;
+}
+
+void ImmRenderContext::sprite(lab::ImmSpriteId id, int depth, float s, float theta_radians, float x, float y, int layer)
+{
+    // layer in the top 8 bits and depth in the low 24, each biased so that
+    // negative values order before positive ones
+    layer = std::min(std::max(layer, -128), 127) + 128;
+    depth = std::min(std::max(depth, -(1 << 23)), (1 << 23) - 1) + (1 << 23);
+    const uint32_t sortbits = (uint32_t(layer) << 24) | uint32_t(depth);
+
+    const SpriteDesc* desc = find_sprite(id);
+    if (!desc)
         return;
 
-    int w = std::get<1>(it->second);
-    int h = std::get<2>(it->second);
+    int w = desc->w;
+    int h = desc->h;
 
     float sx = float(w) * s;  // premultiply scale by natural size
     float sy = float(h) * s;
 
-    spritebatch_push(_detail->batch, id, w, h, x, y, sx, sy, sinf(theta_radians), cosf(theta_radians), sortbits);
+    _detail->pending_sprites.push_back({ id, w, h, x, y, sx, sy, cosf(theta_radians), sinf(theta_radians), (int) sortbits });
+}
+
+void ImmRenderContext::sprite_upload_budget(size_t bytes)
+{
+    _detail->upload_budget = std::max(bytes, size_t(1));
 }
 
 // call render after everything is done to emit draw calls.
 void ImmRenderContext::render(int w, int h)
 { 
     _detail->update_sprites();
+    _detail->gather_lists();
     _detail->dd.Render(w, h);
+    _detail->clear_lists();
 }
 
-// Render-level scissoring. This is passed down to your render function but not used for CPU-side coarse clipping.
+// Render-level scissoring. Primitives entirely outside the clip rect are also culled on the CPU.
 void ImmRenderContext::push_clip_rect(v2f clip_rect_min, v2f clip_rect_max, bool intersect_with_current_clip_rect)
 {
-    _detail->dl.PushClipRect(clip_rect_min, clip_rect_max, intersect_with_current_clip_rect);
+    _detail->list().PushClipRect(clip_rect_min, clip_rect_max, intersect_with_current_clip_rect);
 }
-void ImmRenderContext::push_clip_rect_fullscreen() { _detail->dl.PushClipRectFullScreen(); }
-void ImmRenderContext::pop_clip_rect() { _detail->dl.PopClipRect(); }
+void ImmRenderContext::push_clip_rect_fullscreen() { _detail->list().PushClipRectFullScreen(); }
+void ImmRenderContext::pop_clip_rect() { _detail->list().PopClipRect(); }
 
-v2f  ImmRenderContext::clip_rect_min() const { return _detail->dl.GetClipRectMin(); }
-v2f  ImmRenderContext::clip_rect_max() const { return _detail->dl.GetClipRectMax(); }
+v2f  ImmRenderContext::clip_rect_min() const { return _detail->list().GetClipRectMin(); }
+v2f  ImmRenderContext::clip_rect_max() const { return _detail->list().GetClipRectMax(); }
 
-void ImmRenderContext::push_texture_id(lab::ImmTextureId texture_id) { _detail->dl.PushTextureID(texture_id); }
-void ImmRenderContext::pop_texture_id() { _detail->dl.PopTextureID(); }
+void ImmRenderContext::push_texture_id(lab::ImmTextureId texture_id) { _detail->list().PushTextureID(texture_id); }
+void ImmRenderContext::pop_texture_id() { _detail->list().PopTextureID(); }
 
 // Primitives
 void ImmRenderContext::line(const v2f& a, const v2f& b, uint32_t col, float thickness)
 {
-    _detail->dl.AddLine(a, b, col, thickness);
+    _detail->list().AddLine(a, b, col, thickness);
 }
 
 void ImmRenderContext::rectangle(const lab::v2f& p0, const lab::v2f& p1, uint32_t c,
     float rounding, int rounding_corners_flags,
     float thickness)
 {
-    _detail->dl.AddRect(p0, p1, c, rounding, rounding_corners_flags);
+    _detail->list().AddRect(p0, p1, c, rounding, rounding_corners_flags);
 }
 
 void ImmRenderContext::rectangle_filled(const lab::v2f& p0, const lab::v2f& p1, uint32_t c,
     float rounding, int rounding_corners_flags,
     float thickness)
 {
-    _detail->dl.AddRectFilled(p0, p1, c, rounding, rounding_corners_flags);
+    _detail->list().AddRectFilled(p0, p1, c, rounding, rounding_corners_flags);
 }
 
 void ImmRenderContext::rectangle_filled_multicolor(const lab::v2f& p0, const lab::v2f& p1,
     uint32_t a, uint32_t b, uint32_t c, uint32_t d)
 {
-    _detail->dl.AddRectFilledMultiColor(p0, p1, a, b, c, d);
+    _detail->list().AddRectFilledMultiColor(p0, p1, a, b, c, d);
 }
 
 void ImmRenderContext::quad(const v2f& a, const v2f& b, const v2f& c, const v2f& d, uint32_t col, float thickness)
 {
-    _detail->dl.AddQuad(a, b, c, d, col, thickness);
+    _detail->list().AddQuad(a, b, c, d, col, thickness);
 }
 void ImmRenderContext::quad_filled(const v2f& a, const v2f& b, const v2f& c, const v2f& d, uint32_t col)
 {
-    _detail->dl.AddQuadFilled(a, b, c, d, col);
+    _detail->list().AddQuadFilled(a, b, c, d, col);
 }
 
 void ImmRenderContext::triangle(const v2f& a, const v2f& b, const v2f& c, uint32_t col, float thickness)
 {
-    _detail->dl.AddTriangle(a, b, c, col, thickness);
+    _detail->list().AddTriangle(a, b, c, col, thickness);
 }
 void ImmRenderContext::triangle_filled(const v2f& a, const v2f& b, const v2f& c, uint32_t col)
 {
-    _detail->dl.AddTriangleFilled(a, b, c, col);
+    _detail->list().AddTriangleFilled(a, b, c, col);
 }
 
 void ImmRenderContext::circle(const v2f& centre, float radius, uint32_t col, int num_segments, float thickness)
 {
-    _detail->dl.AddCircle(centre, radius, col, num_segments, thickness);
+    _detail->list().AddCircle(centre, radius, col, num_segments, thickness);
 }
 void ImmRenderContext::circle_filled(const v2f& centre, float radius, uint32_t col, int num_segments)
 {
-    _detail->dl.AddCircleFilled(centre, radius, col, num_segments);
+    _detail->list().AddCircleFilled(centre, radius, col, num_segments);
 }
 
 //   LR_API void  AddText(const v2f& pos, uint32_t col, const char* text_begin, const char* text_end = NULL);
@@ -1711,62 +3230,75 @@ void ImmRenderContext::image(lab::ImmTextureId user_texture_id,
     const v2f& a, const v2f& b,
     const v2f& uv_a, const v2f& uv_b, uint32_t col)
 {
-    _detail->dl.AddImage(user_texture_id, a, b, uv_a, uv_b, col);
+    _detail->list().AddImage(user_texture_id, a, b, uv_a, uv_b, col);
 }
 void ImmRenderContext::image_quad(lab::ImmTextureId user_texture_id,
     const v2f& a, const v2f& b, const v2f& c, const v2f& d,
     const v2f& uv_a, const v2f& uv_b,
     const v2f& uv_c, const v2f& uv_d, uint32_t col)
 {
-    _detail->dl.AddImageQuad(user_texture_id, a, b, c, d, uv_a, uv_b, uv_c, uv_d, col);
+    _detail->list().AddImageQuad(user_texture_id, a, b, c, d, uv_a, uv_b, uv_c, uv_d, col);
 }
 void ImmRenderContext::image_rounded(lab::ImmTextureId user_texture_id,
     const v2f& a, const v2f& b,
     const v2f& uv_a, const v2f& uv_b, uint32_t col,
     float rounding, int rounding_corners)
 {
-    _detail->dl.AddImageRounded(user_texture_id, a, b, uv_a, uv_b, col, rounding, rounding_corners);
+    _detail->list().AddImageRounded(user_texture_id, a, b, uv_a, uv_b, col, rounding, rounding_corners);
 }
 
 void ImmRenderContext::poly_line(const v2f* points, const int num_points, uint32_t col, bool closed, float thickness)
 {
-    _detail->dl.AddPolyline(points, num_points, col, closed, thickness);
+    _detail->list().AddPolyline(points, num_points, col, closed, thickness);
 }
 void ImmRenderContext::poly_convex_filled(const v2f* points, const int num_points, uint32_t col)
 {
-    _detail->dl.AddConvexPolyFilled(points, num_points, col);
+    _detail->list().AddConvexPolyFilled(points, num_points, col);
 }
+void ImmRenderContext::circles_filled(int count, const float* x, const float* y, const float* radius, const uint32_t* col, int num_segments)
+{
+    _detail->list().AddCirclesFilled(count, x, y, radius, col, num_segments);
+}
+void ImmRenderContext::lines(int count, const float* x0, const float* y0, const float* x1, const float* y1, const uint32_t* col, float thickness)
+{
+    _detail->list().AddLines(count, x0, y0, x1, y1, col, thickness);
+}
+void ImmRenderContext::rectangles_filled(int count, const float* x0, const float* y0, const float* x1, const float* y1, const uint32_t* col)
+{
+    _detail->list().AddRectsFilled(count, x0, y0, x1, y1, col);
+}
+
 void ImmRenderContext::bezier(const v2f& pos0, const v2f& cp0, const v2f& cp1, const v2f& pos1, uint32_t col,
     float thickness, int num_segments)
 {
-    _detail->dl.AddBezierCurve(pos0, cp0, cp1, pos1, col, thickness, num_segments);
+    _detail->list().AddBezierCurve(pos0, cp0, cp1, pos1, col, thickness, num_segments);
 }
 
 // Stateful path API, add points then finish with PathFill() or PathStroke()
-void ImmRenderContext::path_clear() { _detail->dl.PathClear(); }
-void ImmRenderContext::path_line_to(const v2f& pos) { _detail->dl.PathLineTo(pos); }
-void ImmRenderContext::path_fill_convex(uint32_t col) { _detail->dl.PathFillConvex(col); }
+void ImmRenderContext::path_clear() { _detail->list().PathClear(); }
+void ImmRenderContext::path_line_to(const v2f& pos) { _detail->list().PathLineTo(pos); }
+void ImmRenderContext::path_fill_convex(uint32_t col) { _detail->list().PathFillConvex(col); }
 void ImmRenderContext::path_stroke(uint32_t col, bool closed, float thickness) 
 { 
-    _detail->dl.PathStroke(col, closed, thickness); 
+    _detail->list().PathStroke(col, closed, thickness); 
 }
 
 void ImmRenderContext::path_arc_to(const v2f& centre, float radius, float a_min, float a_max, int num_segments)
 {
-    _detail->dl.PathArcTo(centre, radius, a_min, a_max, num_segments);
+    _detail->list().PathArcTo(centre, radius, a_min, a_max, num_segments);
 }
 void ImmRenderContext::path_arc_to_coarse(const v2f& centre, float radius, int a_min_of_12, int a_max_of_12)
 {
-    _detail->dl.PathArcToFast(centre, radius, a_min_of_12, a_max_of_12);
+    _detail->list().PathArcToFast(centre, radius, a_min_of_12, a_max_of_12);
 }
 void ImmRenderContext::path_bezier_curve_to(const v2f& p1, const v2f& p2, const v2f& p3, int num_segments)
 {
-    _detail->dl.PathBezierCurveTo(p1, p2, p3, num_segments);
+    _detail->list().PathBezierCurveTo(p1, p2, p3, num_segments);
 }
 void ImmRenderContext::path_rect(const v2f& rect_min, const v2f& rect_max,
     float rounding, int rounding_corners_flags)
 {
-    _detail->dl.PathRect(rect_min, rect_max, rounding, rounding_corners_flags);
+    _detail->list().PathRect(rect_min, rect_max, rounding, rounding_corners_flags);
 }
 
 
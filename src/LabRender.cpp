@@ -1,5 +1,4 @@
-
-#ifdef _WINDOWS
+#ifndef __APPLE__
 #include "GL/gl3w.h"
 #include <stdio.h>
 #endif
@@ -7,11 +6,14 @@
 extern "C"
 int labrender_init()
 {
-#ifdef _WINDOWS
+#ifndef __APPLE__
+    // elsewhere gl3w only provides glProcAddress; GL itself is linked
     if (gl3wInit()) {
         fprintf(stderr, "labrender_init(): failed to initialize OpenGL\n");
         return -1;
     }
+#endif
+#ifdef _WINDOWS
     if (!gl3wIsSupported(4, 2)) {
         fprintf(stderr, "labrender_init(): OpenGL 4.2 not supported\n");
         return -1;
@@ -28,3 +30,14 @@ extern "C"
 void labrender_shutdown()
 {
 }
+
+// declared in gl4.h
+void (*glProcAddress(const char* name))(void)
+{
+#ifdef __APPLE__
+    (void) name;
+    return nullptr;
+#else
+    return gl3wGetProcAddress(name);
+#endif
+}
@@ -0,0 +1,218 @@
+//
+//  MappedFile.cpp
+//  LabRender
+//
+
+#include "LabRender/MappedFile.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+
+#ifdef _WIN32
+# define NOMINMAX
+# include <Windows.h>
+# include <direct.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace lab {
+
+class MappedFile::Detail
+{
+public:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+    void* data = nullptr;
+    size_t size = 0;
+
+    ~Detail()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (data)
+            munmap(data, size);
+#endif
+    }
+
+    bool open(const string & path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file, &sz) || !sz.QuadPart)
+            return false;
+
+        size = size_t(sz.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return false;
+
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        return !!data;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !st.st_size)
+        {
+            close(fd);
+            return false;
+        }
+
+        size = size_t(st.st_size);
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+
+        data = p;
+        return true;
+#endif
+    }
+};
+
+MappedFile::MappedFile()
+: _detail(new Detail())
+{
+}
+
+MappedFile::~MappedFile()
+{
+    delete _detail;
+}
+
+bool MappedFile::open(const std::string & path)
+{
+    delete _detail;
+    _detail = new Detail();
+    if (_detail->open(path))
+        return true;
+
+    delete _detail;
+    _detail = new Detail();
+    return false;
+}
+
+const uint8_t* MappedFile::data() const
+{
+    return static_cast<const uint8_t*>(_detail->data);
+}
+
+size_t MappedFile::size() const
+{
+    return _detail->data ? _detail->size : 0;
+}
+
+bool stampFile(const std::string & path, FileStamp & stamp)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    stamp.size = uint64_t(st.st_size);
+
+    // whole seconds would miss an edit made within a second of the last one
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+    int64_t ticks = int64_t((uint64_t(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+                            attributes.ftLastWriteTime.dwLowDateTime);
+    stamp.modified = (ticks - 116444736000000000ll) * 100;     // 100 ns ticks from 1601
+#elif defined(__APPLE__)
+    stamp.modified = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.modified = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+bool makeDirectories(const std::string & dir)
+{
+    for (size_t i = 1; i <= dir.length(); ++i)
+    {
+        if (i < dir.length() && dir[i] != '/' && dir[i] != '\\')
+            continue;
+
+        string partial = dir.substr(0, i);
+#ifdef _WIN32
+        _mkdir(partial.c_str());
+#else
+        mkdir(partial.c_str(), 0755);
+#endif
+    }
+
+    struct stat st;
+    return stat(dir.c_str(), &st) == 0;
+}
+
+std::string cacheDirectory(char const*const envVar, char const*const name)
+{
+    if (const char* env = getenv(envVar))
+        return env;
+
+    const char* tmp = getenv("TMPDIR");
+    if (!tmp)
+        tmp = getenv("TEMP");
+    if (!tmp)
+        tmp = "/tmp";
+    return string(tmp) + "/LabRender/" + name;
+}
+
+std::string cacheFilePath(const std::string & dir, const std::string & sourcePath, char const*const extension)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (char c : sourcePath)
+    {
+        h ^= uint8_t(c);
+        h *= 1099511628211ull;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long) h, extension);
+    return dir + "/" + name;
+}
+
+bool writeFileAtomically(const std::string & path, const std::function<bool(FILE*)> & write)
+{
+    string tmp = path + "." + to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+
+    bool ok = write(f);
+    ok = fclose(f) == 0 && ok;
+
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // lab
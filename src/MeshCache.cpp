@@ -0,0 +1,301 @@
+//
+//  MeshCache.cpp
+//  LabRender
+//
+
+#include "LabRender/MeshCache.h"
+#include "LabRender/MappedFile.h"
+#include "LabRender/Utils.h"
+
+#include <iostream>
+#include <mutex>
+#include <string.h>
+
+using namespace std;
+
+namespace lab { namespace Render {
+
+namespace {
+
+    const char cacheMagic[4] = { 'L', 'R', 'M', 'S' };
+    const uint32_t cacheVersion = 3;
+    const size_t cacheAlignment = 16;
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t partCount;
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceModified;
+    };
+
+    struct CachePart
+    {
+        float boundsMin[3];
+        float boundsMax[3];
+        uint32_t vertexStride;
+        uint32_t attributeCount;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t attributeOffset;   // offsets are from the start of the file
+        uint64_t materialOffset;
+        uint64_t materialLength;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+    };
+
+    struct CacheAttribute
+    {
+        char name[56];              // nul terminated
+        uint32_t semanticType;
+        uint16_t elementType;
+        uint16_t normalized;
+    };
+
+    size_t align(size_t offset)
+    {
+        return (offset + cacheAlignment - 1) & ~(cacheAlignment - 1);
+    }
+
+    mutex cacheDirectoryMutex;
+    string meshCacheDir = cacheDirectory("LABRENDER_MESH_CACHE", "meshes");
+
+    // vertices read in place from a mapped cache file, which the buffer keeps
+    // open for as long as it might be uploaded
+    class MappedVertexBuffer : public BufferBase
+    {
+        shared_ptr<MappedFile> _file;
+        const uint8_t* _data;
+        size_t _count;
+        int _stride;
+
+    public:
+        MappedVertexBuffer(shared_ptr<MappedFile> file, const uint8_t* data, size_t count, int stride)
+        : BufferBase(BufferType::VertexBuffer), _file(file), _data(data), _count(count), _stride(stride) {}
+        virtual ~MappedVertexBuffer() {}
+
+        virtual void * buffer() const override { return (void*) _data; }
+        virtual size_t count() const override { return _count; }
+        virtual int stride() const override { return _stride; }
+    };
+
+    bool inFile(const MappedFile & file, uint64_t offset, uint64_t size)
+    {
+        return offset <= file.size() && size <= file.size() - offset;
+    }
+
+    shared_ptr<Model> mapCache(const string & path, const FileStamp & stamp)
+    {
+        shared_ptr<MappedFile> file = make_shared<MappedFile>();
+        if (!file->open(path) || file->size() < sizeof(CacheHeader))
+            return nullptr;
+
+        const uint8_t* base = file->data();
+        CacheHeader header;
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, cacheMagic, 4) || header.version != cacheVersion ||
+            header.sourceSize != stamp.size || header.sourceModified != stamp.modified ||
+            !header.partCount || !inFile(*file, sizeof(CacheHeader), uint64_t(header.partCount) * sizeof(CachePart)))
+            return nullptr;
+
+        auto model = make_shared<Model>();
+        for (uint32_t i = 0; i < header.partCount; ++i)
+        {
+            CachePart part;
+            memcpy(&part, base + sizeof(CacheHeader) + i * sizeof(CachePart), sizeof(part));
+            if (!part.vertexStride || !part.attributeCount ||
+                !inFile(*file, part.attributeOffset, part.attributeCount * sizeof(CacheAttribute)) ||
+                !inFile(*file, part.materialOffset, part.materialLength) ||
+                part.vertexCount > file->size() / part.vertexStride ||
+                !inFile(*file, part.vertexOffset, part.vertexCount * part.vertexStride) ||
+                part.indexCount > file->size() / sizeof(uint32_t) ||
+                !inFile(*file, part.indexOffset, part.indexCount * sizeof(uint32_t)))
+                return nullptr;
+
+            // attributes are packed, so their sizes must add up to the stride
+            auto vertices = make_shared<MappedVertexBuffer>(file, base + part.vertexOffset,
+                                                            size_t(part.vertexCount), int(part.vertexStride));
+            uint64_t attributeBytes = 0;
+            for (uint32_t a = 0; a < part.attributeCount; ++a)
+            {
+                CacheAttribute attribute;
+                memcpy(&attribute, base + part.attributeOffset + a * sizeof(CacheAttribute), sizeof(attribute));
+                attribute.name[sizeof(attribute.name) - 1] = '\0';
+                if (attribute.elementType > uint16_t(BufferBase::ElementType::i2_10_10_10))
+                    return nullptr;
+                vertices->layout.push_back(BufferBase::Layout(attribute.name, SemanticType(attribute.semanticType),
+                                                              BufferBase::ElementType(attribute.elementType),
+                                                              attribute.normalized != 0));
+                attributeBytes += vertices->layout.back().size();
+            }
+            if (attributeBytes != part.vertexStride)
+                return nullptr;
+
+            // an index past the vertices would have the GPU read beyond the buffer
+            const uint32_t* index = reinterpret_cast<const uint32_t*>(base + part.indexOffset);
+            for (uint64_t j = 0; j < part.indexCount; ++j)
+                if (index[j] >= part.vertexCount)
+                    return nullptr;
+
+            auto indices = make_shared<IndexBuffer>();
+            indices->assign(index, index + part.indexCount);
+
+            unique_ptr<VAO> vao(new VAO(vertices));
+            vao->setIndices(indices);
+
+            Bounds bounds;
+            bounds.first = { part.boundsMin[0], part.boundsMin[1], part.boundsMin[2] };
+            bounds.second = { part.boundsMax[0], part.boundsMax[1], part.boundsMax[2] };
+
+            auto mesh = make_shared<ModelPart>();
+            mesh->setVAO(std::move(vao), bounds);
+            mesh->materialName.assign(reinterpret_cast<const char*>(base + part.materialOffset), size_t(part.materialLength));
+            model->addPart(mesh);
+        }
+        return model;
+    }
+
+} // anon
+
+void setMeshCacheDirectory(const std::string & dir)
+{
+    lock_guard<mutex> lock(cacheDirectoryMutex);
+    meshCacheDir = dir;
+}
+
+std::string meshCacheDirectory()
+{
+    lock_guard<mutex> lock(cacheDirectoryMutex);
+    return meshCacheDir;
+}
+
+std::string meshCachePath(const std::string & meshPath)
+{
+    string dir = meshCacheDirectory();
+    if (dir.empty())
+        return string();
+
+    return cacheFilePath(dir, lab::expandPath(meshPath.c_str()), "lrmesh");
+}
+
+std::shared_ptr<Model> loadMeshCache(const std::string & meshPath)
+{
+    string path = lab::expandPath(meshPath.c_str());
+    string cachePath = meshCachePath(path);
+
+    FileStamp stamp;
+    if (cachePath.empty() || !stampFile(path, stamp))
+        return nullptr;
+
+    return mapCache(cachePath, stamp);
+}
+
+bool writeMeshCache(const std::string & meshPath, const Model & model)
+{
+    string path = lab::expandPath(meshPath.c_str());
+    string cachePath = meshCachePath(path);
+
+    FileStamp stamp;
+    if (cachePath.empty() || !stampFile(path, stamp))
+        return false;
+
+    struct Source
+    {
+        vector<CacheAttribute> attributes;
+        const ModelPart* part;
+        BufferBase* vertices;
+        BufferBase* indices;
+    };
+
+    vector<ModelBase*> parts;
+    for (auto & p : model.parts())
+        parts.push_back(p.get());
+    if (parts.empty())
+        return false;
+
+    vector<Source> sources(parts.size());
+    vector<CachePart> table(parts.size());
+    size_t offset = align(sizeof(CacheHeader) + table.size() * sizeof(CachePart));
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        Source & s = sources[i];
+        s.part = dynamic_cast<const ModelPart*>(parts[i]);
+        VAO* vao = s.part ? s.part->verts() : nullptr;
+        s.vertices = vao ? vao->vertexBuffer().get() : nullptr;
+        s.indices = vao ? vao->indexBuffer().get() : nullptr;
+        if (!s.vertices || !s.indices || s.indices->stride() != sizeof(uint32_t) || s.vertices->layout.empty())
+            return false;
+
+        for (auto & l : s.vertices->layout)
+        {
+            CacheAttribute attribute = {};
+            if (l.name.length() >= sizeof(attribute.name))
+                return false;
+            memcpy(attribute.name, l.name.c_str(), l.name.length());
+            attribute.semanticType = uint32_t(l.semanticType);
+            attribute.elementType = uint16_t(l.elementType);
+            attribute.normalized = l.normalized ? 1 : 0;
+            s.attributes.push_back(attribute);
+        }
+
+        Bounds bounds = s.part->localBounds();
+        CachePart & t = table[i];
+        t.boundsMin[0] = bounds.first.x;  t.boundsMin[1] = bounds.first.y;  t.boundsMin[2] = bounds.first.z;
+        t.boundsMax[0] = bounds.second.x; t.boundsMax[1] = bounds.second.y; t.boundsMax[2] = bounds.second.z;
+        t.vertexStride = uint32_t(s.vertices->stride());
+        t.attributeCount = uint32_t(s.attributes.size());
+        t.vertexCount = s.vertices->count();
+        t.indexCount = s.indices->count();
+
+        t.attributeOffset = offset;
+        offset = align(offset + s.attributes.size() * sizeof(CacheAttribute));
+        t.materialOffset = offset;
+        t.materialLength = s.part->materialName.length();
+        offset = align(offset + s.part->materialName.length());
+        t.vertexOffset = offset;
+        offset = align(offset + t.vertexCount * t.vertexStride);
+        t.indexOffset = offset;
+        offset = align(offset + t.indexCount * sizeof(uint32_t));
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, cacheMagic, 4);
+    header.version = cacheVersion;
+    header.partCount = uint32_t(table.size());
+    header.reserved = 0;
+    header.sourceSize = stamp.size;
+    header.sourceModified = stamp.modified;
+
+    if (!makeDirectories(meshCacheDirectory()))
+        return false;
+
+    return writeFileAtomically(cachePath, [&](FILE* f)
+    {
+        static const uint8_t padding[cacheAlignment] = {};
+        size_t written = 0;
+        auto put = [&](uint64_t at, const void* data, size_t size)
+        {
+            if (fwrite(padding, 1, size_t(at) - written, f) != size_t(at) - written)
+                return false;
+            written = size_t(at) + size;
+            return !size || fwrite(data, 1, size, f) == size;
+        };
+
+        bool ok = put(0, &header, sizeof(header));
+        ok = ok && put(sizeof(header), table.data(), table.size() * sizeof(CachePart));
+        for (size_t i = 0; ok && i < table.size(); ++i)
+        {
+            const Source & s = sources[i];
+            const CachePart & t = table[i];
+            ok = put(t.attributeOffset, s.attributes.data(), s.attributes.size() * sizeof(CacheAttribute));
+            ok = ok && put(t.materialOffset, s.part->materialName.data(), s.part->materialName.length());
+            ok = ok && put(t.vertexOffset, s.vertices->buffer(), size_t(t.vertexCount * t.vertexStride));
+            ok = ok && put(t.indexOffset, s.indices->buffer(), size_t(t.indexCount * sizeof(uint32_t)));
+        }
+        return ok;
+    });
+}
+
+}} // lab::Render
@@ -0,0 +1,282 @@
+//
+//  MeshOptimizer.cpp
+//  LabRender
+//
+
+#include "LabRender/MeshOptimizer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+namespace lab { namespace Render {
+
+namespace {
+
+    const uint32_t emptySlot = ~0u;
+
+    // the cache Forsyth's scores model; its exact size matters little
+    const int scoredCacheSize = 32;
+    const int scoredMaxValence = 32;
+    const float cacheDecayPower = 1.5f;
+    const float lastTriangleScore = 0.75f;
+    const float valenceBoostScale = 2.f;
+    const float valenceBoostPower = 0.5f;
+
+    uint32_t hashBytes(const uint8_t* p, size_t size)
+    {
+        // murmur2 over whole words, then the remaining bytes
+        const uint32_t m = 0x5bd1e995;
+        uint32_t h = uint32_t(size);
+        for (; size >= 4; p += 4, size -= 4)
+        {
+            uint32_t k;
+            memcpy(&k, p, 4);
+            k *= m;
+            k ^= k >> 24;
+            k *= m;
+            h = (h * m) ^ k;
+        }
+        for (; size; ++p, --size)
+            h = (h ^ *p) * m;
+
+        h ^= h >> 13;
+        h *= m;
+        h ^= h >> 15;
+        return h;
+    }
+
+    struct VertexScores
+    {
+        float cache[scoredCacheSize];
+        float valence[scoredMaxValence + 1];
+
+        VertexScores()
+        {
+            for (int i = 0; i < scoredCacheSize; ++i)
+            {
+                // the last triangle's vertices score the same whatever order
+                // they were used in, so that the next triangle needn't follow it
+                if (i < 3)
+                    cache[i] = lastTriangleScore;
+                else
+                    cache[i] = powf(1.f - float(i - 3) / float(scoredCacheSize - 3), cacheDecayPower);
+            }
+
+            // vertices with few remaining triangles are finished off first
+            valence[0] = 0;
+            for (int i = 1; i <= scoredMaxValence; ++i)
+                valence[i] = valenceBoostScale * powf(float(i), -valenceBoostPower);
+        }
+
+        float score(int cachePosition, uint32_t remaining) const
+        {
+            if (!remaining)
+                return -1.f;
+            float s = cachePosition >= 0 ? cache[cachePosition] : 0.f;
+            return s + valence[std::min(remaining, uint32_t(scoredMaxValence))];
+        }
+    };
+
+} // anon
+
+size_t indexVertices(void* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indices)
+{
+    uint8_t* data = static_cast<uint8_t*>(vertices);
+
+    size_t buckets = 1;
+    while (buckets < vertexCount + vertexCount / 4)
+        buckets *= 2;
+    std::vector<uint32_t> table(buckets, emptySlot);
+
+    // unique vertices are copied down as they are found, so every vertex the
+    // table refers to has already reached its final slot
+    size_t unique = 0;
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        const uint8_t* v = data + i * vertexSize;
+        size_t slot = hashBytes(v, vertexSize) & (buckets - 1);
+        for (size_t probe = 1; ; ++probe)
+        {
+            uint32_t entry = table[slot];
+            if (entry == emptySlot)
+            {
+                if (unique != i)
+                    memcpy(data + unique * vertexSize, v, vertexSize);
+                table[slot] = uint32_t(unique);
+                indices[i] = uint32_t(unique++);
+                break;
+            }
+            if (!memcmp(data + entry * vertexSize, v, vertexSize))
+            {
+                indices[i] = entry;
+                break;
+            }
+            slot = (slot + probe) & (buckets - 1);
+        }
+    }
+    return unique;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+    static const VertexScores scores;
+
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+
+    // the triangles using each vertex; each list keeps its live triangles first
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        ++remaining[indices[i]];
+
+    std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    {
+        std::vector<uint32_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; ++i)
+            adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        vertexScore[v] = scores.score(-1, remaining[v]);
+
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> result(triangleCount * 3);
+
+    uint32_t cache[scoredCacheSize + 3];
+    uint32_t nextCache[scoredCacheSize + 3];
+    int cacheSize = 0;
+
+    size_t best = size_t(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+    size_t cursor = 0;
+
+    for (size_t out = 0; out < triangleCount; ++out)
+    {
+        if (best == size_t(-1))
+        {
+            // nothing in the cache has triangles left, so start a new patch
+            // at the next unemitted triangle
+            while (emitted[cursor])
+                ++cursor;
+            best = cursor;
+        }
+
+        const uint32_t* tri = indices + best * 3;
+        memcpy(&result[out * 3], tri, 3 * sizeof(uint32_t));
+        emitted[best] = 1;
+
+        // retire the triangle from its vertices' live lists
+        for (int c = 0; c < 3; ++c)
+        {
+            uint32_t v = tri[c];
+            uint32_t* list = &adjacency[adjacencyStart[v]];
+            uint32_t live = remaining[v];
+            for (uint32_t i = 0; i < live; ++i)
+                if (list[i] == best)
+                {
+                    std::swap(list[i], list[live - 1]);
+                    break;
+                }
+            --remaining[v];
+        }
+
+        // the triangle's vertices move to the front of the cache
+        int nextSize = 0;
+        for (int c = 0; c < 3; ++c)
+            if (std::find(nextCache, nextCache + nextSize, tri[c]) == nextCache + nextSize)
+                nextCache[nextSize++] = tri[c];
+        for (int i = 0; i < cacheSize; ++i)
+            if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+                nextCache[nextSize++] = cache[i];
+
+        // rescore the vertices whose position changed, including those just
+        // evicted, and pass the changes on to their live triangles
+        for (int i = 0; i < nextSize; ++i)
+        {
+            uint32_t v = nextCache[i];
+            int position = i < scoredCacheSize ? i : -1;
+            cachePosition[v] = position;
+            float score = scores.score(position, remaining[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            const uint32_t* list = &adjacency[adjacencyStart[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j)
+                triangleScore[list[j]] += delta;
+        }
+
+        cacheSize = std::min(nextSize, scoredCacheSize);
+        memcpy(cache, nextCache, cacheSize * sizeof(uint32_t));
+
+        // the next triangle is the best one touching the cache
+        best = size_t(-1);
+        float bestScore = -1e30f;
+        for (int i = 0; i < cacheSize; ++i)
+        {
+            uint32_t v = cache[i];
+            const uint32_t* list = &adjacency[adjacencyStart[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j)
+                if (triangleScore[list[j]] > bestScore)
+                {
+                    bestScore = triangleScore[list[j]];
+                    best = list[j];
+                }
+        }
+    }
+
+    memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize,
+                           uint32_t* indices, size_t indexCount)
+{
+    std::vector<uint32_t> remap(vertexCount, emptySlot);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t& r = remap[indices[i]];
+        if (r == emptySlot)
+            r = next++;
+        indices[i] = r;
+    }
+
+    uint8_t* data = static_cast<uint8_t*>(vertices);
+    std::vector<uint8_t> source(data, data + vertexCount * vertexSize);
+    for (size_t v = 0; v < vertexCount; ++v)
+        if (remap[v] != emptySlot)
+            memcpy(data + remap[v] * vertexSize, &source[v * vertexSize], vertexSize);
+
+    return next;
+}
+
+float averageCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize)
+{
+    size_t triangleCount = indexCount / 3;
+    if (!triangleCount)
+        return 0.f;
+
+    // a vertex is resident while fewer than cacheSize misses follow its own
+    std::vector<size_t> missedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+    {
+        size_t& stamp = missedAt[indices[i]];
+        if (!stamp || misses - stamp >= size_t(cacheSize))
+            stamp = ++misses;
+    }
+    return float(misses) / float(triangleCount);
+}
+
+}} // lab::Render
@@ -0,0 +1,462 @@
+//
+//  MipChain.cpp
+//  LabRender
+//
+
+#include "LabRender/MipChain.h"
+#include "LabRender/Utils.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+namespace lab { namespace Render {
+
+namespace {
+
+    const float kaiserWidth = 3.f;  // in destination texels
+    const float kaiserAlpha = 4.f;
+
+    int channelCount(TextureType t)
+    {
+        switch (t) {
+            case TextureType::f32x1: case TextureType::f16x1:
+            case TextureType::u8x1:  case TextureType::s8x1: return 1;
+            case TextureType::f32x2: case TextureType::f16x2:
+            case TextureType::u8x2:  case TextureType::s8x2: return 2;
+            case TextureType::f32x3: case TextureType::f16x3:
+            case TextureType::u8x3:  case TextureType::s8x3: return 3;
+            case TextureType::f32x4: case TextureType::f16x4:
+            case TextureType::u8x4:  case TextureType::s8x4: return 4;
+            default: return 0;
+        }
+    }
+
+    size_t channelBytes(TextureType t)
+    {
+        switch (t) {
+            case TextureType::f32x1: case TextureType::f32x2:
+            case TextureType::f32x3: case TextureType::f32x4: return 4;
+            case TextureType::f16x1: case TextureType::f16x2:
+            case TextureType::f16x3: case TextureType::f16x4: return 2;
+            default: return 1;
+        }
+    }
+
+    bool isU8(TextureType t)
+    {
+        return t == TextureType::u8x1 || t == TextureType::u8x2 || t == TextureType::u8x3 || t == TextureType::u8x4;
+    }
+
+    bool isS8(TextureType t)
+    {
+        return t == TextureType::s8x1 || t == TextureType::s8x2 || t == TextureType::s8x3 || t == TextureType::s8x4;
+    }
+
+    float srgbToLinear(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    // sRGB decoding, and the linear values halfway between adjacent sRGB codes
+    // so that encoding rounds to the nearest code in sRGB space
+    struct SrgbTables
+    {
+        float toLinear[256];
+        float threshold[255];
+        uint8_t guess[4096];
+
+        SrgbTables()
+        {
+            for (int i = 0; i < 256; ++i)
+                toLinear[i] = srgbToLinear(i / 255.f);
+            for (int i = 0; i < 255; ++i)
+                threshold[i] = srgbToLinear((i + 0.5f) / 255.f);
+
+            int code = 0;
+            for (int i = 0; i < 4096; ++i)
+            {
+                float l = i / 4095.f;
+                while (code < 255 && l >= threshold[code])
+                    ++code;
+                guess[i] = uint8_t(code);
+            }
+        }
+
+        uint8_t encode(float l) const
+        {
+            l = std::min(1.f, std::max(0.f, l));
+            int code = guess[int(l * 4095.f)];
+            while (code < 255 && l >= threshold[code])
+                ++code;
+            while (code > 0 && l < threshold[code - 1])
+                --code;
+            return uint8_t(code);
+        }
+    };
+
+    const SrgbTables & srgbTables()
+    {
+        static SrgbTables tables;
+        return tables;
+    }
+
+    float bessel0(float x)
+    {
+        float sum = 1.f, term = 1.f;
+        for (int k = 1; k < 32; ++k)
+        {
+            float t = x / (2.f * k);
+            term *= t * t;
+            sum += term;
+            if (term < sum * 1e-8f)
+                break;
+        }
+        return sum;
+    }
+
+    float kaiser(float x)
+    {
+        float r = x / kaiserWidth;
+        if (r <= -1.f || r >= 1.f)
+            return 0.f;
+
+        float px = 3.14159265f * x;
+        float sinc = fabsf(px) < 1e-6f ? 1.f : sinf(px) / px;
+        return sinc * bessel0(kaiserAlpha * sqrtf(1.f - r * r)) / bessel0(kaiserAlpha);
+    }
+
+    // the source texels, clamped to the edge, and weights of each output
+    // texel along one axis
+    struct AxisTaps
+    {
+        int taps = 0;
+        std::vector<int> index;
+        std::vector<float> weight;
+    };
+
+    AxisTaps axisTaps(int src, int dst, MipFilter filter)
+    {
+        float scale = float(src) / float(dst);
+        float radius = filter == MipFilter::box ? scale * 0.5f : scale * kaiserWidth;
+        int span = int(ceilf(radius * 2.f)) + 1;
+
+        std::vector<int> first(dst);
+        std::vector<float> weight(size_t(dst) * span);
+        int taps = 1;
+        for (int i = 0; i < dst; ++i)
+        {
+            float center = (i + 0.5f) * scale;
+            first[i] = int(floorf(center - radius));
+
+            float sum = 0.f;
+            int used = 0;
+            for (int k = 0; k < span; ++k)
+            {
+                float j = float(first[i] + k);
+                float w;
+                if (filter == MipFilter::box)
+                    w = std::max(0.f, std::min(j + 1.f, center + radius) - std::max(j, center - radius));
+                else
+                    w = kaiser((j + 0.5f - center) / scale);
+
+                weight[size_t(i) * span + k] = w;
+                sum += w;
+                if (w != 0.f)
+                    used = k + 1;
+            }
+            for (int k = 0; k < span; ++k)
+                weight[size_t(i) * span + k] /= sum;
+
+            taps = std::max(taps, used);
+        }
+
+        // trailing taps that are zero for every texel are dropped, so an even
+        // box reduction reads exactly two texels
+        AxisTaps t;
+        t.taps = taps;
+        t.index.resize(size_t(dst) * taps);
+        t.weight.resize(size_t(dst) * taps);
+        for (int i = 0; i < dst; ++i)
+            for (int k = 0; k < taps; ++k)
+            {
+                t.index[size_t(i) * taps + k] = std::min(src - 1, std::max(0, first[i] + k));
+                t.weight[size_t(i) * taps + k] = weight[size_t(i) * span + k];
+            }
+        return t;
+    }
+
+    size_t minRows(int width)
+    {
+        return std::max<size_t>(1, 16384 / std::max(1, width));
+    }
+
+    // filters a 4 channel float image to dw x dh, first along rows, then
+    // along columns, where a destination row is a weighted sum of whole
+    // intermediate rows
+    void reduce(const std::vector<float> & src, int sw, int sh,
+                std::vector<float> & tmp, std::vector<float> & dst, int dw, int dh, MipFilter filter)
+    {
+        AxisTaps tx = axisTaps(sw, dw, filter);
+        AxisTaps ty = axisTaps(sh, dh, filter);
+
+        tmp.resize(size_t(dw) * sh * 4);
+        parallelFor(sh, minRows(sw), [&](size_t begin, size_t end)
+        {
+            for (size_t y = begin; y < end; ++y)
+            {
+                const float* s = &src[y * sw * 4];
+                float* d = &tmp[y * dw * 4];
+                for (int x = 0; x < dw; ++x, d += 4)
+                {
+                    const int* idx = &tx.index[size_t(x) * tx.taps];
+                    const float* w = &tx.weight[size_t(x) * tx.taps];
+                    float acc[4] = { 0, 0, 0, 0 };
+                    for (int k = 0; k < tx.taps; ++k)
+                    {
+                        const float* p = s + idx[k] * 4;
+                        for (int c = 0; c < 4; ++c)
+                            acc[c] += p[c] * w[k];
+                    }
+                    for (int c = 0; c < 4; ++c)
+                        d[c] = acc[c];
+                }
+            }
+        });
+
+        dst.resize(size_t(dw) * dh * 4);
+        size_t rowFloats = size_t(dw) * 4;
+        parallelFor(dh, minRows(dw * ty.taps), [&](size_t begin, size_t end)
+        {
+            for (size_t y = begin; y < end; ++y)
+            {
+                float* d = &dst[y * rowFloats];
+                std::fill(d, d + rowFloats, 0.f);
+                for (int k = 0; k < ty.taps; ++k)
+                {
+                    const float* s = &tmp[size_t(ty.index[y * ty.taps + k]) * rowFloats];
+                    float w = ty.weight[y * ty.taps + k];
+                    for (size_t i = 0; i < rowFloats; ++i)
+                        d[i] += s[i] * w;
+                }
+            }
+        });
+    }
+
+    // the fourth channel of a four channel type is alpha, except for s8x4,
+    // whose channels are usually a signed vector
+    bool hasAlpha(TextureType type)
+    {
+        return channelCount(type) == 4 && !isS8(type);
+    }
+
+    // the format's branches are taken once per run of texels rather than per
+    // channel, and the sRGB channels go through tables. Colour is returned
+    // premultiplied by alpha, so that transparent texels don't bleed into
+    // their neighbours as the chain is filtered.
+    void decode(TextureType type, bool srgb, const uint8_t* pixels, size_t count, float* out)
+    {
+        int channels = channelCount(type);
+        int srgbChannels = srgb ? 3 : 0;
+        bool premultiply = hasAlpha(type);
+        const float* toLinear = srgbTables().toLinear;
+        for (size_t i = 0; i < count; ++i, out += 4)
+        {
+            out[0] = out[1] = out[2] = 0.f;
+            out[3] = 1.f;
+            if (isU8(type))
+            {
+                const uint8_t* p = pixels + i * channels;
+                int c = 0;
+                for (; c < srgbChannels; ++c)
+                    out[c] = toLinear[p[c]];
+                for (; c < channels; ++c)
+                    out[c] = p[c] * (1.f / 255.f);
+            }
+            else if (isS8(type))
+            {
+                const int8_t* p = reinterpret_cast<const int8_t*>(pixels) + i * channels;
+                for (int c = 0; c < channels; ++c)
+                    out[c] = std::max(-1.f, p[c] * (1.f / 127.f));
+            }
+            else if (channelBytes(type) == 2)
+            {
+                for (int c = 0; c < channels; ++c)
+                {
+                    uint16_t h;
+                    memcpy(&h, pixels + (i * channels + c) * 2, 2);
+                    out[c] = halfToFloat(h);
+                }
+            }
+            else
+                memcpy(out, pixels + i * channels * 4, channels * 4);
+
+            if (premultiply)
+                for (int c = 0; c < 3; ++c)
+                    out[c] *= out[3];
+        }
+    }
+
+    // undoes decode's premultiplication; texels with no coverage store black
+    void encode(TextureType type, bool srgb, const float* premultiplied, size_t count, uint8_t* pixels)
+    {
+        int channels = channelCount(type);
+        int srgbChannels = srgb ? 3 : 0;
+        bool premultiply = hasAlpha(type);
+        const SrgbTables & tables = srgbTables();
+        float texel[4];
+        for (size_t i = 0; i < count; ++i, premultiplied += 4)
+        {
+            const float* in = premultiplied;
+            if (premultiply)
+            {
+                float a = premultiplied[3];
+                float scale = a > 0.f ? 1.f / a : 0.f;
+                for (int c = 0; c < 3; ++c)
+                    texel[c] = premultiplied[c] * scale;
+                texel[3] = a;
+                in = texel;
+            }
+
+            if (isU8(type))
+            {
+                uint8_t* p = pixels + i * channels;
+                int c = 0;
+                for (; c < srgbChannels; ++c)
+                    p[c] = tables.encode(in[c]);
+                for (; c < channels; ++c)
+                    p[c] = uint8_t(std::min(1.f, std::max(0.f, in[c])) * 255.f + 0.5f);
+            }
+            else if (isS8(type))
+            {
+                int8_t* p = reinterpret_cast<int8_t*>(pixels) + i * channels;
+                for (int c = 0; c < channels; ++c)
+                    p[c] = int8_t(lrintf(std::min(1.f, std::max(-1.f, in[c])) * 127.f));
+            }
+            else if (channelBytes(type) == 2)
+            {
+                for (int c = 0; c < channels; ++c)
+                {
+                    uint16_t h = floatToHalf(in[c]);
+                    memcpy(pixels + (i * channels + c) * 2, &h, 2);
+                }
+            }
+            else
+                memcpy(pixels + i * channels * 4, in, channels * 4);
+        }
+    }
+
+} // anon
+
+uint16_t floatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mag = x & 0x7fffffff;
+
+    if (mag >= 0x7f800000)                  // inf or nan
+        return uint16_t(sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0));
+    if (mag >= 0x477ff000)                  // rounds past the largest half
+        return uint16_t(sign | 0x7c00);
+    if (mag < 0x38800000)                   // subnormal half
+    {
+        float a;
+        memcpy(&a, &mag, 4);
+        return uint16_t(sign | uint32_t(lrintf(a * 16777216.f)));
+    }
+
+    // rebias the exponent, then round the mantissa to nearest even
+    uint32_t h = mag - 0x38000000;
+    h += 0xfff + ((h >> 13) & 1);
+    return uint16_t(sign | (h >> 13));
+}
+
+float halfToFloat(uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0)
+    {
+        float f = ldexpf(float(mantissa), -24);
+        return sign ? -f : f;
+    }
+
+    uint32_t x = exponent == 31 ? sign | 0x7f800000 | (mantissa << 13)
+                                : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+size_t textureTexelBytes(TextureType type)
+{
+    return channelCount(type) * channelBytes(type);
+}
+
+int mipLevelCount(int w, int h)
+{
+    int levels = 1;
+    while (w > 1 || h > 1)
+    {
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+        ++levels;
+    }
+    return levels;
+}
+
+MipChain generateMipChain(TextureType type, int w, int h, const void* pixels, MipFilter filter, ColorSpace colorSpace)
+{
+    MipChain chain;
+    int channels = channelCount(type);
+    if (!channels || w < 1 || h < 1 || !pixels)
+        return chain;
+
+    bool srgb = colorSpace == ColorSpace::srgb && isU8(type) && channels >= 3;
+    size_t texelBytes = textureTexelBytes(type);
+
+    chain.type = type;
+    chain.levels.resize(mipLevelCount(w, h));
+    size_t offset = 0;
+    for (size_t i = 0, lw = w, lh = h; i < chain.levels.size(); ++i)
+    {
+        MipChain::Level & level = chain.levels[i];
+        level.width = int(lw);
+        level.height = int(lh);
+        level.offset = offset;
+        level.size = lw * lh * texelBytes;
+        offset += level.size;
+        lw = std::max<size_t>(1, lw / 2);
+        lh = std::max<size_t>(1, lh / 2);
+    }
+    chain.data.resize(offset);
+    memcpy(chain.data.data(), pixels, chain.levels[0].size);
+
+    std::vector<float> curr(size_t(w) * h * 4), next, tmp;
+    parallelFor(h, minRows(w), [&](size_t begin, size_t end)
+    {
+        size_t row = size_t(w);
+        decode(type, srgb, chain.data.data() + begin * row * texelBytes, (end - begin) * row, &curr[begin * row * 4]);
+    });
+
+    for (size_t i = 1; i < chain.levels.size(); ++i)
+    {
+        const MipChain::Level & above = chain.levels[i - 1];
+        const MipChain::Level & level = chain.levels[i];
+        reduce(curr, above.width, above.height, tmp, next, level.width, level.height, filter);
+
+        uint8_t* out = chain.data.data() + level.offset;
+        parallelFor(level.height, minRows(level.width), [&](size_t begin, size_t end)
+        {
+            size_t row = size_t(level.width);
+            encode(type, srgb, &next[begin * row * 4], (end - begin) * row, out + begin * row * texelBytes);
+        });
+        std::swap(curr, next);
+    }
+    return chain;
+}
+
+}} // lab::Render
@@ -42,6 +42,97 @@ inline uint64_t Hash(const char *buf, size_t len)
 
 namespace lab { namespace Render {
 
+    namespace {
+
+        // the transforms of ObjectUniforms, as loose uniforms
+        struct TransformHandles
+        {
+            UniformHandle model = uniformHandle("u_model");
+            UniformHandle modelView = uniformHandle("u_modelView");
+            UniformHandle modelViewProj = uniformHandle("u_modelViewProj");
+            UniformHandle rotationTransform = uniformHandle("u_rotationTransform");
+
+            bool used(const Shader& shader) const
+            {
+                return shader.uniformLocation(model) >= 0 || shader.uniformLocation(modelView) >= 0 ||
+                       shader.uniformLocation(modelViewProj) >= 0 || shader.uniformLocation(rotationTransform) >= 0;
+            }
+        };
+
+        const TransformHandles& transformHandles()
+        {
+            static const TransformHandles handles;
+            return handles;
+        }
+
+        // serves the object block to parts drawn without a renderer's stream
+        UniformStream& fallbackObjectUniforms()
+        {
+            static UniformStream stream(objectUniformBinding, sizeof(ObjectUniforms));
+            return stream;
+        }
+
+        bool isPackedPTNC(const BufferBase& vertices)
+        {
+            std::vector<BufferBase::Layout> packed;
+            VertPackedPTNC::describeLayout(packed);
+            if (vertices.stride() != int(sizeof(VertPackedPTNC)) || vertices.layout.size() != packed.size())
+                return false;
+
+            for (size_t i = 0; i < packed.size(); ++i)
+            {
+                const BufferBase::Layout& a = vertices.layout[i];
+                const BufferBase::Layout& b = packed[i];
+                if (a.name != b.name || a.semanticType != b.semanticType ||
+                    a.elementType != b.elementType || a.normalized != b.normalized)
+                    return false;
+            }
+            return true;
+        }
+
+    } // anon
+
+    void ModelBase::objectUniforms(const ViewMatrices& vm, ObjectUniforms& ou) const
+    {
+        ou.model = vm.model;
+        ou.modelView = vm.mv;
+        ou.modelViewProj = vm.mvp;
+
+        lab::m44f rotationTransform = vm.model;
+        rotationTransform[3].x = 0;
+        rotationTransform[3].y = 0;
+        rotationTransform[3].z = 0;
+        ou.rotationTransform = matrix_transpose(matrix_invert(rotationTransform));
+    }
+
+    void ModelPart::objectUniforms(const ViewMatrices& vm, ObjectUniforms& ou) const
+    {
+        ModelBase::objectUniforms(vm, ou);
+        if (_shaderType == ShaderType::skyShader)
+        {
+            // the sky is centered on the camera
+            ou.modelView[3].x = 0;
+            ou.modelView[3].y = 0;
+            ou.modelView[3].z = 0;
+            ou.modelViewProj = matrix_multiply(vm.projection, ou.modelView);
+        }
+        if (_quantizedPositions)
+        {
+            // map the stored [-1, 1] positions onto the part's bounds; the
+            // rotation transform for normals is unaffected
+            m44f decode = m44f_identity;
+            decode[0].x = 0.5f * (_localBounds.second.x - _localBounds.first.x);
+            decode[1].y = 0.5f * (_localBounds.second.y - _localBounds.first.y);
+            decode[2].z = 0.5f * (_localBounds.second.z - _localBounds.first.z);
+            decode[3].x = 0.5f * (_localBounds.second.x + _localBounds.first.x);
+            decode[3].y = 0.5f * (_localBounds.second.y + _localBounds.first.y);
+            decode[3].z = 0.5f * (_localBounds.second.z + _localBounds.first.z);
+            ou.model = matrix_multiply(ou.model, decode);
+            ou.modelView = matrix_multiply(ou.modelView, decode);
+            ou.modelViewProj = matrix_multiply(ou.modelViewProj, decode);
+        }
+    }
+
     std::shared_ptr<Shader> ModelPart::makeShader(
         const FrameBuffer& fbo, const std::vector<std::string>& output_attachments,
         ModelPart& mesh,
@@ -66,6 +157,12 @@ namespace lab { namespace Render {
         bool hasTextureCubeAttr =   vao->hasAttribute("a_uvw");
         // todo - tangent basis for normal mapping
 
+        // normals stored as an octahedral pair are decoded in the vertex shader
+        bool hasOctahedralNormals = false;
+        for (auto & a : vao->attributes)
+            if (a.name == "a_normal" && a.type == SemanticType::vec2_st)
+                hasOctahedralNormals = true;
+
         shared_ptr<Material> material = mesh.material;
 
         bool hasTexture;
@@ -76,7 +173,26 @@ namespace lab { namespace Render {
 
         bool deferred = fbo.baseNames.size() > 0;
 
-        // variant known, create variant identifier
+        // variant known, look it up by key so that no names are built
+        // unless the variant has to be made
+
+        uint32_t attributeMask = 0;
+        if (hasPositionsAttr)     attributeMask |= 1;
+        if (hasNormalsAttr)       attributeMask |= 2;
+        if (hasTextureCoordsAttr) attributeMask |= 4;
+        if (hasVertexColorAttr)   attributeMask |= 8;
+        if (hasTextureCubeAttr)   attributeMask |= 16;
+        if (hasOctahedralNormals) attributeMask |= 32;
+
+        ShaderBuilder::VariantSource source = ShaderBuilder::variantSource(vshSrc, fshSrc);
+        ShaderBuilder::ShaderKey key = ShaderBuilder::variantKey(
+            attributeMask, static_cast<uint32_t>(shaderType), deferred, hasTexture, source);
+
+        ShaderBuilder sb;
+        if (std::shared_ptr<Shader> cached = sb.cache()->shader(key, source))
+            return cached;
+
+        // create variant identifier
 
         string variantName;
         if (deferred)                            variantName += "D";
@@ -89,6 +205,7 @@ namespace lab { namespace Render {
         if (hasTextureCoordsAttr) variantName += "T";
         if (hasVertexColorAttr)   variantName += "C";
         if (hasTextureCubeAttr)   variantName += "3";
+        if (hasOctahedralNormals) variantName += "o";
 
         string shaderName;
 
@@ -116,12 +233,6 @@ namespace lab { namespace Render {
             shaderName += ss.str();
         }
 
-        // create the shader if it doesn't already exist
-
-        ShaderBuilder sb;
-        if (sb.cache()->hasShader(shaderName))
-            return sb.cache()->shader(shaderName);
-
         Semantic varyings[] {
             { SemanticType::vec4_st, "v_pos", AutomaticUniform::none, 0 },
             { SemanticType::vec3_st, "v_normal", AutomaticUniform::none, 1 },
@@ -172,11 +283,14 @@ namespace lab { namespace Render {
             vsh.assign(vshSrc);
         else
         {
+            // quantized positions arrive as a vec4 whose w is padding
             vsh = R"glsl(
 void main() {
-  vec4 pos = vec4(a_position, 1.0);
-  vec4 n = u_rotationTransform * vec4(a_normal, 1.0);
-  vec4 newPos = u_modelViewProj * pos;
+  vec4 pos = vec4(a_position.xyz, 1.0);
+)glsl";
+            if (hasOctahedralNormals) vsh += "  vec4 n = u_rotationTransform * vec4(octahedralDecode(a_normal), 1.0);\n";
+            else                      vsh += "  vec4 n = u_rotationTransform * vec4(a_normal, 1.0);\n";
+            vsh += R"glsl(  vec4 newPos = u_modelViewProj * pos;
   gl_Position = newPos;
   var.v_pos = newPos;
   var.v_normal = n.xyz;
@@ -236,8 +350,10 @@ R"glsl(
             fsh += "}\n";
         }
 
+        // new variants compile in the background rather than stall the frame
+        sb.compileAsync = true;
         shader = sb.makeShader(shaderName, vsh.c_str(), fsh.c_str(), * mesh.verts());
-        sb.cache()->add(shaderName, shader);
+        sb.cache()->add(key, shader, source);
 
         vao->unbindVAO();
 
@@ -249,6 +365,13 @@ R"glsl(
     void ModelPart::draw(
         const FrameBuffer& fbo, const std::vector<std::string>& output_attachments,
         Renderer::RenderLock& rl)
+    {
+        drawInstances(fbo, output_attachments, rl, 1);
+    }
+
+    void ModelPart::drawInstances(
+        const FrameBuffer& fbo, const std::vector<std::string>& output_attachments,
+        Renderer::RenderLock& rl, int instances)
     {
         if (_verts && !_shader)
         {
@@ -305,36 +428,51 @@ R"glsl(
             }
             else
             {
+                // supplied shaders read float positions and normals
+                unpackVertices();
                 _shader = makeShader(fbo, output_attachments, *this, _shaderType, vsh.c_str(), fsh.c_str());
             }
         }
-        if (_verts && _shader)
+        // the part isn't drawn until its shader has compiled
+        if (_verts && _shader && _shader->poll())
         {
+            static const UniformHandle u_texture = uniformHandle("u_texture");
+
             _shader->bind(rl);
-            if (_shaderType == ShaderType::skyShader)
+
+            // transforms come from the object uniform block; stream them
+            // now unless the caller has already done so
+            const TransformHandles& transforms = transformHandles();
+            const bool loose = transforms.used(*_shader);
+            if (!rl.context.objectUniforms)
             {
-                lab::m44f invMv = rl.context.viewMatrices.mv;
-                // remove translation
-                invMv[3].x = 0;
-                invMv[3].y = 0;
-                invMv[3].z = 0;
-                _shader->uniform("u_modelView", invMv);
-                lab::m44f mvproj = matrix_multiply(rl.context.viewMatrices.projection, invMv);
-                _shader->uniform("u_modelViewProj", mvproj);
+                // without a renderer's stream, the frame's draws share one,
+                // begun by the first of them
+                UniformStream& stream = fallbackObjectUniforms();
+                stream.beginFrame();
+                rl.context.objectUniforms = &stream;
             }
-            else
+
+            int offset = rl.context.objectUniformOffset;
+            if (offset < 0)
             {
-                _shader->uniform("u_view", rl.context.viewMatrices.view);
-                _shader->uniform("u_modelView", rl.context.viewMatrices.mv);
-                _shader->uniform("u_modelViewProj", rl.context.viewMatrices.mvp);
+                ObjectUniforms ou;
+                objectUniforms(rl.context.viewMatrices, ou);
+                offset = rl.context.objectUniforms->push(&ou, sizeof(ou));
+                rl.context.objectUniforms->upload();
             }
+            rl.context.objectUniforms->bind(offset);
 
-            lab::m44f rotationTransform = rl.context.viewMatrices.model;
-            rotationTransform[3].x = 0;
-            rotationTransform[3].y = 0;
-            rotationTransform[3].z = 0;
-            rotationTransform = matrix_transpose(matrix_invert(rotationTransform));
-            _shader->uniform("u_rotationTransform", rotationTransform);
+            // stages outside the block's reach read loose uniforms
+            if (loose)
+            {
+                ObjectUniforms ou;
+                objectUniforms(rl.context.viewMatrices, ou);
+                _shader->uniform(transforms.model, ou.model);
+                _shader->uniform(transforms.modelView, ou.modelView);
+                _shader->uniform(transforms.modelViewProj, ou.modelViewProj);
+                _shader->uniform(transforms.rotationTransform, ou.rotationTransform);
+            }
 
             bool depthWriteSet = true;
             bool depthRangeSet = false;
@@ -347,7 +485,7 @@ R"glsl(
                     shared_ptr<Texture> texture = baseColorInOut->value<shared_ptr<Texture>>();
                     int unit = rl.context.activeTextureUnit;
                     texture->bind(unit);
-                    _shader->uniformInt("u_texture", unit);
+                    _shader->uniformInt(u_texture, unit);
                     rl.context.activeTextureUnit++;
                 }
                 shared_ptr<InOut> dwInOut = material->propertyInlet(ShaderMaterial::depthWriteName());
@@ -384,7 +522,10 @@ R"glsl(
 
             // Draw the model
             //
-            _verts->draw();
+            if (instances > 1)
+                _verts->drawInstanced(instances);
+            else
+                _verts->draw();
 
             if (!depthWriteSet)
                 glDepthMask(GL_TRUE);
@@ -399,10 +540,44 @@ R"glsl(
         }
     }
 
+    bool ModelPart::instanceable() const
+    {
+        return _shader && !transformHandles().used(*_shader);
+    }
+
+    bool ModelPart::unpackVertices()
+    {
+        std::shared_ptr<BufferBase> vertices = _verts ? _verts->vertexBuffer() : nullptr;
+        if (!vertices || !isPackedPTNC(*vertices))
+            return false;
+
+        const float boundsMin[3] = { _localBounds.first.x, _localBounds.first.y, _localBounds.first.z };
+        const float boundsMax[3] = { _localBounds.second.x, _localBounds.second.y, _localBounds.second.z };
+        const VertPackedPTNC* packed = reinterpret_cast<const VertPackedPTNC*>(vertices->buffer());
+        std::vector<VertPTNC> unpacked(vertices->count());
+        for (size_t i = 0; i < unpacked.size(); ++i)
+            unpacked[i] = packed[i].unpack(boundsMin, boundsMax);
+
+        auto full = std::make_shared<Buffer<VertPTNC>>(BufferBase::BufferType::VertexBuffer);
+        full->assign(unpacked.begin(), unpacked.end());
+        std::unique_ptr<VAO> vao(new VAO(full));
+        if (std::shared_ptr<IndexBuffer> indices = _verts->indexBuffer())
+            vao->setIndices(indices);
+        setVAO(std::move(vao), _localBounds);
+        return true;
+    }
+
     void ModelPart::setVAO(std::unique_ptr<VAO> vao, Bounds localBounds)
     {
         _verts = std::move(vao);
         _localBounds = localBounds;
+
+        _quantizedPositions = false;
+        if (std::shared_ptr<BufferBase> vertices = _verts ? _verts->vertexBuffer() : nullptr)
+            for (auto & l : vertices->layout)
+                if (l.name == "a_position")
+                    _quantizedPositions = l.quantized() && l.elementType != BufferBase::ElementType::u8 &&
+                                                           l.elementType != BufferBase::ElementType::u16;
     }
 
 
@@ -10,17 +10,22 @@
 
 #include <LabCamera/LabCamera.h>
 #include "LabRender/FrameBuffer.h"
+#include "LabRender/GeometryPool.h"
 #include "LabRender/Model.h"
 #include "LabRender/SemanticType.h"
 #include "LabRender/ShaderBuilder.h"
 #include "LabRender/Texture.h"
+#include "LabRender/UniformBlocks.h"
 #include "LabRender/Utils.h"
 #include "LabRender/UtilityModel.h"
 #include "LabRenderGraph/LabRenderGraph.h"
 #include "gl4.h"
 #include "json/json.h"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <sys/stat.h>
 
 using namespace std;
@@ -116,6 +121,7 @@ void PassRenderer::Pass::run(RenderLock& rl, const FramebufferSet& fbos)
 	if (isQuadPass)
 	{
         glViewport(0, 0, rl.context.framebufferSize.x, rl.context.framebufferSize.y);
+        _shader->reportLinkErrors();
         _shader->bind(rl);
 		bindInputTextures(rl, fbos);	// binds the textures and the shader uniforms
 		_fullScreenQuadMesh->verts()->draw();
@@ -126,32 +132,155 @@ void PassRenderer::Pass::run(RenderLock& rl, const FramebufferSet& fbos)
     if (drawOpaqueGeometry)
 	{
         std::shared_ptr<FrameBuffer> gbufferAOVs = fbos.fbo(writeBuffer);
+        auto& allMeshes = rl.context.drawList->deferredMeshes;
+        const std::vector<uint32_t>* visible = rl.context.visibleMeshes;
+        const size_t meshCount = visible ? visible->size() : allMeshes.size();
+        auto mesh = [&](size_t i) -> std::pair<m44f, std::shared_ptr<ModelBase>>& {
+            return allMeshes[visible ? (*visible)[i] : i];
+        };
+
+        // parts sharing vertices, shader, and material are drawn instanced.
+        // A part's shader is made on its first draw, so a part is drawn on
+        // its own until the shader is ready.
+        _batchKeys.assign(meshCount, DrawBatchKey());
+        if (rl.context.objectUniforms)
+        {
+            for (size_t i = 0; i < meshCount; ++i)
+            {
+                ModelPart* part = dynamic_cast<ModelPart*>(mesh(i).second.get());
+                if (part && part->verts() && part->shader() && part->shader()->status == Shader::Status::ready &&
+                    part->instanceable())
+                {
+                    _batchKeys[i].vao = part->verts();
+                    _batchKeys[i].shader = part->shader().get();
+                    _batchKeys[i].material = part->material.get();
+                }
+            }
+        }
+        batchReport = batchDraws(_batchKeys, maxObjectsPerDraw, _batchOrder, _batches,
+                                 rl.context.drawList->sortDeferredMeshes);
+
+        // stream the transforms of every object in a single upload, with
+        // the blocks of each batch contiguous
+        _objectMatrices.resize(meshCount);
+        _objectBlocks.resize(meshCount);
+        for (size_t k = 0; k < _batchOrder.size(); ++k)
+        {
+            auto& m = mesh(_batchOrder[k]);
+            ViewMatrices& vm = _objectMatrices[k];
+            vm.model = m.first;
+            vm.view = rl.context.drawList->view;
+            vm.projection = rl.context.drawList->proj;
+            vm.mv = matrix_multiply(vm.view, vm.model);
+            vm.mvp = matrix_multiply(vm.projection, vm.mv);
+            m.second->objectUniforms(vm, _objectBlocks[k]);
+        }
+
+        _batchUniformOffsets.assign(_batches.size(), -1);
+        if (rl.context.objectUniforms)
+        {
+            for (size_t b = 0; b < _batches.size(); ++b)
+                _batchUniformOffsets[b] = rl.context.objectUniforms->push(
+                    &_objectBlocks[_batches[b].first], _batches[b].count * sizeof(ObjectUniforms));
+            rl.context.objectUniforms->upload();
+        }
 
-        for (auto& model : rl.context.drawList->deferredMeshes)
+        for (size_t b = 0; b < _batches.size(); ++b)
 		{
-            rl.context.viewMatrices.model = model.first;
-            rl.context.viewMatrices.mv = matrix_multiply(rl.context.drawList->view, rl.context.viewMatrices.model);
-            rl.context.viewMatrices.mvp = matrix_multiply(rl.context.drawList->proj, rl.context.viewMatrices.mv);
-            rl.context.viewMatrices.view = rl.context.drawList->view;
-            rl.context.viewMatrices.projection = rl.context.drawList->proj;
-            model.second->draw(*gbufferAOVs.get(), writeAttachments, rl);
+            const DrawBatch& batch = _batches[b];
+            auto& model = mesh(_batchOrder[batch.first]).second;
+            rl.context.viewMatrices = _objectMatrices[batch.first];
+            rl.context.objectUniformOffset = _batchUniformOffsets[b];
+            if (batch.count > 1)
+                static_cast<ModelPart*>(model.get())->drawInstances(
+                    *gbufferAOVs.get(), writeAttachments, rl, static_cast<int>(batch.count));
+            else
+                model->draw(*gbufferAOVs.get(), writeAttachments, rl);
         }
+        rl.context.objectUniformOffset = -1;
     }
 
+    // pooled geometry leaves the last arena drawn bound
+    GeometryPool::unbind();
+
     if (renderPlug)
         renderPlug();
 }
 
 class PassRenderer::Detail {
 public:
-    Detail() {}
+    Detail()
+    : frameUniforms(frameUniformBinding, sizeof(FrameUniforms))
+    , objectUniforms(objectUniformBinding, sizeof(ObjectUniforms) * maxObjectsPerDraw) {}
 
     FramebufferSet fbos;
     Render::TextureSet textures;
 
+    // textures named by the configuration that may still be loading
+    vector<shared_ptr<AsyncFileTextureProvider>> textureLoads;
+
+    // forgets the loads whose textures have been swapped in; the texture
+    // set keeps the textures
+    void dropFinishedLoads()
+    {
+        textureLoads.erase(remove_if(textureLoads.begin(), textureLoads.end(),
+            [](const shared_ptr<AsyncFileTextureProvider> & t) {
+                return t->ready().wait_for(chrono::seconds(0)) == future_status::ready;
+            }), textureLoads.end());
+    }
+
     vector<shared_ptr<Pass>> passes;
 
+    // passes compiled from a labfx, culled and ordered by the render graph
+    vector<shared_ptr<Pass>> schedule;
+    bool scheduled = false;
+
+    // the labfx and its passes, kept to recompile the schedule when a
+    // pass is switched on or off after configuration
+    lab::fx::labfx fx;
+    vector<shared_ptr<Pass>> configured;
+    vector<bool> scheduledActive;
+
+    bool scheduleDirty() const
+    {
+        for (size_t i = 0; i < configured.size(); ++i)
+            if (configured[i]->active != scheduledActive[i])
+                return true;
+        return false;
+    }
+
+    void compileSchedule()
+    {
+        scheduledActive.resize(configured.size());
+        for (size_t i = 0; i < configured.size(); ++i)
+        {
+            scheduledActive[i] = configured[i]->active;
+            fx.passes[i].active = configured[i]->active;
+        }
+
+        lab::fx::schedule compiled = lab::fx::compile_schedule(fx);
+        schedule.clear();
+        for (size_t i : compiled.order)
+            schedule.push_back(configured[i]);
+        scheduled = true;
+
+        // share storage between buffer textures whose lifetimes in the schedule don't overlap
+        lab::fx::alias_plan aliases = lab::fx::plan_aliases(fx, compiled);
+        std::map<int, int> slot_users;
+        for (const auto& a : aliases.attachments)
+            ++slot_users[a.slot];
+        fbos.clearAliases();
+        for (const auto& a : aliases.attachments)
+            if (slot_users[a.slot] > 1)
+                fbos.alias(a.buffer, a.texture, a.slot);
+    }
+
     std::map<std::string, std::function<void()>> plugs;
+
+    UniformStream frameUniforms;
+    UniformStream objectUniforms;
+
+    vector<uint32_t> visibleMeshes;
 };
 
 PassRenderer::PassRenderer() : _detail(new Detail()) {
@@ -166,6 +295,16 @@ std::shared_ptr<Render::Texture> PassRenderer::texture(const std::string & name)
     return _detail->textures.texture(name);
 }
 
+bool PassRenderer::waitForTextures()
+{
+    bool loaded = true;
+    for (auto & t : _detail->textureLoads)
+        loaded &= t->finish();
+
+    _detail->textureLoads.clear();
+    return loaded;
+}
+
 std::shared_ptr<FrameBuffer> PassRenderer::framebuffer(const std::string & name)
 {
     return _detail->fbos.fbo(name);
@@ -205,8 +344,9 @@ void PassRenderer::configure(char const*const path)
 
     for (const auto& tx : fx->textures)
 	{
-        Render::FileTextureProvider provider(tx.path);
-        _detail->textures.add_texture(tx.name, provider.texture());
+        auto provider = std::make_shared<Render::AsyncFileTextureProvider>(*this, tx.path, tx.filter, tx.colorSpace);
+        _detail->textures.add_texture(tx.name, provider->texture());
+        _detail->textureLoads.push_back(provider);
     }
 
     for (const auto& bf : fx->buffers)
@@ -225,9 +365,11 @@ void PassRenderer::configure(char const*const path)
     }
 
     int passNumber = 0;
+    vector<shared_ptr<Pass>> configured;
     for (const auto& ps : fx->passes)
 	{
         std::shared_ptr<Pass> pass = addPass(std::make_shared<Pass>(ps.name, passNumber++));
+        configured.push_back(pass);
 
         if (ps.draw == lab::fx::pass_draw::plug) {
             pass->renderPlug = findPlug(ps.shader.c_str());
@@ -392,6 +534,10 @@ void main()
         }
     }
 
+    _detail->fx = *fx;
+    _detail->configured = configured;
+    _detail->compileSchedule();
+
     free_labfx_gen(sh_ptr);
     free_labfx(fx_ptr);
     return;
@@ -412,12 +558,19 @@ void main()
     printf("\nTextures:\n");
     for (Json::Value::iterator it = conf["textures"].begin(); it != conf["textures"].end(); ++it)
 	{
-        // { "id": "tex16", "path": "{ASSET_ROOT}/textures/shadertoy/tex16.png" }
+        // { "id": "tex16", "path": "{ASSET_ROOT}/textures/shadertoy/tex16.png", "filter": "trilinear",
+        //   "color_space": "linear" }
         string id = (*it)["id"].asString();
         printf(" %s\n", id.c_str());
         string path = (*it)["path"].asString();
-        Render::FileTextureProvider provider(path);
-        _detail->textures.add_texture(id, provider.texture());
+        string filterStr = (*it)["filter"].asString();
+        Render::TextureFilter filter = TextureFilter::bilinear;
+        if (filterStr == "trilinear") filter = TextureFilter::trilinear;
+        else if (filterStr == "nearest") filter = TextureFilter::nearest;
+        Render::ColorSpace colorSpace = (*it)["color_space"].asString() == "linear" ? ColorSpace::linear : ColorSpace::srgb;
+        auto provider = std::make_shared<Render::AsyncFileTextureProvider>(*this, path, filter, colorSpace);
+        _detail->textures.add_texture(id, provider->texture());
+        _detail->textureLoads.push_back(provider);
     }
 
     printf("\nBuffers:\n");
@@ -592,6 +745,7 @@ void main()
 std::shared_ptr<PassRenderer::Pass> PassRenderer::addPass(std::shared_ptr<Pass> pass)
 {
     _detail->passes.push_back(pass);
+    _detail->scheduled = false; // passes added by hand run in declaration order
     sort(_detail->passes.begin(), _detail->passes.end(),
          [](const shared_ptr<Pass>& a, const shared_ptr<Pass>& b)
          {
@@ -624,12 +778,60 @@ void PassRenderer::render(RenderLock& rl, v2i fbSize, DrawList& drawList)
 
     CaptureFrameBuffer current_frame_buffer;
 
+    // passes switched on or off since the schedule was compiled change the
+    // culling and the aliasing, and a new alias plan reallocates the buffers
+    if (_detail->scheduled && _detail->scheduleDirty())
+        _detail->compileSchedule();
+
     _detail->fbos.setSize(fbSize.x, fbSize.y);
 
+    ShaderBuilder::cache()->update();
+    if (!_detail->textureLoads.empty())
+        _detail->dropFinishedLoads();
+
+    rl.context.visibleMeshes = nullptr;
+    const std::vector<uint32_t>* order = nullptr;
+    if (drawList.sortDeferredMeshes)
+    {
+        drawList.sortMeshes();
+        order = &drawList.drawOrder();
+        rl.context.visibleMeshes = order;
+    }
+
+    if (drawList.cullDeferredMeshes)
+    {
+        drawList.cullMeshes(_detail->visibleMeshes, order);
+        rl.context.visibleMeshes = &_detail->visibleMeshes;
+    }
+
     rl.context.drawList = &drawList;
     rl.context.framebufferSize = fbSize;
     rl.context.rootFramebuffer = current_frame_buffer.currFramebuffer;
 
+    FrameUniforms frame;
+    frame.view = drawList.view;
+    frame.projection = drawList.proj;
+    frame.skyMatrix = matrix_invert(matrix_multiply(drawList.proj, drawList.modl));
+    frame.resolution = V2F(float(fbSize.x), float(fbSize.y));
+    frame.mousePosition = rl.context.mousePosition;
+    frame.renderTime = float(rl.context.renderTime);
+
+    _detail->frameUniforms.beginFrame();
+    int frameOffset = _detail->frameUniforms.push(&frame, sizeof(frame));
+    _detail->frameUniforms.upload();
+    _detail->frameUniforms.bind(frameOffset);
+
+    // the stream is the renderer's, so the context gives it up however
+    // render returns
+    struct ObjectStreamScope
+    {
+        RenderLock::RenderContext& context;
+        ~ObjectStreamScope() { context.objectUniforms = nullptr; }
+    } objectStreamScope { rl.context };
+
+    _detail->objectUniforms.beginFrame();
+    rl.context.objectUniforms = &_detail->objectUniforms;
+
     string bound_frame_buffer = "*";
     vector<string> bound_attachments;
 
@@ -645,7 +847,8 @@ void PassRenderer::render(RenderLock& rl, v2i fbSize, DrawList& drawList)
 	glDepthMask(GL_TRUE);
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-    for (auto pass : _detail->passes)
+    auto& passes = _detail->scheduled ? _detail->schedule : _detail->passes;
+    for (auto pass : passes)
 	{
         if (!pass->active)
             continue;
@@ -667,7 +870,8 @@ void PassRenderer::render(RenderLock& rl, v2i fbSize, DrawList& drawList)
         checkError(ErrorPolicy::onErrorThrow, TestConditions::exhaustive, "render, bind for write");
 
         // quad pass is a convenience where a full screen quad is automatically provided
-        // before preparing the the pass' own shader and setting input data appropriately
+        // before preparing the the pass' own shader and setting input data appropriately.
+        // The shader is compiled here, on the pass's first run, rather than at configure
 		if (pass->isQuadPass)
 	        pass->prepareFullScreenQuadAndShader(_detail->fbos);
 
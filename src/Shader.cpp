@@ -8,10 +8,77 @@
 
 #include "LabRender/Shader.h"
 #include "LabRender/DrawList.h"
+#include "LabRender/UniformBlocks.h"
 #include "gl4.h"
 
+#include <atomic>
+#include <mutex>
+#include <string.h>
+#include <unordered_map>
+
 namespace lab { namespace Render {
 
+namespace {
+
+    std::atomic<size_t> locationQueries { 0 };
+    std::atomic<size_t> uniformUpdates { 0 };
+
+    // glMaxShaderCompilerThreads isn't declared by the core profile headers
+    typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads(const char* name)
+    {
+        return reinterpret_cast<MaxShaderCompilerThreadsProc>(glProcAddress(name));
+    }
+
+} // anon
+
+UniformHandle uniformHandle(const char* name)
+{
+    // handles are never reassigned, so each thread keeps the ones it has
+    // seen, and only takes the lock for names new to it
+    thread_local std::unordered_map<std::string, UniformHandle> seen;
+    thread_local std::string key;
+    key.assign(name);
+    auto s = seen.find(key);
+    if (s != seen.end())
+        return s->second;
+
+    static std::mutex lock;
+    static std::unordered_map<std::string, UniformHandle> handles;
+
+    UniformHandle h;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto i = handles.find(key);
+        if (i != handles.end())
+            h = i->second;
+        else
+        {
+            h = static_cast<UniformHandle>(handles.size());
+            handles[key] = h;
+        }
+    }
+    seen[key] = h;
+    return h;
+}
+
+Shader::Stats Shader::stats()
+{
+    Stats s;
+    s.locationQueries = locationQueries.load(std::memory_order_relaxed);
+    s.uniformUpdates = uniformUpdates.load(std::memory_order_relaxed);
+    return s;
+}
+
+Shader::Stats Shader::resetStats()
+{
+    Stats s;
+    s.locationQueries = locationQueries.exchange(0, std::memory_order_relaxed);
+    s.uniformUpdates = uniformUpdates.exchange(0, std::memory_order_relaxed);
+    return s;
+}
+
 Shader::~Shader()
 {
 	if (id)
@@ -48,37 +115,195 @@ Shader& Shader::shader(const std::string& name, ProgramType type, bool autoPream
     glCompileShader(shader);
     stages.push_back(shader);
 
-    // Check for errors
-    char buffer[512];
-    int length;
-    glGetShaderInfoLog(shader, sizeof(buffer), &length, buffer);
-    if (length)
-        handleGLError(errorPolicy, GL_INVALID_VALUE, buffer, source);
+    // errors are checked once the program is linked, so that the driver
+    // need not finish compiling now
+    stageSources.push_back(source);
 
     // Allow chaining
     return *this;
 }
 
+bool Shader::parallelCompileSupported()
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        supported = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (!ext)
+                continue;
+
+            const char* threads = nullptr;
+            if (!strcmp(ext, "GL_KHR_parallel_shader_compile"))
+                threads = "glMaxShaderCompilerThreadsKHR";
+            else if (!strcmp(ext, "GL_ARB_parallel_shader_compile"))
+                threads = "glMaxShaderCompilerThreadsARB";
+            if (!threads)
+                continue;
+
+            // drivers may compile on the calling thread until given threads;
+            // all ones lets the driver choose how many
+            if (MaxShaderCompilerThreadsProc setThreads = maxShaderCompilerThreads(threads))
+                setThreads(0xffffffff);
+            supported = 1;
+            break;
+        }
+    }
+    return supported == 1;
+}
+
 void Shader::link()
+{
+    linkAsync();
+    poll(true);
+}
+
+void Shader::linkAsync()
 {
     // Create and link program
     if (!id) id = glCreateProgram();
     for (size_t i = 0; i < stages.size(); i++) {
         glAttachShader(id, stages[i]);
     }
+    glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(id);
+    status = Status::pending;
+}
+
+bool Shader::poll(bool wait, bool report)
+{
+    if (status == Status::pending)
+    {
+        if (!wait && parallelCompileSupported())
+        {
+            GLint done = 0;
+            glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done)
+                return false;
+        }
+        finishLink();
+    }
+    if (report)
+        reportLinkErrors();
+    return status == Status::ready;
+}
+
+void Shader::reportLinkErrors()
+{
+    if (_linkErrors.empty())
+        return;
 
-    // Check for errors
-    char buffer[512];
+    // cleared first, since the policy may throw
+    std::vector<LinkError> errors;
+    errors.swap(_linkErrors);
+    for (auto & e : errors)
+        handleGLError(errorPolicy, e.glErr, e.message.c_str(), e.source.empty() ? nullptr : e.source.c_str());
+}
+
+void Shader::finishLink()
+{
+    GLint linked = 0;
+    glGetProgramiv(id, GL_LINK_STATUS, &linked);
+    status = linked ? Status::ready : Status::failed;
+
+    // Check for errors, which poll reports
+    char buffer[512] = "";
     int length;
+    for (size_t i = 0; i < stages.size(); ++i)
+    {
+        glGetShaderInfoLog(stages[i], sizeof(buffer), &length, buffer);
+        if (length)
+            _linkErrors.push_back({GL_INVALID_VALUE, buffer, i < stageSources.size() ? stageSources[i] : std::string()});
+    }
+    stageSources.clear();
+
     glGetProgramInfoLog(id, sizeof(buffer), &length, buffer);
 
     if (length != 0)
-        handleGLError(errorPolicy, GL_INVALID_OPERATION, buffer);
+        _linkErrors.push_back({GL_INVALID_OPERATION, buffer, std::string()});
 
     GLenum glErr = glGetError();
     if (glErr)
-        handleGLError(errorPolicy, glErr, buffer);
+        _linkErrors.push_back({int(glErr), buffer, std::string()});
+
+    if (status == Status::ready)
+        resolveUniforms();
+}
+
+bool Shader::loadBinary(uint32_t format, const void* data, size_t size)
+{
+    if (!id) id = glCreateProgram();
+    glProgramBinary(id, format, data, static_cast<GLsizei>(size));
+
+    // a binary from another driver version fails to link, and isn't an error
+    GLint linked = 0;
+    glGetProgramiv(id, GL_LINK_STATUS, &linked);
+    while (glGetError() != GL_NO_ERROR) {}
+    if (!linked)
+        return false;
+
+    status = Status::ready;
+    resolveUniforms();
+    return true;
+}
+
+bool Shader::binary(uint32_t & format, std::vector<uint8_t> & data) const
+{
+    if (status != Status::ready)
+        return false;
+
+    GLint length = 0;
+    glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    data.resize(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(id, length, &length, &binaryFormat, data.data());
+    data.resize(length);
+    format = binaryFormat;
+    return length > 0;
+}
+
+void Shader::resolveUniforms()
+{
+    GLuint frameBlock = glGetUniformBlockIndex(id, "LabFrame");
+    if (frameBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(id, frameBlock, frameUniformBinding);
+    GLuint objectBlock = glGetUniformBlockIndex(id, "LabObject");
+    if (objectBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(id, objectBlock, objectUniformBinding);
+
+    locations.clear();
+    GLint count = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        char name[256];
+        GLsizei nameLength = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(id, i, sizeof(name), &nameLength, &size, &type, name);
+
+        // arrays are reported as name[0], but are addressed by name
+        if (nameLength > 3 && !strcmp(name + nameLength - 3, "[0]"))
+            name[nameLength - 3] = '\0';
+
+        // members of uniform blocks have no location
+        int location = glGetUniformLocation(id, name);
+        locationQueries.fetch_add(1, std::memory_order_relaxed);
+        if (location < 0)
+            continue;
+
+        UniformHandle h = uniformHandle(name);
+        if (h >= locations.size())
+            locations.resize(h + 1, -1);
+        locations[h] = location;
+    }
 }
 
 void Shader::bind(Renderer::RenderLock& rl) const
@@ -97,7 +322,7 @@ void Shader::bind(Renderer::RenderLock& rl) const
         if (rl.hasTexture(t.texture)) {
             glActiveTexture(GL_TEXTURE0 + activeTextureUnit);
             rl.bindTexture(t.texture);
-            uniformInt(t.name.c_str(), activeTextureUnit);
+            uniformInt(t.handle, activeTextureUnit);
             ++activeTextureUnit;
         }
     }
@@ -107,21 +332,21 @@ void Shader::bind(Renderer::RenderLock& rl) const
     {
         if (a.automatic == AutomaticUniform::frameBufferResolution)
         {
-            uniform(a.name.c_str(), V2F(rl.context.framebufferSize.x, rl.context.framebufferSize.y));
+            uniform(a.handle, V2F(rl.context.framebufferSize.x, rl.context.framebufferSize.y));
         }
         else if (a.automatic == AutomaticUniform::skyMatrix)
         {
             m44f projection = rl.context.drawList->proj;
             m44f skyMatrix = matrix_invert(matrix_multiply(projection, rl.context.drawList->modl));
-            uniform(a.name.c_str(), skyMatrix);
+            uniform(a.handle, skyMatrix);
         }
         else if (a.automatic == AutomaticUniform::renderTime)
         {
-            uniformFloat(a.name.c_str(), (float) rl.context.renderTime);
+            uniformFloat(a.handle, (float) rl.context.renderTime);
         }
         else if (a.automatic == AutomaticUniform::mousePosition)
         {
-            uniform(a.name.c_str(), rl.context.mousePosition);
+            uniform(a.handle, rl.context.mousePosition);
         }
     }
 
@@ -135,51 +360,78 @@ void Shader::unbind() const { glUseProgram(0); }
 unsigned int Shader::attribute(const char *name) const { return glGetAttribLocation(id, name); }
 unsigned int Shader::uniform(const char *name)   const
 {
-    int rv = glGetUniformLocation(id, name);
-//    if (rv < 0)
-//        std::cout << "Warning: uniform " << name << " not found\n";
-    return rv;
+    return uniformLocation(uniformHandle(name));
+}
+
+void Shader::uniformInt(const char *name, int i)     const { uniformInt(uniformHandle(name), i); }
+void Shader::uniformFloat(const char *name, float f) const { uniformFloat(uniformHandle(name), f); }
+void Shader::uniform(const char *name, const v2f &v) const { uniform(uniformHandle(name), v); }
+void Shader::uniform(const char *name, const v3f &v) const { uniform(uniformHandle(name), v); }
+void Shader::uniform(const char *name, const v4f &v) const { uniform(uniformHandle(name), v); }
+
+void Shader::uniform(const char *name, const m44f &m, bool transpose) const
+{
+    uniform(uniformHandle(name), m, transpose);
 }
 
-void Shader::uniformInt(const char *name, int i)     const
+void Shader::uniformInt(UniformHandle h, int i) const
 {
-    int u = uniform(name);
+    int u = uniformLocation(h);
     if (u >= 0)
+    {
         glUniform1i(u, i);
+        uniformUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
 }
-void Shader::uniformFloat(const char *name, float f) const
+
+void Shader::uniformFloat(UniformHandle h, float f) const
 {
-    int u = uniform(name);
+    int u = uniformLocation(h);
     if (u >= 0)
+    {
         glUniform1f(u, f);
+        uniformUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void Shader::uniform(const char *name, const v2f &v) const
+void Shader::uniform(UniformHandle h, const v2f &v) const
 {
-    int u = uniform(name);
+    int u = uniformLocation(h);
     if (u >= 0)
+    {
         glUniform2fv(u, 1, (float*)&v);
+        uniformUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void Shader::uniform(const char *name, const v3f &v) const
+void Shader::uniform(UniformHandle h, const v3f &v) const
 {
-    int u = uniform(name);
+    int u = uniformLocation(h);
     if (u >= 0)
+    {
         glUniform3fv(u, 1, (float*)&v);
+        uniformUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void Shader::uniform(const char *name, const v4f &v) const
+void Shader::uniform(UniformHandle h, const v4f &v) const
 {
-    int u = uniform(name);
+    int u = uniformLocation(h);
     if (u >= 0)
-    glUniform4fv(u, 1, (float*)&v);
+    {
+        glUniform4fv(u, 1, (float*)&v);
+        uniformUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void Shader::uniform(const char *name, const m44f &m, bool transpose) const
+void Shader::uniform(UniformHandle h, const m44f &m, bool transpose) const
 {
-    int u = uniform(name);
+    int u = uniformLocation(h);
     if (u >= 0)
+    {
         glUniformMatrix4fv(u, 1, transpose, (float*)&m);
+        uniformUpdates.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
 
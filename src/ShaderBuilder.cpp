@@ -9,11 +9,17 @@
 #include "LabRender/ShaderBuilder.h"
 #include "LabRender/Model.h"
 #include "LabRender/FrameBuffer.h"
+#include "LabRender/UniformBlocks.h"
 
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <mutex>
 #include <set>
 #include <map>
 #include <string>
 #include <sstream>
+#include <string.h>
 #include "gl4.h"
 #include "LabRender/Utils.h"
 
@@ -29,35 +35,366 @@ ShaderBuilder::Cache* _cache()
     return _shaderCache;
 }
 
+namespace {
+
+    uint64_t fnv1a(uint64_t hash, const char* data, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+} // anon
+
+// Shaders are found by key in an open addressed table that readers probe
+// without locking. Entries are immutable and live as long as the cache, so
+// a reader always sees a complete entry. Writers serialize on a mutex,
+// replace an entry by publishing a new one to its slot, and grow the table
+// by publishing a copy; superseded tables are kept for readers still in
+// them. Probes start at the mixed key, since variant keys differ mostly in
+// their high bits. Keys can collide, so a hit also compares the name, or a
+// variant's full source hash and source text.
 class ShaderBuilder::Cache::Detail
 {
 public:
-    Detail() { }
-    std::map<std::string, std::shared_ptr<Shader>> shaders;
+    struct Entry
+    {
+        ShaderKey key;
+        std::string name; // empty for variant keys
+        std::shared_ptr<Shader> shader;
+
+        // the source of a variant made from supplied source
+        uint64_t sourceHash = 0;
+        bool hasVsh = false, hasFsh = false;
+        std::string vsh, fsh;
+
+        static bool sameText(bool has, const std::string& stored, char const* text)
+        {
+            return text ? has && stored == text : !has;
+        }
+
+        bool matches(const std::string* n, const VariantSource& source) const
+        {
+            if (n)
+                return name == *n;
+            return name.empty() && sourceHash == source.hash &&
+                   sameText(hasVsh, vsh, source.vsh) && sameText(hasFsh, fsh, source.fsh);
+        }
+
+        bool sameIdentity(const Entry& e) const
+        {
+            return key == e.key && name == e.name && sourceHash == e.sourceHash &&
+                   hasVsh == e.hasVsh && hasFsh == e.hasFsh && vsh == e.vsh && fsh == e.fsh;
+        }
+    };
+
+    struct Slot
+    {
+        std::atomic<ShaderKey> key { 0 };
+        std::atomic<Entry const*> entry { nullptr };
+    };
+
+    struct Table
+    {
+        explicit Table(size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {}
+        size_t mask;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    Detail()
+    {
+        tables.emplace_back(new Table(64));
+        table.store(tables.back().get());
+    }
+
+    Entry const* find(ShaderKey key, const std::string* name, const VariantSource& source = VariantSource()) const
+    {
+        Table const* t = table.load(std::memory_order_acquire);
+        for (size_t i = mix(key) & t->mask; ; i = (i + 1) & t->mask)
+        {
+            ShaderKey k = t->slots[i].key.load(std::memory_order_acquire);
+            if (!k)
+                return nullptr;
+            if (k != key)
+                continue;
+            Entry const* e = t->slots[i].entry.load(std::memory_order_acquire);
+            if (e->matches(name, source))
+                return e;
+        }
+    }
+
+    void insert(ShaderKey key, const std::string& name, std::shared_ptr<Shader> shader,
+                const VariantSource& source = VariantSource())
+    {
+        std::lock_guard<std::mutex> guard(writeLock);
+        entries.push_back(Entry());
+        Entry& added = entries.back();
+        added.key = key;
+        added.name = name;
+        added.shader = shader;
+        added.sourceHash = source.hash;
+        added.hasVsh = source.vsh != nullptr;
+        added.hasFsh = source.fsh != nullptr;
+        if (source.vsh) added.vsh = source.vsh;
+        if (source.fsh) added.fsh = source.fsh;
+        Entry const* e = &added;
+
+        Table* t = table.load(std::memory_order_relaxed);
+        if (!place(*t, e, true))
+        {
+            if (2 * (count + 1) > t->mask + 1)
+            {
+                Table* grown = new Table(2 * (t->mask + 1));
+                for (size_t i = 0; i <= t->mask; ++i)
+                    if (Entry const* old = t->slots[i].entry.load(std::memory_order_relaxed))
+                        place(*grown, old, false);
+                tables.emplace_back(grown);
+                t = grown;
+            }
+            place(*t, e, false);
+            table.store(t, std::memory_order_release);
+            ++count;
+        }
+    }
+
+    mutable std::mutex writeLock;
+
+    // programs still linking, and the keys to store their binaries under
+    std::vector<std::pair<std::shared_ptr<Shader>, std::string>> linking;
+    std::string binaryDirectory;
+
+private:
+    // publishes e in an empty slot, or in place of an entry with the same
+    // key, name and source if replace is set; returns true if an entry was
+    // replaced
+    bool place(Table& t, Entry const* e, bool replace)
+    {
+        for (size_t i = mix(e->key) & t.mask; ; i = (i + 1) & t.mask)
+        {
+            Slot& slot = t.slots[i];
+            ShaderKey k = slot.key.load(std::memory_order_relaxed);
+            if (!k)
+            {
+                if (replace)
+                    return false;
+                slot.entry.store(e, std::memory_order_relaxed);
+                slot.key.store(e->key, std::memory_order_release);
+                return false;
+            }
+            if (replace && k == e->key && slot.entry.load(std::memory_order_relaxed)->sameIdentity(*e))
+            {
+                slot.entry.store(e, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    std::atomic<Table*> table;
+    std::vector<std::unique_ptr<Table>> tables;
+    std::deque<Entry> entries;
+    size_t count = 0;
 };
 
+namespace {
+
+    const char* driverString(GLenum name)
+    {
+        const char* s = reinterpret_cast<const char*>(glGetString(name));
+        return s ? s : "";
+    }
+
+    // 128 bits of hash over the sources and the driver identification,
+    // since binaries are only valid for the driver that made them
+    std::string programBinaryKey(const std::string& vtx, const std::string& fgm)
+    {
+        std::string text = vtx;
+        text += '\0'; text += fgm;
+        text += '\0'; text += driverString(GL_VENDOR);
+        text += '\0'; text += driverString(GL_RENDERER);
+        text += '\0'; text += driverString(GL_VERSION);
+
+        uint64_t a = fnv1a(0xcbf29ce484222325ULL, text.data(), text.size());
+        uint64_t b = fnv1a(mix(a ^ text.size()), text.data(), text.size());
+        char key[33];
+        snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long) mix(a), (unsigned long long) mix(b));
+        return key;
+    }
+
+    const uint32_t programBinaryMagic = 0x4250524c; // LRPB
+
+    std::string programBinaryPath(const std::string& directory, const std::string& key)
+    {
+        return directory + "/" + key + ".labprogram";
+    }
+
+    bool loadProgramBinary(const std::string& path, Shader& shader)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+
+        uint32_t header[3] = { 0, 0, 0 };
+        std::vector<uint8_t> data;
+        bool ok = fread(header, sizeof(header), 1, f) == 1 && header[0] == programBinaryMagic;
+        if (ok)
+        {
+            data.resize(header[2]);
+            ok = !data.empty() && fread(data.data(), 1, data.size(), f) == data.size();
+        }
+        fclose(f);
+        return ok && shader.loadBinary(header[1], data.data(), data.size());
+    }
+
+    void saveProgramBinary(const std::string& path, const Shader& shader)
+    {
+        uint32_t format = 0;
+        std::vector<uint8_t> data;
+        if (!shader.binary(format, data))
+            return;
+
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f)
+        {
+            std::cerr << "Could not write program binary " << path << std::endl;
+            return;
+        }
+
+        uint32_t header[3] = { programBinaryMagic, format, static_cast<uint32_t>(data.size()) };
+        fwrite(header, sizeof(header), 1, f);
+        fwrite(data.data(), 1, data.size(), f);
+        fclose(f);
+    }
+
+} // anon
+
 ShaderBuilder::Cache::Cache() : _detail(new Detail()) { }
-ShaderBuilder::Cache::~Cache() { delete _detail.get(); }
+ShaderBuilder::Cache::~Cache() { }
+
+namespace {
+
+    // names hash with bit 15 clear, and variant keys set it
+    ShaderBuilder::ShaderKey nameKey(const std::string& name)
+    {
+        ShaderBuilder::ShaderKey key = mix(fnv1a(0xcbf29ce484222325ULL, name.data(), name.size()));
+        key &= ~ShaderBuilder::ShaderKey(0x8000);
+        return key ? key : 1;
+    }
+
+} // anon
+
+ShaderBuilder::VariantSource ShaderBuilder::variantSource(char const*const vsh, char const*const fsh)
+{
+    VariantSource source;
+    source.vsh = vsh;
+    source.fsh = fsh;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    if (vsh)
+        hash = fnv1a(hash ^ 'v', vsh, strlen(vsh));
+    if (fsh)
+        hash = fnv1a(hash ^ 'f', fsh, strlen(fsh));
+    source.hash = vsh || fsh ? mix(hash) : 0;
+    return source;
+}
+
+ShaderBuilder::ShaderKey ShaderBuilder::variantKey(
+    uint32_t attributeMask, uint32_t shaderType, bool deferred, bool textured, const VariantSource& source)
+{
+    ShaderKey key = (source.hash << 16) | 0x8000;
+    key |= attributeMask & 0xff;
+    key |= ShaderKey(shaderType & 0xf) << 8;
+    if (deferred) key |= 0x1000;
+    if (textured) key |= 0x2000;
+    return key;
+}
 
-bool ShaderBuilder::Cache::hasShader(const std::string& shader) const
+bool ShaderBuilder::Cache::hasShader(const std::string& name) const
 {
-    Cache *cache = _cache();
-    return cache->_detail->shaders.find(shader) != _detail->shaders.end();
+    return _detail->find(nameKey(name), &name) != nullptr;
 }
 
 void ShaderBuilder::Cache::add(const std::string& name, std::shared_ptr<Shader> shader)
 {
-    Cache *cache = _cache();
-    cache->_detail->shaders[name] = shader;
+    _detail->insert(nameKey(name), name, shader);
 }
 
 std::shared_ptr<Shader> ShaderBuilder::Cache::shader(const std::string& name) const
 {
-    if (!hasShader(name))
-        return std::shared_ptr<Shader>();
+    Detail::Entry const* e = _detail->find(nameKey(name), &name);
+    return e ? e->shader : std::shared_ptr<Shader>();
+}
 
-    Cache *cache = _cache();
-    return cache->_detail->shaders.find(name)->second;
+Shader::Status ShaderBuilder::Cache::status(const std::string& name) const
+{
+    std::shared_ptr<Shader> s = shader(name);
+    return s ? s->status : Shader::Status::failed;
+}
+
+bool ShaderBuilder::Cache::hasShader(ShaderKey key, const VariantSource& source) const
+{
+    return _detail->find(key, nullptr, source) != nullptr;
+}
+
+void ShaderBuilder::Cache::add(ShaderKey key, std::shared_ptr<Shader> shader, const VariantSource& source)
+{
+    _detail->insert(key, std::string(), shader, source);
+}
+
+std::shared_ptr<Shader> ShaderBuilder::Cache::shader(ShaderKey key, const VariantSource& source) const
+{
+    Detail::Entry const* e = _detail->find(key, nullptr, source);
+    return e ? e->shader : std::shared_ptr<Shader>();
+}
+
+Shader::Status ShaderBuilder::Cache::status(ShaderKey key, const VariantSource& source) const
+{
+    std::shared_ptr<Shader> s = shader(key, source);
+    return s ? s->status : Shader::Status::failed;
+}
+
+void ShaderBuilder::Cache::update()
+{
+    // binaries are written after the lock is released
+    std::vector<std::pair<std::shared_ptr<Shader>, std::string>> linked;
+    {
+        std::lock_guard<std::mutex> guard(_detail->writeLock);
+        auto& linking = _detail->linking;
+        for (size_t i = 0; i < linking.size(); )
+        {
+            Shader& s = *linking[i].first;
+            // errors are left for the shader's next draw to report
+            if (s.status == Shader::Status::pending && !s.poll(false, false))
+            {
+                ++i;
+                continue;
+            }
+
+            if (s.status == Shader::Status::ready && !linking[i].second.empty())
+                linked.push_back({linking[i].first, programBinaryPath(_detail->binaryDirectory, linking[i].second)});
+
+            linking[i] = linking.back();
+            linking.pop_back();
+        }
+    }
+
+    for (auto& l : linked)
+        saveProgramBinary(l.second, *l.first);
+}
+
+void ShaderBuilder::Cache::setProgramBinaryDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> guard(_detail->writeLock);
+    _detail->binaryDirectory = directory;
 }
 
 ShaderBuilder::Cache* ShaderBuilder::cache()
@@ -75,6 +412,15 @@ const char* preamble()
 }
 
 
+// uniforms provided by the standard uniform blocks are aliased to the block members
+std::string uniformDeclaration(Semantic& u, bool vertexStage)
+{
+    char const* member = uniformBlockMember(u.name, u.automatic, vertexStage);
+    if (member)
+        return "#define " + u.name + " " + member;
+    return u.uniformString();
+}
+
 std::string generateFragment()
 {
     std::stringstream s;
@@ -94,6 +440,7 @@ void ShaderBuilder::clear()
     for (auto i : attributes) delete i.second; attributes.clear();
     for (auto i : varyings) delete i;   varyings.clear();
     for (auto i : outputs) delete i;    outputs.clear();
+    octahedralNormals = false;
 }
 
 void ShaderBuilder::setFrameBufferOutputs(const FrameBuffer& fbo, const std::vector<std::string>& output_attachments)
@@ -129,7 +476,11 @@ void ShaderBuilder::setAttributes(const ModelPart& mesh)
     VAO* vao = mesh.verts();
     vao->uploadVerts();
     for (int i = 0; i < vao->attributes.size(); ++i)
+    {
         attributes[vao->attributes[i].name] = new Semantic(vao->attributes[i]);
+        if (vao->attributes[i].name == "a_normal" && vao->attributes[i].type == SemanticType::vec2_st)
+            octahedralNormals = true;
+    }
 }
 
 void ShaderBuilder::setAttributes(const ShaderSpec& spec)
@@ -183,11 +534,12 @@ std::string ShaderBuilder::generateVertexShader(const char* body)
     std::stringstream s;
     s << "// Vertex\n";
     s << preamble();
+    s << uniformBlockDeclarations(true);
 
     for (auto a : attributes)
         s << a.second->attributeString() << std::endl;
     for (auto u : uniforms)
-        s << u->uniformString() << std::endl;
+        s << uniformDeclaration(*u, true) << std::endl;
 
     if (varyings.size() > 0)
     {
@@ -196,6 +548,17 @@ std::string ShaderBuilder::generateVertexShader(const char* body)
             s << "   " << semanticTypeToString(v->type) << " " << v->name << ";\n";
         s << "} var;\n";
     }
+
+    if (octahedralNormals)
+        s << R"glsl(
+vec3 octahedralDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+)glsl";
+
     s << body << std::endl;
 
     return s.str();
@@ -206,11 +569,12 @@ std::string ShaderBuilder::generateFragmentShader(const char* body)
     std::stringstream s;
     s << "// Fragment\n";
     s << preamble();
+    s << uniformBlockDeclarations(false);
 
     for (auto i : outputs)
         s << i->outputString() << std::endl;
     for (auto i : uniforms)
-        s << i->uniformString() << std::endl;
+        s << uniformDeclaration(*i, false) << std::endl;
     for (auto i : samplers)
         s << i->uniformString() << std::endl;
 
@@ -269,8 +633,9 @@ std::shared_ptr<Shader> ShaderBuilder::makeShader(
 
     auto shader = makeShader(spec.name, reinterpret_cast<const char*>(&vrtx[0]), reinterpret_cast<const char*>(&fgmt[0]), vao, printShader);
 
+    // automatics served by the frame uniform block need no per bind update
     for (auto u : spec.uniforms)
-        if (u.automatic != AutomaticUniform::none)
+        if (u.automatic != AutomaticUniform::none && !uniformBlockMember(u.name, u.automatic))
             shader->automatics.push_back(u);
 
     return shader;
@@ -291,12 +656,39 @@ std::shared_ptr<Shader> ShaderBuilder::makeShader(
         printf("\nFragment Shader\n__________________________\n%s\n\n\n\n", fgm.c_str());
     }
 
-    vao.bindVAO();
     std::shared_ptr<Shader>shader = std::make_shared<Shader>();
+
+    Cache::Detail* cache = _cache()->_detail.get();
+    std::string binaryDirectory;
+    {
+        std::lock_guard<std::mutex> guard(cache->writeLock);
+        binaryDirectory = cache->binaryDirectory;
+    }
+
+    std::string binaryKey;
+    if (!binaryDirectory.empty())
+    {
+        binaryKey = programBinaryKey(vtx, fgm);
+        if (loadProgramBinary(programBinaryPath(binaryDirectory, binaryKey), *shader))
+            return shader;
+    }
+
+    vao.bindVAO();
     shader->shader(name, Shader::ProgramType::Vertex,   false, vtx.c_str()).
-            shader(name, Shader::ProgramType::Fragment, false, fgm.c_str()).link();
+            shader(name, Shader::ProgramType::Fragment, false, fgm.c_str()).linkAsync();
     vao.unbindVAO();
 
+    if (compileAsync)
+    {
+        std::lock_guard<std::mutex> guard(cache->writeLock);
+        cache->linking.push_back({shader, binaryKey});
+        return shader;
+    }
+
+    shader->poll(true);
+    if (shader->status == Shader::Status::ready && !binaryKey.empty())
+        saveProgramBinary(programBinaryPath(binaryDirectory, binaryKey), *shader);
+
     return shader;
 }
 
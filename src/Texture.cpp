@@ -8,6 +8,8 @@
 
 #include "LabRender/Texture.h"
 #include "gl4.h"
+#include "LabRender/Renderer.h"
+#include "LabRender/TextureCache.h"
 #include "LabRender/Utils.h"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -16,6 +18,15 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
 using namespace std;
 
 namespace lab { namespace Render {
@@ -275,6 +286,44 @@ Texture& Texture::create(int w, int h, int d, TextureType type_, int filter, int
 
 
 
+// glTexStorage2D needs GL 4.2, so each level is specified in turn, and the
+// level range is limited to the chain so that the texture is complete
+Texture& Texture::create(const TextureLevels& chain, int minFilter, int magFilter, int wrap, bool uploadPixels)
+{
+    if (chain.levels.empty())
+        return *this;
+
+    target = GL_TEXTURE_2D;
+    width = chain.levels[0].width;
+    height = chain.levels[0].height;
+    depth = 1;
+    depthTexture = false;
+    type = glType(chain.type);
+    channels = glColorChannels(chain.type);
+    format = chain.compressedFormat ? int(chain.compressedFormat) : glInternalFormat(chain.type);
+    if (!id)
+        glGenTextures(1, &id);
+    bind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, magFilter);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, int(chain.levels.size()) - 1);
+    for (size_t i = 0; i < chain.levels.size(); ++i)
+    {
+        const MipChain::Level& level = chain.levels[i];
+        const void* pixels = uploadPixels ? chain.pixels(i) : nullptr;
+        if (chain.compressedFormat)
+            glCompressedTexImage2D(target, int(i), format, level.width, level.height, 0, GLsizei(level.size), pixels);
+        else
+            glTexImage2D(target, int(i), format, level.width, level.height, 0, channels, type, pixels);
+    }
+    unbind();
+    return *this;
+}
+
 Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wrap, TextureType datatype,
                                 CubeImageDataType cubeType, void* image)
 {
@@ -356,9 +405,20 @@ Texture& Texture::createCube(int w, int h, TextureType type_, int filter, int wr
     }
 
 Texture& Texture::update(int xoffset, int yoffset, int width, int height, int format, int type, void* data) {
+    return updateLevel(0, xoffset, yoffset, width, height, format, type, data);
+}
+
+Texture& Texture::updateCompressedLevel(int level, int width, int height, size_t size, void* data) {
+    bind();
+    glCompressedTexSubImage2D(target, level, 0, 0, width, height, format, GLsizei(size), data);
+    unbind();
+    return *this;
+}
+
+Texture& Texture::updateLevel(int level, int xoffset, int yoffset, int width, int height, int format, int type, void* data) {
     bind();
     glTexSubImage2D(target,
-                    0, // LOD level
+                    level,
                     xoffset, yoffset,
                     width, height,
                     format, type, data);
@@ -390,22 +450,388 @@ void Texture::save(const char * path)
 }
 
 
-FileTextureProvider::FileTextureProvider(const string & path) {
+static int glMinFilter(TextureFilter filter)
+{
+    switch (filter) {
+        case TextureFilter::nearest:   return GL_NEAREST_MIPMAP_NEAREST;
+        case TextureFilter::trilinear: return GL_LINEAR_MIPMAP_LINEAR;
+        default:                       return GL_LINEAR_MIPMAP_NEAREST;
+    }
+}
 
-    std::string filename = lab::expandPath(path.c_str());
+static int glMagFilter(TextureFilter filter)
+{
+    return filter == TextureFilter::nearest ? GL_NEAREST : GL_LINEAR;
+}
 
-    int w, h, n;
-    unsigned char* img;
-    stbi_set_unpremultiply_on_load(1);
-    stbi_convert_iphone_png_to_rgb(1);
-    img = stbi_load(filename.c_str(), &w, &h, &n, 4);
+FileTextureProvider::FileTextureProvider(const string & path, TextureFilter filter, ColorSpace colorSpace) {
 
-    if (img != NULL) {
+    std::unique_ptr<TextureLevels> levels = loadTextureLevels(path, MipFilter::box, colorSpace);
+    if (levels) {
         _texture = std::make_shared<Texture>();
-        _texture->create(w, h, TextureType::u8x4, GL_LINEAR, GL_CLAMP_TO_EDGE, TextureType::u8x4, img);
+        _texture->create(*levels, glMinFilter(filter), glMagFilter(filter), GL_CLAMP_TO_EDGE);
+    }
+}
+
+
+// one image on its way from disk to a texture
+struct TextureStream
+{
+    std::string path;
+    Renderer* renderer = nullptr;       // under the streamer's lock; null once the renderer is gone
+    std::shared_ptr<Texture> texture;   // handed out, takes the staging texture's name once complete
+    std::unique_ptr<Texture> staging;   // receives the rows as they stream in
+    TextureFilter filter = TextureFilter::bilinear;
+    ColorSpace colorSpace = ColorSpace::srgb;
+    std::unique_ptr<TextureLevels> levels;
+    size_t level = 0;                   // the level and row the next band starts at
+    int rowsUploaded = 0;
+    bool done = false;
+
+    std::promise<void> decodedPromise;
+    std::shared_future<void> decoded;
+    std::promise<bool> readyPromise;
+    std::shared_future<bool> ready;
+
+    TextureStream()
+    : decoded(decodedPromise.get_future().share())
+    , ready(readyPromise.get_future().share()) {}
+
+    bool complete() const { return done; }
+};
+
+namespace {
+
+    std::atomic<size_t> textureUploadBudget(4 * 1024 * 1024);
+
+    class TextureDecodePool
+    {
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::deque<std::function<void()>> _jobs;
+        std::vector<std::thread> _workers;
+        bool _stop = false;
+
+        void run()
+        {
+            while (true)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+                    if (_stop)
+                        return;
+
+                    job = std::move(_jobs.front());
+                    _jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+    public:
+        TextureDecodePool()
+        {
+            // leave a core for the render thread
+            unsigned int count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            for (unsigned int i = 0; i < count; ++i)
+                _workers.emplace_back([this]() { run(); });
+        }
+
+        ~TextureDecodePool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (auto & w : _workers)
+                w.join();
+        }
 
-        stbi_image_free(img);
+        void push(std::function<void()> && job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _jobs.emplace_back(std::move(job));
+            }
+            _wake.notify_one();
+        }
+    };
+
+    TextureDecodePool & decodePool()
+    {
+        static TextureDecodePool pool;
+        return pool;
     }
+
+    // Decoded images arrive from the pool, and are uploaded on the render
+    // thread by a pump command that reschedules itself for the next frame
+    // until the backlog is drained. Commands are enqueued under the lock, so
+    // that a renderer being destroyed can't be handed one.
+    class TextureStreamer
+    {
+        std::mutex _mutex;
+        std::vector<std::weak_ptr<TextureStream>> _streams;    // every stream not yet arrived
+        std::deque<std::shared_ptr<TextureStream>> _arrived;
+        Renderer* _pumpQueuedOn = nullptr;
+
+        // render thread only
+        std::deque<std::shared_ptr<TextureStream>> _uploading;
+        GLuint _pbo = 0;
+
+        void collectArrivals()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _uploading.insert(_uploading.end(), _arrived.begin(), _arrived.end());
+            _arrived.clear();
+        }
+
+        // streams up to budget bytes of the next rows of the current level
+        // through the unpack buffer, at least one row, and returns the number
+        // of bytes uploaded. Block compressed levels go a whole level at a time.
+        size_t upload(TextureStream & s, size_t budget)
+        {
+            const TextureLevels & levels = *s.levels;
+            if (!s.staging)
+            {
+                s.staging.reset(new Texture());
+                s.staging->create(levels, glMinFilter(s.filter), glMagFilter(s.filter), GL_CLAMP_TO_EDGE, false);
+            }
+
+            const MipChain::Level & level = levels.levels[s.level];
+            size_t rowBytes = levels.compressedFormat ? level.size : level.size / level.height;
+            int rows = levels.compressedFormat ? level.height
+                     : int(std::min<size_t>(level.height - s.rowsUploaded, std::max<size_t>(1, budget / rowBytes)));
+            size_t bytes = levels.compressedFormat ? level.size : rows * rowBytes;
+            uint8_t* src = const_cast<uint8_t*>(levels.pixels(s.level)) + s.rowsUploaded * rowBytes;
+            int lod = int(s.level);
+            int channels = glColorChannels(levels.type);
+            int type = glType(levels.type);
+
+            if (!_pbo)
+                glGenBuffers(1, &_pbo);
+
+            // orphan the previous band so its transfer can finish while this one is written
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+            void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            uint8_t* data = nullptr;
+            if (dst)
+            {
+                memcpy(dst, src, bytes);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            else
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                data = src;
+            }
+
+            if (levels.compressedFormat)
+                s.staging->updateCompressedLevel(lod, level.width, level.height, bytes, data);
+            else
+                s.staging->updateLevel(lod, 0, s.rowsUploaded, level.width, rows, channels, type, data);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            s.rowsUploaded += rows;
+            if (s.rowsUploaded == level.height)
+            {
+                s.rowsUploaded = 0;
+                if (++s.level == levels.levels.size())
+                    complete(s);
+            }
+
+            return bytes;
+        }
+
+        // the texture handed out takes over the staging texture's name, and the
+        // staging texture leaves with the placeholder's
+        void complete(TextureStream & s)
+        {
+            Texture & t = *s.texture;
+            Texture & st = *s.staging;
+            std::swap(t.id, st.id);
+            std::swap(t.target, st.target);
+            std::swap(t.width, st.width);
+            std::swap(t.height, st.height);
+            std::swap(t.depth, st.depth);
+            std::swap(t.format, st.format);
+            std::swap(t.type, st.type);
+            std::swap(t.channels, st.channels);
+            s.staging.reset();
+
+            s.levels.reset();
+            s.done = true;
+            s.readyPromise.set_value(true);
+        }
+
+        // queues a pump on the renderer of the first stream waiting for one
+        void queuePump()
+        {
+            _pumpQueuedOn = nullptr;
+            if (!_uploading.empty())
+                _pumpQueuedOn = _uploading.front()->renderer;
+            else if (!_arrived.empty())
+                _pumpQueuedOn = _arrived.front()->renderer;
+            if (_pumpQueuedOn)
+                _pumpQueuedOn->enqueCommand([this]() { pump(); });
+        }
+
+    public:
+        void track(const std::shared_ptr<TextureStream> & s)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _streams.erase(std::remove_if(_streams.begin(), _streams.end(),
+                                          [](const std::weak_ptr<TextureStream> & w) { return w.expired(); }),
+                           _streams.end());
+            _streams.push_back(s);
+        }
+
+        // called from the decode pool; returns false if the stream's renderer is gone
+        bool arrive(std::shared_ptr<TextureStream> s)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!s->renderer)
+                return false;
+
+            _arrived.push_back(s);
+            if (!_pumpQueuedOn)
+                queuePump();
+            return true;
+        }
+
+        // Called as a renderer is destroyed, on its render thread. Its streams
+        // still to be uploaded are abandoned as not ready, and a pump queued
+        // on it moves to another renderer.
+        void forget(Renderer * r)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto abandon = [r](std::deque<std::shared_ptr<TextureStream>> & streams)
+            {
+                for (auto i = streams.begin(); i != streams.end(); )
+                {
+                    if ((*i)->renderer != r)
+                    {
+                        ++i;
+                        continue;
+                    }
+                    (*i)->renderer = nullptr;
+                    (*i)->staging.reset();
+                    (*i)->levels.reset();
+                    (*i)->readyPromise.set_value(false);
+                    i = streams.erase(i);
+                }
+            };
+            abandon(_arrived);
+            abandon(_uploading);
+
+            // streams still decoding are dropped as they arrive
+            for (auto & w : _streams)
+                if (std::shared_ptr<TextureStream> s = w.lock())
+                    if (s->renderer == r)
+                        s->renderer = nullptr;
+
+            if (_pumpQueuedOn == r)
+                queuePump();
+        }
+
+        void pump()
+        {
+            collectArrivals();
+
+            size_t budget = textureUploadBudget;
+            while (!_uploading.empty() && budget > 0)
+            {
+                TextureStream & s = *_uploading.front();
+                budget -= std::min(budget, upload(s, budget));
+                if (s.complete())
+                    _uploading.pop_front();
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            queuePump();
+        }
+
+        bool finish(const std::shared_ptr<TextureStream> & s)
+        {
+            s->decoded.wait();
+            collectArrivals();
+
+            auto i = std::find(_uploading.begin(), _uploading.end(), s);
+            if (i != _uploading.end())
+            {
+                while (!s->complete())
+                    upload(*s, ~size_t(0));
+                _uploading.erase(i);
+            }
+            return s->ready.get();
+        }
+    };
+
+    TextureStreamer & textureStreamer()
+    {
+        static TextureStreamer streamer;
+        return streamer;
+    }
+
+} // anon
+
+void setTextureUploadBudget(size_t bytes)
+{
+    textureUploadBudget = bytes;
+}
+
+void cancelTextureStreams(Renderer & renderer)
+{
+    textureStreamer().forget(&renderer);
+}
+
+AsyncFileTextureProvider::AsyncFileTextureProvider(Renderer & renderer, const string & path,
+                                                   TextureFilter filter, ColorSpace colorSpace)
+: _texture(std::make_shared<Texture>())
+, _stream(std::make_shared<TextureStream>())
+{
+    // mid grey until the image arrives
+    uint8_t placeholder[4] = { 128, 128, 128, 255 };
+    _texture->create(1, 1, TextureType::u8x4, GL_LINEAR, GL_CLAMP_TO_EDGE);
+    _texture->update(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+    _stream->path = lab::expandPath(path.c_str());
+    _stream->renderer = &renderer;
+    _stream->texture = _texture;
+    _stream->filter = filter;
+    _stream->colorSpace = colorSpace;
+
+    // the pool keeps the stream alive, so the provider may go out of scope
+    std::shared_ptr<TextureStream> s = _stream;
+    textureStreamer().track(s);
+    decodePool().push([s]()
+    {
+        s->levels = loadTextureLevels(s->path, MipFilter::box, s->colorSpace);
+        if (!s->levels)
+        {
+            std::cerr << "Could not load texture " << s->path << std::endl;
+            s->readyPromise.set_value(false);
+        }
+        else if (!textureStreamer().arrive(s))
+        {
+            s->levels.reset();
+            s->readyPromise.set_value(false);
+        }
+        s->decodedPromise.set_value();
+    });
+}
+
+std::shared_future<bool> AsyncFileTextureProvider::ready() const
+{
+    return _stream->ready;
+}
+
+bool AsyncFileTextureProvider::finish()
+{
+    return textureStreamer().finish(_stream);
 }
 
 
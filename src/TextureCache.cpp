@@ -0,0 +1,277 @@
+//
+//  TextureCache.cpp
+//  LabRender
+//
+
+#include "LabRender/TextureCache.h"
+#include "LabRender/Utils.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string.h>
+
+using namespace std;
+
+namespace lab { namespace Render {
+
+namespace {
+
+    const char cacheMagic[4] = { 'L', 'R', 'T', 'X' };
+    const uint32_t cacheVersion = 3;
+    const size_t cacheAlignment = 16;
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t type;              // TextureType
+        uint32_t compressedFormat;
+        uint32_t levelCount;
+        uint32_t filter;            // MipFilter the levels were built with
+        uint32_t colorSpace;        // ColorSpace requested for an 8 bit image
+        uint64_t sourceSize;
+        int64_t sourceModified;
+    };
+
+    struct CacheLevel
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;            // from the start of the file
+        uint64_t size;
+    };
+
+    size_t align(size_t offset)
+    {
+        return (offset + cacheAlignment - 1) & ~(cacheAlignment - 1);
+    }
+
+    mutex cacheDirectoryMutex;
+    string textureCacheDir = cacheDirectory("LABRENDER_TEXTURE_CACHE", "textures");
+
+    void configureImageLoading()
+    {
+        // stb_image's settings are global, so they are set once before any decoding
+        static once_flag once;
+        call_once(once, []()
+        {
+            stbi_set_unpremultiply_on_load(1);
+            stbi_convert_iphone_png_to_rgb(1);
+        });
+    }
+
+    MipChain decodeImage(const string & path, MipFilter filter, ColorSpace colorSpace)
+    {
+        configureImageLoading();
+
+        int w, h, n;
+        if (stbi_is_hdr(path.c_str()))
+        {
+            float* img = stbi_loadf(path.c_str(), &w, &h, &n, 4);
+            if (!img)
+                return MipChain();
+
+            vector<uint16_t> half(size_t(w) * h * 4);
+            for (size_t i = 0; i < half.size(); ++i)
+                half[i] = floatToHalf(img[i]);
+            stbi_image_free(img);
+            return generateMipChain(TextureType::f16x4, w, h, half.data(), filter, ColorSpace::linear);
+        }
+
+        unsigned char* img = stbi_load(path.c_str(), &w, &h, &n, 4);
+        if (!img)
+            return MipChain();
+
+        MipChain chain = generateMipChain(TextureType::u8x4, w, h, img, filter, colorSpace);
+        stbi_image_free(img);
+        return chain;
+    }
+
+} // anon
+
+// reads and writes cache files on behalf of TextureLevels
+struct TextureCacheFile
+{
+    // maps a cache file, and returns null unless it is intact and was built
+    // from a source matching the stamp with the given filter and colour
+    // space. Uncompressed
+    // levels must be exactly width x height texels of the header's type.
+    static unique_ptr<TextureLevels> map(const string & path, const FileStamp & stamp,
+                                         MipFilter filter, ColorSpace colorSpace)
+    {
+        unique_ptr<MappedFile> mapping(new MappedFile());
+        if (!mapping->open(path) || mapping->size() < sizeof(CacheHeader))
+            return nullptr;
+
+        const uint8_t* base = mapping->data();
+        CacheHeader header;
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, cacheMagic, 4) || header.version != cacheVersion ||
+            header.sourceSize != stamp.size || header.sourceModified != stamp.modified ||
+            header.filter != uint32_t(filter) || header.colorSpace != uint32_t(colorSpace) || !header.levelCount ||
+            mapping->size() < sizeof(CacheHeader) + header.levelCount * sizeof(CacheLevel))
+            return nullptr;
+
+        size_t texelBytes = textureTexelBytes(TextureType(header.type));
+        if (!texelBytes)
+            return nullptr;
+
+        unique_ptr<TextureLevels> result(new TextureLevels());
+        result->type = TextureType(header.type);
+        result->compressedFormat = header.compressedFormat;
+        result->levels.resize(header.levelCount);
+        for (uint32_t i = 0; i < header.levelCount; ++i)
+        {
+            CacheLevel level;
+            memcpy(&level, base + sizeof(CacheHeader) + i * sizeof(CacheLevel), sizeof(level));
+            if (!level.width || !level.height ||
+                level.offset > mapping->size() || level.size > mapping->size() - level.offset)
+                return nullptr;
+            if (!header.compressedFormat && level.size != uint64_t(level.width) * level.height * texelBytes)
+                return nullptr;
+
+            MipChain::Level & l = result->levels[i];
+            l.width = int(level.width);
+            l.height = int(level.height);
+            l.offset = size_t(level.offset);
+            l.size = size_t(level.size);
+        }
+
+        result->_data = base;
+        result->_mapping = std::move(mapping);
+        return result;
+    }
+
+    static bool write(const string & path, const TextureLevels & levels, const FileStamp & stamp,
+                      MipFilter filter, ColorSpace colorSpace)
+    {
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, cacheMagic, 4);
+        header.version = cacheVersion;
+        header.type = uint32_t(levels.type);
+        header.compressedFormat = levels.compressedFormat;
+        header.levelCount = uint32_t(levels.levels.size());
+        header.filter = uint32_t(filter);
+        header.colorSpace = uint32_t(colorSpace);
+        header.sourceSize = stamp.size;
+        header.sourceModified = stamp.modified;
+
+        vector<CacheLevel> table(levels.levels.size());
+        size_t offset = align(sizeof(CacheHeader) + table.size() * sizeof(CacheLevel));
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            table[i].width = uint32_t(levels.levels[i].width);
+            table[i].height = uint32_t(levels.levels[i].height);
+            table[i].offset = offset;
+            table[i].size = levels.levels[i].size;
+            offset = align(offset + levels.levels[i].size);
+        }
+
+        return writeFileAtomically(path, [&](FILE* f)
+        {
+            static const uint8_t padding[cacheAlignment] = {};
+            bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+            ok = ok && (table.empty() || fwrite(table.data(), sizeof(CacheLevel), table.size(), f) == table.size());
+            size_t written = sizeof(header) + table.size() * sizeof(CacheLevel);
+            for (size_t i = 0; ok && i < table.size(); ++i)
+            {
+                ok = fwrite(padding, 1, size_t(table[i].offset) - written, f) == size_t(table[i].offset) - written;
+                ok = ok && fwrite(levels.pixels(i), 1, size_t(table[i].size), f) == size_t(table[i].size);
+                written = size_t(table[i].offset + table[i].size);
+            }
+            return ok;
+        });
+    }
+};
+
+TextureLevels::TextureLevels()
+{
+}
+
+TextureLevels::TextureLevels(MipChain && chain)
+: type(chain.type)
+, levels(std::move(chain.levels))
+, _owned(std::move(chain.data))
+{
+    _data = _owned.data();
+}
+
+TextureLevels::~TextureLevels()
+{
+}
+
+void setTextureCacheDirectory(const std::string & dir)
+{
+    lock_guard<mutex> lock(cacheDirectoryMutex);
+    textureCacheDir = dir;
+}
+
+std::string textureCacheDirectory()
+{
+    lock_guard<mutex> lock(cacheDirectoryMutex);
+    return textureCacheDir;
+}
+
+std::string textureCachePath(const std::string & imagePath)
+{
+    string dir = textureCacheDirectory();
+    if (dir.empty())
+        return string();
+
+    return cacheFilePath(dir, lab::expandPath(imagePath.c_str()), "lrtex");
+}
+
+std::unique_ptr<TextureLevels> loadTextureLevels(const std::string & imagePath, MipFilter filter, ColorSpace colorSpace)
+{
+    string path = lab::expandPath(imagePath.c_str());
+    string cachePath = textureCachePath(path);
+
+    FileStamp stamp;
+    if (!stampFile(path, stamp))
+        return nullptr;
+
+    if (!cachePath.empty())
+    {
+        if (auto cached = TextureCacheFile::map(cachePath, stamp, filter, colorSpace))
+            return cached;
+    }
+
+    MipChain chain = decodeImage(path, filter, colorSpace);
+    if (chain.levels.empty())
+        return nullptr;
+
+    unique_ptr<TextureLevels> levels(new TextureLevels(std::move(chain)));
+    if (cachePath.empty())
+        return levels;
+
+    if (!makeDirectories(textureCacheDirectory()) || !TextureCacheFile::write(cachePath, *levels, stamp, filter, colorSpace))
+    {
+        cerr << "Could not write texture cache " << cachePath << endl;
+        return levels;
+    }
+
+    // the mapped entry replaces the decoded copy, so that later loads and
+    // this one read the same pages
+    if (auto cached = TextureCacheFile::map(cachePath, stamp, filter, colorSpace))
+        return cached;
+    return levels;
+}
+
+bool writeTextureCache(const std::string & imagePath, const TextureLevels & levels,
+                       MipFilter filter, ColorSpace colorSpace)
+{
+    string path = lab::expandPath(imagePath.c_str());
+    string cachePath = textureCachePath(path);
+
+    FileStamp stamp;
+    if (cachePath.empty() || levels.levels.empty() || !stampFile(path, stamp))
+        return false;
+
+    return makeDirectories(textureCacheDirectory()) && TextureCacheFile::write(cachePath, levels, stamp, filter, colorSpace);
+}
+
+}} // lab::Render
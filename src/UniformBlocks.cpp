@@ -0,0 +1,164 @@
+//
+//  UniformBlocks.cpp
+//  LabRender
+//
+//  Copyright (c) 2020 Planet IX. All rights reserved.
+//
+
+#include "LabRender/UniformBlocks.h"
+#include "gl4.h"
+
+#include <string.h>
+#include <vector>
+
+namespace lab { namespace Render {
+
+char const* uniformBlockDeclarations(bool vertexStage)
+{
+    static_assert(maxObjectsPerDraw == 64, "the LabObject declaration must match maxObjectsPerDraw");
+
+    if (!vertexStage)
+        return R"glsl(
+layout(std140) uniform LabFrame {
+    mat4 view;
+    mat4 projection;
+    mat4 skyMatrix;
+    vec2 resolution;
+    vec2 mousePosition;
+    float renderTime;
+} lab_frame;
+)glsl";
+
+    return R"glsl(
+layout(std140) uniform LabFrame {
+    mat4 view;
+    mat4 projection;
+    mat4 skyMatrix;
+    vec2 resolution;
+    vec2 mousePosition;
+    float renderTime;
+} lab_frame;
+
+struct LabObjectData {
+    mat4 model;
+    mat4 modelView;
+    mat4 modelViewProj;
+    mat4 rotationTransform;
+};
+
+layout(std140) uniform LabObject {
+    LabObjectData objects[64];
+} lab_objects;
+
+#define lab_object lab_objects.objects[gl_InstanceID]
+)glsl";
+}
+
+char const* uniformBlockMember(const std::string& name, AutomaticUniform automatic, bool vertexStage)
+{
+    switch (automatic)
+    {
+        case AutomaticUniform::frameBufferResolution: return "lab_frame.resolution";
+        case AutomaticUniform::skyMatrix:             return "lab_frame.skyMatrix";
+        case AutomaticUniform::renderTime:            return "lab_frame.renderTime";
+        case AutomaticUniform::mousePosition:         return "lab_frame.mousePosition";
+        default: break;
+    }
+
+    if (name == "u_view")              return "lab_frame.view";
+    if (!vertexStage)                  return nullptr;
+    if (name == "u_model")             return "lab_object.model";
+    if (name == "u_modelView")         return "lab_object.modelView";
+    if (name == "u_modelViewProj")     return "lab_object.modelViewProj";
+    if (name == "u_rotationTransform") return "lab_object.rotationTransform";
+    return nullptr;
+}
+
+class UniformStream::Detail
+{
+public:
+    Detail(unsigned int binding, size_t range) : binding(binding), range(range) {}
+
+    unsigned int binding;
+    size_t range;
+    GLuint buffer = 0;
+    size_t capacity = 0;
+    size_t alignment = 0;
+    size_t uploaded = 0;
+    std::vector<uint8_t> staging;
+};
+
+UniformStream::UniformStream(unsigned int binding, size_t range)
+: _detail(new Detail(binding, range))
+{
+}
+
+UniformStream::~UniformStream()
+{
+    if (_detail->buffer)
+        glDeleteBuffers(1, &_detail->buffer);
+    delete _detail;
+}
+
+void UniformStream::beginFrame()
+{
+    _detail->staging.clear();
+    _detail->uploaded = 0;
+
+    if (_detail->buffer)
+    {
+        // orphan the storage still in use by the previous frame
+        glBindBuffer(GL_UNIFORM_BUFFER, _detail->buffer);
+        glBufferData(GL_UNIFORM_BUFFER, _detail->capacity, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+}
+
+int UniformStream::push(void const* data, size_t size)
+{
+    if (!_detail->alignment)
+    {
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        _detail->alignment = alignment > 0 ? size_t(alignment) : 256;
+    }
+
+    size_t offset = (_detail->staging.size() + _detail->alignment - 1) & ~(_detail->alignment - 1);
+    _detail->staging.resize(offset + size);
+    memcpy(&_detail->staging[offset], data, size);
+    return static_cast<int>(offset);
+}
+
+void UniformStream::upload()
+{
+    size_t size = _detail->staging.size();
+    if (_detail->uploaded == size)
+        return;
+
+    if (!_detail->buffer)
+        glGenBuffers(1, &_detail->buffer);
+
+    // a full range must fit past the last offset
+    size_t required = size + _detail->range;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, _detail->buffer);
+    if (required > _detail->capacity)
+    {
+        // draws already issued this frame keep the orphaned storage, so
+        // everything streamed so far is uploaded again into the new storage
+        _detail->capacity = required > 2 * _detail->capacity ? required : 2 * _detail->capacity;
+        glBufferData(GL_UNIFORM_BUFFER, _detail->capacity, nullptr, GL_STREAM_DRAW);
+        _detail->uploaded = 0;
+    }
+
+    glBufferSubData(GL_UNIFORM_BUFFER, _detail->uploaded, size - _detail->uploaded, &_detail->staging[_detail->uploaded]);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    _detail->uploaded = size;
+}
+
+void UniformStream::bind(int offset) const
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, _detail->binding, _detail->buffer, offset, _detail->range);
+}
+
+}} // lab::Render
@@ -8,9 +8,15 @@
 
 #include "LabRender/Utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -32,6 +38,131 @@ namespace {
         return result;
     }
 
+    thread_local bool insideParallelFor = false;
+
+    // a parallelFor's ranges, claimed one at a time by the caller and the
+    // pool's workers
+    struct Job
+    {
+        Job(const std::function<void(size_t, size_t)> & fn, size_t count, size_t parts)
+        : fn(fn), count(count), chunk((count + parts - 1) / parts), chunks((count + chunk - 1) / chunk) {}
+
+        const std::function<void(size_t, size_t)> & fn;
+        size_t count;
+        size_t chunk;
+        size_t chunks;
+        atomic<size_t> next { 0 };
+        exception_ptr error;        // the first exception thrown, under the pool's lock
+
+        // runs ranges until none are left, and returns how many ran
+        size_t work(mutex & lock)
+        {
+            bool outer = insideParallelFor;
+            insideParallelFor = true;
+            size_t ran = 0;
+            for (size_t i = next++; i < chunks; i = next++, ++ran)
+            {
+                try
+                {
+                    fn(i * chunk, std::min(count, (i + 1) * chunk));
+                }
+                catch (...)
+                {
+                    lock_guard<mutex> guard(lock);
+                    if (!error)
+                        error = current_exception();
+                }
+            }
+            insideParallelFor = outer;
+            return ran;
+        }
+    };
+
+    // Threads kept for the life of the process, so that a parallelFor
+    // doesn't start and join threads on every call. The pool runs one job
+    // at a time.
+    class WorkerPool
+    {
+        mutex lock;
+        condition_variable wake;
+        condition_variable finished;
+        vector<thread> workers;
+        Job* job = nullptr;
+        size_t generation = 0;
+        size_t done = 0;            // ranges of the current job that have run
+        size_t active = 0;          // workers holding the current job
+        bool quit = false;
+
+        void workerLoop()
+        {
+            size_t seen = 0;
+            unique_lock<mutex> guard(lock);
+            while (true)
+            {
+                wake.wait(guard, [&]() { return quit || (job && generation != seen); });
+                if (quit)
+                    return;
+
+                seen = generation;
+                Job* current = job;
+                ++active;
+                guard.unlock();
+                size_t ran = current->work(lock);
+                guard.lock();
+                done += ran;
+                --active;
+                finished.notify_all();
+            }
+        }
+
+    public:
+        mutex busy;                 // held by the thread whose job is running
+
+        WorkerPool()
+        {
+            size_t count = std::max<size_t>(2, std::thread::hardware_concurrency()) - 1;
+            for (size_t i = 0; i < count; ++i)
+                workers.emplace_back(&WorkerPool::workerLoop, this);
+        }
+
+        ~WorkerPool()
+        {
+            {
+                lock_guard<mutex> guard(lock);
+                quit = true;
+            }
+            wake.notify_all();
+            for (auto & w : workers)
+                w.join();
+        }
+
+        static WorkerPool & instance()
+        {
+            static WorkerPool pool;
+            return pool;
+        }
+
+        // runs the job on the calling thread and the workers, and returns
+        // once every range has run and no worker still refers to the job
+        void run(Job & j)
+        {
+            {
+                lock_guard<mutex> guard(lock);
+                job = &j;
+                done = 0;
+                ++generation;
+            }
+            wake.notify_all();
+
+            size_t ran = j.work(lock);
+
+            unique_lock<mutex> guard(lock);
+            done += ran;
+            finished.wait(guard, [&]() { return done == j.chunks && !active; });
+            job = nullptr;
+        }
+    };
+
 } // anon
 
 namespace lab {
@@ -70,5 +201,34 @@ namespace lab {
         result[l] = '\0';
         return result;
     }
+
+    void parallelFor(size_t count, size_t minPerThread, const std::function<void(size_t, size_t)> & fn)
+    {
+        if (!count)
+            return;
+
+        size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        threads = std::min(threads, std::max<size_t>(1, count / std::max<size_t>(1, minPerThread)));
+
+        // nested calls, and calls made while another thread's loop has the
+        // pool, run on the calling thread
+        WorkerPool & pool = WorkerPool::instance();
+        if (threads == 1 || insideParallelFor)
+        {
+            fn(0, count);
+            return;
+        }
+        unique_lock<mutex> busy(pool.busy, try_to_lock);
+        if (!busy.owns_lock())
+        {
+            fn(0, count);
+            return;
+        }
+
+        Job job(fn, count, threads);
+        pool.run(job);
+        if (job.error)
+            rethrow_exception(job.error);
+    }
     
 }  // lab
\ No newline at end of file
@@ -12,11 +12,36 @@
 
 
 namespace lab { namespace Render {
-    
+
+int BufferBase::Layout::openGLElementType() const {
+    switch (elementType) {
+        case ElementType::f16:         return GL_HALF_FLOAT;
+        case ElementType::i8:          return GL_BYTE;
+        case ElementType::u8:          return GL_UNSIGNED_BYTE;
+        case ElementType::i16:         return GL_SHORT;
+        case ElementType::u16:         return GL_UNSIGNED_SHORT;
+        case ElementType::i2_10_10_10: return GL_INT_2_10_10_10_REV;
+        default:                       return semanticTypeToOpenGLElementType(semanticType);
+    }
+}
+
+int BufferBase::Layout::size() const {
+    int count = semanticTypeElementCount(semanticType);
+    switch (elementType) {
+        case ElementType::f16:
+        case ElementType::i16:
+        case ElementType::u16:         return count * 2;
+        case ElementType::i8:
+        case ElementType::u8:          return count;
+        case ElementType::i2_10_10_10: return 4;
+        default:                       return semanticTypeStride(semanticType);
+    }
+}
+
 void BufferBase::setAttributes(VAO & vao) {
     int i = 0;
-    for (auto l : layout)
-        vao.attribute(l.name.c_str(), l.semanticType, i++);
+    for (auto & l : layout)
+        vao.attribute(l, i++);
 }
 
     
@@ -44,34 +69,47 @@ void BufferBase::uploadStatic() {
     
 
 VAO::VAO(std::shared_ptr<BufferBase> verts, ErrorPolicy ep)
-: _vertices(verts), _errorPolicy(ep), _id(0), _stride(0), _offset(0), _indexType(GL_INVALID_ENUM), _needInit(true) {
+: _vertices(verts), _errorPolicy(ep), _id(0), _stride(0), _offset(0), _indexType(GL_INVALID_ENUM), _needInit(true)
+, _pool(GeometryPool::defaultPool()) {
+}
+
+VAO::~VAO() {
+    if (_pool)
+        _pool->release(_range);
+    glDeleteVertexArrays(1, &_id);
 }
 
-VAO::~VAO() { glDeleteVertexArrays(1, &_id); }
+void const* VAO::vertexArrayKey() const {
+    return _range.arena ? _range.arena : this;
+}
 
 
 VAO & VAO::attribute(const char *name, SemanticType t, int location, bool normalized) {
+    return attribute(BufferBase::Layout(name, t, BufferBase::ElementType::native, normalized), location);
+}
+
+VAO & VAO::attribute(const BufferBase::Layout & l, int location) {
     if (location >= 0) {
         _vertices->bind();
         bindVAO();
         glEnableVertexAttribArray(location);
         glVertexAttribPointer(location,
-                                semanticTypeElementCount(t),
-                                semanticTypeToOpenGLElementType(t),
-                                normalized,
+                                semanticTypeElementCount(l.semanticType),
+                                l.openGLElementType(),
+                                l.normalized,
                                 _stride, (char *)NULL + _offset);
         unbindVAO();
         _vertices->unbind();
-        _offset += semanticTypeStride(t);
+        _offset += l.size();
 
         attributes.resize(location + 1);
-        attributes[location].name = std::string(name);
-        attributes[location].type = t;
+        attributes[location].name = l.name;
+        attributes[location].type = l.semanticType;
         attributes[location].location = location;
     }
     else {
         std::string err = "invalid location for attribute ";
-        err += name;
+        err += l.name;
         handleGLError(_errorPolicy, GL_INVALID_VALUE, err.c_str());
     }
     return *this;
@@ -87,13 +125,44 @@ bool VAO::hasAttribute(char const*const name) const {
 
 
 void VAO::bindVAO() const {
+    if (_pool) {
+        _pool->bind(_range);
+        return;
+    }
+    GeometryPool::unbind();
     glBindVertexArray(_id);
     checkError(_errorPolicy, TestConditions::exhaustive, "VAO::bindVAO");
 }
-void VAO::unbindVAO() const { glBindVertexArray(0); }
+void VAO::unbindVAO() const {
+    if (_pool)
+        GeometryPool::unbind();
+    else
+        glBindVertexArray(0);
+}
 
 bool VAO::uploadVerts() const
 {
+    if (_pool && _needInit) {
+        VAO* self = const_cast<VAO*>(this);
+        if (_vertices && _vertices->bufferType == BufferBase::BufferType::VertexBuffer &&
+            _pool->upload(*_vertices, _indices.get(), self->_range)) {
+            self->attributes.resize(_vertices->layout.size());
+            for (size_t i = 0; i < _vertices->layout.size(); ++i) {
+                self->attributes[i].name = _vertices->layout[i].name;
+                self->attributes[i].type = _vertices->layout[i].semanticType;
+                self->attributes[i].location = int(i);
+            }
+            _needInit = false;
+        }
+        else {
+            // vertices the pool can't hold get buffers of their own
+            _pool->release(self->_range);
+            self->_pool.reset();
+        }
+    }
+    if (_pool)
+        return !_needInit;
+
 	if (_indicesMustBeBound) {
 		if (_indices && _indexType != GL_INVALID_VALUE) {
 			bindVAO();
@@ -132,9 +201,13 @@ bool VAO::uploadVerts() const
 void VAO::draw() const {
     checkError(_errorPolicy, TestConditions::exhaustive, "VAO::draw start");
     uploadVerts();
+    if (_pool) {
+        _pool->draw(_range);
+        return;
+    }
     if (_indices) {
         bindVAO();
-        glDrawRangeElements(GL_TRIANGLES, 0, (int) _indices->count(), (int) _indices->count(), _indexType, NULL);
+        glDrawRangeElements(GL_TRIANGLES, 0, (int) _vertices->count() - 1, (int) _indices->count(), _indexType, NULL);
         //glDrawElements(mode, _indices->size(), _indexType, NULL);
         unbindVAO();
     }
@@ -147,6 +220,10 @@ void VAO::draw() const {
 }
     
 void VAO::drawInstanced(int instances) const {
+    if (_pool) {
+        _pool->drawInstanced(_range, instances);
+        return;
+    }
     bindVAO();
     if (_indices)
         glDrawElementsInstanced(GL_TRIANGLES, (int) _indices->count(), _indexType, NULL, instances);
@@ -172,6 +249,10 @@ void VAO::check() const {
 VAO & VAO::setVertices(std::shared_ptr<BufferBase> vbo) {
     _vertices = vbo;
     _stride = vbo->stride();
+    if (_pool) {
+        _needInit = true;
+        return *this;
+    }
         
     if (!_id)
         glGenVertexArrays(1, &_id);
@@ -192,6 +273,7 @@ VAO & VAO::setIndices(std::shared_ptr<IndexBuffer> ibo) {
     }
     _indices = ibo;
 	_indicesMustBeBound = true;
+    _needInit |= !!_pool;
     return *this;
 }
 
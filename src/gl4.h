@@ -84,6 +84,9 @@
 #ifndef GL_TESS_EVALUATION_SHADER
 # define GL_TESS_EVALUATION_SHADER 0x8E87
 #endif
+#ifndef GL_COMPLETION_STATUS_KHR
+# define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 #define GL_GENERIC_ERROR 1
 
@@ -93,6 +96,10 @@ namespace LabRender {
 
 const char* glErrorString(GLenum err);
 
+// Looks up a GL entry point the headers don't declare, through gl3w, once
+// labrender_init has run. Returns nullptr on Apple platforms.
+void (*glProcAddress(const char* name))(void);
+
 // Convert a C++ type to an OpenGL type enum using TypeToOpenGL<T>::value
 template <typename T> struct TypeToOpenGL {};
 template <> struct TypeToOpenGL<bool>           { enum { value = GL_BOOL }; };
@@ -196,6 +196,11 @@ typedef void* (*get_pixels_t)(SPRITEBATCH_U64 image_id);
 typedef SPRITEBATCH_U64 (*generate_texture_handle_t)(void* pixels, int w, int h);
 typedef void (*destroy_texture_handle_t)(SPRITEBATCH_U64 texture_id);
 
+//@dp
+// Optional. Sorts the sprites `spritebatch_flush` is about to report, in place, replacing the
+// internal sort. Batches are then formed from runs of equal `texture_id`.
+typedef void (*sort_sprites_t)(spritebatch_sprite_t* sprites, int count);
+
 // Initializes a set of good default paramaters. The users must still set
 // the four callbacks inside of `config`.
 EXTERNC void spritebatch_set_default_config(spritebatch_config_t* config);
@@ -213,12 +218,14 @@ struct spritebatch_config_t
 	get_pixels_t get_pixels_callback;
 	generate_texture_handle_t generate_texture_callback;
 	destroy_texture_handle_t delete_texture_callback;
+	sort_sprites_t sort_callback; //@dp
 	void* allocator_context;
 };
 
 struct spritebatch_sprite_t
 {
 	SPRITEBATCH_U64 texture_id;
+	SPRITEBATCH_U64 image_id; //@dp
 
 	// User-defined sorting key, see: http://realtimecollisiondetection.net/blog/?p=86
 	// The first 32-bits store the user's sort bits. The bottom 32-bits are for internal
@@ -719,6 +726,7 @@ struct spritebatch_t
 	get_pixels_t get_pixels_callback;
 	generate_texture_handle_t generate_texture_callback;
 	destroy_texture_handle_t delete_texture_callback;
+	sort_sprites_t sort_callback; //@dp
 	void* mem_ctx;
 };
 
@@ -755,6 +763,7 @@ int spritebatch_init(spritebatch_t* sb, spritebatch_config_t* config)
 	sb->get_pixels_callback = config->get_pixels_callback;
 	sb->generate_texture_callback = config->generate_texture_callback;
 	sb->delete_texture_callback = config->delete_texture_callback;
+	sb->sort_callback = config->sort_callback; //@dp
 	sb->mem_ctx = config->allocator_context;
 
 	if (sb->atlas_width_in_pixels < 1 || sb->atlas_height_in_pixels < 1) return 1;
@@ -829,6 +838,7 @@ void spritebatch_set_default_config(spritebatch_config_t* config)
 	config->batch_callback = 0;
 	config->generate_texture_callback = 0;
 	config->delete_texture_callback = 0;
+	config->sort_callback = 0; //@dp
 	config->allocator_context = 0;
 }
 
@@ -837,7 +847,7 @@ void spritebatch_set_default_config(spritebatch_config_t* config)
 		if (ctx->count == ctx->capacity) \
 		{ \
 			int new_capacity = ctx->capacity * 2; \
-			void* new_data = SPRITEBATCH_MALLOC(new_capacity, ctx->mem_ctx); \
+			void* new_data = SPRITEBATCH_MALLOC(new_capacity * type_size, ctx->mem_ctx); /*@dp*/ \
 			if (!new_data) return 0; \
 			SPRITEBATCH_MEMCPY(new_data, ctx->data, type_size * ctx->count); \
 			SPRITEBATCH_FREE(ctx->data, ctx->mem_ctx); \
@@ -944,6 +954,7 @@ int spritebatch_internal_push_sprite(spritebatch_t* sb, spritebatch_internal_spr
 {
 	int skipped_tex = 0;
 	spritebatch_sprite_t sprite;
+	sprite.image_id = s->image_id; //@dp
 	sprite.sort_bits = s->sort_bits;
 	sprite.x = s->x;
 	sprite.y = s->y;
@@ -1030,7 +1041,8 @@ int spritebatch_flush(spritebatch_t* sb)
 	}
 
 	// sort internal sprite buffer and submit batches
-	spritebatch_internal_qsort_sprites(sb->sprites, sb->sprite_count);
+	if (sb->sort_callback) sb->sort_callback(sb->sprites, sb->sprite_count); //@dp
+	else spritebatch_internal_qsort_sprites(sb->sprites, sb->sprite_count);
 
 	int min = 0;
 	int max = 0;